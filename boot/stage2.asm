@@ -418,13 +418,29 @@ setup_vesa:
 ; ============================================================================
 ; Load Kernel (uses standard CHS reads to low memory)
 ; ============================================================================
+;
+; The kernel is read into low memory a track at a time (the rest of the
+; current track per INT 13h call, never crossing a 64KB DMA boundary). A
+; failed track read is retried one sector at a time, then track reads
+; resume after that sector.
+;
+; The Makefile passes the size of the image on disk as KERNEL_SECTORS; the
+; image is either kernel.bin or, built with KERNEL_LZ=1, its LZSS-packed
+; form (tools/lzpack.c), which protected_mode_entry decodes to 1MB.
 
 KERNEL_SECTOR   equ 33          ; After stage2 (sector 1-32)
-KERNEL_SECTORS  equ 128         ; 64KB kernel (adjust as needed)
+%ifndef KERNEL_SECTORS
+%define KERNEL_SECTORS 128      ; 64KB kernel (set by the Makefile)
+%endif
+%assign KERNEL_MAX_SECTORS (0x8F000 - 0x20000) / 512  ; 4KB below the pmode stack
 KERNEL_LOAD_SEG equ 0x2000      ; Load at 0x20000 (128KB mark)
 KERNEL_LOAD_OFF equ 0x0000
 KERNEL_DEST     equ 0x100000    ; Final destination: 1MB
 
+%if KERNEL_SECTORS > KERNEL_MAX_SECTORS
+%error "Kernel image does not fit below 0x90000 (try KERNEL_LZ=1)"
+%endif
+
 ; Floppy geometry for 1.44MB
 SECTORS_PER_TRACK equ 18
 HEADS           equ 2
@@ -454,6 +470,8 @@ do_load_kernel:
     xor     dx, dx
     mov     cx, SECTORS_PER_TRACK
     div     cx                      ; AX = track*heads + head, DX = sector-1
+    mov     bx, SECTORS_PER_TRACK
+    sub     bx, dx                  ; BX = sectors left on this track
     push    dx                      ; Save sector-1 on stack
     xor     dx, dx
     mov     cx, HEADS
@@ -464,6 +482,21 @@ do_load_kernel:
     inc     al
     mov     cl, al                  ; CL = sector (1-based)
 
+    ; Count = min(rest of track, sectors left, room before 64KB boundary)
+    cmp     bx, [sectors_left]
+    jbe     .track_fits
+    mov     bx, [sectors_left]
+.track_fits:
+    mov     ax, [load_offset]
+    neg     ax                      ; Bytes to the boundary (0 = a full 64KB)
+    shr     ax, 9
+    jz      .dma_fits
+    cmp     bx, ax
+    jbe     .dma_fits
+    mov     bx, ax
+.dma_fits:
+    mov     [read_count], bl
+
     ; Set up read destination
     mov     ax, [load_segment]
     mov     es, ax
@@ -478,7 +511,7 @@ do_load_kernel:
     push    es
 
     mov     ah, 0x02                ; Read sectors
-    mov     al, 1                   ; One sector at a time (safe)
+    mov     al, [read_count]
     mov     dl, [boot_drive]
     int     0x13
 
@@ -493,9 +526,18 @@ do_load_kernel:
     mov     [disk_error_code], ah
 
     ; Reset disk and retry
+    push    dx
     xor     ax, ax
     mov     dl, [boot_drive]
     int     0x13
+    pop     dx
+
+    ; A failed track read falls back to this sector alone
+    cmp     byte [read_count], 1
+    je      .retry_single
+    mov     byte [read_count], 1
+    jmp     .retry
+.retry_single:
     dec     bp
     jnz     .retry
 
@@ -510,15 +552,18 @@ do_load_kernel:
     int     0x10
 
     ; Update load address
-    add     word [load_offset], 512
+    movzx   ax, byte [read_count]
+    shl     ax, 9
+    add     word [load_offset], ax
     jnc     .no_segment_wrap
     add     word [load_segment], 0x1000  ; Add 64KB to segment
     mov     word [load_offset], 0
 .no_segment_wrap:
 
     ; Update counters
-    inc     word [current_lba]
-    dec     word [sectors_left]
+    movzx   ax, byte [read_count]
+    add     word [current_lba], ax
+    sub     word [sectors_left], ax
     jmp     .load_loop
 
 .done:
@@ -538,6 +583,7 @@ sectors_left:   dw 0
 current_lba:    dw 0
 load_segment:   dw 0
 load_offset:    dw 0
+read_count:     db 0
 disk_error_code: db 0
 
 ; ============================================================================
@@ -645,12 +691,21 @@ protected_mode_entry:
     mov     ss, ax
     mov     esp, 0x90000        ; Stack below EBDA
 
-    ; Copy kernel from low memory (0x20000) to 1MB (0x100000)
+    ; Move kernel from low memory (0x20000) to 1MB (0x100000)
     mov     esi, 0x20000        ; Source: where we loaded it
-    mov     edi, 0x100000       ; Destination: 1MB
-    mov     ecx, (KERNEL_SECTORS * 512) / 4  ; Dword count
+    mov     edi, KERNEL_DEST    ; Destination: 1MB
     cld
+    cmp     dword [esi], LZ_MAGIC
+    je      .packed
+    mov     ecx, (KERNEL_SECTORS * 512) / 4  ; Dword count
     rep movsd
+    jmp     .kernel_ready
+.packed:
+    mov     ebp, [esi + 8]      ; Stream size
+    add     esi, LZ_HEADER
+    add     ebp, esi            ; End of stream
+    call    lz_decode
+.kernel_ready:
 
     ; Build boot info structure at 0x500
     mov     edi, 0x500
@@ -692,6 +747,50 @@ protected_mode_entry:
     mov     eax, 0x500          ; Boot info pointer
     jmp     0x100000            ; Jump to kernel at 1MB
 
+; ============================================================================
+; LZSS Decoder (format: tools/lzpack.c)
+; ============================================================================
+;
+; In:  ESI = stream, EBP = end of stream, EDI = destination
+; Out: EDI = end of output. Clobbers EAX, EBX, ECX, ESI.
+
+LZ_MAGIC        equ 0x5A4C4652  ; 'RFLZ'
+LZ_HEADER       equ 12          ; Magic, unpacked size, stream size
+
+lz_decode:
+.group:
+    cmp     esi, ebp
+    jae     .done
+    mov     bl, [esi]           ; Flag byte: one bit per item, LSB first
+    inc     esi
+    mov     bh, 8
+.item:
+    cmp     esi, ebp
+    jae     .done
+    shr     bl, 1
+    jc      .match
+    movsb                       ; Literal
+    jmp     .next
+.match:
+    movzx   eax, word [esi]     ; Distance - 1 (12 bits), length - 3 (4 bits)
+    add     esi, 2
+    mov     ecx, eax
+    shr     ecx, 12
+    add     ecx, 3
+    and     eax, 0x0FFF
+    inc     eax
+    push    esi
+    mov     esi, edi
+    sub     esi, eax
+    rep movsb                   ; Byte order keeps overlapping copies right
+    pop     esi
+.next:
+    dec     bh
+    jnz     .item
+    jmp     .group
+.done:
+    ret
+
 ; ============================================================================
 ; Data (accessible from both 16 and 32-bit modes)
 ; ============================================================================
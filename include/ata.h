@@ -3,6 +3,8 @@
  *
  * Simple PIO mode driver for IDE hard drives and CD-ROMs.
  * PIO mode is slower than DMA but works everywhere and is simpler.
+ * Bus-master DMA (PIIX/PIIX4 style, found via PCI) is available as an
+ * opt-in per drive; PIO remains the fallback.
  *
  * FIXES from original:
  *   - Proper wait after each sector write (wait for BSY clear, not just delay)
@@ -19,6 +21,8 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "idt.h"
+#include "pci.h"
+#include "timer.h"
 
 /* ============================================================================
  * Debug Configuration
@@ -96,6 +100,15 @@ extern void kprintf(const char *fmt, ...);
 #define ATA_CMD_READ_PIO_EXT    0x24    /* 48-bit LBA */
 #define ATA_CMD_WRITE_PIO       0x30
 #define ATA_CMD_WRITE_PIO_EXT   0x34    /* 48-bit LBA */
+#define ATA_CMD_READ_DMA_EXT    0x25    /* 48-bit LBA */
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29  /* 48-bit LBA */
+#define ATA_CMD_WRITE_DMA_EXT   0x35    /* 48-bit LBA */
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39 /* 48-bit LBA */
+#define ATA_CMD_READ_MULTIPLE   0xC4    /* One DRQ per block of sectors */
+#define ATA_CMD_WRITE_MULTIPLE  0xC5
+#define ATA_CMD_SET_MULTIPLE    0xC6    /* Set sectors per DRQ block */
+#define ATA_CMD_READ_DMA        0xC8
+#define ATA_CMD_WRITE_DMA       0xCA
 #define ATA_CMD_CACHE_FLUSH     0xE7
 #define ATA_CMD_CACHE_FLUSH_EXT 0xEA    /* 48-bit LBA */
 #define ATA_CMD_IDENTIFY        0xEC
@@ -118,6 +131,34 @@ extern void kprintf(const char *fmt, ...);
 #define ATA_CTRL_SRST       0x04    /* Software reset */
 #define ATA_CTRL_HOB        0x80    /* High order byte (for 48-bit LBA) */
 
+/* ============================================================================
+ * Timeouts (milliseconds, measured with the TSC so they hold with IRQs off)
+ * ============================================================================ */
+
+#define ATA_TIMEOUT_MS          2000    /* BSY/DRQ after a command */
+#define ATA_FLUSH_TIMEOUT_MS    10000   /* Write completion and cache flush */
+#define ATA_RESET_TIMEOUT_MS    30000   /* Spin-up after SRST */
+#define ATA_DMA_TIMEOUT_MS      2000    /* Plus 1ms per sector */
+
+/* ============================================================================
+ * Bus-Master IDE Registers (offset from BMIDE base, +8 for secondary)
+ * ============================================================================ */
+
+#define ATA_BM_CMD          0x00    /* Command */
+#define ATA_BM_STATUS       0x02    /* Status */
+#define ATA_BM_PRDT         0x04    /* PRD table physical address */
+
+#define ATA_BM_CMD_START    0x01    /* Start/stop bus master */
+#define ATA_BM_CMD_READ     0x08    /* Direction: device to memory */
+
+#define ATA_BM_SR_ACTIVE    0x01    /* Bus master active */
+#define ATA_BM_SR_ERR       0x02    /* DMA error (write 1 to clear) */
+#define ATA_BM_SR_IRQ       0x04    /* INTRQ seen (write 1 to clear) */
+
+#define ATA_PRD_EOT         0x8000  /* Last PRD entry */
+#define ATA_DMA_MAX_PRD     512     /* Entries per channel: 65536 sectors in 64KB pieces */
+#define ATA_DMA_MAX_ERRORS  3       /* Fall back to PIO after this many */
+
 /* ============================================================================
  * Drive Types
  * ============================================================================ */
@@ -145,6 +186,13 @@ typedef struct {
     char            model[41];      /* Model string */
     char            serial[21];     /* Serial number */
     uint16_t        identify[256];  /* Raw identify data */
+    uint8_t         multiple;       /* Sectors per DRQ block (0 = READ/WRITE MULTIPLE off) */
+
+    /* Bus-master DMA */
+    uint16_t        bm_base;        /* Channel BMIDE registers (0 = none) */
+    bool            dma;            /* Transfers use DMA */
+    uint8_t         dma_errors;     /* Failed DMA transfers */
+    bool            flush_pending;  /* Async DMA writes not yet flushed (ata_flush_cache) */
 } ata_drive_t;
 
 /* ============================================================================
@@ -181,6 +229,21 @@ static inline uint16_t ata_inw(ata_drive_t *drive, uint8_t reg) {
     return ret;
 }
 
+/* Transfer @words words with a single string instruction */
+static inline void ata_insw(ata_drive_t *drive, void *buf, uint32_t words) {
+    __asm__ volatile ("cld; rep insw"
+                      : "+D"(buf), "+c"(words)
+                      : "d"((uint16_t)(drive->io_base + ATA_REG_DATA))
+                      : "memory");
+}
+
+static inline void ata_outsw(ata_drive_t *drive, const void *buf, uint32_t words) {
+    __asm__ volatile ("cld; rep outsw"
+                      : "+S"(buf), "+c"(words)
+                      : "d"((uint16_t)(drive->io_base + ATA_REG_DATA))
+                      : "memory");
+}
+
 /* 400ns delay (read alternate status 4 times) */
 static inline void ata_delay(ata_drive_t *drive) {
     inb(drive->ctrl_base + ATA_REG_ALTSTATUS);
@@ -202,15 +265,15 @@ static inline uint8_t ata_alt_status(ata_drive_t *drive) {
  * Wait for BSY to clear
  * @return true if ready, false on timeout
  */
-static inline bool ata_wait_ready(ata_drive_t *drive, uint32_t timeout) {
-    while (timeout--) {
+static inline bool ata_wait_ready(ata_drive_t *drive, uint32_t timeout_ms) {
+    uint64_t deadline = tsc_deadline(timeout_ms);
+    do {
         uint8_t status = ata_alt_status(drive);
         if (!(status & ATA_SR_BSY)) {
             return true;
         }
-        /* Small delay between polls */
-        for (volatile int i = 0; i < 10; i++);
-    }
+        __asm__ volatile ("pause");
+    } while (!tsc_expired(deadline));
     ATA_DBG("wait_ready timeout\n");
     return false;
 }
@@ -219,8 +282,9 @@ static inline bool ata_wait_ready(ata_drive_t *drive, uint32_t timeout) {
  * Wait for DRQ (data request)
  * @return true if DRQ set, false on timeout or error
  */
-static inline bool ata_wait_drq(ata_drive_t *drive, uint32_t timeout) {
-    while (timeout--) {
+static inline bool ata_wait_drq(ata_drive_t *drive, uint32_t timeout_ms) {
+    uint64_t deadline = tsc_deadline(timeout_ms);
+    do {
         uint8_t status = ata_alt_status(drive);
         if (status & ATA_SR_ERR) {
             ATA_DBG("wait_drq: ERR set, error=0x%x\n", ata_inb(drive, ATA_REG_ERROR));
@@ -233,9 +297,8 @@ static inline bool ata_wait_drq(ata_drive_t *drive, uint32_t timeout) {
         if (!(status & ATA_SR_BSY) && (status & ATA_SR_DRQ)) {
             return true;
         }
-        /* Small delay between polls */
-        for (volatile int i = 0; i < 10; i++);
-    }
+        __asm__ volatile ("pause");
+    } while (!tsc_expired(deadline));
     ATA_DBG("wait_drq timeout\n");
     return false;
 }
@@ -245,8 +308,9 @@ static inline bool ata_wait_drq(ata_drive_t *drive, uint32_t timeout) {
  * Used after write operations
  * @return true if successful, false on error or timeout
  */
-static inline bool ata_wait_write_complete(ata_drive_t *drive, uint32_t timeout) {
-    while (timeout--) {
+static inline bool ata_wait_write_complete(ata_drive_t *drive, uint32_t timeout_ms) {
+    uint64_t deadline = tsc_deadline(timeout_ms);
+    do {
         uint8_t status = ata_alt_status(drive);
 
         if (status & ATA_SR_ERR) {
@@ -260,9 +324,8 @@ static inline bool ata_wait_write_complete(ata_drive_t *drive, uint32_t timeout)
         if (!(status & ATA_SR_BSY)) {
             return true;
         }
-        /* Small delay between polls */
-        for (volatile int i = 0; i < 10; i++);
-    }
+        __asm__ volatile ("pause");
+    } while (!tsc_expired(deadline));
     ATA_DBG("write_complete timeout\n");
     return false;
 }
@@ -312,7 +375,7 @@ static bool ata_identify(ata_drive_t *drive) {
     }
 
     /* Wait for BSY to clear */
-    if (!ata_wait_ready(drive, 100000)) {
+    if (!ata_wait_ready(drive, ATA_TIMEOUT_MS)) {
         drive->present = false;
         return false;
     }
@@ -341,14 +404,12 @@ static bool ata_identify(ata_drive_t *drive) {
     }
 
     /* Wait for data */
-    if (!ata_wait_drq(drive, 100000)) {
+    if (!ata_wait_drq(drive, ATA_TIMEOUT_MS)) {
         return false;
     }
 
     /* Read identify data */
-    for (int i = 0; i < 256; i++) {
-        drive->identify[i] = ata_inw(drive, ATA_REG_DATA);
-    }
+    ata_insw(drive, drive->identify, 256);
 
     /* Parse identify data */
     ata_parse_string(&drive->identify[27], drive->model, 20);
@@ -377,64 +438,123 @@ static bool ata_identify(ata_drive_t *drive) {
 }
 
 /* ============================================================================
- * Read Sectors (28-bit LBA)
+ * LBA Taskfile Setup (28-bit and 48-bit)
  * ============================================================================ */
 
+#define ATA_MAX_SECTORS_28  256         /* Sector count 0 = 256 */
+#define ATA_MAX_SECTORS_48  65536       /* Sector count 0 = 65536 */
+#define ATA_LBA28_LIMIT     0x10000000u /* First LBA 28-bit commands cannot reach */
+
+/* Largest transfer a single command can move on this drive */
+static inline uint32_t ata_max_sectors(ata_drive_t *drive) {
+    return drive->lba48 ? ATA_MAX_SECTORS_48 : ATA_MAX_SECTORS_28;
+}
+
+/* 48-bit commands are only used when the request needs them */
+static inline bool ata_use_lba48(ata_drive_t *drive, uint64_t lba, uint32_t count) {
+    return drive->lba48 && (lba + count > ATA_LBA28_LIMIT || count > ATA_MAX_SECTORS_28);
+}
+
 /**
- * Read sectors using 28-bit LBA
- * @param drive  Drive to read from
- * @param lba    Starting LBA (logical block address)
- * @param count  Number of sectors to read (1-255)
- * @param buf    Buffer to read into
- * @return       Number of sectors read, or 0 on error
+ * Check a request against the drive's addressing limits
+ * @return Sectors one command may transfer (0 if unreachable)
  */
-static uint32_t ata_read_sectors(ata_drive_t *drive, uint32_t lba, uint8_t count, void *buf) {
-    if (!drive->present || drive->type != ATA_DEV_ATA) return 0;
-    if (count == 0) count = 1;
+static uint32_t ata_check_request(ata_drive_t *drive, uint64_t lba, uint32_t count) {
+    if (!drive->present || drive->type != ATA_DEV_ATA || count == 0) return 0;
 
-    ATA_DBG("read: lba=%u count=%u\n", lba, count);
+    uint32_t max = ata_max_sectors(drive);
+    if (count > max) count = max;
 
+    if (!drive->lba48 && lba + count > ATA_LBA28_LIMIT) {
+        ATA_DBG("lba %u beyond 28-bit range\n", (uint32_t)lba);
+        return 0;
+    }
+    return count;
+}
+
+/**
+ * Select the drive and load LBA and sector count into the taskfile
+ * @param ext  Use the 48-bit register layout (HOB bytes written first)
+ * @return     false if the drive did not become ready
+ */
+static bool ata_setup_lba(ata_drive_t *drive, uint64_t lba, uint32_t count, bool ext) {
     ata_select_drive(drive);
 
     /* Wait for drive ready */
-    if (!ata_wait_ready(drive, 100000)) {
-        ATA_DBG("read: drive not ready\n");
-        return 0;
+    if (!ata_wait_ready(drive, ATA_TIMEOUT_MS)) {
+        ATA_DBG("drive not ready\n");
+        return false;
     }
 
-    /* Select drive with LBA mode and high LBA bits */
+    /* Select drive with LBA mode (and high LBA bits for 28-bit) */
     uint8_t drive_head = drive->drive ? ATA_DH_DEV1 : ATA_DH_DEV0;
     drive_head |= ATA_DH_LBA;
-    drive_head |= (lba >> 24) & 0x0F;
+    if (!ext) drive_head |= (lba >> 24) & 0x0F;
     ata_outb(drive, ATA_REG_DRIVE, drive_head);
     ata_delay(drive);
 
-    /* Send sector count and LBA */
-    ata_outb(drive, ATA_REG_SECCOUNT, count);
+    if (ext) {
+        /* Previous-content registers take the high-order bytes */
+        ata_outb(drive, ATA_REG_SECCOUNT, (count >> 8) & 0xFF);
+        ata_outb(drive, ATA_REG_LBA_LO, (lba >> 24) & 0xFF);
+        ata_outb(drive, ATA_REG_LBA_MID, (lba >> 32) & 0xFF);
+        ata_outb(drive, ATA_REG_LBA_HI, (lba >> 40) & 0xFF);
+    }
+
+    /* Send sector count and LBA (a count of 256/65536 wraps to 0) */
+    ata_outb(drive, ATA_REG_SECCOUNT, count & 0xFF);
     ata_outb(drive, ATA_REG_LBA_LO, lba & 0xFF);
     ata_outb(drive, ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
     ata_outb(drive, ATA_REG_LBA_HI, (lba >> 16) & 0xFF);
+    return true;
+}
+
+/* ============================================================================
+ * Read Sectors
+ * ============================================================================ */
+
+/**
+ * Read sectors with PIO (28-bit LBA, or 48-bit when required)
+ * @param drive  Drive to read from
+ * @param lba    Starting LBA (logical block address)
+ * @param count  Number of sectors to read (clamped to ata_max_sectors)
+ * @param buf    Buffer to read into
+ * @return       Number of sectors read, or 0 on error
+ */
+static uint32_t ata_read_sectors(ata_drive_t *drive, uint64_t lba, uint32_t count, void *buf) {
+    count = ata_check_request(drive, lba, count);
+    if (count == 0) return 0;
 
-    /* Send read command */
-    ata_outb(drive, ATA_REG_COMMAND, ATA_CMD_READ_PIO);
+    ATA_DBG("read: lba=%u count=%u\n", (uint32_t)lba, count);
+
+    bool ext = ata_use_lba48(drive, lba, count);
+    if (!ata_setup_lba(drive, lba, count, ext)) return 0;
+
+    /* Send read command: one DRQ per block with READ MULTIPLE */
+    uint32_t block = drive->multiple ? drive->multiple : 1;
+    uint8_t cmd;
+    if (drive->multiple) cmd = ext ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE;
+    else                 cmd = ext ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO;
+    ata_outb(drive, ATA_REG_COMMAND, cmd);
 
     /* Read sectors */
-    uint16_t *buf16 = (uint16_t *)buf;
+    uint8_t *ptr = (uint8_t *)buf;
     uint32_t sectors_read = 0;
 
-    for (int s = 0; s < count; s++) {
+    while (sectors_read < count) {
         /* Wait for data */
-        if (!ata_wait_drq(drive, 100000)) {
-            ATA_DBG("read: DRQ timeout at sector %d\n", s);
+        if (!ata_wait_drq(drive, ATA_TIMEOUT_MS)) {
+            ATA_DBG("read: DRQ timeout at sector %u\n", sectors_read);
             break;
         }
 
-        /* Read 256 words (512 bytes) */
-        for (int i = 0; i < 256; i++) {
-            buf16[s * 256 + i] = ata_inw(drive, ATA_REG_DATA);
-        }
+        /* Read one block (the last one may be short) */
+        uint32_t n = count - sectors_read;
+        if (n > block) n = block;
+        ata_insw(drive, ptr, n * 256);
 
-        sectors_read++;
+        ptr += n * 512;
+        sectors_read += n;
     }
 
     ATA_DBG("read: %u sectors completed\n", sectors_read);
@@ -442,66 +562,52 @@ static uint32_t ata_read_sectors(ata_drive_t *drive, uint32_t lba, uint8_t count
 }
 
 /* ============================================================================
- * Write Sectors (28-bit LBA) - FIXED VERSION
+ * Write Sectors - FIXED VERSION
  * ============================================================================ */
 
 /**
- * Write sectors using 28-bit LBA
+ * Write sectors with PIO (28-bit LBA, or 48-bit when required)
  *
- * IMPORTANT: For PIO writes, after sending data for each sector,
- * we must wait for BSY to clear before writing the next sector.
+ * IMPORTANT: For PIO writes, after sending data for each block,
+ * we must wait for BSY to clear before writing the next block.
  * The drive needs time to actually write the data to the platter.
  *
  * @param drive  Drive to write to
  * @param lba    Starting LBA
- * @param count  Number of sectors to write (1-255)
+ * @param count  Number of sectors to write (clamped to ata_max_sectors)
  * @param buf    Buffer to write from
  * @return       Number of sectors written, or 0 on error
  */
-static uint32_t ata_write_sectors(ata_drive_t *drive, uint32_t lba, uint8_t count, const void *buf) {
-    if (!drive->present || drive->type != ATA_DEV_ATA) return 0;
-    if (count == 0) count = 1;
-
-    ATA_DBG("write: lba=%u count=%u\n", lba, count);
-
-    ata_select_drive(drive);
+static uint32_t ata_write_sectors(ata_drive_t *drive, uint64_t lba, uint32_t count, const void *buf) {
+    count = ata_check_request(drive, lba, count);
+    if (count == 0) return 0;
 
-    /* Wait for drive ready */
-    if (!ata_wait_ready(drive, 100000)) {
-        ATA_DBG("write: drive not ready\n");
-        return 0;
-    }
-
-    /* Select drive with LBA mode and high LBA bits */
-    uint8_t drive_head = drive->drive ? ATA_DH_DEV1 : ATA_DH_DEV0;
-    drive_head |= ATA_DH_LBA;
-    drive_head |= (lba >> 24) & 0x0F;
-    ata_outb(drive, ATA_REG_DRIVE, drive_head);
-    ata_delay(drive);
+    ATA_DBG("write: lba=%u count=%u\n", (uint32_t)lba, count);
 
-    /* Send sector count and LBA */
-    ata_outb(drive, ATA_REG_SECCOUNT, count);
-    ata_outb(drive, ATA_REG_LBA_LO, lba & 0xFF);
-    ata_outb(drive, ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
-    ata_outb(drive, ATA_REG_LBA_HI, (lba >> 16) & 0xFF);
+    bool ext = ata_use_lba48(drive, lba, count);
+    if (!ata_setup_lba(drive, lba, count, ext)) return 0;
 
-    /* Send write command */
-    ata_outb(drive, ATA_REG_COMMAND, ATA_CMD_WRITE_PIO);
+    /* Send write command: one DRQ per block with WRITE MULTIPLE */
+    uint32_t block = drive->multiple ? drive->multiple : 1;
+    uint8_t cmd;
+    if (drive->multiple) cmd = ext ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE;
+    else                 cmd = ext ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO;
+    ata_outb(drive, ATA_REG_COMMAND, cmd);
 
-    const uint16_t *buf16 = (const uint16_t *)buf;
+    const uint8_t *ptr = (const uint8_t *)buf;
     uint32_t sectors_written = 0;
 
-    for (int s = 0; s < count; s++) {
+    while (sectors_written < count) {
         /* Wait for DRQ - drive is ready to receive data */
-        if (!ata_wait_drq(drive, 100000)) {
-            ATA_DBG("write: DRQ timeout at sector %d\n", s);
+        if (!ata_wait_drq(drive, ATA_TIMEOUT_MS)) {
+            ATA_DBG("write: DRQ timeout at sector %u\n", sectors_written);
             break;
         }
 
-        /* Write 256 words (512 bytes) */
-        for (int i = 0; i < 256; i++) {
-            ata_outw(drive, ATA_REG_DATA, buf16[s * 256 + i]);
-        }
+        /* Write one block (the last one may be short) */
+        uint32_t n = count - sectors_written;
+        if (n > block) n = block;
+        ata_outsw(drive, ptr, n * 256);
 
         /*
          * CRITICAL: After writing a sector's data, we MUST wait for the
@@ -512,18 +618,19 @@ static uint32_t ata_write_sectors(ata_drive_t *drive, uint32_t lba, uint8_t coun
          * The drive will assert BSY while writing to the platter.
          * Just doing ata_delay() (400ns) is NOT enough!
          */
-        if (!ata_wait_write_complete(drive, 500000)) {
-            ATA_DBG("write: completion timeout at sector %d\n", s);
+        if (!ata_wait_write_complete(drive, ATA_FLUSH_TIMEOUT_MS)) {
+            ATA_DBG("write: completion timeout at sector %u\n", sectors_written);
             break;
         }
 
-        sectors_written++;
+        ptr += n * 512;
+        sectors_written += n;
     }
 
     /* Flush the drive's write cache */
     if (sectors_written > 0) {
-        ata_outb(drive, ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
-        if (!ata_wait_ready(drive, 500000)) {
+        ata_outb(drive, ATA_REG_COMMAND, ext ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+        if (!ata_wait_ready(drive, ATA_FLUSH_TIMEOUT_MS)) {
             ATA_DBG("write: cache flush timeout\n");
             /* Don't fail - data is probably written, just not flushed */
         }
@@ -534,20 +641,88 @@ static uint32_t ata_write_sectors(ata_drive_t *drive, uint32_t lba, uint8_t coun
 }
 
 /* ============================================================================
- * Multi-sector Write (optimized for large writes)
+ * READ/WRITE MULTIPLE Negotiation
  * ============================================================================ */
 
+/**
+ * Enable READ/WRITE MULTIPLE with the largest block the drive reports
+ * @param max  Upper bound on sectors per block (0 = drive maximum)
+ * @return     Sectors per DRQ block now in use (0 = disabled)
+ */
+static uint8_t ata_set_multiple(ata_drive_t *drive, uint8_t max) {
+    drive->multiple = 0;
+    if (!drive->present || drive->type != ATA_DEV_ATA) return 0;
+
+    /* Word 47 bits 7:0: maximum sectors per READ/WRITE MULTIPLE block */
+    uint8_t block = drive->identify[47] & 0xFF;
+    if (max && block > max) block = max;
+
+    if (block < 2) return 0;
+
+    /* Block sizes must be a power of two */
+    uint8_t pow2 = 1;
+    while (pow2 < 128 && (pow2 << 1) <= block) pow2 <<= 1;
+    block = pow2;
+
+    ata_select_drive(drive);
+    if (!ata_wait_ready(drive, ATA_TIMEOUT_MS)) return 0;
+
+    ata_outb(drive, ATA_REG_SECCOUNT, block);
+    ata_outb(drive, ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+    ata_delay(drive);
+
+    if (!ata_wait_ready(drive, ATA_TIMEOUT_MS) || (ata_alt_status(drive) & ATA_SR_ERR)) {
+        ATA_DBG("set multiple %u rejected\n", block);
+        return 0;
+    }
+
+    drive->multiple = block;
+    ATA_DBG("multiple mode: %u sectors/block\n", block);
+    return block;
+}
+
+/* ============================================================================
+ * Multi-command Transfers (optimized for large requests)
+ * ============================================================================ */
+
+/**
+ * Read any number of sectors, chaining commands of ata_max_sectors each
+ */
+static uint32_t ata_read_sectors_multi(ata_drive_t *drive, uint64_t lba,
+                                        uint32_t count, void *buf) {
+    uint8_t *ptr = (uint8_t *)buf;
+    uint32_t total_read = 0;
+    uint32_t max = ata_max_sectors(drive);
+
+    while (count > 0) {
+        uint32_t chunk = (count > max) ? max : count;
+
+        uint32_t got = ata_read_sectors(drive, lba, chunk, ptr);
+        if (got == 0) break;
+
+        total_read += got;
+        lba += got;
+        ptr += got * 512;
+        count -= got;
+
+        if (got != chunk) break;  /* Partial read - stop */
+    }
+
+    return total_read;
+}
+
 /**
  * Write multiple sectors efficiently
- * Handles writes larger than 255 sectors by splitting
+ * Handles writes larger than one command by splitting
  */
-static uint32_t ata_write_sectors_multi(ata_drive_t *drive, uint32_t lba,
+static uint32_t ata_write_sectors_multi(ata_drive_t *drive, uint64_t lba,
                                          uint32_t count, const void *buf) {
     const uint8_t *ptr = (const uint8_t *)buf;
     uint32_t total_written = 0;
+    uint32_t max = ata_max_sectors(drive);
 
     while (count > 0) {
-        uint8_t chunk = (count > 255) ? 255 : count;
+        uint32_t chunk = (count > max) ? max : count;
 
         uint32_t written = ata_write_sectors(drive, lba, chunk, ptr);
         if (written == 0) break;
@@ -563,6 +738,375 @@ static uint32_t ata_write_sectors_multi(ata_drive_t *drive, uint32_t lba,
     return total_written;
 }
 
+/* ============================================================================
+ * Bus-Master DMA (PIIX/PIIX4)
+ *
+ * The IDE function's BAR4 holds the BMIDE register block. Each channel
+ * gets a PRD table describing the physical buffer (identity mapped, so
+ * the caller's buffer is used directly) in pieces that do not cross a
+ * 64KB boundary. Completion is signalled through IRQ14/15; the wait also
+ * polls the bus-master status so it works before interrupts are enabled.
+ *
+ * ata_dma_start() returns as soon as the command is issued. With a done
+ * callback the transfer completes asynchronously (from the IRQ handler
+ * or ata_dma_poll); ata_dma_transfer() is the synchronous wrapper.
+ * ============================================================================ */
+
+typedef struct {
+    uint32_t addr;      /* Physical buffer address */
+    uint16_t bytes;     /* Byte count (0 = 64KB) */
+    uint16_t flags;     /* ATA_PRD_EOT on the last entry */
+} __attribute__((packed)) ata_prd_t;
+
+/* Completion callback: @sectors transferred, 0 on error */
+typedef void (*ata_dma_done_fn)(void *ctx, uint32_t sectors);
+
+typedef struct {
+    volatile bool    irq;           /* Completion interrupt received */
+    volatile uint8_t bm_status;     /* BM status latched by the IRQ */
+
+    /* Transfer in flight */
+    volatile bool    active;
+    ata_drive_t     *drive;
+    uint32_t         count;
+    bool             write;
+    bool             ext;           /* 48-bit command (EXT cache flush) */
+    uint64_t         deadline;      /* TSC value at which the transfer times out */
+    ata_dma_done_fn  done;
+    void            *ctx;
+} ata_dma_channel_t;
+
+static struct {
+    bool         probed;
+    uint16_t     base;              /* BMIDE I/O base (0 = no controller) */
+    pci_device_t pci;
+} g_ata_bm;
+
+static ata_dma_channel_t g_ata_dma[2];
+
+/* PRD tables must be dword aligned and not cross a 64KB boundary */
+static ata_prd_t g_ata_prd[2][ATA_DMA_MAX_PRD] __attribute__((aligned(4096)));
+
+static inline int ata_channel(ata_drive_t *drive) {
+    return drive->io_base == ATA_PRIMARY_IO ? 0 : 1;
+}
+
+/**
+ * Stop the bus master and collect the result of the transfer in flight
+ * @param ok  false if the wait already failed (timeout)
+ * @return    Sectors transferred, or 0 on error
+ */
+static uint32_t ata_dma_finish(ata_drive_t *drive, bool ok) {
+    ata_dma_channel_t *ch = &g_ata_dma[ata_channel(drive)];
+    uint16_t bm = drive->bm_base;
+
+    /* Stop the engine and collect status (the IRQ may have latched it) */
+    outb(bm + ATA_BM_CMD, ch->write ? 0 : ATA_BM_CMD_READ);
+    uint8_t bm_status = inb(bm + ATA_BM_STATUS);
+    if (ch->irq) bm_status |= ch->bm_status;
+    uint8_t status = ata_inb(drive, ATA_REG_STATUS);
+    outb(bm + ATA_BM_STATUS, bm_status | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+    ch->active = false;
+
+    if (!ok || (bm_status & ATA_BM_SR_ERR) || (status & (ATA_SR_ERR | ATA_SR_DF))) {
+        ATA_DBG("dma: failed bm=0x%x status=0x%x\n", bm_status, status);
+        return 0;
+    }
+
+    /* Asynchronous completion may be in the IRQ handler: leave the
+     * (slow) cache flush to the next ata_flush_cache from thread context */
+    if (ch->write && ch->done) {
+        drive->flush_pending = true;
+    } else if (ch->write) {
+        ata_outb(drive, ATA_REG_COMMAND, ch->ext ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+        ata_wait_ready(drive, ATA_FLUSH_TIMEOUT_MS);
+        ata_inb(drive, ATA_REG_STATUS);     /* Clear the flush's INTRQ */
+    }
+
+    return ch->count;
+}
+
+/* Finish an asynchronous transfer and report it */
+static void ata_dma_complete(ata_dma_channel_t *ch, bool ok) {
+    uint32_t n = ata_dma_finish(ch->drive, ok);
+    ata_dma_done_fn done = ch->done;
+    ch->done = NULL;
+    done(ch->ctx, n);
+}
+
+/*
+ * IRQ14/15. Only a bus-master interrupt (ATA_BM_SR_IRQ) ends a DMA
+ * transfer: INTRQ is also raised by PIO commands and cache flushes, and
+ * one of those delivered late must not complete the transfer started
+ * since. The transfer is completed here once the engine has stopped;
+ * if it still shows active, poll finishes it.
+ */
+static void ata_dma_irq(int channel, uint16_t io_base) {
+    ata_dma_channel_t *ch = &g_ata_dma[channel];
+    uint8_t status = 0;
+
+    if (g_ata_bm.base) {
+        uint16_t bm = g_ata_bm.base + channel * 8;
+        status = inb(bm + ATA_BM_STATUS);
+        if (status & ATA_BM_SR_IRQ) {
+            ch->bm_status = status;
+            outb(bm + ATA_BM_STATUS, status | ATA_BM_SR_IRQ);
+        }
+    }
+
+    /* Reading the status register deasserts INTRQ */
+    inb(io_base + ATA_REG_STATUS);
+    if (!(status & ATA_BM_SR_IRQ)) return;
+    ch->irq = true;
+
+    if (ch->active && ch->done && !(status & ATA_BM_SR_ACTIVE)) {
+        ata_dma_complete(ch, true);
+    }
+}
+
+static void ata_irq_primary(int_frame_t *frame) {
+    (void)frame;
+    ata_dma_irq(0, ATA_PRIMARY_IO);
+}
+
+static void ata_irq_secondary(int_frame_t *frame) {
+    (void)frame;
+    ata_dma_irq(1, ATA_SECONDARY_IO);
+}
+
+/**
+ * Locate the bus-master IDE controller (once)
+ * @return true if a BMIDE register block is available
+ */
+static bool ata_dma_probe(void) {
+    if (g_ata_bm.probed) return g_ata_bm.base != 0;
+    g_ata_bm.probed = true;
+
+    if (!pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &g_ata_bm.pci)) {
+        ATA_DBG("dma: no PCI IDE controller\n");
+        return false;
+    }
+
+    uint32_t bar4 = pci_read32(g_ata_bm.pci.bus, g_ata_bm.pci.slot,
+                               g_ata_bm.pci.func, PCI_BAR4);
+    if (!(bar4 & 1) || (bar4 & 0xFFFC) == 0) {
+        ATA_DBG("dma: BAR4 not an I/O range (0x%x)\n", bar4);
+        return false;
+    }
+
+    g_ata_bm.base = (uint16_t)(bar4 & 0xFFFC);
+    pci_enable_bus_master(&g_ata_bm.pci);
+
+    irq_register(IRQ_ATA_PRI, ata_irq_primary);
+    irq_register(IRQ_ATA_SEC, ata_irq_secondary);
+    pic_enable_irq(IRQ_CASCADE);
+    pic_enable_irq(IRQ_ATA_PRI);
+    pic_enable_irq(IRQ_ATA_SEC);
+
+    ATA_DBG("dma: BMIDE at 0x%x (%x:%x)\n", g_ata_bm.base,
+            g_ata_bm.pci.vendor, g_ata_bm.pci.device);
+    return true;
+}
+
+/**
+ * Switch a drive to bus-master DMA if the drive and controller support it
+ * @return true if DMA is now enabled for the drive
+ */
+static bool ata_dma_enable(ata_drive_t *drive) {
+    if (!drive->present || drive->type != ATA_DEV_ATA) return false;
+    if (!(drive->identify[49] & (1 << 8))) return false;   /* No DMA support */
+    if (!ata_dma_probe()) return false;
+
+    drive->bm_base = g_ata_bm.base + ata_channel(drive) * 8;
+    drive->dma = true;
+    drive->dma_errors = 0;
+    drive->flush_pending = false;
+
+    /* Completion is interrupt driven: clear nIEN on this channel */
+    outb(drive->ctrl_base + ATA_REG_DEVCTRL, 0);
+    return true;
+}
+
+/* Has the transfer in flight on this drive's channel finished? */
+static bool ata_dma_ready(ata_drive_t *drive) {
+    ata_dma_channel_t *ch = &g_ata_dma[ata_channel(drive)];
+    if (ch->irq) return true;
+
+    uint8_t bm = inb(drive->bm_base + ATA_BM_STATUS);
+    if (bm & (ATA_BM_SR_ERR | ATA_BM_SR_IRQ)) return true;
+    return !(bm & ATA_BM_SR_ACTIVE) && !(ata_alt_status(drive) & ATA_SR_BSY);
+}
+
+/**
+ * Wait for a synchronous DMA command to finish
+ * Halts between checks when interrupts are on: the drive IRQ or the
+ * next timer tick wakes the CPU.
+ */
+static bool ata_dma_wait(ata_drive_t *drive, uint64_t deadline) {
+    while (!tsc_expired(deadline)) {
+        if (ata_dma_ready(drive)) {
+            ata_dma_channel_t *ch = &g_ata_dma[ata_channel(drive)];
+            return !(ch->irq && (ch->bm_status & ATA_BM_SR_ERR));
+        }
+        timer_idle();
+    }
+    ATA_DBG("dma: completion timeout\n");
+    return false;
+}
+
+/**
+ * Issue a bus-master DMA command
+ * @param buf   Must be word aligned (PRD addresses are)
+ * @param done  Completion callback (NULL: caller waits with ata_dma_wait)
+ * @return      Sectors being transferred, or 0 if the command was not issued
+ */
+static uint32_t ata_dma_start(ata_drive_t *drive, uint64_t lba, uint32_t count,
+                              void *buf, bool write, ata_dma_done_fn done, void *ctx) {
+    if (!drive->dma || ((uintptr_t)buf & 1)) return 0;
+    count = ata_check_request(drive, lba, count);
+    if (count == 0) return 0;
+
+    int channel = ata_channel(drive);
+    ata_dma_channel_t *ch = &g_ata_dma[channel];
+    if (ch->active) return 0;
+
+    ata_prd_t *prd = g_ata_prd[channel];
+    uint16_t bm = drive->bm_base;
+
+    /* Describe the buffer in pieces that stay inside a 64KB page */
+    uint32_t addr = (uint32_t)(uintptr_t)buf;
+    uint32_t left = count * 512;
+    int n = 0;
+    while (left > 0) {
+        if (n == ATA_DMA_MAX_PRD) return 0;
+        uint32_t chunk = 0x10000 - (addr & 0xFFFF);
+        if (chunk > left) chunk = left;
+        prd[n].addr = addr;
+        prd[n].bytes = (uint16_t)chunk;     /* 0x10000 wraps to 0 = 64KB */
+        prd[n].flags = 0;
+        addr += chunk;
+        left -= chunk;
+        n++;
+    }
+    prd[n - 1].flags = ATA_PRD_EOT;
+
+    uint8_t dir = write ? 0 : ATA_BM_CMD_READ;
+
+    /* Stop the engine, clear stale status, load the PRD table */
+    outb(bm + ATA_BM_CMD, 0);
+    outb(bm + ATA_BM_STATUS, inb(bm + ATA_BM_STATUS) | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+    pci_outl(bm + ATA_BM_PRDT, (uint32_t)(uintptr_t)prd);
+    outb(bm + ATA_BM_CMD, dir);
+
+    bool ext = ata_use_lba48(drive, lba, count);
+    if (!ata_setup_lba(drive, lba, count, ext)) return 0;
+
+    ch->irq = false;
+    ch->drive = drive;
+    ch->count = count;
+    ch->write = write;
+    ch->ext = ext;
+    ch->deadline = tsc_deadline(ATA_DMA_TIMEOUT_MS + count);
+    ch->done = done;
+    ch->ctx = ctx;
+    ch->active = true;
+
+    uint8_t cmd;
+    if (write) cmd = ext ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
+    else       cmd = ext ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
+    ata_outb(drive, ATA_REG_COMMAND, cmd);
+
+    /* Go */
+    outb(bm + ATA_BM_CMD, dir | ATA_BM_CMD_START);
+    return count;
+}
+
+/**
+ * Complete an asynchronous transfer by polling (interrupts disabled,
+ * or the IRQ was lost). Safe to call at any time.
+ */
+static void ata_dma_poll(ata_drive_t *drive) {
+    ata_dma_channel_t *ch = &g_ata_dma[ata_channel(drive)];
+    uint32_t flags = irq_save();
+
+    if (ch->active && ch->done && ch->drive == drive) {
+        if (ata_dma_ready(drive)) {
+            ata_dma_complete(ch, !(ch->irq && (ch->bm_status & ATA_BM_SR_ERR)));
+        } else if (tsc_expired(ch->deadline)) {
+            ATA_DBG("dma: completion timeout\n");
+            ata_dma_complete(ch, false);
+        }
+    }
+
+    irq_restore(flags);
+}
+
+/**
+ * Wait until no DMA transfer is in flight on @drive's channel, whichever
+ * drive it belongs to (thread context; both kinds of transfer time out)
+ */
+static void ata_dma_wait_idle(ata_drive_t *drive) {
+    ata_dma_channel_t *ch = &g_ata_dma[ata_channel(drive)];
+    while (ch->active) {
+        if (ch->done) ata_dma_poll(ch->drive);
+        if (ch->active) timer_idle();
+    }
+}
+
+/**
+ * Flush the drive's write cache after asynchronous DMA writes (thread
+ * context; waits for the channel to be free first)
+ * @return false if the drive did not finish the flush in time
+ */
+static bool ata_flush_cache(ata_drive_t *drive) {
+    if (!drive->flush_pending) return true;
+    ata_dma_wait_idle(drive);
+
+    ata_select_drive(drive);
+    ata_outb(drive, ATA_REG_COMMAND, drive->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+    bool ok = ata_wait_ready(drive, ATA_FLUSH_TIMEOUT_MS);
+    uint8_t status = ata_inb(drive, ATA_REG_STATUS);    /* Clears INTRQ */
+    drive->flush_pending = false;
+
+    if (!ok || (status & (ATA_SR_ERR | ATA_SR_DF))) {
+        ATA_DBG("dma: cache flush failed status=0x%x\n", status);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Transfer sectors with bus-master DMA and wait for completion
+ * @param buf  Must be word aligned (PRD addresses are)
+ * @return     Number of sectors transferred, or 0 on error
+ */
+static uint32_t ata_dma_transfer(ata_drive_t *drive, uint64_t lba, uint32_t count,
+                                 void *buf, bool write) {
+    ata_dma_channel_t *ch = &g_ata_dma[ata_channel(drive)];
+    uint32_t flags = irq_save();
+    while (ch->active) {
+        irq_restore(flags);
+        ata_dma_wait_idle(drive);
+        flags = irq_save();
+    }
+    count = ata_dma_start(drive, lba, count, buf, write, NULL, NULL);
+    irq_restore(flags);
+    if (count == 0) return 0;
+
+    bool ok = ata_dma_wait(drive, g_ata_dma[ata_channel(drive)].deadline);
+    return ata_dma_finish(drive, ok);
+}
+
+static inline uint32_t ata_dma_read_sectors(ata_drive_t *drive, uint64_t lba,
+                                             uint32_t count, void *buf) {
+    return ata_dma_transfer(drive, lba, count, buf, false);
+}
+
+static inline uint32_t ata_dma_write_sectors(ata_drive_t *drive, uint64_t lba,
+                                              uint32_t count, const void *buf) {
+    return ata_dma_transfer(drive, lba, count, (void *)buf, true);
+}
+
 /* ============================================================================
  * Software Reset
  * ============================================================================ */
@@ -578,19 +1122,20 @@ static void ata_software_reset(ata_drive_t *drive) {
     outb(drive->ctrl_base + ATA_REG_DEVCTRL, ATA_CTRL_SRST | ATA_CTRL_NIEN);
 
     /* Wait at least 5us */
-    for (volatile int i = 0; i < 1000; i++);
+    tsc_delay_us(5);
 
     /* De-assert SRST, keep interrupts disabled */
     outb(drive->ctrl_base + ATA_REG_DEVCTRL, ATA_CTRL_NIEN);
 
     /* Wait for drive to become ready (up to 30 seconds for some drives) */
-    for (int i = 0; i < 300000; i++) {
+    uint64_t deadline = tsc_deadline(ATA_RESET_TIMEOUT_MS);
+    while (!tsc_expired(deadline)) {
         uint8_t status = ata_alt_status(drive);
         if (!(status & ATA_SR_BSY)) {
             ATA_DBG("Reset complete\n");
             return;
         }
-        for (volatile int j = 0; j < 100; j++);
+        timer_idle();
     }
 
     ATA_DBG("Reset timeout!\n");
@@ -608,8 +1153,14 @@ static void ata_init_drive(int index, uint16_t io_base, uint16_t ctrl_base, uint
     drive->drive = drive_num;
     drive->present = false;
     drive->type = ATA_DEV_NONE;
+    drive->bm_base = 0;
+    drive->dma = false;
+    drive->dma_errors = 0;
+    drive->multiple = 0;
 
-    ata_identify(drive);
+    if (ata_identify(drive)) {
+        ata_set_multiple(drive, 0);
+    }
 }
 
 static inline void ata_init(void) {
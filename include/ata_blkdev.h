@@ -10,41 +10,169 @@
 #include "vfs.h"
 #include "ata.h"
 
+/* ============================================================================
+ * Transfer Mode
+ * ============================================================================ */
+
+typedef enum {
+    ATA_XFER_PIO = 0,       /* Programmed I/O only */
+    ATA_XFER_DMA,           /* Bus-master DMA, PIO on failure */
+} ata_xfer_mode_t;
+
+#ifndef ATA_BLKDEV_DEFAULT_XFER
+#define ATA_BLKDEV_DEFAULT_XFER ATA_XFER_DMA
+#endif
+
+/**
+ * Record a failed DMA transfer; give up on DMA after repeated errors
+ */
+static void ata_blkdev_dma_failed(ata_drive_t *drive) {
+    if (++drive->dma_errors >= ATA_DMA_MAX_ERRORS) {
+        drive->dma = false;
+        ATA_DBG("dma: too many errors, using PIO\n");
+    }
+}
+
 /* ============================================================================
  * ATA Block Device Implementation
  * ============================================================================ */
 
 /**
- * ATA read implementation
+ * Transfer one command's worth of sectors: DMA first, PIO on failure.
+ * A transfer still in flight on the channel is waited for first, so
+ * neither kind of command is issued over it (or counted as a DMA error).
  */
-static uint32_t ata_blkdev_read(blkdev_t *dev, uint32_t lba, uint8_t count, void *buf) {
+static uint32_t ata_blkdev_xfer(ata_drive_t *drive, uint32_t lba, uint32_t count,
+                                void *buf, bool write) {
+    ata_dma_wait_idle(drive);
+    if (drive->dma) {
+        uint32_t n = write ? ata_dma_write_sectors(drive, lba, count, buf)
+                           : ata_dma_read_sectors(drive, lba, count, buf);
+        if (n) return n;
+        ata_blkdev_dma_failed(drive);
+    }
+    return write ? ata_write_sectors(drive, lba, count, buf)
+                 : ata_read_sectors(drive, lba, count, buf);
+}
+
+/**
+ * Split a request into commands the drive can take (256 sectors with
+ * 28-bit LBA, 65536 with LBA48)
+ */
+static uint32_t ata_blkdev_chain(blkdev_t *dev, uint32_t lba, uint32_t count,
+                                 void *buf, bool write) {
     ata_drive_t *drive = (ata_drive_t *)dev->driver_data;
     if (!drive) return 0;
-    return ata_read_sectors(drive, lba, count, buf);
+
+    uint8_t *ptr = (uint8_t *)buf;
+    uint32_t max = ata_max_sectors(drive);
+    uint32_t done = 0;
+
+    while (done < count) {
+        uint32_t chunk = count - done;
+        if (chunk > max) chunk = max;
+
+        uint32_t n = ata_blkdev_xfer(drive, lba + done, chunk, ptr + done * 512, write);
+        done += n;
+        if (n != chunk) break;
+    }
+    return done;
 }
 
+/* ============================================================================
+ * Asynchronous DMA (request queue start/poll ops)
+ * ============================================================================ */
+
+/* Device whose transfer is in flight, per channel */
+static blkdev_t *g_ata_blkdev_async[2];
+
 /**
- * ATA write implementation
+ * DMA completion (IRQ handler or poll): hand the result to the request
+ * queue. A failed transfer goes back to the queue, which retries it with
+ * the synchronous ops (DMA, then PIO) from thread context.
+ */
+static void ata_blkdev_dma_done(void *ctx, uint32_t sectors) {
+    ata_drive_t *drive = (ata_drive_t *)ctx;
+    blkdev_t *dev = g_ata_blkdev_async[ata_channel(drive)];
+
+    if (sectors == 0) {
+        ata_blkdev_dma_failed(drive);
+        blkq_retry(dev);
+        return;
+    }
+    blkq_complete(dev, sectors);
+}
+
+/**
+ * Start a queued transfer with DMA; completion arrives via IRQ14/15
+ * (called with interrupts disabled, so it cannot arrive before the
+ * channel's record is filled in)
+ * @return false to have the queue run the transfer synchronously; a busy
+ *         channel is "not started", not a DMA error
  */
-static uint32_t ata_blkdev_write(blkdev_t *dev, uint32_t lba, uint8_t count, const void *buf) {
+static bool ata_blkdev_start(blkdev_t *dev, uint32_t lba, uint32_t count, void *buf, bool write) {
     ata_drive_t *drive = (ata_drive_t *)dev->driver_data;
-    if (!drive) return 0;
-    return ata_write_sectors(drive, lba, count, buf);
+    if (!drive || !drive->dma || count > ata_max_sectors(drive)) return false;
+
+    /*
+     * This may be the completion IRQ, which must not wait: the drive
+     * ready wait in ata_dma_start has to pass at once, or the transfer
+     * is left to thread context. Selecting the drive would disturb a
+     * transfer still running on the channel, so check that first.
+     */
+    if (g_ata_dma[ata_channel(drive)].active) return false;
+    ata_select_drive(drive);
+    uint8_t status = ata_alt_status(drive);
+    if ((status & (ATA_SR_BSY | ATA_SR_DRQ)) || !(status & ATA_SR_DRDY)) return false;
+
+    if (ata_dma_start(drive, lba, count, buf, write, ata_blkdev_dma_done, drive) != count) {
+        return false;
+    }
+    g_ata_blkdev_async[ata_channel(drive)] = dev;
+    return true;
+}
+
+/**
+ * Complete a DMA transfer without waiting for the IRQ
+ */
+static void ata_blkdev_poll(blkdev_t *dev) {
+    ata_drive_t *drive = (ata_drive_t *)dev->driver_data;
+    if (drive && drive->bm_base) ata_dma_poll(drive);
+}
+
+/**
+ * ATA read implementation
+ */
+static uint32_t ata_blkdev_read(blkdev_t *dev, uint32_t lba, uint32_t count, void *buf) {
+    return ata_blkdev_chain(dev, lba, count, buf, false);
+}
+
+/**
+ * ATA write implementation
+ */
+static uint32_t ata_blkdev_write(blkdev_t *dev, uint32_t lba, uint32_t count, const void *buf) {
+    return ata_blkdev_chain(dev, lba, count, (void *)buf, true);
 }
 
 /**
  * ATA sync implementation
- * Note: PIO mode writes are synchronous, so no cache flush needed
+ * Writes back the buffer cache, then flushes the drive cache once for
+ * every asynchronous DMA write since the last sync (their completion
+ * runs in the IRQ handler, which must not wait for a flush)
  */
 static bool ata_blkdev_sync(blkdev_t *dev) {
-    (void)dev;  /* PIO mode is synchronous - nothing to flush */
-    return true;
+    ata_drive_t *drive = (ata_drive_t *)dev->driver_data;
+    bool ok = bcache_flush(dev);
+    if (!drive || !drive->flush_pending) return ok;
+
+    blkq_idle(dev);
+    return ata_flush_cache(drive) && ok;
 }
 
 /**
- * Initialize ATA block device from ATA drive
+ * Initialize ATA block device from ATA drive with a given transfer mode
  */
-static void ata_blkdev_init(blkdev_t *blk, ata_drive_t *drive) {
+static void ata_blkdev_init_mode(blkdev_t *blk, ata_drive_t *drive, ata_xfer_mode_t mode) {
     blk->type = BLKDEV_ATA;
 
     /* Copy name */
@@ -71,15 +199,71 @@ static void ata_blkdev_init(blkdev_t *blk, ata_drive_t *drive) {
     blk->present = drive->present;
     blk->removable = false;
     blk->readonly = false;
+    blk->cached = true;
 
     /* Operations */
     blk->read = ata_blkdev_read;
     blk->write = ata_blkdev_write;
     blk->sync = ata_blkdev_sync;
     blk->eject = NULL;
+    blk->start = ata_blkdev_start;
+    blk->poll = ata_blkdev_poll;
+    blk->queue = NULL;
 
     /* Driver data */
     blk->driver_data = drive;
+
+    /* Transfer mode */
+    drive->dma = false;
+    if (mode == ATA_XFER_DMA) {
+        ata_dma_enable(drive);
+    }
+}
+
+/**
+ * Initialize ATA block device from ATA drive (default transfer mode)
+ */
+static void ata_blkdev_init(blkdev_t *blk, ata_drive_t *drive) {
+    ata_blkdev_init_mode(blk, drive, ATA_BLKDEV_DEFAULT_XFER);
+}
+
+/* ============================================================================
+ * Raw Access (format, disktest, atabench)
+ *
+ * Commands sent straight to an ata_drive_t bypass the request queue and
+ * the buffer cache. ata_blkdev_raw_begin() takes the VFS lock, writes
+ * back cached data of every queued device on the drive's channel and
+ * waits until none of them has a transfer queued or in flight (readahead
+ * leaves DMA running after the lock is released). ata_blkdev_raw_end()
+ * drops their cached sectors if the raw commands wrote anything.
+ * ============================================================================ */
+
+/* Queued block device @i if it is an ATA drive on @drive's channel */
+static blkdev_t *ata_blkdev_raw_peer(ata_drive_t *drive, int i) {
+    blkdev_t *dev = g_blkq[i].dev;
+    if (!dev || dev->type != BLKDEV_ATA || !dev->driver_data) return NULL;
+    return ata_channel((ata_drive_t *)dev->driver_data) == ata_channel(drive) ? dev : NULL;
+}
+
+static void ata_blkdev_raw_begin(ata_drive_t *drive) {
+    vfs_lock();
+    for (int i = 0; i < BLKQ_MAX_DEVICES; i++) {
+        blkdev_t *dev = ata_blkdev_raw_peer(drive, i);
+        if (!dev) continue;
+        bcache_flush(dev);
+        blkq_idle(dev);
+    }
+    ata_dma_wait_idle(drive);
+}
+
+static void ata_blkdev_raw_end(ata_drive_t *drive, bool wrote) {
+    if (wrote) {
+        for (int i = 0; i < BLKQ_MAX_DEVICES; i++) {
+            blkdev_t *dev = ata_blkdev_raw_peer(drive, i);
+            if (dev) bcache_invalidate(dev);
+        }
+    }
+    vfs_unlock();
 }
 
 /**
@@ -0,0 +1,282 @@
+/**
+ * cpu.h - CPUID Feature Detection
+ *
+ * Identifies the processor once at boot and turns on the pieces the
+ * kernel relies on. With -march=pentium3 GCC emits SSE moves for struct
+ * copies, so CR4.OSFXSR must be set before any of that code runs.
+ *
+ * Also programs variable MTRRs so the linear framebuffer is
+ * write-combining (there is no paging, so PAT does not apply).
+ */
+
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "idt.h"
+
+/* CPUID leaf 1 EDX feature bits */
+#define CPUID_FEAT_FPU      (1u << 0)
+#define CPUID_FEAT_TSC      (1u << 4)
+#define CPUID_FEAT_MSR      (1u << 5)
+#define CPUID_FEAT_MTRR     (1u << 12)
+#define CPUID_FEAT_PAT      (1u << 16)
+#define CPUID_FEAT_MMX      (1u << 23)
+#define CPUID_FEAT_FXSR     (1u << 24)
+#define CPUID_FEAT_SSE      (1u << 25)
+#define CPUID_FEAT_SSE2     (1u << 26)
+
+/* Control register bits */
+#define CR0_MP              (1u << 1)
+#define CR0_EM              (1u << 2)
+#define CR0_NW              (1u << 29)
+#define CR0_CD              (1u << 30)
+#define CR4_OSFXSR          (1u << 9)
+#define CR4_OSXMMEXCPT      (1u << 10)
+
+#define EFLAGS_ID           (1u << 21)
+
+typedef struct {
+    bool     has_cpuid;
+    char     vendor[13];
+    uint32_t max_leaf;
+    uint32_t family;
+    uint32_t model;
+    uint32_t stepping;
+    uint32_t features;      /* Leaf 1 EDX */
+    bool     sse_enabled;   /* CR4.OSFXSR set, XMM registers usable */
+} cpu_info_t;
+
+static cpu_info_t g_cpu;
+
+static inline void cpuid(uint32_t leaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
+
+static inline uint32_t read_cr0(void) {
+    uint32_t v;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(uint32_t v) {
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(v) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t v;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr4(uint32_t v) {
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(v) : "memory");
+}
+
+static inline bool cpu_has(uint32_t feature) {
+    return (g_cpu.features & feature) != 0;
+}
+
+/* CPUID exists if EFLAGS.ID can be toggled */
+static inline bool cpu_probe_cpuid(void) {
+    uint32_t before, after;
+    __asm__ volatile (
+        "pushfl\n\t"
+        "popl %0\n\t"
+        "movl %0, %1\n\t"
+        "xorl %2, %1\n\t"
+        "pushl %1\n\t"
+        "popfl\n\t"
+        "pushfl\n\t"
+        "popl %1\n\t"
+        "pushl %0\n\t"
+        "popfl"
+        : "=&r"(before), "=&r"(after) : "i"(EFLAGS_ID) : "cc");
+    return ((before ^ after) & EFLAGS_ID) != 0;
+}
+
+/**
+ * Identify the CPU and enable SSE state if supported
+ * Must run before any compiler-generated SSE code.
+ */
+static void cpu_init(void) {
+    uint32_t a, b, c, d;
+
+    g_cpu.has_cpuid = cpu_probe_cpuid();
+    if (!g_cpu.has_cpuid) return;
+
+    cpuid(0, &a, &b, &c, &d);
+    g_cpu.max_leaf = a;
+    for (int i = 0; i < 4; i++) {
+        g_cpu.vendor[i]     = (char)(b >> (i * 8));
+        g_cpu.vendor[i + 4] = (char)(d >> (i * 8));
+        g_cpu.vendor[i + 8] = (char)(c >> (i * 8));
+    }
+    g_cpu.vendor[12] = '\0';
+
+    if (g_cpu.max_leaf >= 1) {
+        cpuid(1, &a, &b, &c, &d);
+        g_cpu.stepping = a & 0xF;
+        g_cpu.model = (a >> 4) & 0xF;
+        g_cpu.family = (a >> 8) & 0xF;
+        g_cpu.features = d;
+    }
+
+    if (cpu_has(CPUID_FEAT_SSE) && cpu_has(CPUID_FEAT_FXSR)) {
+        write_cr0((read_cr0() & ~CR0_EM) | CR0_MP);
+        write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+        g_cpu.sse_enabled = true;
+    }
+}
+
+/* ============================================================================
+ * Memory Type Range Registers
+ * ============================================================================ */
+
+#define MSR_MTRR_CAP        0x0FE
+#define MSR_MTRR_DEF_TYPE   0x2FF
+#define MSR_MTRR_BASE(n)    (0x200 + 2 * (n))
+#define MSR_MTRR_MASK(n)    (0x201 + 2 * (n))
+
+#define MTRR_CAP_VCNT       0xFF
+#define MTRR_CAP_WC         (1u << 10)
+#define MTRR_DEF_ENABLE     (1u << 11)
+#define MTRR_MASK_VALID     (1u << 11)
+
+#define MTRR_TYPE_UC        0
+#define MTRR_TYPE_WC        1
+#define MTRR_TYPE_MASK      0xFF
+
+#define MTRR_MAX_VAR        16
+
+typedef struct {
+    uint32_t    base;       /* Framebuffer range made write-combining */
+    uint32_t    size;
+    uint8_t     regs;       /* Variable MTRRs used for it */
+    bool        wc;
+    const char *status;     /* Human-readable outcome for 'info' */
+} mtrr_wc_t;
+
+static mtrr_wc_t g_fb_wc = { 0, 0, 0, false, "not attempted" };
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+/* Physical address mask for MTRR mask registers (36 bits unless reported) */
+static uint64_t mtrr_phys_mask(void) {
+    uint32_t a, b, c, d, bits = 36;
+    cpuid(0x80000000, &a, &b, &c, &d);
+    if (a >= 0x80000008 && a < 0x8000FFFF) {
+        cpuid(0x80000008, &a, &b, &c, &d);
+        bits = a & 0xFF;
+    }
+    return (bits >= 64) ? ~0ull : (1ull << bits) - 1;
+}
+
+/* Largest power of two that is <= @n and divides @base (4KB minimum) */
+static uint32_t mtrr_chunk(uint32_t base, uint32_t n) {
+    uint32_t chunk = 0x80000000u;
+    while (chunk > 0x1000 && (chunk > n || (base & (chunk - 1)))) chunk >>= 1;
+    return chunk;
+}
+
+/**
+ * Make [base, base+size) write-combining with free variable MTRRs
+ * Follows the SDM update sequence: caches off and flushed, MTRRs
+ * disabled while the pairs are written, then everything restored.
+ * @return true if the whole range is now WC
+ */
+static bool mtrr_set_write_combining(uint32_t base, uint32_t size) {
+    g_fb_wc.base = base;
+    g_fb_wc.size = size;
+
+    if (!cpu_has(CPUID_FEAT_MTRR) || !cpu_has(CPUID_FEAT_MSR)) {
+        g_fb_wc.status = "no MTRRs";
+        return false;
+    }
+    uint32_t cap = (uint32_t)rdmsr(MSR_MTRR_CAP);
+    if (!(cap & MTRR_CAP_WC)) {
+        g_fb_wc.status = "WC type unsupported";
+        return false;
+    }
+
+    uint32_t vcnt = cap & MTRR_CAP_VCNT;
+    if (vcnt > MTRR_MAX_VAR) vcnt = MTRR_MAX_VAR;
+    uint64_t phys = mtrr_phys_mask();
+
+    /* Round up to a power of two when that stays aligned: one register */
+    size = (size + 0xFFF) & ~0xFFFu;
+    uint32_t whole = 0x1000;
+    while (whole < size) whole <<= 1;
+    if (!(base & (whole - 1))) size = whole;
+
+    /* Find free pairs; an existing overlapping range would take precedence */
+    uint8_t free_regs[MTRR_MAX_VAR];
+    uint32_t nfree = 0;
+    for (uint32_t i = 0; i < vcnt; i++) {
+        uint64_t mask = rdmsr(MSR_MTRR_MASK(i));
+        if (!(mask & MTRR_MASK_VALID)) {
+            free_regs[nfree++] = (uint8_t)i;
+            continue;
+        }
+        uint64_t rbase = rdmsr(MSR_MTRR_BASE(i)) & ~0xFFFull & phys;
+        uint64_t rmask = mask & ~0xFFFull & phys;
+        uint64_t rsize = (~rmask & phys) + 1;
+        if (rbase < (uint64_t)base + size && (uint64_t)base < rbase + rsize &&
+            (rdmsr(MSR_MTRR_BASE(i)) & MTRR_TYPE_MASK) != MTRR_TYPE_WC) {
+            g_fb_wc.status = "range already covered by BIOS MTRR";
+            return false;
+        }
+    }
+
+    /* Split into aligned power-of-two chunks */
+    uint32_t chunks = 0;
+    for (uint32_t at = base, left = size; left; chunks++) {
+        uint32_t c = mtrr_chunk(at, left);
+        at += c;
+        left -= c;
+    }
+    if (chunks > nfree) {
+        g_fb_wc.status = "not enough free MTRRs";
+        return false;
+    }
+
+    uint32_t flags = irq_save();
+    uint32_t cr0 = read_cr0();
+    write_cr0((cr0 | CR0_CD) & ~CR0_NW);
+    __asm__ volatile ("wbinvd" : : : "memory");
+
+    uint64_t def = rdmsr(MSR_MTRR_DEF_TYPE);
+    wrmsr(MSR_MTRR_DEF_TYPE, def & ~(uint64_t)MTRR_DEF_ENABLE);
+
+    uint32_t at = base, left = size;
+    for (uint32_t i = 0; i < chunks; i++) {
+        uint32_t c = mtrr_chunk(at, left);
+        wrmsr(MSR_MTRR_BASE(free_regs[i]), (uint64_t)at | MTRR_TYPE_WC);
+        wrmsr(MSR_MTRR_MASK(free_regs[i]), (~(uint64_t)(c - 1) & phys & ~0xFFFull) |
+                                           MTRR_MASK_VALID);
+        at += c;
+        left -= c;
+    }
+
+    __asm__ volatile ("wbinvd" : : : "memory");
+    wrmsr(MSR_MTRR_DEF_TYPE, def);
+    write_cr0(cr0);
+    irq_restore(flags);
+
+    g_fb_wc.size = size;
+    g_fb_wc.regs = (uint8_t)chunks;
+    g_fb_wc.wc = true;
+    g_fb_wc.status = "write-combining";
+    return true;
+}
+
+#endif /* CPU_H */
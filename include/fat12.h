@@ -18,12 +18,14 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "trace.h"
 
 /* ============================================================================
  * FAT12 Constants
  * ============================================================================ */
 
 #define FAT12_SECTOR_SIZE       512
+#define FAT12_MAX_RUN           65536   /* Max sectors per block request */
 #define FAT12_CLUSTER_FREE      0x000
 #define FAT12_CLUSTER_RESERVED  0x001
 #define FAT12_CLUSTER_BAD       0xFF7
@@ -41,6 +43,12 @@
 #define FAT12_DELETED           0xE5    // First byte of deleted entry
 #define FAT12_KANJI             0x05    // Escaped 0xE5 in first byte
 
+#define FAT12_MAX_CLUSTERS      4084    /* FAT12 spec limit */
+#define FAT12_FAT_ENTRIES       (FAT12_MAX_CLUSTERS + 2)
+#define FAT12_MAP_WORDS         ((FAT12_FAT_ENTRIES + 31) / 32)
+#define FAT12_ALLOC_RUN         8       /* Preferred free run for a new chain */
+#define FAT12_MAX_FAT_SECTORS   64      /* Per-sector dirty tracking limit */
+
 #define FAT12_MAX_PATH          260
 #define FAT12_MAX_OPEN_FILES    16
 
@@ -98,8 +106,8 @@ typedef struct {
  * ============================================================================ */
 
 /* Block device read/write function types */
-typedef uint32_t (*block_read_fn)(uint32_t lba, uint8_t count, void *buf);
-typedef uint32_t (*block_write_fn)(uint32_t lba, uint8_t count, const void *buf);
+typedef uint32_t (*block_read_fn)(uint32_t lba, uint32_t count, void *buf);
+typedef uint32_t (*block_write_fn)(uint32_t lba, uint32_t count, const void *buf);
 
 typedef struct {
     /* Block device callbacks */
@@ -119,6 +127,14 @@ typedef struct {
     /* FAT cache (for small FATs, cache entire FAT) */
     uint8_t        *fat_cache;
     bool            fat_dirty;
+    uint32_t        fat_dirty_map[FAT12_MAX_FAT_SECTORS / 32];  // Dirty FAT sectors
+    
+    /* Decoded FAT and free-cluster bitmap (bit set = free), built at mount */
+    uint16_t        fat_shadow[FAT12_FAT_ENTRIES];
+    uint32_t        free_map[FAT12_MAP_WORDS];
+    uint32_t        free_clusters;      // Maintained free cluster count
+    uint16_t        next_free;          // Next-fit allocation cursor
+    bool            shadow;             // fat_shadow/free_map are valid
     
     /* Sector buffer */
     uint8_t         sector_buf[FAT12_SECTOR_SIZE];
@@ -173,6 +189,13 @@ static uint16_t fat12_read_fat(fat12_fs_t *fs, uint16_t cluster) {
     uint32_t fat_offset = cluster + (cluster / 2);  // cluster * 1.5
     uint16_t value;
     
+    if (fs->shadow) {
+        return cluster < FAT12_FAT_ENTRIES ? fs->fat_shadow[cluster] : FAT12_CLUSTER_BAD;
+    }
+
+    // Only the cache/disk path is timed; a shadow lookup is cheaper than rdtsc
+    TRACE_BEGIN(t0);
+    
     if (fs->fat_cache) {
         value = *(uint16_t *)&fs->fat_cache[fat_offset];
     } else {
@@ -192,6 +215,8 @@ static uint16_t fat12_read_fat(fat12_fs_t *fs, uint16_t cluster) {
         }
     }
     
+    TRACE_END(TP_FAT_READ, t0, cluster);
+
     // FAT12 entries are 12 bits
     if (cluster & 1) {
         return value >> 4;
@@ -200,18 +225,53 @@ static uint16_t fat12_read_fat(fat12_fs_t *fs, uint16_t cluster) {
     }
 }
 
+/* Mark cluster free/used in the allocation bitmap */
+static inline void fat12_map_set(fat12_fs_t *fs, uint16_t cluster, bool free) {
+    uint32_t bit = 1u << (cluster & 31);
+    if (free) {
+        fs->free_map[cluster >> 5] |= bit;
+    } else {
+        fs->free_map[cluster >> 5] &= ~bit;
+    }
+}
+
+/* Mark the FAT sector(s) holding byte offset @fat_offset dirty */
+static inline void fat12_mark_fat_dirty(fat12_fs_t *fs, uint32_t fat_offset) {
+    uint32_t first = fat_offset / FAT12_SECTOR_SIZE;
+    uint32_t last = (fat_offset + 1) / FAT12_SECTOR_SIZE;  // Entries may span two
+    for (uint32_t i = first; i <= last && i < FAT12_MAX_FAT_SECTORS; i++) {
+        fs->fat_dirty_map[i >> 5] |= 1u << (i & 31);
+    }
+    fs->fat_dirty = true;
+}
+
 /* Write FAT entry for cluster */
 static void fat12_write_fat(fat12_fs_t *fs, uint16_t cluster, uint16_t value) {
     uint32_t fat_offset = cluster + (cluster / 2);
     
+    value &= 0x0FFF;
+    
+    if (fs->shadow) {
+        if (cluster < 2 || cluster >= fs->total_clusters + 2) return;
+        uint16_t old = fs->fat_shadow[cluster];
+        if (old == FAT12_CLUSTER_FREE && value != FAT12_CLUSTER_FREE) {
+            fat12_map_set(fs, cluster, false);
+            fs->free_clusters--;
+        } else if (old != FAT12_CLUSTER_FREE && value == FAT12_CLUSTER_FREE) {
+            fat12_map_set(fs, cluster, true);
+            fs->free_clusters++;
+        }
+        fs->fat_shadow[cluster] = value;
+    }
+    
     if (fs->fat_cache) {
         uint16_t *entry = (uint16_t *)&fs->fat_cache[fat_offset];
         if (cluster & 1) {
             *entry = (*entry & 0x000F) | (value << 4);
         } else {
-            *entry = (*entry & 0xF000) | (value & 0x0FFF);
+            *entry = (*entry & 0xF000) | value;
         }
-        fs->fat_dirty = true;
+        fat12_mark_fat_dirty(fs, fat_offset);
     }
     // TODO: Direct disk write if no cache
 }
@@ -221,14 +281,93 @@ static inline bool fat12_is_eof(uint16_t cluster) {
     return cluster >= FAT12_CLUSTER_EOF_MIN;
 }
 
-/* Find free cluster */
-static uint16_t fat12_find_free_cluster(fat12_fs_t *fs) {
-    for (uint16_t i = 2; i < fs->total_clusters + 2; i++) {
-        if (fat12_read_fat(fs, i) == FAT12_CLUSTER_FREE) {
-            return i;
+/* Bitmap word @w with clusters outside [2, total_clusters + 2) masked off */
+static inline uint32_t fat12_map_word(fat12_fs_t *fs, uint32_t w) {
+    uint32_t bits = fs->free_map[w];
+    uint32_t end = fs->total_clusters + 2;
+    if (w == 0) bits &= ~3u;
+    if ((w + 1) * 32 > end) bits &= (1u << (end & 31)) - 1;
+    return bits;
+}
+
+/* Bits that start a run of FAT12_ALLOC_RUN free clusters within the word */
+static inline uint32_t fat12_run_bits(uint32_t bits) {
+    bits &= bits >> 1;
+    bits &= bits >> 2;
+    bits &= bits >> 4;
+    return bits;
+}
+
+/* Next-fit scan of the bitmap from next_free, one word at a time */
+static uint16_t fat12_scan_free(fat12_fs_t *fs, bool want_run) {
+    uint32_t words = (fs->total_clusters + 2 + 31) / 32;
+    uint32_t start = fs->next_free >> 5;
+    
+    for (uint32_t n = 0; n <= words; n++) {
+        uint32_t w = (start + n) % words;
+        uint32_t bits = fat12_map_word(fs, w);
+        if (n == 0) bits &= ~((1u << (fs->next_free & 31)) - 1);
+        if (n == words) bits &= (1u << (fs->next_free & 31)) - 1;
+        if (want_run) bits = fat12_run_bits(bits);
+        if (bits) {
+            return (uint16_t)(w * 32 + __builtin_ctz(bits));
+        }
+    }
+    return 0;
+}
+
+/*
+ * Find free cluster. @hint (usually last + 1 of a chain being extended)
+ * is taken if free, so files stay contiguous; otherwise allocation is
+ * next-fit, preferring the start of a run of free clusters.
+ */
+static uint16_t fat12_find_free_cluster(fat12_fs_t *fs, uint16_t hint) {
+    if (!fs->shadow) {
+        for (uint16_t i = 2; i < fs->total_clusters + 2; i++) {
+            if (fat12_read_fat(fs, i) == FAT12_CLUSTER_FREE) {
+                return i;
+            }
+        }
+        return 0;  // No free clusters
+    }
+    
+    if (fs->free_clusters == 0) return 0;
+    
+    if (hint >= 2 && hint < fs->total_clusters + 2 &&
+        (fs->free_map[hint >> 5] & (1u << (hint & 31)))) {
+        fs->next_free = hint + 1;
+        return hint;
+    }
+    
+    uint16_t cluster = fat12_scan_free(fs, true);
+    if (cluster == 0) cluster = fat12_scan_free(fs, false);
+    if (cluster != 0) fs->next_free = cluster + 1;
+    if (fs->next_free >= fs->total_clusters + 2) fs->next_free = 2;
+    return cluster;
+}
+
+/* Decode the FAT into fat_shadow and build the free bitmap */
+static void fat12_build_shadow(fat12_fs_t *fs) {
+    fs->shadow = false;
+    fs->free_clusters = 0;
+    fs->next_free = 2;
+    if (fs->total_clusters + 2 > FAT12_FAT_ENTRIES) return;
+    
+    for (uint32_t w = 0; w < FAT12_MAP_WORDS; w++) {
+        fs->free_map[w] = 0;
+    }
+    for (uint32_t i = 0; i < FAT12_FAT_ENTRIES; i++) {
+        uint16_t value = FAT12_CLUSTER_BAD;
+        if (i < fs->total_clusters + 2) {
+            value = fat12_read_fat(fs, (uint16_t)i);
+        }
+        fs->fat_shadow[i] = value;
+        if (i >= 2 && value == FAT12_CLUSTER_FREE) {
+            fat12_map_set(fs, (uint16_t)i, true);
+            fs->free_clusters++;
         }
     }
-    return 0;  // No free clusters
+    fs->shadow = true;
 }
 
 /* ============================================================================
@@ -306,12 +445,19 @@ static bool fat12_mount(fat12_fs_t *fs, block_read_fn read_fn, block_write_fn wr
     fs->write_sectors = write_fn;
     fs->fat_cache = fat_cache_buf;
     fs->fat_dirty = false;
+    for (uint32_t w = 0; w < FAT12_MAX_FAT_SECTORS / 32; w++) {
+        fs->fat_dirty_map[w] = 0;
+    }
+    fs->shadow = false;
     fs->mounted = false;
     
-    // Read boot sector
-    if (fs->read_sectors(0, 1, &fs->bpb) != 1) {
+    // Read boot sector (the BPB is only its first bytes)
+    if (fs->read_sectors(0, 1, fs->sector_buf) != 1) {
         return false;
     }
+    for (uint32_t i = 0; i < sizeof(fat12_bpb_t); i++) {
+        ((uint8_t *)&fs->bpb)[i] = fs->sector_buf[i];
+    }
     
     // Validate BPB
     if (fs->bpb.bytes_per_sector != 512) return false;
@@ -336,23 +482,48 @@ static bool fat12_mount(fat12_fs_t *fs, block_read_fn read_fn, block_write_fn wr
         }
     }
     
+    fat12_build_shadow(fs);
+    
     fs->mounted = true;
     return true;
 }
 
+/* Test and clear the dirty bit for FAT sector @i */
+static inline bool fat12_take_dirty(fat12_fs_t *fs, uint32_t i) {
+    if (fs->bpb.fat_size_16 > FAT12_MAX_FAT_SECTORS) return true;  // Untracked
+    uint32_t bit = 1u << (i & 31);
+    if (!(fs->fat_dirty_map[i >> 5] & bit)) return false;
+    fs->fat_dirty_map[i >> 5] &= ~bit;
+    return true;
+}
+
 /**
  * Sync FAT to disk
+ *
+ * Only sectors changed since the last sync are written. Adjacent dirty
+ * sectors go out as one multi-sector write, mirrored to every FAT copy
+ * before moving on to the next run.
  */
 static void fat12_sync(fat12_fs_t *fs) {
     if (!fs->fat_cache || !fs->fat_dirty) return;
     
-    // Write to both FATs
-    for (uint8_t f = 0; f < fs->bpb.num_fats; f++) {
-        uint32_t fat_sector = fs->fat_start + f * fs->bpb.fat_size_16;
-        for (uint16_t i = 0; i < fs->bpb.fat_size_16; i++) {
-            fs->write_sectors(fat_sector + i, 1,
+    uint32_t i = 0;
+    while (i < fs->bpb.fat_size_16) {
+        if (!fat12_take_dirty(fs, i)) {
+            i++;
+            continue;
+        }
+        uint32_t run = 1;
+        while (i + run < fs->bpb.fat_size_16 && fat12_take_dirty(fs, i + run)) {
+            run++;
+        }
+        
+        for (uint8_t f = 0; f < fs->bpb.num_fats; f++) {
+            uint32_t fat_sector = fs->fat_start + f * fs->bpb.fat_size_16;
+            fs->write_sectors(fat_sector + i, run,
                              &fs->fat_cache[i * FAT12_SECTOR_SIZE]);
         }
+        i += run;
     }
     
     fs->fat_dirty = false;
@@ -496,6 +667,15 @@ static bool fat12_open(fat12_fs_t *fs, const char *path, fat12_file_t *file) {
             return false;
         }
 
+        // Remember where the entry lives (the iterator is one past it)
+        if (dir.entry == 0) {
+            file->dir_sector = dir.sector - 1;
+            file->dir_offset = 15 * 32;
+        } else {
+            file->dir_sector = dir.sector;
+            file->dir_offset = (dir.entry - 1) * 32;
+        }
+
         // If more path components, must be directory
         if (*path) {
             if (!(de.attributes & FAT12_ATTR_DIRECTORY)) {
@@ -517,8 +697,50 @@ static bool fat12_open(fat12_fs_t *fs, const char *path, fat12_file_t *file) {
     return true;
 }
 
+/**
+ * Count sectors from the current file position to the end of the
+ * contiguous cluster run it lies in, stopping once @want is reached.
+ * Used to turn a transfer into one multi-sector command per extent.
+ */
+static uint32_t fat12_run_sectors(fat12_file_t *file, uint32_t want) {
+    fat12_fs_t *fs = file->fs;
+    uint32_t spc = fs->bpb.sectors_per_cluster;
+    uint32_t avail = spc - file->cluster_offset / FAT12_SECTOR_SIZE;
+    uint16_t c = file->cluster;
+
+    while (avail < want && avail < FAT12_MAX_RUN) {
+        uint16_t next = fat12_read_fat(fs, c);
+        if (next != c + 1) break;
+        c = next;
+        avail += spc;
+    }
+
+    if (avail > want) avail = want;
+    if (avail > FAT12_MAX_RUN) avail = FAT12_MAX_RUN;
+    return avail;
+}
+
+/**
+ * Advance the file position by @bytes within a contiguous cluster run.
+ * Ends on the last byte of a cluster rather than stepping into the next
+ * one, which may not be allocated yet.
+ */
+static void fat12_advance_run(fat12_file_t *file, uint32_t bytes) {
+    uint32_t cluster_size = file->fs->bpb.sectors_per_cluster * FAT12_SECTOR_SIZE;
+    uint32_t end = file->cluster_offset + bytes;
+    uint32_t skip = (end - 1) / cluster_size;
+
+    file->cluster += skip;
+    file->cluster_offset = end - skip * cluster_size;
+    file->position += bytes;
+}
+
 /**
  * Read from file
+ *
+ * Whole sectors are read straight into the caller's buffer, one command
+ * per run of contiguous clusters. Only a leading or trailing partial
+ * sector goes through sector_buf.
  */
 static uint32_t fat12_read(fat12_file_t *file, void *buf, uint32_t size) {
     if (!file->open) return 0;
@@ -528,11 +750,12 @@ static uint32_t fat12_read(fat12_file_t *file, void *buf, uint32_t size) {
     uint32_t bytes_read = 0;
     uint32_t cluster_size = fs->bpb.sectors_per_cluster * FAT12_SECTOR_SIZE;
 
-    while (size > 0 && file->position < file->dirent.file_size) {
-        // Clamp to file size
-        uint32_t remaining = file->dirent.file_size - file->position;
-        if (size > remaining) size = remaining;
+    // Clamp to file size
+    if (file->position >= file->dirent.file_size) return 0;
+    uint32_t remaining = file->dirent.file_size - file->position;
+    if (size > remaining) size = remaining;
 
+    while (size > 0) {
         // Handle cluster boundary
         if (file->cluster_offset >= cluster_size) {
             uint16_t next = fat12_read_fat(fs, file->cluster);
@@ -541,21 +764,16 @@ static uint32_t fat12_read(fat12_file_t *file, void *buf, uint32_t size) {
             file->cluster_offset = 0;
         }
 
-        // Calculate how much to read from current cluster
-        uint32_t to_read = cluster_size - file->cluster_offset;
-        if (to_read > size) to_read = size;
-
-        // Read sector(s)
         uint32_t sector = fat12_cluster_to_sector(fs, file->cluster) +
                           (file->cluster_offset / FAT12_SECTOR_SIZE);
         uint32_t offset = file->cluster_offset % FAT12_SECTOR_SIZE;
 
-        // Simple: read one sector at a time
-        while (to_read > 0) {
-            fs->read_sectors(sector, 1, fs->sector_buf);
+        if (offset != 0 || size < FAT12_SECTOR_SIZE) {
+            // Partial sector: bounce through sector_buf
+            if (fs->read_sectors(sector, 1, fs->sector_buf) != 1) break;
 
             uint32_t chunk = FAT12_SECTOR_SIZE - offset;
-            if (chunk > to_read) chunk = to_read;
+            if (chunk > size) chunk = size;
 
             for (uint32_t i = 0; i < chunk; i++) {
                 out[bytes_read + i] = fs->sector_buf[offset + i];
@@ -564,12 +782,18 @@ static uint32_t fat12_read(fat12_file_t *file, void *buf, uint32_t size) {
             bytes_read += chunk;
             file->position += chunk;
             file->cluster_offset += chunk;
-            to_read -= chunk;
             size -= chunk;
-
-            offset = 0;
-            sector++;
+            continue;
         }
+
+        // Whole sectors: one request for the contiguous extent
+        uint32_t count = fat12_run_sectors(file, size / FAT12_SECTOR_SIZE);
+        if (fs->read_sectors(sector, count, out + bytes_read) != count) break;
+
+        uint32_t chunk = count * FAT12_SECTOR_SIZE;
+        fat12_advance_run(file, chunk);
+        bytes_read += chunk;
+        size -= chunk;
     }
 
     return bytes_read;
@@ -669,14 +893,16 @@ static bool fat12_get_label(fat12_fs_t *fs, char *label) {
 }
 
 /**
- * Get free space in bytes
+ * Get free space in bytes (O(1) from the maintained counter once mounted)
  */
 static uint32_t fat12_free_space(fat12_fs_t *fs) {
-    uint32_t free_clusters = 0;
+    uint32_t free_clusters = fs->free_clusters;
 
-    for (uint16_t i = 2; i < fs->total_clusters + 2; i++) {
-        if (fat12_read_fat(fs, i) == FAT12_CLUSTER_FREE) {
-            free_clusters++;
+    if (!fs->shadow) {
+        for (uint16_t i = 2; i < fs->total_clusters + 2; i++) {
+            if (fat12_read_fat(fs, i) == FAT12_CLUSTER_FREE) {
+                free_clusters++;
+            }
         }
     }
 
@@ -33,14 +33,25 @@ static fat12_vfs_state_t g_fat12_state;
 /* Current device for block I/O (set during mount) */
 static blkdev_t *g_fat12_current_dev = NULL;
 
-static uint32_t fat12_vfs_read_sectors(uint32_t lba, uint8_t count, void *buf) {
-    if (!g_fat12_current_dev || !g_fat12_current_dev->read) return 0;
-    return g_fat12_current_dev->read(g_fat12_current_dev, lba, count, buf);
+static uint32_t fat12_vfs_read_sectors(uint32_t lba, uint32_t count, void *buf) {
+    if (!g_fat12_current_dev) return 0;
+    return blkdev_read(g_fat12_current_dev, lba, count, buf);
 }
 
-static uint32_t fat12_vfs_write_sectors(uint32_t lba, uint8_t count, const void *buf) {
-    if (!g_fat12_current_dev || !g_fat12_current_dev->write) return 0;
-    return g_fat12_current_dev->write(g_fat12_current_dev, lba, count, buf);
+static uint32_t fat12_vfs_write_sectors(uint32_t lba, uint32_t count, const void *buf) {
+    if (!g_fat12_current_dev) return 0;
+    return blkdev_write(g_fat12_current_dev, lba, count, buf);
+}
+
+/**
+ * Write back the buffer cache after a completed operation
+ * (file close, create/delete/rename) so the device is consistent
+ */
+static bool fat12_vfs_commit(fat12_vfs_state_t *state, bool ok) {
+    if (ok && state->device) {
+        blkdev_sync(state->device);
+    }
+    return ok;
 }
 
 /* ============================================================================
@@ -110,6 +121,7 @@ static bool fat12_vfs_lookup(vfs_mount_t *mnt, const char *path, vfs_node_t *nod
         node->size = 0;
         node->inode = 0;
         node->cluster = 0;
+        node->mtime = 0;
         node->mount = mnt;
         return true;
     }
@@ -132,6 +144,7 @@ static bool fat12_vfs_lookup(vfs_mount_t *mnt, const char *path, vfs_node_t *nod
     node->size = de.file_size;
     node->inode = de.cluster_low;
     node->cluster = de.cluster_low;
+    node->mtime = ((uint32_t)de.modify_date << 16) | de.modify_time;
     node->mount = mnt;
 
     return true;
@@ -146,11 +159,12 @@ static bool fat12_vfs_stat(vfs_node_t *node, vfs_stat_t *stat) {
     stat->permissions = 0755;  /* rwxr-xr-x */
     stat->uid = 0;
     stat->gid = 0;
-    stat->atime = 0;  /* TODO: Parse FAT timestamps */
-    stat->mtime = 0;
+    stat->atime = 0;
+    stat->mtime = node->mtime;      /* FAT date << 16 | time */
     stat->ctime = 0;
     stat->blocks = (node->size + 511) / 512;
     stat->block_size = 512;
+    stat->inode = node->inode;
     return true;
 }
 
@@ -164,9 +178,9 @@ static bool fat12_vfs_create(vfs_mount_t *mnt, const char *path, uint8_t type) {
     if (*path == '/') path++;
 
     if (type == VFS_DIRECTORY) {
-        return fat12_mkdir(&state->fs, path);
+        return fat12_vfs_commit(state, fat12_mkdir(&state->fs, path));
     } else {
-        return fat12_create_file(&state->fs, path, FAT12_ATTR_ARCHIVE);
+        return fat12_vfs_commit(state, fat12_create_file(&state->fs, path, FAT12_ATTR_ARCHIVE));
     }
 }
 
@@ -178,7 +192,7 @@ static bool fat12_vfs_unlink(vfs_mount_t *mnt, const char *path) {
     if (!state) return false;
 
     if (*path == '/') path++;
-    return fat12_delete(&state->fs, path);
+    return fat12_vfs_commit(state, fat12_delete(&state->fs, path));
 }
 
 /**
@@ -188,7 +202,7 @@ static bool fat12_vfs_rename(vfs_mount_t *mnt, const char *old_path, const char
     fat12_vfs_state_t *state = (fat12_vfs_state_t *)mnt->fs_data;
     if (!state) return false;
 
-    return fat12_rename(&state->fs, old_path, new_path);
+    return fat12_vfs_commit(state, fat12_rename(&state->fs, old_path, new_path));
 }
 
 /**
@@ -199,7 +213,7 @@ static bool fat12_vfs_mkdir(vfs_mount_t *mnt, const char *path) {
     if (!state) return false;
 
     if (*path == '/') path++;
-    return fat12_mkdir(&state->fs, path);
+    return fat12_vfs_commit(state, fat12_mkdir(&state->fs, path));
 }
 
 /**
@@ -210,7 +224,7 @@ static bool fat12_vfs_rmdir(vfs_mount_t *mnt, const char *path) {
     if (!state) return false;
 
     if (*path == '/') path++;
-    return fat12_rmdir(&state->fs, path);
+    return fat12_vfs_commit(state, fat12_rmdir(&state->fs, path));
 }
 
 /* ============================================================================
@@ -286,6 +300,9 @@ static void fat12_vfs_close(vfs_file_t *file) {
         fat12_close(&fstate->file);
         fstate->opened = false;
         file->fs_data = NULL;
+
+        fat12_vfs_state_t *state = (fat12_vfs_state_t *)file->mount->fs_data;
+        if (state) fat12_vfs_commit(state, file->dirty);
     }
 }
 
@@ -296,8 +313,10 @@ static int32_t fat12_vfs_read(vfs_file_t *file, void *buf, uint32_t size) {
     fat12_file_state_t *fstate = (fat12_file_state_t *)file->fs_data;
     if (!fstate) return -1;
 
-    /* Seek to current position */
-    fstate->file.position = file->position;
+    /* Reposition the cluster cursor if the VFS position moved */
+    if (fstate->file.position != file->position) {
+        fat12_seek(&fstate->file, file->position);
+    }
 
     uint32_t bytes = fat12_read(&fstate->file, buf, size);
     file->position = fstate->file.position;
@@ -305,6 +324,39 @@ static int32_t fat12_vfs_read(vfs_file_t *file, void *buf, uint32_t size) {
     return (int32_t)bytes;
 }
 
+/**
+ * Prefetch from the file position to the end of its contiguous cluster
+ * run (at most @sectors, never past end of file). Works on a copy of the
+ * cluster cursor, stepping into the next run when the cursor sits at the
+ * end of a cluster. Does nothing on devices without a start op (the
+ * floppy), where the reads could not be queued asynchronously.
+ */
+static void fat12_vfs_readahead(vfs_file_t *file, uint32_t sectors) {
+    fat12_file_state_t *fstate = (fat12_file_state_t *)file->fs_data;
+    fat12_vfs_state_t *state = (fat12_vfs_state_t *)file->mount->fs_data;
+    if (!fstate || !state || !state->device || !state->device->start) return;
+
+    fat12_file_t cur = fstate->file;
+    fat12_fs_t *fs = cur.fs;
+    uint32_t cluster_size = fs->bpb.sectors_per_cluster * FAT12_SECTOR_SIZE;
+    if (cur.position >= cur.dirent.file_size) return;
+
+    if (cur.cluster_offset >= cluster_size) {
+        uint16_t next = fat12_read_fat(fs, cur.cluster);
+        if (fat12_is_eof(next)) return;
+        cur.cluster = next;
+        cur.cluster_offset = 0;
+    }
+
+    uint32_t offset = cur.cluster_offset % FAT12_SECTOR_SIZE;
+    uint32_t left = (cur.dirent.file_size - cur.position + offset + FAT12_SECTOR_SIZE - 1) /
+                    FAT12_SECTOR_SIZE;
+    if (sectors > left) sectors = left;
+
+    uint32_t lba = fat12_cluster_to_sector(fs, cur.cluster) + cur.cluster_offset / FAT12_SECTOR_SIZE;
+    blkdev_readahead(state->device, lba, fat12_run_sectors(&cur, sectors));
+}
+
 /**
  * Write to file
  */
@@ -312,8 +364,10 @@ static int32_t fat12_vfs_write(vfs_file_t *file, const void *buf, uint32_t size)
     fat12_file_state_t *fstate = (fat12_file_state_t *)file->fs_data;
     if (!fstate) return -1;
 
-    /* Seek to current position */
-    fstate->file.position = file->position;
+    /* Reposition the cluster cursor if the VFS position moved */
+    if (fstate->file.position != file->position) {
+        fat12_seek(&fstate->file, file->position);
+    }
 
     uint32_t bytes = fat12_write(&fstate->file, buf, size);
 
@@ -353,11 +407,7 @@ static int32_t fat12_vfs_seek(vfs_file_t *file, int32_t offset, int whence) {
 
     file->position = new_pos;
 
-    fat12_file_state_t *fstate = (fat12_file_state_t *)file->fs_data;
-    if (fstate) {
-        fstate->file.position = new_pos;
-    }
-
+    /* The cluster cursor follows lazily on the next read/write */
     return new_pos;
 }
 
@@ -365,10 +415,19 @@ static int32_t fat12_vfs_seek(vfs_file_t *file, int32_t offset, int whence) {
  * Directory Operations
  * ============================================================================ */
 
-/* Directory state */
+/*
+ * Directory cursor: the iterator plus its own copy of the current
+ * directory sector, so each sector is read once per pass however the
+ * entries are consumed, and file lookups in between (which use the
+ * shared fs->sector_buf) cannot disturb a listing.
+ */
 typedef struct {
     fat12_dir_t dir;
-    bool opened;
+    uint8_t     buf[FAT12_SECTOR_SIZE];
+    uint32_t    buf_sector;     /* Sector held in buf */
+    bool        buf_valid;
+    bool        done;           /* End of directory reached */
+    bool        opened;
 } fat12_dir_state_t;
 
 static fat12_dir_state_t g_fat12_dir_states[VFS_MAX_OPEN_FILES];
@@ -385,6 +444,76 @@ static fat12_dir_state_t *alloc_dir_state(void) {
     return NULL;
 }
 
+/* Point the cursor at the start of @dir's directory */
+static void fat12_dir_cursor_reset(fat12_dir_state_t *dstate, fat12_fs_t *fs, vfs_dir_t *dir) {
+    if (dir->node.cluster == 0) {
+        fat12_open_root(fs, &dstate->dir);
+    } else {
+        fat12_open_dir(fs, &dstate->dir, dir->node.cluster);
+    }
+    dstate->buf_valid = false;
+    dstate->done = false;
+    dir->position = 0;
+}
+
+/**
+ * Next listable entry (not deleted, LFN, "." or "..")
+ * @return pointer into the cursor's sector copy, or NULL at the end
+ */
+static fat12_dirent_t *fat12_dir_cursor_next(fat12_dir_state_t *dstate) {
+    fat12_dir_t *d = &dstate->dir;
+    fat12_fs_t *fs = d->fs;
+
+    while (!dstate->done) {
+        if (d->is_root) {
+            if (d->sector >= fs->root_start + fs->root_sectors) break;
+        } else {
+            uint32_t cluster_end = fat12_cluster_to_sector(fs, d->cluster) +
+                                   fs->bpb.sectors_per_cluster;
+            if (d->sector >= cluster_end) {
+                uint16_t next = fat12_read_fat(fs, d->cluster);
+                if (fat12_is_eof(next)) break;
+                d->cluster = next;
+                d->sector = fat12_cluster_to_sector(fs, next);
+            }
+        }
+
+        if (!dstate->buf_valid || dstate->buf_sector != d->sector) {
+            if (fs->read_sectors(d->sector, 1, dstate->buf) != 1) break;
+            dstate->buf_sector = d->sector;
+            dstate->buf_valid = true;
+        }
+
+        fat12_dirent_t *de = (fat12_dirent_t *)&dstate->buf[d->entry * 32];
+        if (++d->entry >= 16) {
+            d->entry = 0;
+            d->sector++;
+        }
+
+        if (de->name[0] == 0x00) break;     /* End marker */
+        if ((uint8_t)de->name[0] == FAT12_DELETED) continue;
+        if (de->attributes == FAT12_ATTR_LFN) continue;
+        if (de->name[0] == '.' &&
+            (de->name[1] == ' ' || (de->name[1] == '.' && de->name[2] == ' '))) {
+            continue;
+        }
+        return de;
+    }
+
+    dstate->done = true;
+    return NULL;
+}
+
+static void fat12_fill_dirent(const fat12_dirent_t *de, vfs_dirent_t *entry) {
+    fat12_name_to_string((fat12_dirent_t *)de, entry->name);
+    entry->inode = de->cluster_low;
+    entry->type = (de->attributes & FAT12_ATTR_DIRECTORY) ? VFS_DIRECTORY : VFS_FILE;
+    entry->size = de->file_size;
+    entry->attributes = de->attributes;
+    entry->cluster = de->cluster_low;
+    entry->mtime = ((uint32_t)de->modify_date << 16) | de->modify_time;
+}
+
 /**
  * Open directory
  */
@@ -396,16 +525,9 @@ static bool fat12_vfs_opendir(vfs_dir_t *dir) {
     fat12_dir_state_t *dstate = alloc_dir_state();
     if (!dstate) return false;
 
-    /* Open directory based on cluster */
-    if (dir->node.cluster == 0) {
-        fat12_open_root(&state->fs, &dstate->dir);
-    } else {
-        fat12_open_dir(&state->fs, &dstate->dir, dir->node.cluster);
-    }
-
+    fat12_dir_cursor_reset(dstate, &state->fs, dir);
     dstate->opened = true;
     dir->fs_data = dstate;
-    dir->position = 0;
 
     return true;
 }
@@ -428,28 +550,28 @@ static bool fat12_vfs_readdir(vfs_dir_t *dir, vfs_dirent_t *entry) {
     fat12_dir_state_t *dstate = (fat12_dir_state_t *)dir->fs_data;
     if (!dstate) return false;
 
-    fat12_dirent_t de;
+    fat12_dirent_t *de = fat12_dir_cursor_next(dstate);
+    if (!de) return false;
 
-    while (fat12_read_dir(&dstate->dir, &de)) {
-        /* Skip . and .. */
-        if (de.name[0] == '.') {
-            if (de.name[1] == ' ' ||
-                (de.name[1] == '.' && de.name[2] == ' ')) {
-                continue;
-            }
-        }
+    fat12_fill_dirent(de, entry);
+    dir->position++;
+    return true;
+}
 
-        /* Fill VFS dirent */
-        fat12_name_to_string(&de, entry->name);
-        entry->inode = de.cluster_low;
-        entry->type = (de.attributes & FAT12_ATTR_DIRECTORY) ? VFS_DIRECTORY : VFS_FILE;
-        entry->size = de.file_size;
+/**
+ * Read up to @max entries in one pass over the cursor
+ */
+static int fat12_vfs_getdents(vfs_dir_t *dir, vfs_dirent_t *entries, int max) {
+    fat12_dir_state_t *dstate = (fat12_dir_state_t *)dir->fs_data;
+    if (!dstate) return -1;
 
-        dir->position++;
-        return true;
+    int n = 0;
+    fat12_dirent_t *de;
+    while (n < max && (de = fat12_dir_cursor_next(dstate)) != NULL) {
+        fat12_fill_dirent(de, &entries[n++]);
     }
-
-    return false;
+    dir->position += n;
+    return n;
 }
 
 /**
@@ -461,15 +583,7 @@ static void fat12_vfs_rewinddir(vfs_dir_t *dir) {
     fat12_dir_state_t *dstate = (fat12_dir_state_t *)dir->fs_data;
 
     if (!state || !dstate) return;
-
-    /* Reopen directory */
-    if (dir->node.cluster == 0) {
-        fat12_open_root(&state->fs, &dstate->dir);
-    } else {
-        fat12_open_dir(&state->fs, &dstate->dir, dir->node.cluster);
-    }
-
-    dir->position = 0;
+    fat12_dir_cursor_reset(dstate, &state->fs, dir);
 }
 
 /**
@@ -535,11 +649,13 @@ static vfs_ops_t g_fat12_vfs_ops = {
     .write     = fat12_vfs_write,
     .seek      = fat12_vfs_seek,
     .truncate  = NULL,  /* TODO */
+    .readahead = fat12_vfs_readahead,
 
     /* Directory operations */
     .opendir   = fat12_vfs_opendir,
     .closedir  = fat12_vfs_closedir,
     .readdir   = fat12_vfs_readdir,
+    .getdents  = fat12_vfs_getdents,
     .rewinddir = fat12_vfs_rewinddir,
 
     /* Filesystem info */
@@ -321,13 +321,14 @@ static bool fat12_format(block_write_fn write_fn, block_read_fn read_fn,
  * ============================================================================ */
 
 /**
- * Allocate a free cluster
+ * Allocate a free cluster, preferring @hint
  *
  * @param fs    Mounted filesystem
+ * @param hint  Preferred cluster (0 for none)
  * @return      Cluster number, or 0 on failure
  */
-static uint16_t fat12_alloc_cluster(fat12_fs_t *fs) {
-    uint16_t cluster = fat12_find_free_cluster(fs);
+static uint16_t fat12_alloc_cluster_near(fat12_fs_t *fs, uint16_t hint) {
+    uint16_t cluster = fat12_find_free_cluster(fs, hint);
     if (cluster == 0) {
         return 0;  /* No free clusters */
     }
@@ -338,6 +339,16 @@ static uint16_t fat12_alloc_cluster(fat12_fs_t *fs) {
     return cluster;
 }
 
+/**
+ * Allocate a free cluster for a new chain
+ *
+ * @param fs    Mounted filesystem
+ * @return      Cluster number, or 0 on failure
+ */
+static uint16_t fat12_alloc_cluster(fat12_fs_t *fs) {
+    return fat12_alloc_cluster_near(fs, 0);
+}
+
 /**
  * Extend a cluster chain
  *
@@ -346,7 +357,7 @@ static uint16_t fat12_alloc_cluster(fat12_fs_t *fs) {
  * @return        New cluster number, or 0 on failure
  */
 static uint16_t fat12_extend_chain(fat12_fs_t *fs, uint16_t last) {
-    uint16_t new_cluster = fat12_alloc_cluster(fs);
+    uint16_t new_cluster = fat12_alloc_cluster_near(fs, last + 1);
     if (new_cluster == 0) {
         return 0;
     }
@@ -606,9 +617,40 @@ static bool fat12_mkdir(fat12_fs_t *fs, const char *path) {
  * File Writing
  * ============================================================================ */
 
+/**
+ * Extend a contiguous run for a write: count sectors available from the
+ * current position, allocating clusters at the end of the chain as long
+ * as the new cluster directly follows the previous one.
+ */
+static uint32_t fat12_write_run_sectors(fat12_file_t *file, uint32_t want) {
+    fat12_fs_t *fs = file->fs;
+    uint32_t spc = fs->bpb.sectors_per_cluster;
+    uint32_t avail = spc - file->cluster_offset / FAT12_SECTOR_SIZE;
+    uint16_t c = file->cluster;
+
+    while (avail < want && avail < FAT12_MAX_RUN) {
+        uint16_t next = fat12_read_fat(fs, c);
+        if (fat12_is_eof(next)) {
+            next = fat12_extend_chain(fs, c);
+            if (next == 0) break;
+        }
+        if (next != c + 1) break;  /* Linked; picked up by the next pass */
+        c = next;
+        avail += spc;
+    }
+
+    if (avail > want) avail = want;
+    if (avail > FAT12_MAX_RUN) avail = FAT12_MAX_RUN;
+    return avail;
+}
+
 /**
  * Write data to an open file (overwrites from current position)
  *
+ * Fully covered sectors are written straight from the caller's buffer,
+ * one command per contiguous extent. Partial sectors are read first
+ * only if they hold file data that must be preserved.
+ *
  * @param file  Open file handle
  * @param buf   Data to write
  * @param size  Bytes to write
@@ -652,29 +694,44 @@ static uint32_t fat12_write(fat12_file_t *file, const void *buf, uint32_t size)
         uint32_t sector = fat12_cluster_to_sector(fs, file->cluster) +
                           (file->cluster_offset / FAT12_SECTOR_SIZE);
         uint32_t offset = file->cluster_offset % FAT12_SECTOR_SIZE;
+        uint32_t to_write;
 
-        /* Read sector if partial write */
         if (offset != 0 || size < FAT12_SECTOR_SIZE) {
-            fs->read_sectors(sector, 1, fs->sector_buf);
-        }
+            to_write = FAT12_SECTOR_SIZE - offset;
+            if (to_write > size) to_write = size;
+
+            /* Read-modify-write only if the sector holds data we keep */
+            if (offset != 0 || file->position + to_write < file->dirent.file_size) {
+                if (fs->read_sectors(sector, 1, fs->sector_buf) != 1) break;
+            } else {
+                for (uint32_t i = to_write; i < FAT12_SECTOR_SIZE; i++) {
+                    fs->sector_buf[i] = 0;
+                }
+            }
 
-        /* Copy data */
-        uint32_t to_write = FAT12_SECTOR_SIZE - offset;
-        if (to_write > size) to_write = size;
+            for (uint32_t i = 0; i < to_write; i++) {
+                fs->sector_buf[offset + i] = in[bytes_written + i];
+            }
 
-        for (uint32_t i = 0; i < to_write; i++) {
-            fs->sector_buf[offset + i] = in[bytes_written + i];
-        }
+            if (fs->write_sectors(sector, 1, fs->sector_buf) != 1) {
+                break;
+            }
+
+            file->position += to_write;
+            file->cluster_offset += to_write;
+        } else {
+            /* Fully covered sectors: no read, no copy */
+            uint32_t count = fat12_write_run_sectors(file, size / FAT12_SECTOR_SIZE);
+            if (fs->write_sectors(sector, count, in + bytes_written) != count) {
+                break;
+            }
 
-        /* Write sector */
-        if (fs->write_sectors(sector, 1, fs->sector_buf) != 1) {
-            break;
+            to_write = count * FAT12_SECTOR_SIZE;
+            fat12_advance_run(file, to_write);
         }
 
         bytes_written += to_write;
         size -= to_write;
-        file->position += to_write;
-        file->cluster_offset += to_write;
 
         /* Update file size */
         if (file->position > file->dirent.file_size) {
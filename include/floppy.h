@@ -4,8 +4,12 @@
  * Driver for the Intel 82077AA compatible floppy disk controller.
  * Supports 1.44MB 3.5" floppy disks.
  * 
- * This is a simple polling-mode driver. For better performance,
- * interrupt-driven DMA transfers would be used.
+ * This is a simple polling-mode driver. Reads go through a two-slot
+ * cylinder buffer: a miss reads the whole cylinder (both heads) in one
+ * multi-track command. A reader that moves on to the next cylinder starts
+ * a kernel thread that loads the one after it, so a sequential reader
+ * overlaps its own work with the next cylinder read. The motor is left
+ * running and switched off after an idle period.
  */
 
 #ifndef FLOPPY_H
@@ -15,6 +19,9 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "idt.h"
+#include "tsc.h"
+#include "timer.h"
+#include "sched.h"
 
 /* ============================================================================
  * FDC Port Definitions
@@ -84,10 +91,13 @@
 #define FD_SECTORS_PER_TRACK    18
 #define FD_HEADS                2
 #define FD_TRACKS               80
+#define FD_SECTORS_PER_CYL      (FD_SECTORS_PER_TRACK * FD_HEADS)  // 36
 #define FD_SECTOR_SIZE          512
 #define FD_TOTAL_SECTORS        (FD_SECTORS_PER_TRACK * FD_HEADS * FD_TRACKS)  // 2880
 #define FD_TOTAL_SIZE           (FD_TOTAL_SECTORS * FD_SECTOR_SIZE)  // 1474560
 
+#define FD_CYL_BYTES            (FD_SECTORS_PER_CYL * FD_SECTOR_SIZE)  // 18432
+
 /* Gap lengths for 1.44MB */
 #define FD_GAP3_RW              0x1B    // Gap length for read/write
 #define FD_GAP3_FORMAT          0x54    // Gap length for format
@@ -96,52 +106,85 @@
  * Driver State
  * ============================================================================ */
 
+#define FD_TRACK_SLOTS      2       // Cylinder buffers (current + next)
+#define FD_MOTOR_IDLE_MS    3000    // Motor off after this long without I/O
+#define FD_MOTOR_SPINUP_MS  300
+#define FD_FIFO_TIMEOUT_MS  100     // RQM/DIO handshake on the FIFO
+#define FD_RESET_DELAY_US   100
+
+typedef struct {
+    bool        valid;
+    uint8_t     cylinder;
+    uint32_t    last_use;           // LRU stamp
+} fd_track_t;
+
 typedef struct {
     bool        initialized;
     bool        motor_on;
     uint8_t     current_track;
     volatile bool irq_received;
+    ktimer_t    motor_timer;        // Stops the motor FD_MOTOR_IDLE_MS after the last I/O
+
+    kmutex_t    lock;               // Held across a command (it yields in fdc_wait_irq)
+
+    /* Track buffer */
+    fd_track_t  tracks[FD_TRACK_SLOTS];
+    uint32_t    track_clock;
+    uint32_t    track_gen;          // Bumped when every cylinder is dropped (media change)
+    uint32_t    track_hits;         // Sectors served from a cylinder buffer
+    uint32_t    track_misses;       // Cylinder reads
+
+    /* Next-cylinder prefetch */
+    uint8_t     last_cylinder;      // Cylinder of the last read
+    bool        prefetch_live;      // A prefetch thread exists
+    uint32_t    prefetches;         // Cylinders loaded ahead of the reader
 } floppy_state_t;
 
 static floppy_state_t g_floppy = {0};
 
-/* DMA buffer (must be below 16MB and not cross 64KB boundary) */
+/*
+ * DMA area (must be below 16MB and not cross a 64KB boundary): the
+ * cylinder buffers followed by a write bounce buffer, 0x80000-0x8D7FF.
+ */
 #define FD_DMA_BUFFER   0x80000     // 512KB mark - safe location
-static uint8_t *const fd_dma_buffer = (uint8_t *)FD_DMA_BUFFER;
+#define FD_TRACK_BUFFER(slot)   (FD_DMA_BUFFER + (slot) * FD_CYL_BYTES)
+#define FD_WRITE_BUFFER         FD_TRACK_BUFFER(FD_TRACK_SLOTS)
 
 /* ============================================================================
  * Low-Level I/O
  * ============================================================================ */
 
 /* Wait for FDC to be ready for command/data */
-static bool fdc_wait_ready(uint32_t timeout) {
-    while (timeout--) {
+static bool fdc_wait_ready(uint32_t timeout_ms) {
+    uint64_t deadline = tsc_deadline(timeout_ms);
+    do {
         if (inb(FDC_MSR) & MSR_RQM) return true;
-        for (volatile int i = 0; i < 100; i++);
-    }
+        __asm__ volatile ("pause");
+    } while (!tsc_expired(deadline));
     return false;
 }
 
 /* Wait for data to be available */
-static bool fdc_wait_data(uint32_t timeout) {
-    while (timeout--) {
+static bool fdc_wait_data(uint32_t timeout_ms) {
+    uint64_t deadline = tsc_deadline(timeout_ms);
+    do {
         uint8_t msr = inb(FDC_MSR);
         if ((msr & (MSR_RQM | MSR_DIO)) == (MSR_RQM | MSR_DIO)) return true;
-        for (volatile int i = 0; i < 100; i++);
-    }
+        __asm__ volatile ("pause");
+    } while (!tsc_expired(deadline));
     return false;
 }
 
 /* Send byte to FDC FIFO */
 static bool fdc_send_byte(uint8_t byte) {
-    if (!fdc_wait_ready(10000)) return false;
+    if (!fdc_wait_ready(FD_FIFO_TIMEOUT_MS)) return false;
     outb(FDC_FIFO, byte);
     return true;
 }
 
 /* Read byte from FDC FIFO */
 static bool fdc_read_byte(uint8_t *byte) {
-    if (!fdc_wait_data(10000)) return false;
+    if (!fdc_wait_data(FD_FIFO_TIMEOUT_MS)) return false;
     *byte = inb(FDC_FIFO);
     return true;
 }
@@ -170,17 +213,9 @@ static void fdc_irq_handler(int_frame_t *frame) {
     g_floppy.irq_received = true;
 }
 
-/* Wait for IRQ with timeout */
+/* Wait for IRQ with timeout (the flag is cleared before each command) */
 static bool fdc_wait_irq(uint32_t timeout_ms) {
-    g_floppy.irq_received = false;
-    
-    // Timeout in ~ms
-    uint32_t timeout = timeout_ms * 1000;
-    while (!g_floppy.irq_received && timeout--) {
-        for (volatile int i = 0; i < 100; i++);
-    }
-    
-    return g_floppy.irq_received;
+    return timer_wait_flag(&g_floppy.irq_received, timeout_ms);
 }
 
 /* ============================================================================
@@ -232,21 +267,30 @@ static void dma_setup(bool write, uint32_t addr, uint16_t count) {
  * Motor Control
  * ============================================================================ */
 
+/* Start the motor if needed and push back the idle switch-off */
 static void fdc_motor_on(void) {
     if (!g_floppy.motor_on) {
         outb(FDC_DOR, DOR_DRIVE0 | DOR_RESET | DOR_IRQ_DMA | DOR_MOTOR0);
         g_floppy.motor_on = true;
-        
-        // Wait for motor to spin up (~300ms)
-        for (volatile int i = 0; i < 300000; i++);
+
+        // Wait for motor to spin up
+        timer_sleep_ms(FD_MOTOR_SPINUP_MS);
     }
+    timer_start(&g_floppy.motor_timer, FD_MOTOR_IDLE_MS, 0);
 }
 
 static void fdc_motor_off(void) {
+    timer_cancel(&g_floppy.motor_timer);
     outb(FDC_DOR, DOR_DRIVE0 | DOR_RESET | DOR_IRQ_DMA);
     g_floppy.motor_on = false;
 }
 
+/* Timer callback (IRQ0): FD_MOTOR_IDLE_MS have passed without I/O */
+static void fdc_motor_timeout(void *arg) {
+    (void)arg;
+    if (g_floppy.motor_on) fdc_motor_off();
+}
+
 /* ============================================================================
  * FDC Operations
  * ============================================================================ */
@@ -255,9 +299,10 @@ static void fdc_motor_off(void) {
 static bool fdc_reset(void) {
     // Disable controller
     outb(FDC_DOR, 0x00);
-    for (volatile int i = 0; i < 10000; i++);
+    tsc_delay_us(FD_RESET_DELAY_US);
     
     // Enable controller
+    g_floppy.irq_received = false;
     outb(FDC_DOR, DOR_RESET | DOR_IRQ_DMA);
     
     // Wait for interrupt
@@ -283,6 +328,7 @@ static bool fdc_recalibrate(void) {
     fdc_motor_on();
     
     uint8_t cmd[] = {CMD_RECALIBRATE, 0x00};  // Drive 0
+    g_floppy.irq_received = false;
     if (!fdc_command(cmd, 2, NULL, 0)) return false;
     
     // Wait for seek to complete
@@ -304,6 +350,7 @@ static bool fdc_seek(uint8_t track) {
     fdc_motor_on();
     
     uint8_t cmd[] = {CMD_SEEK, 0x00, track};  // Drive 0, head 0, track
+    g_floppy.irq_received = false;
     if (!fdc_command(cmd, 3, NULL, 0)) return false;
     
     // Wait for seek to complete
@@ -328,29 +375,27 @@ static void lba_to_chs(uint32_t lba, uint8_t *track, uint8_t *head, uint8_t *sec
 }
 
 /* ============================================================================
- * Read/Write Sectors
+ * Data Transfer
  * ============================================================================ */
 
 /**
- * Read sectors from floppy
+ * Seek and run one multi-track READ DATA / WRITE DATA command
+ * between the disk and the DMA area at @dma_addr
  */
-static uint32_t fdc_read_sectors(uint32_t lba, uint8_t count, void *buf) {
-    if (lba + count > FD_TOTAL_SECTORS) return 0;
-    
+static bool fdc_transfer(bool write, uint32_t lba, uint32_t count, uint32_t dma_addr) {
     uint8_t track, head, sector;
     lba_to_chs(lba, &track, &head, &sector);
-    
+
     // Seek to track
-    if (!fdc_seek(track)) return 0;
-    
-    // Set up DMA for read
-    uint32_t dma_addr = FD_DMA_BUFFER;
-    uint16_t dma_len = count * FD_SECTOR_SIZE;
-    dma_setup(false, dma_addr, dma_len);
-    
-    // Send read command
+    if (!fdc_seek(track)) return false;
+    fdc_motor_on();
+
+    // Set up DMA
+    dma_setup(write, dma_addr, (uint16_t)(count * FD_SECTOR_SIZE));
+
+    // Send command
     uint8_t cmd[] = {
-        CMD_READ_DATA | CMD_MFM | CMD_MT,
+        (write ? CMD_WRITE_DATA : CMD_READ_DATA) | CMD_MFM | CMD_MT,
         (head << 2) | 0,                    // Head, drive
         track,
         head,
@@ -360,89 +405,199 @@ static uint32_t fdc_read_sectors(uint32_t lba, uint8_t count, void *buf) {
         FD_GAP3_RW,
         0xFF                                // Data length (ignored for sector size != 0)
     };
-    
-    if (!fdc_command(cmd, 9, NULL, 0)) return 0;
-    
+
+    g_floppy.irq_received = false;
+    if (!fdc_command(cmd, 9, NULL, 0)) return false;
+
     // Wait for completion
-    if (!fdc_wait_irq(2000)) return 0;
-    
+    if (!fdc_wait_irq(2000)) return false;
+
     // Read result
     uint8_t result[7];
     for (int i = 0; i < 7; i++) {
-        if (!fdc_read_byte(&result[i])) return 0;
+        if (!fdc_read_byte(&result[i])) return false;
     }
-    
+
     // Check for errors
-    if ((result[0] & 0xC0) != 0) return 0;
-    
-    // Copy from DMA buffer
-    uint8_t *src = fd_dma_buffer;
-    uint8_t *dst = (uint8_t *)buf;
-    for (uint32_t i = 0; i < dma_len; i++) {
-        dst[i] = src[i];
+    return (result[0] & 0xC0) == 0;
+}
+
+static inline void fdc_copy(void *dst, const void *src, uint32_t bytes) {
+    uint32_t *d = (uint32_t *)dst;
+    const uint32_t *s = (const uint32_t *)src;
+    for (uint32_t i = 0; i < bytes / 4; i++) d[i] = s[i];
+}
+
+/* ============================================================================
+ * Track Buffer
+ * ============================================================================ */
+
+static int fdc_track_find(uint8_t cylinder) {
+    for (int i = 0; i < FD_TRACK_SLOTS; i++) {
+        if (g_floppy.tracks[i].valid && g_floppy.tracks[i].cylinder == cylinder) return i;
     }
-    
-    return count;
+    return -1;
 }
 
 /**
- * Write sectors to floppy
+ * Read a whole cylinder into the least recently used slot
+ * @return slot, or -1 on error
  */
-static uint32_t fdc_write_sectors(uint32_t lba, uint8_t count, const void *buf) {
-    if (lba + count > FD_TOTAL_SECTORS) return 0;
-    
-    uint8_t track, head, sector;
-    lba_to_chs(lba, &track, &head, &sector);
-    
-    // Seek to track
-    if (!fdc_seek(track)) return 0;
-    
-    // Copy to DMA buffer
-    uint32_t dma_len = count * FD_SECTOR_SIZE;
-    const uint8_t *src = (const uint8_t *)buf;
-    uint8_t *dst = fd_dma_buffer;
-    for (uint32_t i = 0; i < dma_len; i++) {
-        dst[i] = src[i];
+static int fdc_track_load(uint8_t cylinder) {
+    int slot = 0;
+    for (int i = 1; i < FD_TRACK_SLOTS; i++) {
+        fd_track_t *t = &g_floppy.tracks[i];
+        if (!t->valid || (g_floppy.tracks[slot].valid && t->last_use < g_floppy.tracks[slot].last_use)) {
+            slot = i;
+        }
     }
-    
-    // Set up DMA for write
-    dma_setup(true, FD_DMA_BUFFER, dma_len);
-    
-    // Send write command
-    uint8_t cmd[] = {
-        CMD_WRITE_DATA | CMD_MFM | CMD_MT,
-        (head << 2) | 0,
-        track,
-        head,
-        sector,
-        2,
-        FD_SECTORS_PER_TRACK,
-        FD_GAP3_RW,
-        0xFF
-    };
-    
-    if (!fdc_command(cmd, 9, NULL, 0)) return 0;
-    
-    // Wait for completion
-    if (!fdc_wait_irq(2000)) return 0;
-    
-    // Read result
-    uint8_t result[7];
-    for (int i = 0; i < 7; i++) {
-        if (!fdc_read_byte(&result[i])) return 0;
+
+    fd_track_t *t = &g_floppy.tracks[slot];
+    t->valid = false;
+    if (!fdc_transfer(false, (uint32_t)cylinder * FD_SECTORS_PER_CYL, FD_SECTORS_PER_CYL,
+                      FD_TRACK_BUFFER(slot))) {
+        return -1;
     }
-    
-    // Check for errors
-    if ((result[0] & 0xC0) != 0) return 0;
-    
+
+    t->valid = true;
+    t->cylinder = cylinder;
+    t->last_use = ++g_floppy.track_clock;
+    g_floppy.track_misses++;
+    return slot;
+}
+
+/* Drop cylinders overlapping [lba, lba+count) */
+static void fdc_track_invalidate(uint32_t lba, uint32_t count) {
+    uint32_t first = lba / FD_SECTORS_PER_CYL;
+    uint32_t last = (lba + count - 1) / FD_SECTORS_PER_CYL;
+    for (int i = 0; i < FD_TRACK_SLOTS; i++) {
+        fd_track_t *t = &g_floppy.tracks[i];
+        if (t->valid && t->cylinder >= first && t->cylinder <= last) t->valid = false;
+    }
+}
+
+/* Forget every buffered cylinder (media change) */
+static void fdc_track_invalidate_all(void) {
+    kmutex_lock(&g_floppy.lock);
+    for (int i = 0; i < FD_TRACK_SLOTS; i++) {
+        g_floppy.tracks[i].valid = false;
+    }
+    g_floppy.track_gen++;
+    kmutex_unlock(&g_floppy.lock);
+}
+
+/* ============================================================================
+ * Prefetch
+ * ============================================================================ */
+
+typedef struct {
+    uint8_t     cylinder;
+    uint32_t    gen;                // track_gen when the prefetch was started
+} fd_prefetch_t;
+
+static fd_prefetch_t g_fd_prefetch;
+
+/* Prefetch thread: load one cylinder unless the disk changed meanwhile */
+static void fdc_prefetch_main(void *arg) {
+    fd_prefetch_t *p = (fd_prefetch_t *)arg;
+
+    kmutex_lock(&g_floppy.lock);
+    if (p->gen == g_floppy.track_gen && fdc_track_find(p->cylinder) < 0 &&
+        fdc_track_load(p->cylinder) >= 0) {
+        g_floppy.prefetches++;
+    }
+    kmutex_unlock(&g_floppy.lock);
+    g_floppy.prefetch_live = false;
+}
+
+/**
+ * Called with the lock held on a read of @cylinder: if the reader came
+ * from the previous cylinder, start loading the next one. The thread
+ * first runs at the reader's next yield, so the current read returns
+ * without waiting for it.
+ */
+static void fdc_prefetch_next(uint8_t cylinder) {
+    bool sequential = cylinder == (uint8_t)(g_floppy.last_cylinder + 1);
+    g_floppy.last_cylinder = cylinder;
+
+    if (!sequential || g_floppy.prefetch_live || cylinder + 1 >= FD_TRACKS) return;
+    if (fdc_track_find(cylinder + 1) >= 0) return;
+
+    g_fd_prefetch.cylinder = cylinder + 1;
+    g_fd_prefetch.gen = g_floppy.track_gen;
+    if (kthread_create("fdprefetch", fdc_prefetch_main, &g_fd_prefetch, 0)) {
+        g_floppy.prefetch_live = true;
+    }
+}
+
+/* ============================================================================
+ * Read/Write Sectors
+ * ============================================================================ */
+
+/**
+ * Read sectors from floppy (at most one cylinder per call)
+ *
+ * Served from the cylinder buffer; a miss reads the whole cylinder, and
+ * a read that follows on from the previous cylinder prefetches the next
+ * one in the background (fdc_prefetch_next). A read of the cylinder
+ * being prefetched waits for the lock and then hits. If the cylinder
+ * cannot be read as a whole (bad sector elsewhere on it), the requested
+ * sectors are read on their own.
+ */
+static uint32_t fdc_read_sectors(uint32_t lba, uint8_t count, void *buf) {
+    if (count == 0 || lba + count > FD_TOTAL_SECTORS) return 0;
+
+    uint8_t cylinder = lba / FD_SECTORS_PER_CYL;
+    uint32_t first = lba % FD_SECTORS_PER_CYL;
+    if (first + count > FD_SECTORS_PER_CYL) return 0;
+
+    kmutex_lock(&g_floppy.lock);
+    int slot = fdc_track_find(cylinder);
+    if (slot < 0) slot = fdc_track_load(cylinder);
+
+    if (slot < 0) {
+        bool ok = fdc_transfer(false, lba, count, FD_WRITE_BUFFER);
+        if (ok) fdc_copy(buf, (const void *)FD_WRITE_BUFFER, count * FD_SECTOR_SIZE);
+        kmutex_unlock(&g_floppy.lock);
+        return ok ? count : 0;
+    }
+
+    g_floppy.tracks[slot].last_use = ++g_floppy.track_clock;
+    g_floppy.track_hits += count;
+    fdc_copy(buf, (const uint8_t *)FD_TRACK_BUFFER(slot) + first * FD_SECTOR_SIZE,
+             count * FD_SECTOR_SIZE);
+    fdc_prefetch_next(cylinder);
+    kmutex_unlock(&g_floppy.lock);
     return count;
 }
 
+/**
+ * Write sectors to floppy (at most one cylinder per call)
+ */
+static uint32_t fdc_write_sectors(uint32_t lba, uint8_t count, const void *buf) {
+    if (count == 0 || lba + count > FD_TOTAL_SECTORS) return 0;
+    if (lba % FD_SECTORS_PER_CYL + count > FD_SECTORS_PER_CYL) return 0;
+
+    kmutex_lock(&g_floppy.lock);
+    fdc_track_invalidate(lba, count);
+
+    // Copy to DMA buffer
+    fdc_copy((void *)FD_WRITE_BUFFER, buf, count * FD_SECTOR_SIZE);
+
+    bool ok = fdc_transfer(true, lba, count, FD_WRITE_BUFFER);
+    kmutex_unlock(&g_floppy.lock);
+    return ok ? count : 0;
+}
+
 /* ============================================================================
  * Initialization
  * ============================================================================ */
 
 static bool floppy_init(void) {
+    if (!g_floppy.motor_timer.fn) {
+        timer_setup(&g_floppy.motor_timer, fdc_motor_timeout, NULL);
+    }
+
     // Register IRQ handler
     irq_register(IRQ_FLOPPY, fdc_irq_handler);
     pic_enable_irq(IRQ_FLOPPY);
@@ -64,7 +64,7 @@ static bool floppy_ensure_init(void) {
 /**
  * Read sectors from floppy
  */
-static uint32_t floppy_blkdev_read(blkdev_t *dev, uint32_t lba, uint8_t count, void *buf) {
+static uint32_t floppy_blkdev_read(blkdev_t *dev, uint32_t lba, uint32_t count, void *buf) {
     (void)dev;
 
     /* Lazy init */
@@ -72,13 +72,22 @@ static uint32_t floppy_blkdev_read(blkdev_t *dev, uint32_t lba, uint8_t count, v
         return 0;
     }
 
-    return fdc_read_sectors(lba, count, buf);
+    /* A multi-track transfer ends at the last sector of the cylinder */
+    uint8_t *dst = (uint8_t *)buf;
+    uint32_t done = 0;
+    while (done < count) {
+        uint32_t left = FD_SECTORS_PER_CYL - (lba + done) % FD_SECTORS_PER_CYL;
+        uint8_t n = (count - done < left) ? (uint8_t)(count - done) : (uint8_t)left;
+        if (fdc_read_sectors(lba + done, n, dst + done * FD_SECTOR_SIZE) != n) break;
+        done += n;
+    }
+    return done;
 }
 
 /**
  * Write sectors to floppy
  */
-static uint32_t floppy_blkdev_write(blkdev_t *dev, uint32_t lba, uint8_t count, const void *buf) {
+static uint32_t floppy_blkdev_write(blkdev_t *dev, uint32_t lba, uint32_t count, const void *buf) {
     (void)dev;
 
     /* Lazy init */
@@ -86,22 +95,32 @@ static uint32_t floppy_blkdev_write(blkdev_t *dev, uint32_t lba, uint8_t count,
         return 0;
     }
 
-    return fdc_write_sectors(lba, count, buf);
+    const uint8_t *src = (const uint8_t *)buf;
+    uint32_t done = 0;
+    while (done < count) {
+        uint32_t left = FD_SECTORS_PER_CYL - (lba + done) % FD_SECTORS_PER_CYL;
+        uint8_t n = (count - done < left) ? (uint8_t)(count - done) : (uint8_t)left;
+        if (fdc_write_sectors(lba + done, n, src + done * FD_SECTOR_SIZE) != n) break;
+        done += n;
+    }
+    return done;
 }
 
 /**
- * Sync (flush) - floppy has no cache, so this is a no-op
+ * Sync (flush) - write back dirty sectors from the buffer cache
  */
 static bool floppy_blkdev_sync(blkdev_t *dev) {
-    (void)dev;
-    return true;
+    return bcache_flush(dev);
 }
 
 /**
  * Eject floppy (turn off motor)
  */
 static bool floppy_blkdev_eject(blkdev_t *dev) {
-    (void)dev;
+    /* The next disk may be different: write back and forget cached sectors */
+    bcache_flush(dev);
+    bcache_invalidate(dev);
+    fdc_track_invalidate_all();
 
     /* Only turn off motor if we actually initialized */
     if (g_floppy_hw_initialized) {
@@ -154,12 +173,16 @@ static bool floppy_blkdev_init(blkdev_t *dev) {
     dev->present = true;
     dev->removable = true;
     dev->readonly = false;
+    dev->cached = true;
 
     /* Operations */
     dev->read = floppy_blkdev_read;
     dev->write = floppy_blkdev_write;
     dev->sync = floppy_blkdev_sync;
     dev->eject = floppy_blkdev_eject;
+    dev->start = NULL;    /* fdc_* wait for IRQ6 themselves */
+    dev->poll = NULL;
+    dev->queue = NULL;
 
     dev->driver_data = NULL;
 
@@ -190,6 +213,11 @@ static bool floppy_blkdev_check_media(blkdev_t *dev) {
         return false;
     }
 
+    /* Media may have been swapped since the cache was filled */
+    bcache_flush(dev);
+    bcache_invalidate(dev);
+    fdc_track_invalidate_all();
+
     uint8_t buf[512];
     return fdc_read_sectors(0, 1, buf) == 1;
 }
@@ -0,0 +1,423 @@
+/**
+ * heap.h - Kernel Heap (Buddy Page Allocator + Slab Caches)
+ *
+ * Physical pages above HEAP_BASE are managed by a binary buddy allocator
+ * seeded from the E820 free regions. Small allocations (up to 2048 bytes)
+ * come from per-size-class slabs carved out of buddy blocks; anything
+ * larger is rounded up to a power-of-two run of pages. kmalloc/kfree back
+ * kernel_api.malloc and the chunk allocator of intrusive_list_pool.h.
+ *
+ * Fixed areas below HEAP_BASE are never handed out:
+ *   0x080000  Floppy DMA / track buffers
+ *   0x100000  Kernel image
+ *   0x200000  Loaded program (image, BSS, arena)
+ *   0x400000  RAM disk data (1MB)
+ */
+
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "intrusive_list_fast.h"
+
+static void *kmalloc(size_t size);
+static void  kfree(void *ptr);
+
+/* Let ilist pools grow from the heap once their static storage is used */
+#ifndef ILIST_POOL_MALLOC
+#define ILIST_POOL_MALLOC(size) kmalloc(size)
+#endif
+#ifndef ILIST_POOL_FREE
+#define ILIST_POOL_FREE(ptr)    kfree(ptr)
+#endif
+
+/* ============================================================================
+ * Page Allocator
+ * ============================================================================ */
+
+#define HEAP_BASE           0x500000    /* Above the RAM disk */
+#define PAGE_SIZE           4096
+#define PAGE_SHIFT          12
+#define PAGE_MAX_ORDER      10          /* Largest block: 4MB */
+
+#define PAGE_FREE           0x01        /* Head of a free block */
+#define PAGE_ALLOC          0x02        /* Head of a kmalloc'd page run */
+#define PAGE_SLAB           0x04        /* Part of a slab (cls is valid) */
+
+typedef struct page_info {
+    uint8_t flags;
+    uint8_t order;
+    uint8_t cls;            /* Slab size class */
+    uint8_t reserved;
+} page_info_t;
+
+typedef struct page_allocator {
+    uint32_t      base;                 /* Address of page 0 */
+    uint32_t      count;                /* Pages covered by info[] */
+    page_info_t  *info;                 /* Per-page state (at HEAP_BASE) */
+    ilist_head_t  free[PAGE_MAX_ORDER + 1];
+    uint32_t      total_pages;          /* Pages handed to the allocator */
+    uint32_t      free_pages;
+    bool          initialized;
+} page_allocator_t;
+
+static page_allocator_t g_pages;
+
+static inline ilist_node_t *page_node(uint32_t idx) {
+    return (ilist_node_t *)(uintptr_t)(g_pages.base + (idx << PAGE_SHIFT));
+}
+
+static inline uint32_t page_index(const void *addr) {
+    return ((uint32_t)(uintptr_t)addr - g_pages.base) >> PAGE_SHIFT;
+}
+
+static inline bool page_owns(const void *addr) {
+    uint32_t a = (uint32_t)(uintptr_t)addr;
+    return g_pages.initialized && a >= g_pages.base &&
+           ((a - g_pages.base) >> PAGE_SHIFT) < g_pages.count;
+}
+
+/**
+ * Set up an empty allocator covering [start, end)
+ *
+ * The page_info array is placed at @start; memory is only handed out
+ * once page_add_range() has been called for it.
+ */
+static bool page_init(uint32_t start, uint32_t end) {
+    start = (start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    end &= ~(PAGE_SIZE - 1);
+    if (end <= start) return false;
+
+    uint32_t pages = (end - start) >> PAGE_SHIFT;
+    uint32_t info_bytes = pages * sizeof(page_info_t);
+    uint32_t base = (start + info_bytes + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (base >= end) return false;
+
+    g_pages.info = (page_info_t *)(uintptr_t)start;
+    g_pages.base = base;
+    g_pages.count = (end - base) >> PAGE_SHIFT;
+    for (uint32_t i = 0; i < g_pages.count; i++) {
+        g_pages.info[i].flags = 0;
+        g_pages.info[i].order = 0;
+        g_pages.info[i].cls = 0;
+        g_pages.info[i].reserved = 0;
+    }
+    for (int o = 0; o <= PAGE_MAX_ORDER; o++) {
+        ilist_init_head(&g_pages.free[o]);
+    }
+    g_pages.total_pages = 0;
+    g_pages.free_pages = 0;
+    g_pages.initialized = true;
+    return true;
+}
+
+/* Free a 2^order block at page @idx, merging with free buddies */
+static void page_free_block(uint32_t idx, uint32_t order) {
+    g_pages.free_pages += 1u << order;
+
+    while (order < PAGE_MAX_ORDER) {
+        uint32_t buddy = idx ^ (1u << order);
+        if (buddy + (1u << order) > g_pages.count) break;
+
+        page_info_t *b = &g_pages.info[buddy];
+        if (!(b->flags & PAGE_FREE) || b->order != order) break;
+
+        ilist_remove(page_node(buddy));
+        b->flags = 0;
+        idx &= ~(1u << order);
+        order++;
+    }
+
+    g_pages.info[idx].flags = PAGE_FREE;
+    g_pages.info[idx].order = (uint8_t)order;
+    ilist_push_front(&g_pages.free[order], page_node(idx));
+}
+
+/**
+ * Hand the usable memory [addr, addr + len) to the allocator
+ * (clipped to the range given to page_init)
+ */
+static void page_add_range(uint64_t addr, uint64_t len) {
+    if (!g_pages.initialized) return;
+
+    uint64_t lo = (addr + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t hi = (addr + len) & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t top = g_pages.base + ((uint64_t)g_pages.count << PAGE_SHIFT);
+    if (lo < g_pages.base) lo = g_pages.base;
+    if (hi > top) hi = top;
+    if (hi <= lo) return;
+
+    uint32_t idx = (uint32_t)(lo - g_pages.base) >> PAGE_SHIFT;
+    uint32_t end = (uint32_t)(hi - g_pages.base) >> PAGE_SHIFT;
+
+    /* Largest naturally aligned blocks that fit */
+    while (idx < end) {
+        uint32_t order = 0;
+        while (order < PAGE_MAX_ORDER && !(idx & (1u << order)) &&
+               idx + (2u << order) <= end) {
+            order++;
+        }
+        g_pages.total_pages += 1u << order;
+        page_free_block(idx, order);
+        idx += 1u << order;
+    }
+}
+
+/**
+ * Allocate 2^@order contiguous pages
+ * @return page-aligned address, or NULL
+ */
+static void *page_alloc(uint32_t order) {
+    if (!g_pages.initialized || order > PAGE_MAX_ORDER) return NULL;
+
+    uint32_t o = order;
+    while (o <= PAGE_MAX_ORDER && ilist_is_empty(&g_pages.free[o])) o++;
+    if (o > PAGE_MAX_ORDER) return NULL;
+
+    ilist_node_t *node = g_pages.free[o].node.next;
+    ilist_remove(node);
+    uint32_t idx = page_index(node);
+
+    /* Split, returning the upper halves to the free lists */
+    while (o > order) {
+        o--;
+        uint32_t buddy = idx + (1u << o);
+        g_pages.info[buddy].flags = PAGE_FREE;
+        g_pages.info[buddy].order = (uint8_t)o;
+        ilist_push_front(&g_pages.free[o], page_node(buddy));
+    }
+
+    g_pages.info[idx].flags = 0;
+    g_pages.info[idx].order = (uint8_t)order;
+    g_pages.free_pages -= 1u << order;
+    return (void *)page_node(idx);
+}
+
+/**
+ * Return a block from page_alloc(@order)
+ */
+static void page_free(void *addr, uint32_t order) {
+    if (!page_owns(addr)) return;
+    page_free_block(page_index(addr), order);
+}
+
+/* Smallest order whose block holds @bytes */
+static inline uint32_t page_order_for(size_t bytes) {
+    uint32_t order = 0;
+    while (order <= PAGE_MAX_ORDER && ((size_t)PAGE_SIZE << order) < bytes) order++;
+    return order;
+}
+
+/* ============================================================================
+ * Slab Allocator
+ *
+ * Each size class owns slabs (one buddy block each) with a header at the
+ * start and equal objects after it. Slabs with free objects sit on the
+ * class's partial list, so alloc and free are a list pop/push. A slab
+ * that becomes empty goes back to the page allocator unless it is the
+ * class's last partial slab.
+ * ============================================================================ */
+
+#define SLAB_SIZES          8
+#define SLAB_MIN_OBJECTS    8           /* Objects per slab (sets slab order) */
+
+typedef struct slab {
+    ilist_node_t  link;                 /* Class partial list */
+    void         *free;                 /* Free objects (singly linked) */
+    uint16_t      inuse;
+    uint16_t      total;
+} slab_t;
+
+/* Objects start after the header, 16-byte aligned */
+#define SLAB_HEADER_SIZE    ((sizeof(slab_t) + 15) & ~15u)
+
+typedef struct slab_cache {
+    uint32_t      size;                 /* Object size */
+    uint32_t      order;                /* Slab size: 2^order pages */
+    uint32_t      per_slab;             /* Objects per slab */
+    uint32_t      free_count;           /* Free objects across partial slabs */
+    uint32_t      slabs;                /* Slabs allocated */
+    uint32_t      inuse;                /* Objects handed out */
+    ilist_head_t  partial;              /* Slabs with free objects */
+} slab_cache_t;
+
+typedef struct slab_allocator {
+    slab_cache_t caches[SLAB_SIZES];
+    uint32_t     large_pages;           /* Pages held by large allocations */
+} slab_allocator_t;
+
+static slab_allocator_t g_slab;
+
+static void slab_init(slab_allocator_t *slab) {
+    uint32_t sizes[] = {16, 32, 64, 128, 256, 512, 1024, 2048};
+    for (int i = 0; i < SLAB_SIZES; i++) {
+        slab_cache_t *c = &slab->caches[i];
+        c->size = sizes[i];
+        c->order = 0;
+        while (((PAGE_SIZE << c->order) - SLAB_HEADER_SIZE) / c->size < SLAB_MIN_OBJECTS) {
+            c->order++;
+        }
+        c->per_slab = ((PAGE_SIZE << c->order) - SLAB_HEADER_SIZE) / c->size;
+        c->free_count = 0;
+        c->slabs = 0;
+        c->inuse = 0;
+        ilist_init_head(&c->partial);
+    }
+    slab->large_pages = 0;
+}
+
+/* Size class for @size, or -1 if it needs whole pages */
+static inline int slab_class(size_t size) {
+    for (int i = 0; i < SLAB_SIZES; i++) {
+        if (size <= g_slab.caches[i].size) return i;
+    }
+    return -1;
+}
+
+/* Carve a new slab for class @cls and put it on the partial list */
+static slab_t *slab_grow(int cls) {
+    slab_cache_t *c = &g_slab.caches[cls];
+    slab_t *s = (slab_t *)page_alloc(c->order);
+    if (!s) return NULL;
+
+    uint32_t idx = page_index(s);
+    for (uint32_t i = 0; i < (1u << c->order); i++) {
+        g_pages.info[idx + i].flags = PAGE_SLAB;
+        g_pages.info[idx + i].cls = (uint8_t)cls;
+    }
+
+    uint8_t *obj = (uint8_t *)s + SLAB_HEADER_SIZE;
+    s->free = NULL;
+    for (uint32_t i = c->per_slab; i-- > 0; ) {
+        void **o = (void **)(obj + i * c->size);
+        *o = s->free;
+        s->free = o;
+    }
+    s->inuse = 0;
+    s->total = (uint16_t)c->per_slab;
+    ilist_push_front(&c->partial, &s->link);
+    c->free_count += c->per_slab;
+    c->slabs++;
+    return s;
+}
+
+static void *slab_alloc(int cls) {
+    slab_cache_t *c = &g_slab.caches[cls];
+    slab_t *s;
+
+    if (ilist_is_empty(&c->partial)) {
+        s = slab_grow(cls);
+        if (!s) return NULL;
+    } else {
+        s = ilist_first_entry(&c->partial, slab_t, link);
+    }
+
+    void **obj = (void **)s->free;
+    s->free = *obj;
+    s->inuse++;
+    c->free_count--;
+    c->inuse++;
+    if (s->inuse == s->total) ilist_remove(&s->link);
+    return obj;
+}
+
+static void slab_free(void *ptr, int cls) {
+    slab_cache_t *c = &g_slab.caches[cls];
+    uint32_t idx = page_index(ptr) & ~((1u << c->order) - 1);
+    slab_t *s = (slab_t *)page_node(idx);
+
+    *(void **)ptr = s->free;
+    s->free = ptr;
+    if (s->inuse == s->total) ilist_push_front(&c->partial, &s->link);
+    s->inuse--;
+    c->free_count++;
+    c->inuse--;
+
+    /* Keep one empty slab around to avoid thrashing the page allocator */
+    if (s->inuse == 0 && c->free_count > c->per_slab) {
+        ilist_remove(&s->link);
+        c->free_count -= c->per_slab;
+        c->slabs--;
+        for (uint32_t i = 0; i < (1u << c->order); i++) {
+            g_pages.info[idx + i].flags = 0;
+        }
+        page_free(s, c->order);
+    }
+}
+
+/* ============================================================================
+ * kmalloc / kfree
+ * ============================================================================ */
+
+/**
+ * Allocate @size bytes (16-byte aligned; page aligned above 2048)
+ */
+static void *kmalloc(size_t size) {
+    if (size == 0) return NULL;
+
+    int cls = slab_class(size);
+    if (cls >= 0) return slab_alloc(cls);
+
+    uint32_t order = page_order_for(size);
+    void *p = page_alloc(order);
+    if (!p) return NULL;
+    g_pages.info[page_index(p)].flags = PAGE_ALLOC;
+    g_slab.large_pages += 1u << order;
+    return p;
+}
+
+static void kfree(void *ptr) {
+    if (!ptr || !page_owns(ptr)) return;
+
+    page_info_t *info = &g_pages.info[page_index(ptr)];
+    if (info->flags & PAGE_SLAB) {
+        slab_free(ptr, info->cls);
+    } else if (info->flags & PAGE_ALLOC) {
+        uint32_t order = info->order;
+        info->flags = 0;
+        g_slab.large_pages -= 1u << order;
+        page_free(ptr, order);
+    }
+}
+
+/* Usable size of a kmalloc'd block */
+static size_t kmalloc_size(void *ptr) {
+    if (!ptr || !page_owns(ptr)) return 0;
+
+    page_info_t *info = &g_pages.info[page_index(ptr)];
+    if (info->flags & PAGE_SLAB) return g_slab.caches[info->cls].size;
+    if (info->flags & PAGE_ALLOC) return (size_t)PAGE_SIZE << info->order;
+    return 0;
+}
+
+static void *kcalloc(size_t count, size_t size) {
+    if (size && count > (size_t)-1 / size) return NULL;
+    size_t bytes = count * size;
+
+    uint8_t *p = (uint8_t *)kmalloc(bytes);
+    if (p) {
+        for (size_t i = 0; i < bytes; i++) p[i] = 0;
+    }
+    return p;
+}
+
+static void *krealloc(void *ptr, size_t size) {
+    if (!ptr) return kmalloc(size);
+    if (size == 0) {
+        kfree(ptr);
+        return NULL;
+    }
+
+    size_t old = kmalloc_size(ptr);
+    if (size <= old) return ptr;
+
+    uint8_t *p = (uint8_t *)kmalloc(size);
+    if (!p) return NULL;
+    for (size_t i = 0; i < old; i++) p[i] = ((uint8_t *)ptr)[i];
+    kfree(ptr);
+    return p;
+}
+
+#endif /* HEAP_H */
@@ -422,4 +422,16 @@ static inline void interrupts_disable(void) {
     __asm__ volatile ("cli");
 }
 
+/* Disable interrupts, returning the previous EFLAGS for irq_restore */
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+/* Re-enable interrupts if they were enabled at irq_save */
+static inline void irq_restore(uint32_t flags) {
+    if (flags & 0x200) __asm__ volatile ("sti" : : : "memory");
+}
+
 #endif /* IDT_H */
\ No newline at end of file
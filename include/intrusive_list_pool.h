@@ -25,8 +25,29 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <stdlib.h>
-#include <string.h>
+
+/*
+ * Chunk allocator hooks. Hosted builds get malloc/free; freestanding builds
+ * (-ffreestanding, or ILIST_POOL_FREESTANDING) may supply their own
+ * ILIST_POOL_MALLOC/ILIST_POOL_FREE. Without them a freestanding pool can
+ * only hand out objects from storage given to ilist_pool_add_storage().
+ */
+#if defined(ILIST_POOL_FREESTANDING) || (defined(__STDC_HOSTED__) && __STDC_HOSTED__ == 0)
+    #ifndef ILIST_POOL_MALLOC
+    #define ILIST_POOL_MALLOC(size) ((void)(size), (void *)0)
+    #endif
+    #ifndef ILIST_POOL_FREE
+    #define ILIST_POOL_FREE(ptr)    ((void)(ptr))
+    #endif
+#else
+    #include <stdlib.h>
+    #ifndef ILIST_POOL_MALLOC
+    #define ILIST_POOL_MALLOC(size) malloc(size)
+    #endif
+    #ifndef ILIST_POOL_FREE
+    #define ILIST_POOL_FREE(ptr)    free(ptr)
+    #endif
+#endif
 
 #include "intrusive_list_fast.h"
 
@@ -45,6 +66,7 @@ typedef struct ilist_pool_chunk {
     struct ilist_pool_chunk *next;  // Link to next chunk
     size_t capacity;                 // Objects in this chunk
     size_t used;                     // Objects allocated
+    bool owned;                      // Allocated by the pool (false = caller storage)
     // Object storage follows immediately (flexible array member)
     char data[];
 } ilist_pool_chunk_t;
@@ -123,7 +145,9 @@ static inline void ilist_pool_destroy(ilist_pool_t *pool) {
     ilist_pool_chunk_t *chunk = pool->chunks;
     while (chunk) {
         ilist_pool_chunk_t *next = chunk->next;
-        free(chunk);
+        if (chunk->owned) {
+            ILIST_POOL_FREE(chunk);
+        }
         chunk = next;
     }
     pool->chunks = NULL;
@@ -139,12 +163,13 @@ static inline ilist_pool_chunk_t *__ilist_pool_alloc_chunk(ilist_pool_t *pool) {
     size_t data_size = pool->object_size * pool->objects_per_chunk;
     size_t total_size = sizeof(ilist_pool_chunk_t) + data_size;
     
-    ilist_pool_chunk_t *chunk = (ilist_pool_chunk_t *)malloc(total_size);
+    ilist_pool_chunk_t *chunk = (ilist_pool_chunk_t *)ILIST_POOL_MALLOC(total_size);
     if (!chunk) return NULL;
     
     chunk->next = pool->chunks;
     chunk->capacity = pool->objects_per_chunk;
     chunk->used = 0;
+    chunk->owned = true;
     
     pool->chunks = chunk;
     pool->current = chunk;
@@ -152,6 +177,39 @@ static inline ilist_pool_chunk_t *__ilist_pool_alloc_chunk(ilist_pool_t *pool) {
     return chunk;
 }
 
+/**
+ * ILIST_POOL_STORAGE_SIZE - Bytes of caller storage needed for @count objects
+ */
+#define ILIST_POOL_STORAGE_SIZE(object_size, count) \
+    (sizeof(ilist_pool_chunk_t) + \
+     ILIST_POOL_ALIGN(object_size, ILIST_POOL_ALIGNMENT) * (count))
+
+/**
+ * ilist_pool_add_storage - Seed the pool with caller-owned memory
+ * @pool:  Initialized pool
+ * @mem:   Storage (should be ILIST_POOL_ALIGNMENT aligned)
+ * @bytes: Size of @mem, see ILIST_POOL_STORAGE_SIZE()
+ *
+ * The storage becomes the current chunk and is never passed to
+ * ILIST_POOL_FREE. Returns false if @mem cannot hold a single object.
+ */
+static inline bool ilist_pool_add_storage(ilist_pool_t *pool, void *mem, size_t bytes) {
+    if (!mem || bytes < sizeof(ilist_pool_chunk_t) + pool->object_size) {
+        return false;
+    }
+
+    ilist_pool_chunk_t *chunk = (ilist_pool_chunk_t *)mem;
+    chunk->next = pool->chunks;
+    chunk->capacity = (bytes - sizeof(ilist_pool_chunk_t)) / pool->object_size;
+    chunk->used = 0;
+    chunk->owned = false;
+
+    pool->chunks = chunk;
+    pool->current = chunk;
+
+    return true;
+}
+
 /* ============================================================================
  * Allocation / Deallocation
  * ============================================================================ */
@@ -196,7 +254,10 @@ static inline void *ilist_pool_alloc(ilist_pool_t *pool) {
 static inline void *ilist_pool_calloc(ilist_pool_t *pool) {
     void *obj = ilist_pool_alloc(pool);
     if (obj) {
-        memset(obj, 0, pool->object_size);
+        unsigned char *p = (unsigned char *)obj;
+        for (size_t i = 0; i < pool->object_size; i++) {
+            p[i] = 0;
+        }
     }
     return obj;
 }
@@ -18,6 +18,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "idt.h"
+#include "sched.h"
 
 /* ============================================================================
  * Keyboard Port Constants
@@ -357,9 +358,9 @@ static inline char keyboard_getchar(void) {
     key_event_t event;
 
     while (1) {
-        /* Enable interrupts while waiting */
+        /* Enable interrupts while waiting; other threads run meanwhile */
         __asm__ volatile ("sti");
-        __asm__ volatile ("hlt");
+        if (!sched_wait_yield()) __asm__ volatile ("hlt");
 
         /* Check for key */
         while (kb_buffer_pop(&g_keyboard.buffer, &event)) {
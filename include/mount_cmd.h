@@ -7,6 +7,7 @@
  *   mount              - List mounted filesystems
  *   mount fd0 /fd0     - Mount floppy at /fd0
  *   mount hda /mnt     - Mount hard drive at /mnt
+ *   mount rd0 /ram     - Mount RAM disk at /ram
  *   umount /fd0        - Unmount filesystem
  *   eject              - Eject floppy (turn off motor)
  *
@@ -26,6 +27,7 @@
 #include "vfs.h"
 #include "fat12_vfs.h"
 #include "floppy_blkdev.h"
+#include "ramdisk_vfs.h"
 
 /* ============================================================================
  * Global Device State
@@ -77,6 +79,33 @@ static blkdev_t *mount_get_floppy(void) {
     return g_floppy_struct_ready ? &g_floppy_dev : NULL;
 }
 
+/**
+ * Mount the RAM disk filesystem at @path and record it
+ * (the RAM disk itself must already be initialized)
+ */
+static bool mount_ramdisk(const char *path) {
+    int slot = -1;
+    for (int i = 0; i < MAX_MOUNT_POINTS; i++) {
+        if (!g_mount_points[i].in_use) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) return false;
+
+    if (g_ramdisk_dev.type != BLKDEV_RAMDISK && !ramdisk_blkdev_init(&g_ramdisk_dev, &g_ramdisk)) {
+        return false;
+    }
+    if (!vfs_mount(path, &g_ramdisk_dev, ramdisk_get_vfs_ops(), NULL, NULL)) {
+        return false;
+    }
+
+    sh_strcpy(g_mount_points[slot].path, path);
+    g_mount_points[slot].device = &g_ramdisk_dev;
+    g_mount_points[slot].in_use = true;
+    return true;
+}
+
 /* ============================================================================
  * Shell Commands
  * ============================================================================ */
@@ -112,6 +141,8 @@ static void kcmd_mount(shell_state_t *sh, int argc, char **argv) {
                 /* We've tried to use it before */
                 sh->io->printf("  fd0      %s\n",
                     floppy_blkdev_hw_ok() ? "1.44MB Floppy (ready)" : "Floppy (not responding)");
+                sh->io->printf("           track buffer: %u sectors hit, %u cylinder reads (%u prefetched)\n",
+                              g_floppy.track_hits, g_floppy.track_misses, g_floppy.prefetches);
             } else {
                 /* Haven't tried yet */
                 sh->io->printf("  fd0      1.44MB Floppy (not probed)\n");
@@ -119,6 +150,9 @@ static void kcmd_mount(shell_state_t *sh, int argc, char **argv) {
         } else {
             sh->io->printf("  fd0      (not configured)\n");
         }
+        if (g_ramdisk.initialized) {
+            sh->io->printf("  rd0      %u KB RAM disk\n", g_ramdisk.data_size / 1024);
+        }
 
         sh->io->printf("\n");
         sh->last_result = 0;
@@ -186,8 +220,20 @@ static void kcmd_mount(shell_state_t *sh, int argc, char **argv) {
         return;
     }
 
+    if (sh_strcmp(device, "rd0") == 0) {
+        sh->io->printf("Mounting %s at %s...\n", device, path);
+        if (mount_ramdisk(path)) {
+            sh->io->printf("Mounted successfully.\n");
+            sh->last_result = 0;
+        } else {
+            sh->io->printf("Mount failed.\n");
+            sh->last_result = 1;
+        }
+        return;
+    }
+
     sh->io->printf("Unknown device: %s\n", device);
-    sh->io->printf("Available: fd0\n");
+    sh->io->printf("Available: fd0, rd0\n");
     sh->last_result = 1;
 }
 
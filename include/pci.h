@@ -0,0 +1,141 @@
+/**
+ * pci.h - PCI Configuration Space Access
+ *
+ * Configuration mechanism #1 (ports 0xCF8/0xCFC), which every PCI
+ * chipset since the i430 supports. Enough to find a device by class
+ * and read its BARs; no resource assignment (the BIOS does that).
+ */
+
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "idt.h"
+
+/* ============================================================================
+ * Configuration Space
+ * ============================================================================ */
+
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+
+/* Header offsets */
+#define PCI_VENDOR_ID       0x00
+#define PCI_DEVICE_ID       0x02
+#define PCI_COMMAND         0x04
+#define PCI_STATUS          0x06
+#define PCI_PROG_IF         0x09
+#define PCI_SUBCLASS        0x0A
+#define PCI_CLASS           0x0B
+#define PCI_HEADER_TYPE     0x0E
+#define PCI_BAR0            0x10
+#define PCI_BAR4            0x20
+
+/* Command register bits */
+#define PCI_CMD_IO          0x0001  /* I/O space enable */
+#define PCI_CMD_MEMORY      0x0002  /* Memory space enable */
+#define PCI_CMD_BUS_MASTER  0x0004  /* Bus master enable */
+
+/* Classes */
+#define PCI_CLASS_STORAGE   0x01
+#define PCI_SUBCLASS_IDE    0x01
+
+typedef struct {
+    uint8_t  bus;
+    uint8_t  slot;
+    uint8_t  func;
+    uint16_t vendor;
+    uint16_t device;
+} pci_device_t;
+
+/* ============================================================================
+ * Low-Level Access
+ * ============================================================================ */
+
+static inline void pci_outl(uint16_t port, uint32_t val) {
+    __asm__ volatile ("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint32_t pci_inl(uint16_t port) {
+    uint32_t ret;
+    __asm__ volatile ("inl %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline uint32_t pci_address(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    return 0x80000000u | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+           ((uint32_t)func << 8) | (offset & 0xFC);
+}
+
+static inline uint32_t pci_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    pci_outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    return pci_inl(PCI_CONFIG_DATA);
+}
+
+static inline uint16_t pci_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    return (uint16_t)(pci_read32(bus, slot, func, offset) >> ((offset & 2) * 8));
+}
+
+static inline uint8_t pci_read8(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    return (uint8_t)(pci_read32(bus, slot, func, offset) >> ((offset & 3) * 8));
+}
+
+static inline void pci_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset,
+                               uint32_t val) {
+    pci_outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    pci_outl(PCI_CONFIG_DATA, val);
+}
+
+static inline void pci_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset,
+                               uint16_t val) {
+    uint32_t shift = (offset & 2) * 8;
+    uint32_t old = pci_read32(bus, slot, func, offset);
+    old = (old & ~(0xFFFFu << shift)) | ((uint32_t)val << shift);
+    pci_write32(bus, slot, func, offset, old);
+}
+
+/* ============================================================================
+ * Device Discovery
+ * ============================================================================ */
+
+/**
+ * Find the first device with the given class/subclass
+ * @return true if found (filled into @out)
+ */
+static bool pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t *out) {
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            if (pci_read16((uint8_t)bus, slot, 0, PCI_VENDOR_ID) == 0xFFFF) continue;
+
+            uint8_t funcs = (pci_read8((uint8_t)bus, slot, 0, PCI_HEADER_TYPE) & 0x80) ? 8 : 1;
+            for (uint8_t func = 0; func < funcs; func++) {
+                uint16_t vendor = pci_read16((uint8_t)bus, slot, func, PCI_VENDOR_ID);
+                if (vendor == 0xFFFF) continue;
+
+                if (pci_read8((uint8_t)bus, slot, func, PCI_CLASS) == class_code &&
+                    pci_read8((uint8_t)bus, slot, func, PCI_SUBCLASS) == subclass) {
+                    out->bus = (uint8_t)bus;
+                    out->slot = slot;
+                    out->func = func;
+                    out->vendor = vendor;
+                    out->device = pci_read16((uint8_t)bus, slot, func, PCI_DEVICE_ID);
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Enable I/O decoding and bus mastering for a device
+ */
+static inline void pci_enable_bus_master(pci_device_t *dev) {
+    uint16_t cmd = pci_read16(dev->bus, dev->slot, dev->func, PCI_COMMAND);
+    cmd |= PCI_CMD_IO | PCI_CMD_BUS_MASTER;
+    pci_write16(dev->bus, dev->slot, dev->func, PCI_COMMAND, cmd);
+}
+
+#endif /* PCI_H */
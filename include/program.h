@@ -16,6 +16,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include "heap.h"
+#include "vfs.h"
+#include "trace.h"
 
 /* ============================================================================
  * Executable Format
@@ -29,7 +32,7 @@
  * 0x04    4     Entry point offset from load address
  * 0x08    4     Preferred load address (0 = default 0x200000)
  * 0x0C    4     BSS size (zero-initialized data after binary)
- * 0x10    4     Flags (reserved)
+ * 0x10    4     Flags (RFEX_FLAG_*)
  * 0x14    12    Reserved (pad to 32 bytes)
  * 0x20    ...   Program code and data
  *
@@ -53,6 +56,7 @@ typedef struct {
 /* Program flags */
 #define RFEX_FLAG_RESIDENT  0x01    /* Don't unload after exit */
 #define RFEX_FLAG_SHARED    0x02    /* Can be called by other programs */
+#define RFEX_FLAG_ARENA     0x04    /* malloc/free use the program arena */
 
 /* ============================================================================
  * Kernel API
@@ -118,10 +122,31 @@ typedef struct kernel_api {
     int   (*set_cwd)(const char *path);
 
     /* Extended (added in API 1.1+) */
-    void *reserved[16];                 /* Room for future expansion */
+    void *(*arena_mark)(void);          /* Current arena position (NULL if none) */
+    void  (*arena_reset)(void *mark);   /* Free everything allocated after mark */
+
+    /* Extended (added in API 1.2+) */
+    void  (*write)(const char *buf, size_t len);    /* Console span, one redraw */
+
+    /* Extended (added in API 1.3+) */
+    const void *(*fmap)(void *file, size_t *size);  /* Read-only view, NULL if unsupported */
+
+    /* Extended (added in API 1.4+): buffered, like their C namesakes */
+    int   (*fgetc)(void *file);                     /* Byte, or -1 at end of file */
+    char *(*fgets)(char *buf, int size, void *file);
+    int   (*fputc)(int c, void *file);
+
+    /* Extended (added in API 1.5+) */
+    int   (*getdents)(void *dir, void *entries, int max);   /* vfs_dirent_t[]; count, 0 at end */
+    void *reserved[8];                  /* Room for future expansion */
 } kernel_api_t;
 
-#define KERNEL_API_VERSION  0x00010000  /* Version 1.0 */
+#define KERNEL_API_VERSION  0x00010005  /* Version 1.5 */
+
+/* True if the kernel's API table has (and fills) @member */
+#define KERNEL_API_HAS(api, member) \
+    ((api)->struct_size >= offsetof(kernel_api_t, member) + sizeof((api)->member) && \
+     (api)->member != NULL)
 
 /* ============================================================================
  * Program Entry Point
@@ -149,20 +174,58 @@ typedef int (*program_entry_t)(kernel_api_t *api, int argc, char **argv);
 #define PROGRAM_DEFAULT_LOAD_ADDR   0x200000    /* 2MB mark */
 #define PROGRAM_MAX_SIZE            0x100000    /* 1MB max program size */
 #define PROGRAM_MAX_ARGS            16
+#define PROGRAM_ARENA_END           0x400000    /* RAM disk starts here */
+#define PROGRAM_ARENA_ALIGN         8
+
+/* Resident image cache (RFEX_FLAG_RESIDENT), kept on the kernel heap */
+#define PROGRAM_CACHE_SLOTS         8
+#define PROGRAM_CACHE_BYTES         0x80000     /* 512KB of cached images */
 
 /* Loader state */
 typedef struct {
     bool loaded;                /* Program is loaded */
+    bool busy;                  /* Being loaded or run (may be parked at a yield) */
     uint32_t load_addr;         /* Where program is loaded */
     uint32_t size;              /* Size in bytes */
     uint32_t entry;             /* Entry point address */
     char name[64];              /* Program name */
     uint32_t flags;             /* Program flags */
+    uint32_t bss_size;          /* Zeroed bytes after the image */
+
+    /* Bump arena (RFEX_FLAG_ARENA): [arena_base, arena_end) */
+    uint32_t arena_base;
+    uint32_t arena_ptr;
+    uint32_t arena_end;
 } program_state_t;
 
 /* Global program state */
 static program_state_t g_program = {0};
 
+/* Cached copy of a resident program file, as read from disk */
+typedef struct {
+    char         path[VFS_MAX_PATH];    /* Normalized path ("" = free slot) */
+    vfs_mount_t *mount;
+    uint32_t     inode;
+    uint32_t     mtime;
+    uint32_t     size;
+    uint8_t     *image;
+    uint32_t     last_used;             /* LRU stamp */
+} program_cache_entry_t;
+
+typedef struct {
+    program_cache_entry_t entries[PROGRAM_CACHE_SLOTS];
+    uint32_t bytes;                     /* Sum of cached image sizes */
+    uint32_t clock;                     /* Next LRU stamp */
+
+    /* Statistics */
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t invalidations;
+} program_cache_t;
+
+static program_cache_t g_program_cache;
+
 /* ============================================================================
  * Loader Functions
  * ============================================================================ */
@@ -207,6 +270,14 @@ static void program_unload(void);
  */
 static const program_state_t *program_get_state(void);
 
+/**
+ * Allocate from the program arena (RFEX_FLAG_ARENA programs only)
+ *
+ * @param size      Bytes to allocate
+ * @return          8-byte aligned block, or NULL if out of arena space
+ */
+static void *program_arena_alloc(uint32_t size);
+
 /* ============================================================================
  * Implementation
  * ============================================================================ */
@@ -245,54 +316,154 @@ static void prog_memcpy(void *dst, const void *src, size_t n) {
     while (n--) *d++ = *s++;
 }
 
-/**
- * Load a program from disk
+/* ============================================================================
+ * Resident Image Cache
+ * ============================================================================
+ *
+ * Programs flagged RFEX_FLAG_RESIDENT keep a copy of their file on the
+ * heap after the first load from disk (files the VFS can map are already
+ * in memory and are not cached), keyed by normalized path plus the mtime and
+ * size reported by vfs_stat. Running one again copies the image back to
+ * the load address without touching the disk. Entries are evicted LRU
+ * within PROGRAM_CACHE_BYTES, and the VFS change hook drops an entry as
+ * soon as its file is written, renamed or deleted (FAT12 writes carry no
+ * real timestamp, so mtime alone would not notice). Unmounting drops
+ * every entry of the mount, since a format rewrites the disk underneath.
  */
-static bool program_load(const char *path, uint32_t load_addr) {
-    /* Unload any existing program */
-    program_unload();
 
-    /* Open the file */
-    vfs_file_t *file = vfs_open(path, VFS_O_RDONLY);
-    if (!file) {
-        return false;
+static void program_cache_drop(program_cache_entry_t *e) {
+    if (!e->path[0]) return;
+    kfree(e->image);
+    g_program_cache.bytes -= e->size;
+    e->path[0] = '\0';
+    e->image = NULL;
+}
+
+/* VFS change hook: forget images of a file (inode 0: a whole mount) about to change */
+static void program_cache_changed(vfs_mount_t *mnt, uint32_t inode) {
+    for (uint32_t i = 0; i < PROGRAM_CACHE_SLOTS; i++) {
+        program_cache_entry_t *e = &g_program_cache.entries[i];
+        if (e->path[0] && e->mount == mnt && (inode == 0 || e->inode == inode)) {
+            program_cache_drop(e);
+            g_program_cache.invalidations++;
+        }
     }
+}
 
-    /* Get file size by reading to end */
-    uint8_t temp[512];
-    uint32_t file_size = 0;
-    int32_t bytes;
+/* Cached image for @path if it still matches @st, else NULL (stale dropped) */
+static program_cache_entry_t *program_cache_find(const char *path, const vfs_stat_t *st) {
+    for (uint32_t i = 0; i < PROGRAM_CACHE_SLOTS; i++) {
+        program_cache_entry_t *e = &g_program_cache.entries[i];
+        if (!e->path[0] || vfs_strcmp(e->path, path) != 0) continue;
 
-    /* First pass: get size */
-    while ((bytes = vfs_read(file, temp, sizeof(temp))) > 0) {
-        file_size += bytes;
+        if (e->mtime == st->mtime && e->size == st->size && e->inode == st->inode) {
+            e->last_used = ++g_program_cache.clock;
+            return e;
+        }
+        program_cache_drop(e);
+        g_program_cache.invalidations++;
+        return NULL;
     }
+    return NULL;
+}
 
-    if (file_size == 0 || file_size > PROGRAM_MAX_SIZE) {
-        vfs_close(file);
-        return false;
+/**
+ * Keep a copy of the @st->size bytes at @image for @path
+ * Silently gives up if the image is too big or the heap is full.
+ */
+static void program_cache_insert(const char *path, const vfs_stat_t *st, const void *image) {
+    if (st->size > PROGRAM_CACHE_BYTES || vfs_strlen(path) >= VFS_MAX_PATH) return;
+
+    /* Make room: a free slot and enough budget, evicting LRU */
+    program_cache_entry_t *slot = NULL;
+    for (;;) {
+        program_cache_entry_t *lru = NULL;
+        slot = NULL;
+        for (uint32_t i = 0; i < PROGRAM_CACHE_SLOTS; i++) {
+            program_cache_entry_t *e = &g_program_cache.entries[i];
+            if (!e->path[0]) {
+                if (!slot) slot = e;
+            } else if (!lru || e->last_used < lru->last_used) {
+                lru = e;
+            }
+        }
+        if (slot && g_program_cache.bytes + st->size <= PROGRAM_CACHE_BYTES) break;
+        if (!lru) return;
+        program_cache_drop(lru);
+        g_program_cache.evictions++;
     }
 
-    /* Reopen to read from beginning */
-    vfs_close(file);
-    file = vfs_open(path, VFS_O_RDONLY);
-    if (!file) {
+    uint8_t *copy = (uint8_t *)kmalloc(st->size);
+    if (!copy) return;
+    prog_memcpy(copy, image, st->size);
+
+    vfs_strcpy(slot->path, path);
+    slot->mount = vfs_find_mount(path);
+    slot->inode = st->inode;
+    slot->mtime = st->mtime;
+    slot->size = st->size;
+    slot->image = copy;
+    slot->last_used = ++g_program_cache.clock;
+    g_program_cache.bytes += st->size;
+    g_vfs.on_change = program_cache_changed;
+}
+
+/**
+ * Load a program from disk
+ *
+ * The image is sized with vfs_stat and read straight to the load address
+ * in one vfs_read; resident programs come from the cache when unchanged.
+ */
+static void program_release(void);
+
+static bool program_load_image(const char *path, uint32_t load_addr) {
+    /* Unload any existing program */
+    program_release();
+
+    char normalized[VFS_MAX_PATH];
+    vfs_normalize_path(path, normalized, "/");
+
+    vfs_stat_t st;
+    if (!vfs_stat(normalized, &st) || st.type != VFS_FILE) {
+        return false;
+    }
+    if (st.size == 0 || st.size > PROGRAM_MAX_SIZE) {
         return false;
     }
 
     /* Determine load address */
     uint32_t addr = load_addr ? load_addr : PROGRAM_DEFAULT_LOAD_ADDR;
-
-    /* Read entire file into memory */
     uint8_t *dest = (uint8_t *)(uintptr_t)addr;
-    uint32_t total_read = 0;
-
-    while ((bytes = vfs_read(file, dest + total_read, 4096)) > 0) {
-        total_read += bytes;
+    uint32_t total_read = st.size;
+
+    /* Images are linked for their load address, so even a mapped file is copied */
+    bool in_memory = false;
+    program_cache_entry_t *cached = program_cache_find(normalized, &st);
+    if (cached) {
+        prog_memcpy(dest, cached->image, st.size);
+        g_program_cache.hits++;
+    } else {
+        vfs_file_t *file = vfs_open(normalized, VFS_O_RDONLY);
+        if (!file) {
+            return false;
+        }
+        uint32_t mapped_size;
+        const void *mapped = vfs_map(file, &mapped_size);
+        int32_t bytes;
+        if (mapped && mapped_size == st.size) {
+            prog_memcpy(dest, mapped, st.size);
+            bytes = (int32_t)st.size;
+            in_memory = true;
+        } else {
+            bytes = vfs_read(file, dest, st.size);
+        }
+        vfs_close(file);
+        if (bytes != (int32_t)st.size) {
+            return false;
+        }
+        if (!in_memory) g_program_cache.misses++;
     }
 
-    vfs_close(file);
-
     /* Check for RFEX header */
     rfex_header_t *header = (rfex_header_t *)dest;
     uint32_t entry_offset = 0;
@@ -318,6 +489,11 @@ static bool program_load(const char *path, uint32_t load_addr) {
         code_start = 0;
     }
 
+    /* Keep a pristine copy before the program can modify itself */
+    if (!cached && !in_memory && (g_program.flags & RFEX_FLAG_RESIDENT)) {
+        program_cache_insert(normalized, &st, dest);
+    }
+
     /* Zero BSS section if present */
     if (bss_size > 0) {
         prog_memset(dest + total_read, 0, bss_size);
@@ -328,16 +504,39 @@ static bool program_load(const char *path, uint32_t load_addr) {
     g_program.load_addr = addr + code_start;
     g_program.size = total_read - code_start;
     g_program.entry = addr + code_start + entry_offset;
+    g_program.bss_size = bss_size;
     prog_strcpy(g_program.name, prog_basename(path), sizeof(g_program.name));
 
+    /* Arena covers the rest of the program area above the image and BSS */
+    if (g_program.flags & RFEX_FLAG_ARENA) {
+        uint32_t base = g_program.load_addr + g_program.size + bss_size;
+        base = (base + PROGRAM_ARENA_ALIGN - 1) & ~(PROGRAM_ARENA_ALIGN - 1);
+        g_program.arena_base = base;
+        g_program.arena_ptr = base;
+        g_program.arena_end = base < PROGRAM_ARENA_END ? PROGRAM_ARENA_END : base;
+    }
+
     return true;
 }
 
+/*
+ * Disk reads yield, so the area is marked busy while loading: another
+ * thread must not load over (or run) a half-read image
+ */
+static bool program_load(const char *path, uint32_t load_addr) {
+    if (g_program.busy) return false;
+
+    g_program.busy = true;
+    bool ok = program_load_image(path, load_addr);
+    g_program.busy = false;
+    return ok;
+}
+
 /**
  * Execute the loaded program
  */
 static int program_run(kernel_api_t *api, int argc, char **argv) {
-    if (!g_program.loaded) {
+    if (!g_program.loaded || g_program.busy) {
         return -1;
     }
 
@@ -345,7 +544,11 @@ static int program_run(kernel_api_t *api, int argc, char **argv) {
     program_entry_t entry = (program_entry_t)(uintptr_t)g_program.entry;
 
     /* Call the program */
+    g_program.busy = true;
+    TRACE_BEGIN(t0);
     int result = entry(api, argc, argv);
+    TRACE_END(TP_PROGRAM_RUN, t0, argc);
+    g_program.busy = false;
 
     /* Unload unless marked resident */
     if (!(g_program.flags & RFEX_FLAG_RESIDENT)) {
@@ -366,9 +569,14 @@ static int program_exec(const char *path, kernel_api_t *api, int argc, char **ar
 }
 
 /**
- * Unload current program
+ * Unload current program (not while it is being loaded or run)
  */
 static void program_unload(void) {
+    if (!g_program.busy) program_release();
+}
+
+/* Drop the loaded image, whether or not the area is busy */
+static void program_release(void) {
     if (g_program.loaded) {
         /* Could zero memory for security, but not required */
         g_program.loaded = false;
@@ -377,6 +585,12 @@ static void program_unload(void) {
         g_program.entry = 0;
         g_program.name[0] = '\0';
         g_program.flags = 0;
+        g_program.bss_size = 0;
+
+        /* Dropping the arena releases every allocation at once */
+        g_program.arena_base = 0;
+        g_program.arena_ptr = 0;
+        g_program.arena_end = 0;
     }
 }
 
@@ -387,4 +601,67 @@ static const program_state_t *program_get_state(void) {
     return &g_program;
 }
 
+/* ============================================================================
+ * Program Arena
+ * ============================================================================
+ *
+ * Programs flagged RFEX_FLAG_ARENA get malloc from a bump allocator over
+ * the free part of the program area. free() is a no-op; memory comes
+ * back in bulk through arena_reset(mark) or when the program unloads.
+ * Each block carries its size in the word before it so realloc can copy.
+ */
+
+static inline bool program_arena_owns(const void *ptr) {
+    uint32_t a = (uint32_t)(uintptr_t)ptr;
+    return a >= g_program.arena_base && a < g_program.arena_ptr;
+}
+
+static void *program_arena_alloc(uint32_t size) {
+    uint32_t need = (size + PROGRAM_ARENA_ALIGN + PROGRAM_ARENA_ALIGN - 1) &
+                    ~(PROGRAM_ARENA_ALIGN - 1);
+    if (size == 0 || need < size || g_program.arena_end - g_program.arena_ptr < need) {
+        return NULL;
+    }
+
+    uint32_t block = g_program.arena_ptr + PROGRAM_ARENA_ALIGN;
+    ((uint32_t *)(uintptr_t)block)[-1] = size;
+    g_program.arena_ptr += need;
+    return (void *)(uintptr_t)block;
+}
+
+/* Size recorded for an arena block */
+static inline uint32_t program_arena_size(const void *ptr) {
+    return ((const uint32_t *)ptr)[-1];
+}
+
+/* Grow the most recent arena block in place */
+static bool program_arena_extend(void *ptr, uint32_t size) {
+    uint32_t block = (uint32_t)(uintptr_t)ptr;
+    uint32_t old_end = block + ((program_arena_size(ptr) + PROGRAM_ARENA_ALIGN - 1) &
+                                ~(PROGRAM_ARENA_ALIGN - 1));
+    uint32_t new_end = block + ((size + PROGRAM_ARENA_ALIGN - 1) & ~(PROGRAM_ARENA_ALIGN - 1));
+    if (old_end != g_program.arena_ptr || new_end < block || new_end > g_program.arena_end) {
+        return false;
+    }
+
+    ((uint32_t *)ptr)[-1] = size;
+    g_program.arena_ptr = new_end;
+    return true;
+}
+
+/* Current position, for a later program_arena_reset() */
+static inline void *program_arena_mark(void) {
+    if (!g_program.arena_base) return NULL;
+    return (void *)(uintptr_t)g_program.arena_ptr;
+}
+
+/* Release everything allocated since @mark (NULL: the whole arena) */
+static inline void program_arena_reset(void *mark) {
+    uint32_t m = (uint32_t)(uintptr_t)mark;
+    if (!mark) m = g_program.arena_base;
+    if (m >= g_program.arena_base && m <= g_program.arena_ptr) {
+        g_program.arena_ptr = m;
+    }
+}
+
 #endif /* PROGRAM_H */
@@ -19,6 +19,9 @@
 
 #include "program.h"
 #include "shell.h"
+#include "heap.h"
+#include "sched.h"
+#include "timer.h"
 #include "vfs.h"
 
 /* ============================================================================
@@ -55,6 +58,15 @@ static void api_puts(const char *s) {
     }
 }
 
+static void api_write(const char *buf, size_t len) {
+    if (!g_current_shell) return;
+    if (g_current_shell->io->write) {
+        g_current_shell->io->write(buf, len);
+    } else if (g_current_shell->io->putchar) {
+        while (len--) g_current_shell->io->putchar(*buf++);
+    }
+}
+
 static char api_getchar(void) {
     if (g_current_shell && g_current_shell->io->getchar) {
         return g_current_shell->io->getchar();
@@ -91,13 +103,48 @@ static void api_set_cursor(int x, int y) { (void)x; (void)y; }
 static void api_get_cursor(int *x, int *y) { if(x) *x=0; if(y) *y=0; }
 static void api_set_color(uint8_t fg, uint8_t bg) { (void)fg; (void)bg; }
 
-static void *api_malloc(size_t size) { (void)size; return NULL; }
-static void *api_calloc(size_t count, size_t size) { (void)count; (void)size; return NULL; }
-static void *api_realloc(void *ptr, size_t size) { (void)ptr; (void)size; return NULL; }
-static void api_free(void *ptr) { (void)ptr; }
+/* Memory - kernel heap, or the program arena for RFEX_FLAG_ARENA programs */
+static inline bool api_use_arena(void) {
+    return g_program.loaded && (g_program.flags & RFEX_FLAG_ARENA);
+}
+
+static void *api_malloc(size_t size) {
+    if (api_use_arena()) return program_arena_alloc(size);
+    return kmalloc(size);
+}
+
+static void *api_calloc(size_t count, size_t size) {
+    if (!api_use_arena()) return kcalloc(count, size);
+    if (size && count > (size_t)-1 / size) return NULL;
+
+    uint8_t *p = (uint8_t *)program_arena_alloc(count * size);
+    if (p) prog_memset(p, 0, count * size);
+    return p;
+}
+
+static void *api_realloc(void *ptr, size_t size) {
+    if (!ptr) return api_malloc(size);
+    if (!program_arena_owns(ptr)) return krealloc(ptr, size);
+
+    uint32_t old = program_arena_size(ptr);
+    if (size <= old) return ptr;
+    if (program_arena_extend(ptr, size)) return ptr;
 
-static void api_sleep(uint32_t ms) { (void)ms; }
-static uint32_t api_get_ticks(void) { return 0; }
+    void *p = program_arena_alloc(size);
+    if (p) prog_memcpy(p, ptr, old);
+    return p;
+}
+
+static void api_free(void *ptr) {
+    if (program_arena_owns(ptr)) return;  /* Reclaimed at reset/exit */
+    kfree(ptr);
+}
+
+static void *api_arena_mark(void) { return program_arena_mark(); }
+static void api_arena_reset(void *mark) { program_arena_reset(mark); }
+
+static void api_sleep(uint32_t ms) { timer_sleep_ms(ms); }
+static uint32_t api_get_ticks(void) { return timer_ticks(); }
 static void api_reboot(void) { /* Could call kernel reboot */ }
 
 static const char *api_get_program_name(void) {
@@ -110,43 +157,261 @@ static const char *api_get_cwd(void) {
 
 static int api_set_cwd(const char *path) { (void)path; return -1; }
 
-/* File I/O wrappers */
+/* ============================================================================
+ * Buffered File Streams
+ *
+ * kernel_api.fopen returns an api_file_t: a VFS handle plus an
+ * API_FILE_BUF_SIZE buffer, so small reads and writes (fgetc, fputc, line
+ * reads) are served from memory and the VFS sees buffer-sized transfers.
+ * Requests of a buffer or more go straight to the VFS. The buffer holds
+ * either data read ahead of the stream position (rlen) or data not yet
+ * written (wlen), never both. Each stream belongs to the thread that
+ * opened it; the streams a program leaves open are flushed and closed
+ * when it returns on that thread, leaving other jobs' files alone.
+ * ============================================================================ */
+
+#define API_FILE_BUF_SIZE   4096
+#define API_EOF             (-1)
+
+typedef struct {
+    vfs_file_t *vf;
+    kthread_t  *owner;          /* Thread that opened the stream */
+    uint8_t    *buf;            /* NULL: unbuffered (no memory at open) */
+    uint32_t    rpos;           /* Next unread byte in buf */
+    uint32_t    rlen;           /* Bytes of file data in buf */
+    uint32_t    wlen;           /* Bytes waiting to be written */
+    bool        writable;
+    bool        eof;
+    bool        in_use;
+} api_file_t;
+
+static api_file_t g_api_files[VFS_MAX_OPEN_FILES];
+
+/* The stream behind a program's handle, or NULL if it is not one */
+static api_file_t *api_file_get(void *file) {
+    api_file_t *f = (api_file_t *)file;
+    if (f < g_api_files || f >= g_api_files + VFS_MAX_OPEN_FILES) return NULL;
+    return f->in_use ? f : NULL;
+}
+
+/* Stream position as the program sees it */
+static inline uint32_t api_file_tell(api_file_t *f) {
+    return f->vf->position - (f->rlen - f->rpos) + f->wlen;
+}
+
+/* Write out buffered data; false on a short write (the data is dropped) */
+static bool api_file_flush(api_file_t *f) {
+    if (!f->wlen) return true;
+    int32_t n = vfs_write(f->vf, f->buf, f->wlen);
+    bool ok = (n == (int32_t)f->wlen);
+    f->wlen = 0;
+    return ok;
+}
+
+/* Give back data read ahead, so the VFS position is the stream's again */
+static void api_file_unread(api_file_t *f) {
+    if (f->rpos < f->rlen) vfs_seek(f->vf, (int32_t)api_file_tell(f), VFS_SEEK_SET);
+    f->rpos = f->rlen = 0;
+}
+
+static uint32_t api_file_read(api_file_t *f, uint8_t *dst, uint32_t len) {
+    uint32_t done = 0;
+    if (!api_file_flush(f)) return 0;
+
+    while (done < len) {
+        if (f->rpos < f->rlen) {
+            uint32_t n = f->rlen - f->rpos;
+            if (n > len - done) n = len - done;
+            prog_memcpy(dst + done, f->buf + f->rpos, n);
+            f->rpos += n;
+            done += n;
+            continue;
+        }
+
+        /* Large request (or no buffer): read into the caller's memory */
+        uint8_t *into = f->buf;
+        uint32_t want = API_FILE_BUF_SIZE;
+        if (!f->buf || len - done >= API_FILE_BUF_SIZE) {
+            into = dst + done;
+            want = len - done;
+        }
+
+        int32_t n = vfs_read(f->vf, into, want);
+        if (n <= 0) {
+            f->eof = true;
+            break;
+        }
+        if (into == f->buf) {
+            f->rpos = 0;
+            f->rlen = (uint32_t)n;
+        } else {
+            done += (uint32_t)n;
+        }
+    }
+    return done;
+}
+
+static uint32_t api_file_write(api_file_t *f, const uint8_t *src, uint32_t len) {
+    if (!f->writable) return 0;
+    if (f->rlen) api_file_unread(f);
+
+    if (!f->buf || len >= API_FILE_BUF_SIZE) {
+        if (!api_file_flush(f)) return 0;
+        int32_t n = vfs_write(f->vf, src, len);
+        return n > 0 ? (uint32_t)n : 0;
+    }
+
+    uint32_t done = 0;
+    while (done < len) {
+        if (f->wlen == API_FILE_BUF_SIZE && !api_file_flush(f)) break;
+        uint32_t n = API_FILE_BUF_SIZE - f->wlen;
+        if (n > len - done) n = len - done;
+        prog_memcpy(f->buf + f->wlen, src + done, n);
+        f->wlen += n;
+        done += n;
+    }
+    return done;
+}
+
 static void *api_fopen(const char *path, const char *mode) {
     int flags = 0;
     if (mode[0] == 'r') flags = VFS_O_RDONLY;
     else if (mode[0] == 'w') flags = VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC;
     else if (mode[0] == 'a') flags = VFS_O_WRONLY | VFS_O_CREAT | VFS_O_APPEND;
-    return vfs_open(path, flags);
+
+    api_file_t *f = NULL;
+    for (int i = 0; i < VFS_MAX_OPEN_FILES && !f; i++) {
+        if (!g_api_files[i].in_use) f = &g_api_files[i];
+    }
+    if (!f) return NULL;
+
+    vfs_file_t *vf = vfs_open(path, flags);
+    if (!vf) return NULL;
+
+    f->vf = vf;
+    f->owner = kthread_current();
+    f->buf = (uint8_t *)kmalloc(API_FILE_BUF_SIZE);
+    f->rpos = f->rlen = f->wlen = 0;
+    f->writable = (flags & VFS_O_WRONLY) != 0;
+    f->eof = false;
+    f->in_use = true;
+    return f;
 }
 
 static int api_fclose(void *file) {
-    vfs_close((vfs_file_t *)file);
-    return 0;
+    api_file_t *f = api_file_get(file);
+    if (!f) return -1;
+
+    bool ok = api_file_flush(f);
+    vfs_close(f->vf);
+    kfree(f->buf);
+    f->buf = NULL;
+    f->in_use = false;
+    return ok ? 0 : -1;
+}
+
+/* Close whatever the program running on @owner left open */
+static void api_close_files_of(kthread_t *owner) {
+    for (int i = 0; i < VFS_MAX_OPEN_FILES; i++) {
+        if (g_api_files[i].in_use && g_api_files[i].owner == owner) {
+            api_fclose(&g_api_files[i]);
+        }
+    }
 }
 
 static int api_fread(void *buf, size_t size, size_t count, void *file) {
-    int32_t result = vfs_read((vfs_file_t *)file, buf, size * count);
-    return result > 0 ? result / (int)size : result;
+    api_file_t *f = api_file_get(file);
+    if (!f || !buf) return -1;
+    if (!size) return 0;
+    return (int)(api_file_read(f, (uint8_t *)buf, size * count) / size);
 }
 
 static int api_fwrite(const void *buf, size_t size, size_t count, void *file) {
-    int32_t result = vfs_write((vfs_file_t *)file, buf, size * count);
-    return result > 0 ? result / (int)size : result;
+    api_file_t *f = api_file_get(file);
+    if (!f || !buf) return -1;
+    if (!size) return 0;
+    return (int)(api_file_write(f, (const uint8_t *)buf, size * count) / size);
 }
 
 static int api_fseek(void *file, long offset, int whence) {
-    (void)file; (void)offset; (void)whence;
-    return -1;  /* Not implemented yet */
+    api_file_t *f = api_file_get(file);
+    if (!f || !api_file_flush(f)) return -1;
+
+    long target;
+    switch (whence) {
+        case VFS_SEEK_SET: target = offset; break;
+        case VFS_SEEK_CUR: target = (long)api_file_tell(f) + offset; break;
+        case VFS_SEEK_END: target = (long)f->vf->node.size + offset; break;
+        default: return -1;
+    }
+    if (target < 0) return -1;
+
+    /* Still inside the read buffer: just move the cursor */
+    long buf_start = (long)f->vf->position - (long)f->rlen;
+    if (f->rlen && target >= buf_start && target <= (long)f->vf->position) {
+        f->rpos = (uint32_t)(target - buf_start);
+        f->eof = false;
+        return 0;
+    }
+
+    f->rpos = f->rlen = 0;
+    if (vfs_seek(f->vf, (int32_t)target, VFS_SEEK_SET) < 0) return -1;
+    f->eof = false;
+    return 0;
 }
 
 static long api_ftell(void *file) {
-    (void)file;
-    return -1;  /* Not implemented yet */
+    api_file_t *f = api_file_get(file);
+    return f ? (long)api_file_tell(f) : -1;
 }
 
 static int api_feof(void *file) {
-    (void)file;
-    return 0;
+    api_file_t *f = api_file_get(file);
+    return f && f->eof && f->rpos >= f->rlen;
+}
+
+static int api_fgetc(void *file) {
+    api_file_t *f = api_file_get(file);
+    if (!f) return API_EOF;
+    if (f->rpos < f->rlen) return f->buf[f->rpos++];
+
+    uint8_t c;
+    return api_file_read(f, &c, 1) == 1 ? c : API_EOF;
+}
+
+/* Read up to @size - 1 bytes, stopping after a newline; NULL if none were read */
+static char *api_fgets(char *buf, int size, void *file) {
+    if (!buf || size <= 0) return NULL;
+
+    int i = 0;
+    while (i < size - 1) {
+        int c = api_fgetc(file);
+        if (c == API_EOF) break;
+        buf[i++] = (char)c;
+        if (c == '\n') break;
+    }
+    buf[i] = '\0';
+    return i ? buf : NULL;
+}
+
+static int api_fputc(int c, void *file) {
+    api_file_t *f = api_file_get(file);
+    if (!f) return API_EOF;
+
+    uint8_t b = (uint8_t)c;
+    if (f->buf && f->writable && !f->rlen && f->wlen < API_FILE_BUF_SIZE) {
+        f->buf[f->wlen++] = b;
+        return b;
+    }
+    return api_file_write(f, &b, 1) == 1 ? b : API_EOF;
+}
+
+static const void *api_fmap(void *file, size_t *size) {
+    api_file_t *f = api_file_get(file);
+    uint32_t n = 0;
+    const void *p = f ? vfs_map(f->vf, &n) : NULL;
+    if (size) *size = p ? n : 0;
+    return p;
 }
 
 static void *api_opendir(const char *path) {
@@ -161,6 +426,10 @@ static void *api_readdir(void *dir) {
     return NULL;
 }
 
+static int api_getdents(void *dir, void *entries, int max) {
+    return vfs_getdents((vfs_dir_t *)dir, (vfs_dirent_t *)entries, max);
+}
+
 static int api_closedir(void *dir) {
     vfs_closedir((vfs_dir_t *)dir);
     return 0;
@@ -243,8 +512,26 @@ static void program_shell_init(void) {
     g_kernel_api.get_cwd = api_get_cwd;
     g_kernel_api.set_cwd = api_set_cwd;
 
+    /* Program arena */
+    g_kernel_api.arena_mark = api_arena_mark;
+    g_kernel_api.arena_reset = api_arena_reset;
+
+    /* Bulk console output */
+    g_kernel_api.write = api_write;
+
+    /* Zero-copy file reads */
+    g_kernel_api.fmap = api_fmap;
+
+    /* Buffered character I/O */
+    g_kernel_api.fgetc = api_fgetc;
+    g_kernel_api.fgets = api_fgets;
+    g_kernel_api.fputc = api_fputc;
+
+    /* Batched directory reads */
+    g_kernel_api.getdents = api_getdents;
+
     /* Clear reserved pointers */
-    for (int i = 0; i < 16; i++) {
+    for (int i = 0; i < 8; i++) {
         g_kernel_api.reserved[i] = NULL;
     }
 }
@@ -253,6 +540,19 @@ static void program_shell_init(void) {
  * Shell Commands
  * ============================================================================ */
 
+/*
+ * The program area holds one image. A background job can be parked at a
+ * yield point inside it, so nothing may load, run or unload meanwhile.
+ */
+static bool program_shell_busy(shell_state_t *sh) {
+    const program_state_t *prog = program_get_state();
+    if (!prog->busy) return false;
+
+    sh->io->printf("Another program is being loaded or run.\n");
+    sh->last_result = 1;
+    return true;
+}
+
 /**
  * load <file> [address]
  * Load a program into memory
@@ -265,6 +565,8 @@ static void sh_cmd_load(shell_state_t *sh, int argc, char **argv) {
         return;
     }
 
+    if (program_shell_busy(sh)) return;
+
     const char *path = argv[1];
     uint32_t load_addr = 0;
 
@@ -303,6 +605,7 @@ static void sh_cmd_load(shell_state_t *sh, int argc, char **argv) {
  */
 static void sh_cmd_run(shell_state_t *sh, int argc, char **argv) {
     const program_state_t *prog = program_get_state();
+    if (program_shell_busy(sh)) return;
 
     if (!prog->loaded) {
         sh->io->printf("No program loaded. Use 'load <file>' first.\n");
@@ -334,6 +637,7 @@ static void sh_cmd_run(shell_state_t *sh, int argc, char **argv) {
 
     /* Run the program */
     int result = program_run(&g_kernel_api, prog_argc, prog_argv);
+    api_close_files_of(kthread_current());
 
     sh->io->printf("\nProgram exited with code %d\n", result);
     sh->last_result = result;
@@ -354,6 +658,8 @@ static void sh_cmd_exec(shell_state_t *sh, int argc, char **argv) {
         return;
     }
 
+    if (program_shell_busy(sh)) return;
+
     const char *path = argv[1];
 
     sh->io->printf("Loading '%s'...\n", path);
@@ -391,6 +697,7 @@ static void sh_cmd_exec(shell_state_t *sh, int argc, char **argv) {
 
     /* Run the program */
     int result = program_run(&g_kernel_api, prog_argc, prog_argv);
+    api_close_files_of(kthread_current());
 
     sh->io->printf("\nProgram exited with code %d\n", result);
     sh->last_result = result;
@@ -407,6 +714,7 @@ static void sh_cmd_unload(shell_state_t *sh, int argc, char **argv) {
     (void)argc; (void)argv;
 
     const program_state_t *prog = program_get_state();
+    if (program_shell_busy(sh)) return;
 
     if (!prog->loaded) {
         sh->io->printf("No program loaded.\n");
@@ -444,6 +752,11 @@ static void sh_cmd_proginfo(shell_state_t *sh, int argc, char **argv) {
     sh->io->printf("  Flags:       0x%08X\n", prog->flags);
     if (prog->flags & RFEX_FLAG_RESIDENT) sh->io->printf("               - Resident\n");
     if (prog->flags & RFEX_FLAG_SHARED)   sh->io->printf("               - Shared\n");
+    if (prog->flags & RFEX_FLAG_ARENA) {
+        sh->io->printf("               - Arena: %u/%u bytes used\n",
+                      prog->arena_ptr - prog->arena_base,
+                      prog->arena_end - prog->arena_base);
+    }
     sh->io->printf("\n");
 
     sh->last_result = 0;
@@ -10,6 +10,11 @@
  *   - File flags (readonly, hidden, executable, etc.)
  *   - Works with editor and assembler (future)
  *   - Copy between FAT12 and RAM disk
+ *
+ * Names are found through an open-addressing hash index, and file data
+ * comes from an address-ordered list of free extents that coalesces on
+ * delete, so freed space is reused. ramdisk_compact() slides all files
+ * together when the free space is too scattered for a large file.
  */
 
 #ifndef RAMDISK_H
@@ -23,10 +28,19 @@
  * Configuration
  * ============================================================================ */
 
-#define RAMDISK_MAX_FILES       128
+#define RAMDISK_MAX_FILES       512
 #define RAMDISK_MAX_FILENAME    32
 #define RAMDISK_SIZE            (1024 * 1024)   /* 1MB RAM disk */
 #define RAMDISK_BLOCK_SIZE      512
+#define RAMDISK_MIN_ALLOC       4096            /* First allocation of a file */
+
+/* Name index: power of 2, at least twice the file count so probes stay short */
+#define RAMDISK_HASH_SIZE       1024
+#define RAMDISK_INDEX_EMPTY     0x0000
+#define RAMDISK_INDEX_DELETED   0xFFFF
+
+/* Free extents never touch, so there is at most one per gap between files */
+#define RAMDISK_MAX_EXTENTS     (RAMDISK_MAX_FILES + 1)
 
 /* Data area location - must be in usable memory above kernel */
 #define RAMDISK_DATA_ADDR       0x400000        /* 4MB mark */
@@ -75,6 +89,12 @@ typedef struct {
     uint32_t    modified;       /* Last modified timestamp */
 } ramdisk_file_t;
 
+/* Free run of the data area */
+typedef struct {
+    uint32_t    offset;
+    uint32_t    size;
+} ramdisk_extent_t;
+
 /* ============================================================================
  * RAM Disk Structure
  * ============================================================================ */
@@ -84,11 +104,25 @@ typedef struct {
     ramdisk_file_t  files[RAMDISK_MAX_FILES];
     uint32_t        file_count;
 
+    /* Name index (file index + 1, or RAMDISK_INDEX_EMPTY/DELETED) */
+    uint16_t        index[RAMDISK_HASH_SIZE];
+    uint32_t        index_deleted;  /* Tombstones; rebuilt when too many */
+
+    /* Unused file slots (stack) */
+    uint16_t        free_slots[RAMDISK_MAX_FILES];
+    uint32_t        free_slot_count;
+
     /* Data storage */
     uint8_t        *data;           /* Points to data area */
     uint32_t        data_size;      /* Total data area size */
-    uint32_t        data_used;      /* Bytes allocated (includes fragmentation) */
-    uint32_t        data_ptr;       /* Next free offset (simple bump allocator) */
+    uint32_t        data_used;      /* Bytes allocated to files (includes slack) */
+
+    /* Free extents, sorted by offset */
+    ramdisk_extent_t extents[RAMDISK_MAX_EXTENTS];
+    uint32_t        extent_count;
+
+    /* Handles holding a direct pointer into the data area */
+    uint32_t        mapped;
 
     /* Statistics */
     uint32_t        total_reads;
@@ -115,6 +149,7 @@ typedef struct {
     bool            open;
     bool            write_mode;
     bool            append_mode;
+    bool            mapped;         /* ramdisk_map() handed out a pointer */
 } ramdisk_handle_t;
 
 /* ============================================================================
@@ -141,7 +176,9 @@ typedef struct {
     uint32_t total_writes;
     uint32_t bytes_read;
     uint32_t bytes_written;
-    uint32_t fragmented_bytes;  /* Space lost to deleted files */
+    uint32_t fragmented_bytes;  /* Allocated to files but not used */
+    uint32_t free_extents;      /* Separate free runs */
+    uint32_t largest_free;      /* Biggest single allocation possible */
 } ramdisk_stats_t;
 
 /* ============================================================================
@@ -196,10 +233,11 @@ static inline void rd_strncpy(char *dst, const char *src, int n) {
     *dst = '\0';
 }
 
+/* Forward copy; also safe for overlapping moves to a lower address */
 static inline void rd_memcpy(void *dst, const void *src, uint32_t n) {
-    uint8_t *d = (uint8_t *)dst;
-    const uint8_t *s = (const uint8_t *)src;
-    while (n--) *d++ = *s++;
+    uint32_t words = n / 4, bytes = n & 3;
+    __asm__ volatile ("rep movsl" : "+D"(dst), "+S"(src), "+c"(words) : : "memory");
+    __asm__ volatile ("rep movsb" : "+D"(dst), "+S"(src), "+c"(bytes) : : "memory");
 }
 
 static inline void rd_memset(void *dst, uint8_t val, uint32_t n) {
@@ -217,6 +255,174 @@ static inline int rd_memcmp(const void *a, const void *b, uint32_t n) {
     return 0;
 }
 
+/* ============================================================================
+ * Name Index
+ * ============================================================================ */
+
+/* FNV-1a over the lower-cased name (lookups are case-insensitive) */
+static inline uint32_t rd_name_hash(const char *name) {
+    uint32_t h = 2166136261u;
+    for (; *name; name++) {
+        char c = *name;
+        if (c >= 'A' && c <= 'Z') c += 32;
+        h = (h ^ (uint8_t)c) * 16777619u;
+    }
+    return h;
+}
+
+/* Index slot holding @name, or -1 */
+static inline int rd_index_find(ramdisk_t *rd, const char *name) {
+    uint32_t mask = RAMDISK_HASH_SIZE - 1;
+    uint32_t i = rd_name_hash(name) & mask;
+
+    for (uint32_t n = 0; n < RAMDISK_HASH_SIZE; n++, i = (i + 1) & mask) {
+        uint16_t e = rd->index[i];
+        if (e == RAMDISK_INDEX_EMPTY) break;
+        if (e != RAMDISK_INDEX_DELETED && rd_strcasecmp(rd->files[e - 1].name, name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static inline void rd_index_insert(ramdisk_t *rd, uint32_t file) {
+    uint32_t mask = RAMDISK_HASH_SIZE - 1;
+    uint32_t i = rd_name_hash(rd->files[file].name) & mask;
+
+    while (rd->index[i] != RAMDISK_INDEX_EMPTY && rd->index[i] != RAMDISK_INDEX_DELETED) {
+        i = (i + 1) & mask;
+    }
+    if (rd->index[i] == RAMDISK_INDEX_DELETED) rd->index_deleted--;
+    rd->index[i] = (uint16_t)(file + 1);
+}
+
+/* Re-insert every file, dropping tombstones */
+static inline void rd_index_rebuild(ramdisk_t *rd) {
+    rd_memset(rd->index, 0, sizeof(rd->index));
+    rd->index_deleted = 0;
+    for (uint32_t i = 0; i < RAMDISK_MAX_FILES; i++) {
+        if (rd->files[i].flags & RAMDISK_FILE_USED) rd_index_insert(rd, i);
+    }
+}
+
+static inline void rd_index_remove(ramdisk_t *rd, int slot) {
+    uint32_t next = ((uint32_t)slot + 1) & (RAMDISK_HASH_SIZE - 1);
+
+    /* End of a probe chain can simply be emptied */
+    if (rd->index[next] == RAMDISK_INDEX_EMPTY) {
+        rd->index[slot] = RAMDISK_INDEX_EMPTY;
+        return;
+    }
+    rd->index[slot] = RAMDISK_INDEX_DELETED;
+    if (++rd->index_deleted > RAMDISK_HASH_SIZE / 4) rd_index_rebuild(rd);
+}
+
+/* ============================================================================
+ * Extent Allocator
+ * ============================================================================
+ *
+ * Free space is a sorted array of non-adjacent extents. Allocation is
+ * address-ordered first fit; freeing merges with both neighbours.
+ */
+
+static inline void rd_extent_remove(ramdisk_t *rd, uint32_t i) {
+    for (rd->extent_count--; i < rd->extent_count; i++) {
+        rd->extents[i] = rd->extents[i + 1];
+    }
+}
+
+static inline bool rd_extent_alloc(ramdisk_t *rd, uint32_t size, uint32_t *offset) {
+    for (uint32_t i = 0; i < rd->extent_count; i++) {
+        ramdisk_extent_t *e = &rd->extents[i];
+        if (e->size < size) continue;
+
+        *offset = e->offset;
+        e->offset += size;
+        e->size -= size;
+        if (e->size == 0) rd_extent_remove(rd, i);
+        rd->data_used += size;
+        return true;
+    }
+    return false;
+}
+
+/* Take @size bytes from the free extent starting exactly at @offset */
+static inline bool rd_extent_take(ramdisk_t *rd, uint32_t offset, uint32_t size) {
+    for (uint32_t i = 0; i < rd->extent_count; i++) {
+        ramdisk_extent_t *e = &rd->extents[i];
+        if (e->offset < offset) continue;
+        if (e->offset > offset || e->size < size) return false;
+
+        e->offset += size;
+        e->size -= size;
+        if (e->size == 0) rd_extent_remove(rd, i);
+        rd->data_used += size;
+        return true;
+    }
+    return false;
+}
+
+static inline void rd_extent_free(ramdisk_t *rd, uint32_t offset, uint32_t size) {
+    if (size == 0) return;
+    rd->data_used -= size;
+
+    uint32_t i = 0;
+    while (i < rd->extent_count && rd->extents[i].offset < offset) i++;
+
+    bool join_prev = i > 0 && rd->extents[i - 1].offset + rd->extents[i - 1].size == offset;
+    bool join_next = i < rd->extent_count && offset + size == rd->extents[i].offset;
+
+    if (join_prev && join_next) {
+        rd->extents[i - 1].size += size + rd->extents[i].size;
+        rd_extent_remove(rd, i);
+    } else if (join_prev) {
+        rd->extents[i - 1].size += size;
+    } else if (join_next) {
+        rd->extents[i].offset = offset;
+        rd->extents[i].size += size;
+    } else if (rd->extent_count < RAMDISK_MAX_EXTENTS) {
+        for (uint32_t j = rd->extent_count++; j > i; j--) {
+            rd->extents[j] = rd->extents[j - 1];
+        }
+        rd->extents[i].offset = offset;
+        rd->extents[i].size = size;
+    }
+}
+
+static inline uint32_t rd_largest_free(ramdisk_t *rd) {
+    uint32_t best = 0;
+    for (uint32_t i = 0; i < rd->extent_count; i++) {
+        if (rd->extents[i].size > best) best = rd->extents[i].size;
+    }
+    return best;
+}
+
+/**
+ * Give @f exactly @size bytes of storage, growing in place when the
+ * extent after it is free, otherwise moving the contents
+ */
+static inline bool rd_file_resize(ramdisk_t *rd, ramdisk_file_t *f, uint32_t size) {
+    if (size <= f->allocated) {
+        rd_extent_free(rd, f->offset + size, f->allocated - size);
+        f->allocated = size;
+        if (size == 0) f->offset = 0;
+        return true;
+    }
+
+    if (f->allocated && rd_extent_take(rd, f->offset + f->allocated, size - f->allocated)) {
+        f->allocated = size;
+        return true;
+    }
+
+    uint32_t offset;
+    if (!rd_extent_alloc(rd, size, &offset)) return false;
+    if (f->size > 0) rd_memcpy(&rd->data[offset], &rd->data[f->offset], f->size);
+    rd_extent_free(rd, f->offset, f->allocated);
+    f->offset = offset;
+    f->allocated = size;
+    return true;
+}
+
 /* ============================================================================
  * Core Functions
  * ============================================================================ */
@@ -229,15 +435,23 @@ static inline bool ramdisk_init(ramdisk_t *rd, void *data_area, uint32_t size) {
         return false;
     }
 
-    /* Clear file table */
+    /* Clear file table and index */
     rd_memset(rd->files, 0, sizeof(rd->files));
     rd->file_count = 0;
+    rd_memset(rd->index, 0, sizeof(rd->index));
+    rd->index_deleted = 0;
+    for (uint32_t i = 0; i < RAMDISK_MAX_FILES; i++) {
+        rd->free_slots[i] = (uint16_t)(RAMDISK_MAX_FILES - 1 - i);
+    }
+    rd->free_slot_count = RAMDISK_MAX_FILES;
 
-    /* Set up data area */
+    /* Set up data area as one free extent */
     rd->data = (uint8_t *)data_area;
     rd->data_size = size;
     rd->data_used = 0;
-    rd->data_ptr = 0;
+    rd->extents[0].offset = 0;
+    rd->extents[0].size = size;
+    rd->extent_count = 1;
 
     /* Clear data area */
     rd_memset(rd->data, 0, size);
@@ -299,11 +513,9 @@ static inline int ramdisk_find(ramdisk_t *rd, const char *name) {
         return -1;
     }
 
-    for (uint32_t i = 0; i < RAMDISK_MAX_FILES; i++) {
-        if ((rd->files[i].flags & RAMDISK_FILE_USED) &&
-            rd_strcasecmp(rd->files[i].name, name) == 0) {
-            return (int)i;
-        }
+    int slot = rd_index_find(rd, name);
+    if (slot >= 0) {
+        return rd->index[slot] - 1;
     }
 
     rd->last_error = RAMDISK_ERR_NOT_FOUND;
@@ -311,13 +523,11 @@ static inline int ramdisk_find(ramdisk_t *rd, const char *name) {
 }
 
 /**
- * Find a free file slot
+ * Take a free file slot
  */
 static inline int ramdisk_find_free_slot(ramdisk_t *rd) {
-    for (uint32_t i = 0; i < RAMDISK_MAX_FILES; i++) {
-        if (!(rd->files[i].flags & RAMDISK_FILE_USED)) {
-            return (int)i;
-        }
+    if (rd->free_slot_count > 0) {
+        return rd->free_slots[--rd->free_slot_count];
     }
     rd->last_error = RAMDISK_ERR_NO_SLOTS;
     return -1;
@@ -371,6 +581,7 @@ static inline bool ramdisk_create(ramdisk_t *rd, const char *name, uint32_t flag
     f->flags = RAMDISK_FILE_USED | flags;
     f->created = g_ramdisk_ticks;
     f->modified = g_ramdisk_ticks;
+    rd_index_insert(rd, (uint32_t)slot);
 
     rd->file_count++;
     rd->total_created++;
@@ -388,9 +599,13 @@ static inline bool ramdisk_delete(ramdisk_t *rd, const char *name) {
         return false;
     }
 
-    int idx = ramdisk_find(rd, name);
-    if (idx < 0) return false;
+    int slot = rd_index_find(rd, name);
+    if (slot < 0) {
+        rd->last_error = RAMDISK_ERR_NOT_FOUND;
+        return false;
+    }
 
+    uint32_t idx = rd->index[slot] - 1;
     ramdisk_file_t *f = &rd->files[idx];
 
     /* Check if readonly */
@@ -399,12 +614,14 @@ static inline bool ramdisk_delete(ramdisk_t *rd, const char *name) {
         return false;
     }
 
-    /* Mark as free
-     * Note: data space is not reclaimed in this simple implementation.
-     * A compaction function could be added later.
-     */
+    /* Return the data to the free extents and the slot to the stack */
+    rd_extent_free(rd, f->offset, f->allocated);
+    rd_index_remove(rd, slot);
     f->flags = RAMDISK_FILE_FREE;
     f->name[0] = '\0';
+    f->offset = 0;
+    f->allocated = 0;
+    rd->free_slots[rd->free_slot_count++] = (uint16_t)idx;
 
     rd->file_count--;
     rd->total_deleted++;
@@ -479,12 +696,30 @@ static inline bool ramdisk_open_append(ramdisk_t *rd, const char *name,
  */
 static inline void ramdisk_close(ramdisk_handle_t *handle) {
     if (handle) {
+        if (handle->mapped && handle->disk) handle->disk->mapped--;
+        handle->mapped = false;
         handle->open = false;
         handle->file = NULL;
         handle->disk = NULL;
     }
 }
 
+/**
+ * Read-only pointer to the file's data (contiguous in the data area)
+ *
+ * Valid until the handle is closed. Compaction is refused while any
+ * handle is mapped; writes that grow the file may still move it.
+ */
+static inline const uint8_t *ramdisk_map(ramdisk_handle_t *handle) {
+    if (!handle || !handle->open) return NULL;
+
+    if (!handle->mapped) {
+        handle->mapped = true;
+        handle->disk->mapped++;
+    }
+    return &handle->disk->data[handle->file->offset];
+}
+
 /**
  * Read from a file
  */
@@ -530,28 +765,29 @@ static inline uint32_t ramdisk_write(ramdisk_handle_t *handle, const void *buf,
     uint32_t new_end = handle->position + size;
 
     /* Need to allocate/extend space? */
-    if (f->allocated == 0 || new_end > f->allocated) {
+    if (new_end < handle->position) {
+        rd->last_error = RAMDISK_ERR_TOO_LARGE;
+        return 0;
+    }
+    if (new_end > f->allocated) {
         /* Calculate needed space (round up to block size) */
         uint32_t needed = (new_end + RAMDISK_BLOCK_SIZE - 1) & ~(RAMDISK_BLOCK_SIZE - 1);
+        if (needed < RAMDISK_MIN_ALLOC) needed = RAMDISK_MIN_ALLOC;
 
-        /* Add some extra space for future growth */
-        if (needed < 4096) needed = 4096;
+        /* Double on growth so appends stay amortized; exact fit if that fails */
+        uint32_t want = f->allocated * 2;
+        if (want < needed || want > rd->data_size) want = needed;
 
-        /* Check if we have space */
-        if (rd->data_ptr + needed > rd->data_size) {
+        if (!rd_file_resize(rd, f, want) &&
+            (want == needed || !rd_file_resize(rd, f, needed))) {
             rd->last_error = RAMDISK_ERR_NO_SPACE;
             return 0;
         }
+    }
 
-        /* If file already has data, copy it to new location */
-        if (f->size > 0 && f->allocated > 0) {
-            rd_memcpy(&rd->data[rd->data_ptr], &rd->data[f->offset], f->size);
-        }
-
-        f->offset = rd->data_ptr;
-        f->allocated = needed;
-        rd->data_ptr += needed;
-        rd->data_used += needed;
+    /* Reused extents hold stale bytes: a write past the end leaves zeros */
+    if (handle->position > f->size) {
+        rd_memset(&rd->data[f->offset + f->size], 0, handle->position - f->size);
     }
 
     /* Write data */
@@ -699,8 +935,13 @@ static inline bool ramdisk_truncate(ramdisk_handle_t *handle) {
         return false;
     }
 
-    handle->file->size = handle->position;
-    handle->file->modified = g_ramdisk_ticks;
+    ramdisk_file_t *f = handle->file;
+    if (handle->position < f->size) f->size = handle->position;
+    f->modified = g_ramdisk_ticks;
+
+    /* Release whole blocks past the new end */
+    uint32_t keep = (f->size + RAMDISK_BLOCK_SIZE - 1) & ~(RAMDISK_BLOCK_SIZE - 1);
+    if (keep < f->allocated) rd_file_resize(handle->disk, f, keep);
     return true;
 }
 
@@ -802,10 +1043,22 @@ static inline bool ramdisk_rename(ramdisk_t *rd, const char *old_name, const cha
         return false;
     }
 
-    int idx = ramdisk_find(rd, old_name);
-    if (idx < 0) return false;
+    int len = rd_strlen(new_name);
+    if (len == 0 || len >= RAMDISK_MAX_FILENAME) {
+        rd->last_error = RAMDISK_ERR_INVALID;
+        return false;
+    }
 
+    int slot = rd_index_find(rd, old_name);
+    if (slot < 0) {
+        rd->last_error = RAMDISK_ERR_NOT_FOUND;
+        return false;
+    }
+
+    uint32_t idx = rd->index[slot] - 1;
+    rd_index_remove(rd, slot);
     rd_strncpy(rd->files[idx].name, new_name, RAMDISK_MAX_FILENAME - 1);
+    rd_index_insert(rd, idx);
     rd->files[idx].modified = g_ramdisk_ticks;
     rd->last_error = RAMDISK_OK;
 
@@ -947,6 +1200,68 @@ static inline void ramdisk_get_stats(ramdisk_t *rd, ramdisk_stats_t *stats) {
     stats->bytes_read = rd->bytes_read;
     stats->bytes_written = rd->bytes_written;
     stats->fragmented_bytes = rd->data_used - actual_used;
+    stats->free_extents = rd->extent_count;
+    stats->largest_free = rd_largest_free(rd);
+}
+
+/* ============================================================================
+ * Compaction
+ * ============================================================================ */
+
+/**
+ * Slide every file down to the start of the data area and trim its slack,
+ * leaving all free space in one extent at the end. Open handles stay
+ * valid: they refer to file entries, which are updated in place.
+ * Refused while a file is mapped, since that pointer would move.
+ *
+ * @return bytes gained in the largest free extent
+ */
+static inline uint32_t ramdisk_compact(ramdisk_t *rd) {
+    if (!rd || !rd->initialized || rd->mapped) return 0;
+
+    uint32_t before = rd_largest_free(rd);
+
+    /* Files with storage, in data-area order (insertion sort) */
+    uint16_t order[RAMDISK_MAX_FILES];
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < RAMDISK_MAX_FILES; i++) {
+        ramdisk_file_t *f = &rd->files[i];
+        if (!(f->flags & RAMDISK_FILE_USED) || f->allocated == 0) continue;
+
+        uint32_t j = n++;
+        while (j > 0 && rd->files[order[j - 1]].offset > f->offset) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = (uint16_t)i;
+    }
+
+    /* Moving down never overwrites unread data, so a forward copy is safe */
+    uint32_t at = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        ramdisk_file_t *f = &rd->files[order[k]];
+        uint32_t keep = (f->size + RAMDISK_BLOCK_SIZE - 1) & ~(RAMDISK_BLOCK_SIZE - 1);
+
+        if (keep == 0) {
+            f->offset = 0;
+            f->allocated = 0;
+            continue;
+        }
+        if (f->offset != at) rd_memcpy(&rd->data[at], &rd->data[f->offset], f->size);
+        f->offset = at;
+        f->allocated = keep;
+        at += keep;
+    }
+
+    rd->data_used = at;
+    rd->extent_count = 0;
+    if (at < rd->data_size) {
+        rd->extents[0].offset = at;
+        rd->extents[0].size = rd->data_size - at;
+        rd->extent_count = 1;
+    }
+
+    return rd_largest_free(rd) - before;
 }
 
 /* ============================================================================
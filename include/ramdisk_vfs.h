@@ -0,0 +1,370 @@
+/**
+ * ramdisk_vfs.h - RAM Disk Block Device and VFS Adapter
+ *
+ * Presents the RAM disk as block device "rd0" and as a flat filesystem
+ * for the VFS, usually mounted at /ram. Files live contiguously in the
+ * data area, so the map operation can hand out a direct read-only
+ * pointer instead of copying.
+ */
+
+#ifndef RAMDISK_VFS_H
+#define RAMDISK_VFS_H
+
+#include "vfs.h"
+#include "ramdisk.h"
+
+#define RAMDISK_MOUNT_PATH  "/ram"
+
+/* ============================================================================
+ * Block Device
+ *
+ * Raw sector view of the data area (not cached: it is already memory).
+ * ============================================================================ */
+
+static blkdev_t g_ramdisk_dev;
+
+static uint32_t ramdisk_blkdev_read(blkdev_t *dev, uint32_t lba, uint32_t count, void *buf) {
+    ramdisk_t *rd = (ramdisk_t *)dev->driver_data;
+    if (lba >= dev->total_sectors) return 0;
+    if (count > dev->total_sectors - lba) count = dev->total_sectors - lba;
+
+    rd_memcpy(buf, &rd->data[lba * RAMDISK_BLOCK_SIZE], count * RAMDISK_BLOCK_SIZE);
+    return count;
+}
+
+static uint32_t ramdisk_blkdev_write(blkdev_t *dev, uint32_t lba, uint32_t count,
+                                     const void *buf) {
+    ramdisk_t *rd = (ramdisk_t *)dev->driver_data;
+    if (lba >= dev->total_sectors) return 0;
+    if (count > dev->total_sectors - lba) count = dev->total_sectors - lba;
+
+    rd_memcpy(&rd->data[lba * RAMDISK_BLOCK_SIZE], buf, count * RAMDISK_BLOCK_SIZE);
+    return count;
+}
+
+/**
+ * Initialize block device for an (initialized) RAM disk
+ */
+static bool ramdisk_blkdev_init(blkdev_t *dev, ramdisk_t *rd) {
+    if (!rd || !rd->initialized) return false;
+
+    rd_memset(dev, 0, sizeof(*dev));
+    dev->type = BLKDEV_RAMDISK;
+    rd_strcpy(dev->name, "rd0");
+    rd_strcpy(dev->model, "RAM disk");
+    dev->sector_size = RAMDISK_BLOCK_SIZE;
+    dev->total_sectors = rd->data_size / RAMDISK_BLOCK_SIZE;
+    dev->present = true;
+    dev->read = ramdisk_blkdev_read;
+    dev->write = ramdisk_blkdev_write;
+    dev->driver_data = rd;
+    return true;
+}
+
+/* ============================================================================
+ * VFS Operations Implementation
+ * ============================================================================
+ *
+ * The namespace is flat: "/" plus one level of files. Node inodes are
+ * the file table index + 1 (0 is the root).
+ */
+
+/* RAM disk behind a mount */
+static inline ramdisk_t *ramdisk_vfs_disk(vfs_mount_t *mnt) {
+    return (ramdisk_t *)mnt->fs_data;
+}
+
+/* File name from a mount-relative path, or NULL for nested paths */
+static inline const char *ramdisk_vfs_name(const char *path) {
+    while (*path == '/') path++;
+    for (const char *p = path; *p; p++) {
+        if (*p == '/') return NULL;
+    }
+    return path;
+}
+
+static bool ramdisk_vfs_mount(vfs_mount_t *mnt, blkdev_t *dev, const char *opts) {
+    (void)opts;
+    if (!dev || dev->type != BLKDEV_RAMDISK || !dev->driver_data) return false;
+
+    ramdisk_t *rd = (ramdisk_t *)dev->driver_data;
+    if (!rd->initialized) return false;
+
+    mnt->fs_data = rd;
+    return true;
+}
+
+static void ramdisk_vfs_unmount(vfs_mount_t *mnt) {
+    mnt->fs_data = NULL;
+}
+
+static bool ramdisk_vfs_lookup(vfs_mount_t *mnt, const char *path, vfs_node_t *node) {
+    ramdisk_t *rd = ramdisk_vfs_disk(mnt);
+    const char *name = ramdisk_vfs_name(path);
+    if (!rd || !name) return false;
+
+    rd_memset(node, 0, sizeof(*node));
+    node->mount = mnt;
+
+    if (name[0] == '\0') {
+        vfs_strcpy(node->name, "/");
+        node->type = VFS_DIRECTORY;
+        return true;
+    }
+
+    int idx = ramdisk_find(rd, name);
+    if (idx < 0) return false;
+
+    ramdisk_file_t *f = &rd->files[idx];
+    vfs_strcpy(node->name, f->name);
+    node->type = VFS_FILE;
+    node->size = f->size;
+    node->inode = (uint32_t)idx + 1;
+    node->mtime = f->modified;
+    return true;
+}
+
+static bool ramdisk_vfs_stat(vfs_node_t *node, vfs_stat_t *stat) {
+    ramdisk_t *rd = ramdisk_vfs_disk(node->mount);
+    uint32_t flags = 0;
+
+    if (rd && node->inode) {
+        ramdisk_file_t *f = &rd->files[node->inode - 1];
+        flags = f->flags;
+        stat->size = f->size;
+        stat->mtime = f->modified;
+        stat->ctime = f->created;
+    } else {
+        stat->size = node->size;
+        stat->mtime = node->mtime;
+        stat->ctime = 0;
+    }
+    stat->type = node->type;
+    stat->permissions = (flags & RAMDISK_FILE_READONLY) ? 0444 : 0644;
+    if ((flags & RAMDISK_FILE_EXECUTABLE) || node->type == VFS_DIRECTORY) {
+        stat->permissions |= 0111;
+    }
+    stat->uid = 0;
+    stat->gid = 0;
+    stat->atime = 0;
+    stat->blocks = (stat->size + RAMDISK_BLOCK_SIZE - 1) / RAMDISK_BLOCK_SIZE;
+    stat->block_size = RAMDISK_BLOCK_SIZE;
+    stat->inode = node->inode;
+    return true;
+}
+
+static bool ramdisk_vfs_create(vfs_mount_t *mnt, const char *path, uint8_t type) {
+    ramdisk_t *rd = ramdisk_vfs_disk(mnt);
+    const char *name = ramdisk_vfs_name(path);
+    if (!rd || !name || type != VFS_FILE) return false;
+
+    return ramdisk_create(rd, name, 0);
+}
+
+static bool ramdisk_vfs_unlink(vfs_mount_t *mnt, const char *path) {
+    ramdisk_t *rd = ramdisk_vfs_disk(mnt);
+    const char *name = ramdisk_vfs_name(path);
+    if (!rd || !name) return false;
+
+    return ramdisk_delete(rd, name);
+}
+
+static bool ramdisk_vfs_rename(vfs_mount_t *mnt, const char *old_path, const char *new_path) {
+    ramdisk_t *rd = ramdisk_vfs_disk(mnt);
+    const char *old_name = ramdisk_vfs_name(old_path);
+    const char *new_name = ramdisk_vfs_name(new_path);
+    if (!rd || !old_name || !new_name) return false;
+
+    return ramdisk_rename(rd, old_name, new_name);
+}
+
+/* ============================================================================
+ * File Operations
+ * ============================================================================ */
+
+/* One handle per VFS file slot */
+static ramdisk_handle_t g_ramdisk_handles[VFS_MAX_OPEN_FILES];
+
+static bool ramdisk_vfs_open(vfs_file_t *file, uint32_t flags) {
+    ramdisk_t *rd = ramdisk_vfs_disk(file->mount);
+    if (!rd || file->node.type != VFS_FILE) return false;
+
+    ramdisk_handle_t *h = &g_ramdisk_handles[file - g_vfs.files];
+    if (!ramdisk_open(rd, file->node.name, h, (flags & VFS_O_WRONLY) != 0)) {
+        return false;
+    }
+
+    if (flags & VFS_O_TRUNC) {
+        ramdisk_truncate(h);
+        file->node.size = 0;
+    }
+    if (flags & VFS_O_APPEND) {
+        ramdisk_seek_end(h);
+    }
+
+    file->fs_data = h;
+    file->position = h->position;
+    return true;
+}
+
+static void ramdisk_vfs_close(vfs_file_t *file) {
+    ramdisk_handle_t *h = (ramdisk_handle_t *)file->fs_data;
+    if (h) {
+        ramdisk_close(h);
+        file->fs_data = NULL;
+    }
+}
+
+static int32_t ramdisk_vfs_read(vfs_file_t *file, void *buf, uint32_t size) {
+    ramdisk_handle_t *h = (ramdisk_handle_t *)file->fs_data;
+    if (!h) return -1;
+
+    if (!ramdisk_seek(h, file->position)) return 0;
+    uint32_t n = ramdisk_read(h, buf, size);
+    file->position = h->position;
+    return (int32_t)n;
+}
+
+static int32_t ramdisk_vfs_write(vfs_file_t *file, const void *buf, uint32_t size) {
+    ramdisk_handle_t *h = (ramdisk_handle_t *)file->fs_data;
+    if (!h) return -1;
+
+    ramdisk_seek(h, file->position);
+    uint32_t n = ramdisk_write(h, buf, size);
+    if (n == 0 && size > 0) return -1;
+
+    file->position = h->position;
+    file->node.size = h->file->size;
+    file->dirty = true;
+    return (int32_t)n;
+}
+
+static bool ramdisk_vfs_truncate(vfs_file_t *file, uint32_t size) {
+    ramdisk_handle_t *h = (ramdisk_handle_t *)file->fs_data;
+    if (!h || size > h->file->size) return false;
+
+    ramdisk_seek(h, size);
+    ramdisk_truncate(h);
+    file->node.size = size;
+    if (file->position > size) file->position = size;
+    return true;
+}
+
+/**
+ * Direct view of the whole file; stays valid until the handle closes
+ * (the disk will not compact while any file is mapped)
+ */
+static const void *ramdisk_vfs_map(vfs_file_t *file, uint32_t *size) {
+    ramdisk_handle_t *h = (ramdisk_handle_t *)file->fs_data;
+    if (!h) return NULL;
+
+    *size = h->file->size;
+    return ramdisk_map(h);
+}
+
+/* ============================================================================
+ * Directory Operations
+ * ============================================================================ */
+
+static bool ramdisk_vfs_opendir(vfs_dir_t *dir) {
+    if (!ramdisk_vfs_disk(dir->mount) || dir->node.inode != 0) return false;
+    dir->position = 0;
+    return true;
+}
+
+static void ramdisk_vfs_closedir(vfs_dir_t *dir) {
+    (void)dir;
+}
+
+/* dir->position is the next file table index to look at */
+static bool ramdisk_vfs_readdir(vfs_dir_t *dir, vfs_dirent_t *entry) {
+    ramdisk_t *rd = ramdisk_vfs_disk(dir->mount);
+    if (!rd) return false;
+
+    ramdisk_dir_t it = { rd, dir->position, false };
+    ramdisk_file_t f;
+    if (!ramdisk_readdir(&it, &f)) {
+        dir->position = it.index;
+        return false;
+    }
+
+    vfs_strcpy(entry->name, f.name);
+    entry->inode = it.index;        /* Index of f, plus one */
+    entry->type = VFS_FILE;
+    entry->size = f.size;
+    entry->attributes = 0;
+    entry->cluster = 0;
+    entry->mtime = 0;
+    dir->position = it.index;
+    return true;
+}
+
+static void ramdisk_vfs_rewinddir(vfs_dir_t *dir) {
+    dir->position = 0;
+}
+
+static bool ramdisk_vfs_statfs(vfs_mount_t *mnt, uint32_t *total, uint32_t *free) {
+    ramdisk_t *rd = ramdisk_vfs_disk(mnt);
+    if (!rd) return false;
+
+    *total = rd->data_size;
+    *free = rd->data_size - rd->data_used;
+    return true;
+}
+
+static bool ramdisk_vfs_label(vfs_mount_t *mnt, char *buf, size_t len) {
+    (void)mnt;
+    if (len == 0) return false;
+    rd_strncpy(buf, "RAMDISK", (int)len - 1);
+    return true;
+}
+
+/* ============================================================================
+ * RAM Disk VFS Operations Table
+ * ============================================================================ */
+
+static vfs_ops_t g_ramdisk_vfs_ops = {
+    .name      = "ramdisk",
+
+    /* Mount/unmount */
+    .mount     = ramdisk_vfs_mount,
+    .unmount   = ramdisk_vfs_unmount,
+    .sync      = NULL,  /* Nothing to flush */
+
+    /* Node operations */
+    .lookup    = ramdisk_vfs_lookup,
+    .stat      = ramdisk_vfs_stat,
+    .create    = ramdisk_vfs_create,
+    .unlink    = ramdisk_vfs_unlink,
+    .rename    = ramdisk_vfs_rename,
+    .mkdir     = NULL,  /* Flat namespace */
+    .rmdir     = NULL,
+
+    /* File operations */
+    .open      = ramdisk_vfs_open,
+    .close     = ramdisk_vfs_close,
+    .read      = ramdisk_vfs_read,
+    .write     = ramdisk_vfs_write,
+    .seek      = NULL,  /* VFS default */
+    .truncate  = ramdisk_vfs_truncate,
+    .map       = ramdisk_vfs_map,
+
+    /* Directory operations */
+    .opendir   = ramdisk_vfs_opendir,
+    .closedir  = ramdisk_vfs_closedir,
+    .readdir   = ramdisk_vfs_readdir,
+    .rewinddir = ramdisk_vfs_rewinddir,
+
+    /* Filesystem info */
+    .statfs    = ramdisk_vfs_statfs,
+    .label     = ramdisk_vfs_label,
+};
+
+/**
+ * Get RAM disk VFS operations table
+ */
+static inline vfs_ops_t *ramdisk_get_vfs_ops(void) {
+    return &g_ramdisk_vfs_ops;
+}
+
+#endif /* RAMDISK_VFS_H */
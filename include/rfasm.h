@@ -7,7 +7,8 @@
  * Design Philosophy:
  *   - Simple like the C64's ~40 common 6502 instructions
  *   - Two-pass assembly (collect labels, emit code)
- *   - Direct memory output (no object files)
+ *   - Direct memory output (no object files), or streamed line by line
+ *     from a reader to a sink (rfasm_assemble_stream)
  *   - Integrated into OS like machine language monitors
  *
  * Author: Jesse (with Claude)
@@ -30,7 +31,7 @@ extern "C" {
  * ============================================================================ */
 
 #ifndef RFASM_MAX_LABELS
-#define RFASM_MAX_LABELS        64      /* Maximum labels */
+#define RFASM_MAX_LABELS        512     /* Maximum labels (hashed) */
 #endif
 
 #ifndef RFASM_MAX_LABEL_LEN
@@ -46,7 +47,23 @@ extern "C" {
 #endif
 
 #ifndef RFASM_MAX_FIXUPS
-#define RFASM_MAX_FIXUPS        64      /* Maximum forward references */
+#define RFASM_MAX_FIXUPS        512     /* Maximum forward references */
+#endif
+
+#ifndef RFASM_MAX_BRANCHES
+#define RFASM_MAX_BRANCHES      2048    /* JMP/Jcc tracked for relaxation */
+#endif
+
+#ifndef RFASM_MAX_RELAX_PASSES
+#define RFASM_MAX_RELAX_PASSES  8       /* Layout passes before sizes freeze */
+#endif
+
+#ifndef RFASM_LABEL_HASH_SIZE
+#define RFASM_LABEL_HASH_SIZE   (RFASM_MAX_LABELS * 2)  /* Label hash slots */
+#endif
+
+#if RFASM_LABEL_HASH_SIZE <= RFASM_MAX_LABELS
+#error "RFASM_LABEL_HASH_SIZE must exceed RFASM_MAX_LABELS"
 #endif
 
 /* ============================================================================
@@ -66,6 +83,7 @@ typedef enum {
     RFASM_ERR_OUT_OF_RANGE,     /* Value out of range */
     RFASM_ERR_MEMORY,           /* Out of memory/buffer */
     RFASM_ERR_INTERNAL,         /* Internal error */
+    RFASM_ERR_IO,               /* Source or output stream failed */
 } rfasm_error_t;
 
 /* ============================================================================
@@ -240,6 +258,32 @@ typedef struct {
     uint32_t base;              /* Base address for relative (PC after inst) */
 } rfasm_fixup_t;
 
+/* ============================================================================
+ * Streaming Source and Output
+ * ============================================================================ */
+
+/**
+ * Line source for rfasm_assemble_stream. read_line copies the next line
+ * (without its newline, truncated to @size - 1) into @buf and returns
+ * false at end of input; rewind restarts it for the second pass.
+ */
+typedef struct {
+    bool (*read_line)(void *ctx, char *buf, int size);
+    bool (*rewind)(void *ctx);
+    void *ctx;
+} rfasm_reader_t;
+
+/**
+ * Output sink: the output buffer becomes a window that is handed to
+ * write() as it fills. patch() rewrites bytes at an absolute offset that
+ * already left the window (forward-reference fixups).
+ */
+typedef struct {
+    bool (*write)(void *ctx, const uint8_t *data, uint32_t len);
+    bool (*patch)(void *ctx, uint32_t offset, const uint8_t *data, uint32_t len);
+    void *ctx;
+} rfasm_sink_t;
+
 /* ============================================================================
  * Assembler State
  * ============================================================================ */
@@ -249,6 +293,8 @@ typedef struct {
     uint8_t *output;
     uint32_t output_size;
     uint32_t output_capacity;
+    const rfasm_sink_t *sink;   /* Streaming output (NULL = whole image in output) */
+    uint32_t flushed;           /* Bytes already handed to the sink */
 
     /* Origin address */
     uint32_t org;
@@ -257,6 +303,7 @@ typedef struct {
     /* Symbol table */
     rfasm_label_t labels[RFASM_MAX_LABELS];
     int num_labels;
+    uint16_t label_hash[RFASM_LABEL_HASH_SIZE];   /* Label index + 1, 0 = empty */
 
     /* Forward reference fixups */
     rfasm_fixup_t fixups[RFASM_MAX_FIXUPS];
@@ -270,9 +317,19 @@ typedef struct {
     int error_line;
     char error_msg[128];
 
-    /* Current pass (1 or 2) */
+    /* Current pass (1 = layout, possibly repeated; 2 = emit) */
     int pass;
 
+    /* Branch relaxation: one bit per JMP/Jcc in source order, set = rel8 */
+    uint8_t branch_short[(RFASM_MAX_BRANCHES + 7) / 8];
+    int num_branches;           /* Branches seen so far this pass */
+    int relax_passes;           /* Layout passes completed */
+    bool relax_changed;         /* A branch was resized this pass */
+    bool relax_frozen;          /* Stop resizing (pass limit reached) */
+
+    /* Peephole rewrites (smaller encodings that may differ in flags) */
+    bool peephole;
+
     /* Statistics */
     int lines_processed;
     int instructions_emitted;
@@ -347,8 +404,21 @@ static inline bool rfa_isalnum(char c) {
     return rfa_isalpha(c) || rfa_isdigit(c);
 }
 
+#define RFA_HASH_SEED   2166136261u
+
+/**
+ * Case-insensitive FNV-1a over at most *room characters of @s
+ * Chains, so a scoped name hashes as scope and then name without a copy.
+ */
+static inline uint32_t rfa_hash_ci(uint32_t h, const char *s, int *room) {
+    for (; *s && *room > 0; s++, (*room)--) {
+        h = (h ^ (uint8_t)rfa_toupper(*s)) * 16777619u;
+    }
+    return h;
+}
+
 /* ============================================================================
- * Register Lookup Table
+ * Register Lookup Table (ordered by rfasm_reg_t)
  * ============================================================================ */
 
 typedef struct {
@@ -503,6 +573,41 @@ static const inst_entry_t g_instructions[] = {
     { NULL, INST_NONE }
 };
 
+/* ============================================================================
+ * Mnemonic and Register Hashes
+ * ============================================================================ */
+
+#define RFASM_REG_HASH_SIZE     64      /* Power of two, > 2x g_registers */
+#define RFASM_INST_HASH_SIZE    256     /* Power of two, > 2x g_instructions */
+#define RFASM_REG_COUNT         (REG_GS + 1)
+
+/* Table index + 1 per slot (0 = empty), filled once on first lookup */
+static uint8_t g_rfasm_reg_hash[RFASM_REG_HASH_SIZE];
+static uint8_t g_rfasm_inst_hash[RFASM_INST_HASH_SIZE];
+static bool    g_rfasm_hash_ready;
+
+static inline uint32_t rfasm_sym_hash(const char *name) {
+    int room = RFASM_MAX_LINE;
+    return rfa_hash_ci(RFA_HASH_SEED, name, &room);
+}
+
+static void rfasm_hash_insert(uint8_t *table, uint32_t size, const char *name, int index) {
+    uint32_t slot = rfasm_sym_hash(name) & (size - 1);
+    while (table[slot]) slot = (slot + 1) & (size - 1);
+    table[slot] = (uint8_t)(index + 1);
+}
+
+static void rfasm_build_hashes(void) {
+    for (int i = 0; g_registers[i].name != NULL; i++) {
+        rfasm_hash_insert(g_rfasm_reg_hash, RFASM_REG_HASH_SIZE, g_registers[i].name, i);
+    }
+    for (int i = 0; g_instructions[i].mnemonic != NULL; i++) {
+        rfasm_hash_insert(g_rfasm_inst_hash, RFASM_INST_HASH_SIZE,
+                          g_instructions[i].mnemonic, i);
+    }
+    g_rfasm_hash_ready = true;
+}
+
 /* ============================================================================
  * Forward Declarations
  * ============================================================================ */
@@ -510,6 +615,7 @@ static const inst_entry_t g_instructions[] = {
 static void rfasm_init(rfasm_state_t *state, uint8_t *output_buf, uint32_t capacity);
 static void rfasm_reset(rfasm_state_t *state);
 static rfasm_error_t rfasm_assemble(rfasm_state_t *state, const char *source);
+static rfasm_error_t rfasm_assemble_stream(rfasm_state_t *state, const rfasm_reader_t *reader);
 static const char *rfasm_error_string(rfasm_error_t err);
 
 /* Internal functions */
@@ -539,15 +645,24 @@ static void rfasm_init(rfasm_state_t *state, uint8_t *output_buf, uint32_t capac
     state->output = output_buf;
     state->output_size = 0;
     state->output_capacity = capacity;
+    state->sink = NULL;
+    state->flushed = 0;
     state->org = 0;
     state->pc = 0;
     state->num_labels = 0;
+    for (int i = 0; i < RFASM_LABEL_HASH_SIZE; i++) state->label_hash[i] = 0;
     state->num_fixups = 0;
     state->current_scope[0] = '\0';
     state->error = RFASM_OK;
     state->error_line = 0;
     state->error_msg[0] = '\0';
     state->pass = 1;
+    for (int i = 0; i < (int)sizeof(state->branch_short); i++) state->branch_short[i] = 0;
+    state->num_branches = 0;
+    state->relax_passes = 0;
+    state->relax_changed = false;
+    state->relax_frozen = false;
+    state->peephole = false;
     state->lines_processed = 0;
     state->instructions_emitted = 0;
 }
@@ -557,8 +672,11 @@ static void rfasm_init(rfasm_state_t *state, uint8_t *output_buf, uint32_t capac
  */
 static void rfasm_reset(rfasm_state_t *state) {
     state->output_size = 0;
+    state->flushed = 0;
     state->pc = state->org;
     state->num_fixups = 0;
+    state->num_branches = 0;
+    state->relax_changed = false;
     state->current_scope[0] = '\0';
     state->error = RFASM_OK;
     state->error_line = 0;
@@ -571,11 +689,15 @@ static void rfasm_reset(rfasm_state_t *state) {
  * Look up register by name
  */
 static rfasm_reg_t rfasm_lookup_reg(const char *name, uint8_t *size, uint8_t *encoding) {
-    for (int i = 0; g_registers[i].name != NULL; i++) {
-        if (rfa_strcasecmp(name, g_registers[i].name) == 0) {
-            if (size) *size = g_registers[i].size;
-            if (encoding) *encoding = g_registers[i].encoding;
-            return g_registers[i].reg;
+    if (!g_rfasm_hash_ready) rfasm_build_hashes();
+
+    uint32_t slot = rfasm_sym_hash(name) & (RFASM_REG_HASH_SIZE - 1);
+    for (; g_rfasm_reg_hash[slot]; slot = (slot + 1) & (RFASM_REG_HASH_SIZE - 1)) {
+        const reg_entry_t *r = &g_registers[g_rfasm_reg_hash[slot] - 1];
+        if (rfa_strcasecmp(name, r->name) == 0) {
+            if (size) *size = r->size;
+            if (encoding) *encoding = r->encoding;
+            return r->reg;
         }
     }
     return REG_NONE;
@@ -585,9 +707,13 @@ static rfasm_reg_t rfasm_lookup_reg(const char *name, uint8_t *size, uint8_t *en
  * Look up instruction by mnemonic
  */
 static rfasm_inst_t rfasm_lookup_inst(const char *mnemonic) {
-    for (int i = 0; g_instructions[i].mnemonic != NULL; i++) {
-        if (rfa_strcasecmp(mnemonic, g_instructions[i].mnemonic) == 0) {
-            return g_instructions[i].inst;
+    if (!g_rfasm_hash_ready) rfasm_build_hashes();
+
+    uint32_t slot = rfasm_sym_hash(mnemonic) & (RFASM_INST_HASH_SIZE - 1);
+    for (; g_rfasm_inst_hash[slot]; slot = (slot + 1) & (RFASM_INST_HASH_SIZE - 1)) {
+        const inst_entry_t *e = &g_instructions[g_rfasm_inst_hash[slot] - 1];
+        if (rfa_strcasecmp(mnemonic, e->mnemonic) == 0) {
+            return e->inst;
         }
     }
     return INST_NONE;
@@ -597,37 +723,78 @@ static rfasm_inst_t rfasm_lookup_inst(const char *mnemonic) {
  * Get register encoding for ModR/M byte
  */
 static uint8_t rfasm_reg_encoding(rfasm_reg_t reg) {
-    for (int i = 0; g_registers[i].name != NULL; i++) {
-        if (g_registers[i].reg == reg) {
-            return g_registers[i].encoding;
-        }
-    }
-    return 0;
+    return (reg < RFASM_REG_COUNT) ? g_registers[reg].encoding : 0;
 }
 
 /**
  * Get register size
  */
 static uint8_t rfasm_reg_size(rfasm_reg_t reg) {
-    for (int i = 0; g_registers[i].name != NULL; i++) {
-        if (g_registers[i].reg == reg) {
-            return g_registers[i].size;
-        }
+    return (reg < RFASM_REG_COUNT) ? g_registers[reg].size : 4;  /* Default to 32-bit */
+}
+
+/**
+ * Hand the buffered window to the sink (no-op without one)
+ */
+static bool rfasm_flush(rfasm_state_t *state) {
+    uint32_t n = state->output_size - state->flushed;
+    if (!state->sink || n == 0) return true;
+
+    bool ok = state->sink->write(state->sink->ctx, state->output, n);
+    state->flushed = state->output_size;
+    if (!ok && state->error == RFASM_OK) {
+        state->error = RFASM_ERR_IO;
+        rfa_strcpy(state->error_msg, "Output write failed");
     }
-    return 4;  /* Default to 32-bit */
+    return ok;
 }
 
 /**
  * Emit a single byte
  */
 static void rfasm_emit_byte(rfasm_state_t *state, uint8_t b) {
-    if (state->pass == 2 && state->output_size < state->output_capacity) {
-        state->output[state->output_size] = b;
+    if (state->pass == 2) {
+        if (state->sink) {
+            if (state->output_size - state->flushed >= state->output_capacity) {
+                rfasm_flush(state);
+            }
+            state->output[state->output_size - state->flushed] = b;
+        } else if (state->output_size < state->output_capacity) {
+            state->output[state->output_size] = b;
+        }
     }
     state->output_size++;
     state->pc++;
 }
 
+/**
+ * Overwrite @size bytes of emitted output at offset @loc (little-endian)
+ * Bytes still in the window are patched in place, earlier ones through
+ * the sink.
+ */
+static bool rfasm_patch(rfasm_state_t *state, uint32_t loc, uint32_t value, uint8_t size) {
+    uint8_t bytes[4] = { value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24 };
+    uint32_t i = 0;
+
+    if (!state->sink) {
+        if (loc + size > state->output_capacity) return true;  /* Truncated output */
+        for (; i < size; i++) state->output[loc + i] = bytes[i];
+        return true;
+    }
+
+    if (loc < state->flushed) {
+        i = state->flushed - loc;
+        if (i > size) i = size;
+        if (!state->sink->patch(state->sink->ctx, loc, bytes, i)) {
+            state->error = RFASM_ERR_IO;
+            rfa_strcpy(state->error_msg, "Output patch failed");
+            return false;
+        }
+    }
+    for (; i < size; i++) state->output[loc + i - state->flushed] = bytes[i];
+    return true;
+}
+
 /**
  * Emit a 16-bit word (little-endian)
  */
@@ -646,14 +813,44 @@ static void rfasm_emit_dword(rfasm_state_t *state, uint32_t d) {
     rfasm_emit_byte(state, (d >> 24) & 0xFF);
 }
 
+/* Does a stored label name equal @scope + @name (truncated like stored names)? */
+static bool rfasm_label_match(const char *stored, const char *scope, const char *name) {
+    int room = RFASM_MAX_LABEL_LEN - 1;
+    for (const char *s = scope; *s && room > 0; s++, room--, stored++) {
+        if (rfa_toupper(*stored) != rfa_toupper(*s)) return false;
+    }
+    for (const char *s = name; *s && room > 0; s++, room--, stored++) {
+        if (rfa_toupper(*stored) != rfa_toupper(*s)) return false;
+    }
+    return *stored == '\0';
+}
+
+/**
+ * Hash slot for the label (@scope, @name): the one holding it, or the
+ * empty slot where it would go
+ */
+static uint16_t *rfasm_label_slot(rfasm_state_t *state, const char *scope, const char *name) {
+    int room = RFASM_MAX_LABEL_LEN - 1;
+    uint32_t h = rfa_hash_ci(rfa_hash_ci(RFA_HASH_SEED, scope, &room), name, &room);
+    uint32_t slot = h % RFASM_LABEL_HASH_SIZE;
+
+    while (state->label_hash[slot]) {
+        if (rfasm_label_match(state->labels[state->label_hash[slot] - 1].name, scope, name)) break;
+        if (++slot == RFASM_LABEL_HASH_SIZE) slot = 0;
+    }
+    return &state->label_hash[slot];
+}
+
 /**
  * Add a label to the symbol table
  */
 static bool rfasm_add_label(rfasm_state_t *state, const char *name, uint32_t addr) {
     /* Check for duplicate */
-    rfasm_label_t *existing = rfasm_find_label(state, name);
-    if (existing) {
-        if (existing->defined && state->pass == 1) {
+    const char *scope = (name[0] == '.') ? state->current_scope : "";
+    uint16_t *slot = rfasm_label_slot(state, scope, name);
+    if (*slot) {
+        rfasm_label_t *existing = &state->labels[*slot - 1];
+        if (existing->defined && state->pass == 1 && state->relax_passes == 0) {
             state->error = RFASM_ERR_DUPLICATE_LABEL;
             return false;
         }
@@ -669,40 +866,29 @@ static bool rfasm_add_label(rfasm_state_t *state, const char *name, uint32_t add
     }
 
     rfasm_label_t *label = &state->labels[state->num_labels++];
-    rfa_strncpy(label->name, name, RFASM_MAX_LABEL_LEN - 1);
-    label->name[RFASM_MAX_LABEL_LEN - 1] = '\0';
+    rfa_strncpy(label->name, scope, RFASM_MAX_LABEL_LEN - 1);
+    rfa_strncpy(label->name + rfa_strlen(label->name), name,
+                RFASM_MAX_LABEL_LEN - 1 - rfa_strlen(label->name));
     label->address = addr;
     label->defined = true;
     label->is_local = (name[0] == '.');
+    *slot = (uint16_t)state->num_labels;
 
     /* Update scope for non-local labels */
     if (!label->is_local) {
-        rfa_strcpy(state->current_scope, name);
+        rfa_strcpy(state->current_scope, label->name);
     }
 
     return true;
 }
 
 /**
- * Find a label in the symbol table
+ * Find a label in the symbol table (local labels resolve in the current scope)
  */
 static rfasm_label_t *rfasm_find_label(rfasm_state_t *state, const char *name) {
-    /* Handle local labels - prepend current scope */
-    char full_name[RFASM_MAX_LABEL_LEN * 2];
-    if (name[0] == '.') {
-        /* Local label - prepend scope */
-        int len = rfa_strlen(state->current_scope);
-        rfa_strcpy(full_name, state->current_scope);
-        rfa_strcpy(full_name + len, name);
-        name = full_name;
-    }
-
-    for (int i = 0; i < state->num_labels; i++) {
-        if (rfa_strcasecmp(state->labels[i].name, name) == 0) {
-            return &state->labels[i];
-        }
-    }
-    return NULL;
+    const char *scope = (name[0] == '.') ? state->current_scope : "";
+    uint16_t *slot = rfasm_label_slot(state, scope, name);
+    return *slot ? &state->labels[*slot - 1] : NULL;
 }
 
 /**
@@ -721,10 +907,9 @@ static bool rfasm_add_fixup(rfasm_state_t *state, const char *label, uint32_t lo
     if (label[0] == '.') {
         int len = rfa_strlen(state->current_scope);
         rfa_strcpy(fixup->label, state->current_scope);
-        rfa_strcpy(fixup->label + len, label);
+        rfa_strncpy(fixup->label + len, label, RFASM_MAX_LABEL_LEN - 1 - len);
     } else {
         rfa_strncpy(fixup->label, label, RFASM_MAX_LABEL_LEN - 1);
-        fixup->label[RFASM_MAX_LABEL_LEN - 1] = '\0';
     }
 
     fixup->location = loc;
@@ -741,15 +926,8 @@ static bool rfasm_add_fixup(rfasm_state_t *state, const char *label, uint32_t lo
 static bool rfasm_resolve_fixups(rfasm_state_t *state) {
     for (int i = 0; i < state->num_fixups; i++) {
         rfasm_fixup_t *fixup = &state->fixups[i];
-        rfasm_label_t *label = NULL;
-
-        /* Search for label */
-        for (int j = 0; j < state->num_labels; j++) {
-            if (rfa_strcasecmp(state->labels[j].name, fixup->label) == 0) {
-                label = &state->labels[j];
-                break;
-            }
-        }
+        uint16_t slot = *rfasm_label_slot(state, "", fixup->label);
+        rfasm_label_t *label = slot ? &state->labels[slot - 1] : NULL;
 
         if (!label || !label->defined) {
             state->error = RFASM_ERR_UNKNOWN_LABEL;
@@ -768,25 +946,12 @@ static bool rfasm_resolve_fixups(rfasm_state_t *state) {
         }
 
         /* Patch the output */
-        uint32_t loc = fixup->location;
-        switch (fixup->size) {
-            case 1:
-                if (value < -128 || value > 127) {
-                    state->error = RFASM_ERR_OUT_OF_RANGE;
-                    return false;
-                }
-                state->output[loc] = (uint8_t)value;
-                break;
-            case 2:
-                state->output[loc] = value & 0xFF;
-                state->output[loc + 1] = (value >> 8) & 0xFF;
-                break;
-            case 4:
-                state->output[loc] = value & 0xFF;
-                state->output[loc + 1] = (value >> 8) & 0xFF;
-                state->output[loc + 2] = (value >> 16) & 0xFF;
-                state->output[loc + 3] = (value >> 24) & 0xFF;
-                break;
+        if (fixup->size == 1 && (value < -128 || value > 127)) {
+            state->error = RFASM_ERR_OUT_OF_RANGE;
+            return false;
+        }
+        if (!rfasm_patch(state, fixup->location, (uint32_t)value, fixup->size)) {
+            return false;
         }
     }
 
@@ -1192,7 +1357,9 @@ static void rfasm_emit_alu(rfasm_state_t *state, uint8_t opcode_base,
         /* reg/mem, imm */
         bool short_imm = (src->value >= -128 && src->value <= 127 && opsize > 1);
 
-        if (dst->type == OP_REG && dst->reg == REG_EAX && !short_imm) {
+        bool acc = dst->type == OP_REG &&
+                   (dst->reg == REG_AL || ((dst->reg == REG_EAX || dst->reg == REG_AX) && !short_imm));
+        if (acc) {
             /* Special AL/AX/EAX, imm form */
             rfasm_emit_byte(state, opcode_base + 4 + (opsize > 1 ? 1 : 0));
         } else {
@@ -1235,44 +1402,119 @@ static void rfasm_emit_alu(rfasm_state_t *state, uint8_t opcode_base,
     }
 }
 
+static inline bool rfasm_fits_rel8(int32_t rel) {
+    return rel >= -128 && rel <= 127;
+}
+
 /**
- * Emit a conditional jump
+ * Emit a JMP or Jcc: @short_op with rel8, else @long_op (after @prefix if
+ * non-zero) with rel32.
+ *
+ * Layout passes pick the size. A branch to a label starts long unless its
+ * target is already known, and shrinks to rel8 once a later pass sees the
+ * displacement fit. Shrinking only brings code closer together, so a
+ * branch never has to grow back and the layout converges. Absolute
+ * targets are re-checked every pass in both directions. Pass 2 just
+ * replays the recorded sizes.
  */
-static void rfasm_emit_jcc(rfasm_state_t *state, uint8_t cc, rfasm_operand_t *target) {
-    /* Try short jump first (rel8) */
+static bool rfasm_emit_branch(rfasm_state_t *state, uint8_t short_op, uint8_t prefix,
+                              uint8_t long_op, rfasm_operand_t *target) {
+    int idx = state->num_branches++;
+    bool tracked = idx < RFASM_MAX_BRANCHES;
+    uint8_t bit = (uint8_t)(1u << (idx & 7));
+    bool is_short = tracked && (state->branch_short[idx >> 3] & bit);
+
+    bool known = (target->type == OP_IMM);
+    int32_t dest = target->value;
     if (target->type == OP_LABEL) {
         rfasm_label_t *label = rfasm_find_label(state, target->label);
         if (label && label->defined) {
-            int32_t rel = (int32_t)label->address - (int32_t)(state->pc + 2);
-            if (rel >= -128 && rel <= 127) {
-                rfasm_emit_byte(state, 0x70 + cc);
-                rfasm_emit_byte(state, (uint8_t)rel);
-                return;
-            }
+            known = true;
+            dest = (int32_t)label->address;
         }
+    }
 
-        /* Near jump (rel32) with 0F prefix */
-        rfasm_emit_byte(state, 0x0F);
-        rfasm_emit_byte(state, 0x80 + cc);
-
-        if (state->pass == 2) {
-            uint32_t fixup_loc = state->output_size;
-            rfasm_emit_dword(state, 0);  /* Placeholder */
-            rfasm_add_fixup(state, target->label, fixup_loc, 4, true, state->pc);
-        } else {
-            rfasm_emit_dword(state, 0);
+    if (state->pass == 1 && tracked && !state->relax_frozen) {
+        /* A forward label moves back by our own saving if we shrink */
+        int32_t rel = dest - (int32_t)(state->pc + 2);
+        if (!is_short && target->type == OP_LABEL && rel > 0) rel -= prefix ? 4 : 3;
+        bool fits = known && rfasm_fits_rel8(rel);
+        if (fits ? !is_short : (is_short && target->type == OP_IMM)) {
+            state->branch_short[idx >> 3] ^= bit;
+            is_short = fits;
+            state->relax_changed = true;
+        } else if (!known && state->relax_passes == 0) {
+            state->relax_changed = true;    /* Forward target: lay out again */
         }
-    } else if (target->type == OP_IMM) {
-        int32_t rel = target->value - (int32_t)(state->pc + 2);
-        if (rel >= -128 && rel <= 127) {
-            rfasm_emit_byte(state, 0x70 + cc);
-            rfasm_emit_byte(state, (uint8_t)rel);
-        } else {
-            rel = target->value - (int32_t)(state->pc + 6);
-            rfasm_emit_byte(state, 0x0F);
-            rfasm_emit_byte(state, 0x80 + cc);
-            rfasm_emit_dword(state, rel);
+    }
+
+    if (is_short) {
+        rfasm_emit_byte(state, short_op);
+        int32_t rel = dest - (int32_t)(state->pc + 1);
+        if (state->pass == 2 && (!known || !rfasm_fits_rel8(rel))) {
+            state->error = RFASM_ERR_OUT_OF_RANGE;
+            rfa_strcpy(state->error_msg, "Jump target too far for short jump");
+            return false;
         }
+        rfasm_emit_byte(state, (uint8_t)rel);
+        return true;
+    }
+
+    if (prefix) rfasm_emit_byte(state, prefix);
+    rfasm_emit_byte(state, long_op);
+    if (state->pass == 2 && target->type == OP_LABEL && !known) {
+        uint32_t fixup_loc = state->output_size;
+        rfasm_emit_dword(state, 0);  /* Placeholder */
+        return rfasm_add_fixup(state, target->label, fixup_loc, 4, true, state->pc);
+    }
+    rfasm_emit_dword(state, (uint32_t)(dest - (int32_t)(state->pc + 4)));
+    return true;
+}
+
+/**
+ * Emit a conditional jump (errors are left in state->error)
+ */
+static void rfasm_emit_jcc(rfasm_state_t *state, uint8_t cc, rfasm_operand_t *target) {
+    if (target->type == OP_LABEL || target->type == OP_IMM) {
+        rfasm_emit_branch(state, 0x70 + cc, 0x0F, 0x80 + cc, target);
+    }
+}
+
+/**
+ * Peephole: rewrite an instruction into a smaller equivalent
+ *   MOV r, 0       -> XOR r, r
+ *   ADD r, 1       -> INC r      (SUB r, -1 likewise)
+ *   SUB r, 1       -> DEC r      (ADD r, -1 likewise)
+ *   CMP r, 0       -> TEST r, r
+ * For 32/16-bit general registers only. These leave different flags
+ * behind (CF is kept by INC/DEC, set by nothing in XOR), so it is opt-in.
+ */
+static void rfasm_peephole(rfasm_inst_t *inst, rfasm_operand_t *op1, rfasm_operand_t *op2) {
+    if (op1->type != OP_REG || op1->reg > REG_DI || op2->type != OP_IMM) return;
+
+    int32_t v = op2->value;
+    switch (*inst) {
+        case INST_MOV:
+            if (v == 0) {
+                *inst = INST_XOR;
+                *op2 = *op1;
+            }
+            break;
+        case INST_ADD:
+        case INST_SUB:
+            if (v == 1 || v == -1) {
+                *inst = ((*inst == INST_ADD) == (v == 1)) ? INST_INC : INST_DEC;
+                op2->type = OP_NONE;
+            }
+            break;
+        case INST_CMP:
+            if (v == 0) {
+                *inst = INST_TEST;
+                *op2 = *op1;
+            }
+            break;
+        default:
+            break;
     }
 }
 
@@ -1283,6 +1525,8 @@ static bool rfasm_emit_instruction(rfasm_state_t *state, rfasm_inst_t inst,
                                     rfasm_operand_t *op1, rfasm_operand_t *op2) {
     state->instructions_emitted++;
 
+    if (state->peephole) rfasm_peephole(&inst, op1, op2);
+
     switch (inst) {
         /* ===== Data Movement ===== */
         case INST_MOV:
@@ -1625,71 +1869,7 @@ static bool rfasm_emit_instruction(rfasm_state_t *state, rfasm_inst_t inst,
         /* ===== Control Flow ===== */
         case INST_JMP:
             if (op1->type == OP_LABEL || op1->type == OP_IMM) {
-                /* 
-                 * For consistent sizing between passes, we need to decide
-                 * jump size based on information available in pass 1.
-                 * - Backward jumps: label is defined, we can check distance
-                 * - Forward jumps: label not defined in pass 1, assume short (2 bytes)
-                 *   and fix up in pass 2. If too far, we'll error.
-                 */
-                bool use_short = true;  /* Assume short by default */
-                int32_t rel = 0;
-
-                if (op1->type == OP_LABEL) {
-                    rfasm_label_t *label = rfasm_find_label(state, op1->label);
-                    if (label && label->defined) {
-                        /* Backward jump - we know the distance */
-                        rel = (int32_t)label->address - (int32_t)(state->pc + 2);
-                        if (rel < -128 || rel > 127) {
-                            use_short = false;  /* Need near jump */
-                        }
-                    }
-                    /* Forward jump (label not yet defined) - assume short */
-                } else if (op1->type == OP_IMM) {
-                    rel = op1->value - (int32_t)(state->pc + 2);
-                    if (rel < -128 || rel > 127) {
-                        use_short = false;
-                    }
-                }
-
-                if (use_short) {
-                    rfasm_emit_byte(state, 0xEB);
-                    if (state->pass == 2 && op1->type == OP_LABEL) {
-                        rfasm_label_t *label = rfasm_find_label(state, op1->label);
-                        if (label && label->defined) {
-                            rel = (int32_t)label->address - (int32_t)(state->pc + 1);
-                            if (rel < -128 || rel > 127) {
-                                state->error = RFASM_ERR_OUT_OF_RANGE;
-                                rfa_strcpy(state->error_msg, "Jump target too far for short jump");
-                                return false;
-                            }
-                            rfasm_emit_byte(state, (uint8_t)rel);
-                        } else {
-                            /* Forward reference - add fixup */
-                            uint32_t fixup_loc = state->output_size;
-                            rfasm_emit_byte(state, 0);
-                            rfasm_add_fixup(state, op1->label, fixup_loc, 1, true, state->pc);
-                        }
-                    } else if (op1->type == OP_IMM) {
-                        rfasm_emit_byte(state, (uint8_t)rel);
-                    } else {
-                        /* Pass 1 - emit placeholder */
-                        rfasm_emit_byte(state, 0);
-                    }
-                } else {
-                    /* Near jump (5 bytes) */
-                    rfasm_emit_byte(state, 0xE9);
-                    if (state->pass == 2 && op1->type == OP_LABEL) {
-                        uint32_t fixup_loc = state->output_size;
-                        rfasm_emit_dword(state, 0);
-                        rfasm_add_fixup(state, op1->label, fixup_loc, 4, true, state->pc);
-                    } else if (op1->type == OP_IMM) {
-                        rel = op1->value - (int32_t)(state->pc + 4);
-                        rfasm_emit_dword(state, rel);
-                    } else {
-                        rfasm_emit_dword(state, 0);
-                    }
-                }
+                if (!rfasm_emit_branch(state, 0xEB, 0, 0xE9, op1)) return false;
             } else if (op1->type == OP_REG) {
                 rfasm_emit_byte(state, 0xFF);
                 rfasm_emit_byte(state, rfasm_modrm(3, 4, rfasm_reg_encoding(op1->reg)));
@@ -2189,91 +2369,114 @@ static bool rfasm_parse_line(rfasm_state_t *state, const char *line) {
 }
 
 /**
- * Assemble source code (main entry point)
+ * Run one pass over every line from @reader
  */
-static rfasm_error_t rfasm_assemble(rfasm_state_t *state, const char *source) {
-    /* Pass 1: Collect labels */
-    state->pass = 1;
-    state->pc = state->org;
-
-    const char *line_start = source;
+static bool rfasm_run_pass(rfasm_state_t *state, const rfasm_reader_t *reader) {
+    char line_buf[RFASM_MAX_LINE];
     int line_num = 1;
 
-    while (*line_start) {
-        /* Find end of line */
-        const char *line_end = line_start;
-        while (*line_end && *line_end != '\n') line_end++;
-
-        /* Copy line to buffer */
-        char line_buf[RFASM_MAX_LINE];
-        int line_len = line_end - line_start;
-        if (line_len >= RFASM_MAX_LINE) line_len = RFASM_MAX_LINE - 1;
-
-        for (int i = 0; i < line_len; i++) {
-            line_buf[i] = line_start[i];
-        }
-        line_buf[line_len] = '\0';
-
+    while (reader->read_line(reader->ctx, line_buf, RFASM_MAX_LINE)) {
         /* Strip CR if present */
+        int line_len = rfa_strlen(line_buf);
         if (line_len > 0 && line_buf[line_len - 1] == '\r') {
             line_buf[line_len - 1] = '\0';
         }
 
-        /* Process line */
-        if (!rfasm_parse_line(state, line_buf)) {
+        /* Process line (emit errors such as a failed flush surface here too) */
+        if (!rfasm_parse_line(state, line_buf) || state->error != RFASM_OK) {
             state->error_line = line_num;
-            return state->error;
+            return false;
         }
 
-        state->lines_processed++;
-
-        /* Next line */
-        if (*line_end == '\n') line_end++;
-        line_start = line_end;
+        if (state->pass == 1) state->lines_processed++;
         line_num++;
     }
+    return true;
+}
+
+/**
+ * Assemble from a line source (layout passes, then emit; rewinding in between)
+ * Only one line is resident at a time; with state->sink set the output
+ * buffer is just a write window, so neither side depends on program size.
+ */
+static rfasm_error_t rfasm_assemble_stream(rfasm_state_t *state, const rfasm_reader_t *reader) {
+    /* Pass 1: Collect labels, then lay out again until no branch changes size */
+    state->pass = 1;
+    state->pc = state->org;
+    state->relax_passes = 0;
+    state->relax_frozen = false;
+
+    for (;;) {
+        if (!rfasm_run_pass(state, reader)) {
+            return state->error;
+        }
+        if (!reader->rewind(reader->ctx)) {
+            state->error = RFASM_ERR_IO;
+            rfa_strcpy(state->error_msg, "Cannot rewind source");
+            return state->error;
+        }
+        if (!state->relax_changed) break;
+
+        /* Sizes freeze on the last pass so its label addresses are final */
+        if (++state->relax_passes >= RFASM_MAX_RELAX_PASSES - 1) state->relax_frozen = true;
+        rfasm_reset(state);
+    }
 
     /* Pass 2: Emit code */
     state->pass = 2;
     rfasm_reset(state);
     state->pass = 2;
 
-    line_start = source;
-    line_num = 1;
+    if (!rfasm_run_pass(state, reader)) {
+        return state->error;
+    }
 
-    while (*line_start) {
-        const char *line_end = line_start;
-        while (*line_end && *line_end != '\n') line_end++;
+    /* Resolve forward references, then push out the last window */
+    if (!rfasm_resolve_fixups(state) || !rfasm_flush(state)) {
+        return state->error;
+    }
 
-        char line_buf[RFASM_MAX_LINE];
-        int line_len = line_end - line_start;
-        if (line_len >= RFASM_MAX_LINE) line_len = RFASM_MAX_LINE - 1;
+    if (!state->sink && state->output_size > state->output_capacity) {
+        state->error = RFASM_ERR_MEMORY;
+        rfa_strcpy(state->error_msg, "Output exceeds buffer");
+        return state->error;
+    }
 
-        for (int i = 0; i < line_len; i++) {
-            line_buf[i] = line_start[i];
-        }
-        line_buf[line_len] = '\0';
+    return RFASM_OK;
+}
 
-        if (line_len > 0 && line_buf[line_len - 1] == '\r') {
-            line_buf[line_len - 1] = '\0';
-        }
+/* In-memory source for rfasm_assemble */
+typedef struct {
+    const char *source;
+    const char *pos;
+} rfasm_string_src_t;
 
-        if (!rfasm_parse_line(state, line_buf)) {
-            state->error_line = line_num;
-            return state->error;
-        }
+static bool rfasm_string_read_line(void *ctx, char *buf, int size) {
+    rfasm_string_src_t *src = (rfasm_string_src_t *)ctx;
+    if (!*src->pos) return false;
 
-        if (*line_end == '\n') line_end++;
-        line_start = line_end;
-        line_num++;
+    int len = 0;
+    for (; *src->pos && *src->pos != '\n'; src->pos++) {
+        if (len < size - 1) buf[len++] = *src->pos;
     }
+    if (*src->pos == '\n') src->pos++;
+    buf[len] = '\0';
+    return true;
+}
 
-    /* Resolve forward references */
-    if (!rfasm_resolve_fixups(state)) {
-        return state->error;
-    }
+static bool rfasm_string_rewind(void *ctx) {
+    rfasm_string_src_t *src = (rfasm_string_src_t *)ctx;
+    src->pos = src->source;
+    return true;
+}
 
-    return RFASM_OK;
+/**
+ * Assemble source code (main entry point)
+ */
+static rfasm_error_t rfasm_assemble(rfasm_state_t *state, const char *source) {
+    rfasm_string_src_t src = { source, source };
+    rfasm_reader_t reader = { rfasm_string_read_line, rfasm_string_rewind, &src };
+    return rfasm_assemble_stream(state, &reader);
 }
 
 /**
@@ -2293,6 +2496,7 @@ static const char *rfasm_error_string(rfasm_error_t err) {
         case RFASM_ERR_OUT_OF_RANGE:    return "Value out of range";
         case RFASM_ERR_MEMORY:          return "Out of memory";
         case RFASM_ERR_INTERNAL:        return "Internal error";
+        case RFASM_ERR_IO:              return "I/O error";
         default:                        return "Unknown error";
     }
 }
@@ -2,7 +2,8 @@
  * rfasm_shell.h - RF-ASM Shell Integration
  *
  * Provides shell commands for the RetroFuture assembler:
- *   - asm <source> [output]    - Assemble source file to binary
+ *   - asm [-O] <source> [output] - Assemble source file to binary
+ *                                (-O enables peephole rewrites)
  *   - hexdump <file> [offset]  - Hex dump of file or memory
  *   - asmhelp                  - Show instruction reference
  *
@@ -31,11 +32,16 @@
 #define RFASM_OUTPUT_BUFFER_SIZE    8192
 #endif
 
-/* Source buffer for reading files */
+/* Scratch buffer for file hexdumps */
 #ifndef RFASM_SOURCE_BUFFER_SIZE
 #define RFASM_SOURCE_BUFFER_SIZE    8192
 #endif
 
+/* Read-ahead for streamed source files */
+#ifndef RFASM_READ_BUFFER_SIZE
+#define RFASM_READ_BUFFER_SIZE      512
+#endif
+
 /* ============================================================================
  * Global Buffers (static allocation for OS use)
  * ============================================================================ */
@@ -44,22 +50,138 @@ static uint8_t  g_rfasm_output[RFASM_OUTPUT_BUFFER_SIZE];
 static char     g_rfasm_source[RFASM_SOURCE_BUFFER_SIZE];
 static rfasm_state_t g_rfasm_state;
 
+/* ============================================================================
+ * VFS Streaming - source lines in through a small buffer, output out
+ * ============================================================================ */
+
+typedef struct {
+    vfs_file_t *file;
+    char     buf[RFASM_READ_BUFFER_SIZE];
+    uint32_t head;          /* Next unread byte in buf */
+    uint32_t count;         /* Valid bytes in buf */
+    bool     eof;
+    bool     failed;        /* vfs_read returned an error */
+} rfasm_vfs_reader_t;
+
+static bool rfasm_vfs_refill(rfasm_vfs_reader_t *r) {
+    if (r->eof) return false;
+
+    int32_t n = vfs_read(r->file, r->buf, RFASM_READ_BUFFER_SIZE);
+    if (n <= 0) {
+        r->eof = true;
+        r->failed = (n < 0);
+        return false;
+    }
+    r->head = 0;
+    r->count = (uint32_t)n;
+    return true;
+}
+
+static bool rfasm_vfs_read_line(void *ctx, char *buf, int size) {
+    rfasm_vfs_reader_t *r = (rfasm_vfs_reader_t *)ctx;
+    if (r->head == r->count && !rfasm_vfs_refill(r)) return false;
+
+    int len = 0;
+    while (r->head < r->count || rfasm_vfs_refill(r)) {
+        char c = r->buf[r->head++];
+        if (c == '\n') break;
+        if (len < size - 1) buf[len++] = c;
+    }
+    buf[len] = '\0';
+    return true;
+}
+
+static bool rfasm_vfs_rewind(void *ctx) {
+    rfasm_vfs_reader_t *r = (rfasm_vfs_reader_t *)ctx;
+    r->head = r->count = 0;
+    r->eof = false;
+    return vfs_seek(r->file, 0, VFS_SEEK_SET) == 0;
+}
+
+static bool rfasm_vfs_write(void *ctx, const uint8_t *data, uint32_t len) {
+    return vfs_write((vfs_file_t *)ctx, data, len) == (int32_t)len;
+}
+
+/* Rewrite bytes behind the write position, then return to the end */
+static bool rfasm_vfs_patch(void *ctx, uint32_t offset, const uint8_t *data, uint32_t len) {
+    vfs_file_t *file = (vfs_file_t *)ctx;
+    int32_t end = vfs_seek(file, 0, VFS_SEEK_CUR);
+    bool ok = end >= 0 && vfs_seek(file, (int32_t)offset, VFS_SEEK_SET) >= 0 &&
+              vfs_write(file, data, len) == (int32_t)len;
+    return ok && vfs_seek(file, end, VFS_SEEK_SET) >= 0;
+}
+
+/**
+ * Assemble the open file @src (NULL = assemble @text) into @state,
+ * streaming the image to @out when given
+ */
+static rfasm_error_t rfasm_shell_assemble(rfasm_state_t *state, vfs_file_t *src,
+                                          const char *text, vfs_file_t *out) {
+    static rfasm_vfs_reader_t reader;
+    rfasm_sink_t sink = { rfasm_vfs_write, rfasm_vfs_patch, out };
+    rfasm_error_t err;
+
+    if (out) state->sink = &sink;
+    if (src) {
+        reader.file = src;
+        reader.head = reader.count = 0;
+        reader.eof = reader.failed = false;
+        rfasm_reader_t lines = { rfasm_vfs_read_line, rfasm_vfs_rewind, &reader };
+        err = rfasm_assemble_stream(state, &lines);
+        if (err == RFASM_OK && reader.failed) {
+            state->error = err = RFASM_ERR_IO;
+            rfa_strcpy(state->error_msg, "Source read failed");
+        }
+    } else {
+        err = rfasm_assemble(state, text);
+    }
+    state->sink = NULL;
+    return err;
+}
+
+/* Is the whole last image still in g_rfasm_output? */
+static bool rfasm_shell_have_output(shell_state_t *sh) {
+    if (g_rfasm_state.output_size == 0) {
+        sh->io->printf("No assembly output available.\n");
+        return false;
+    }
+    if (g_rfasm_state.output_size > RFASM_OUTPUT_BUFFER_SIZE) {
+        sh->io->printf("Last output (%u bytes) was streamed to its file only.\n",
+                      g_rfasm_state.output_size);
+        return false;
+    }
+    return true;
+}
+
 /* ============================================================================
  * ASM Command - Assemble source file
  *
- * Usage: asm <source.asm> [output.bin]
+ * Usage: asm [-O] <source.asm> [output.bin]
  *        asm -e "MOV EAX, 42"     - Assemble expression inline
  * ============================================================================ */
 
+/* Strip a leading -O (peephole) flag */
+static bool rfasm_shell_opt_flag(int *argc, char ***argv) {
+    if (*argc > 1 && rfa_strcmp((*argv)[1], "-O") == 0) {
+        (*argv)[1] = (*argv)[0];
+        (*argc)--;
+        (*argv)++;
+        return true;
+    }
+    return false;
+}
+
 static void sh_cmd_asm(shell_state_t *sh, int argc, char **argv) {
+    bool optimize = rfasm_shell_opt_flag(&argc, &argv);
     if (argc < 2) {
-        sh->io->printf("Usage: asm <source.asm> [output.bin]\n");
+        sh->io->printf("Usage: asm [-O] <source.asm> [output.bin]\n");
         sh->io->printf("       asm -e \"instruction\"  (inline assembly)\n");
         sh->last_result = 1;
         return;
     }
 
     const char *source_text = NULL;
+    const char *source_path = NULL;
     const char *output_path = NULL;
     bool inline_mode = false;
 
@@ -75,37 +197,42 @@ static void sh_cmd_asm(shell_state_t *sh, int argc, char **argv) {
         if (argc > 3) output_path = argv[3];
     } else {
         /* File mode */
-        const char *source_path = argv[1];
+        source_path = argv[1];
         if (argc > 2) output_path = argv[2];
+    }
 
-        /* Read source file */
-        vfs_file_t *src_file = vfs_open(source_path, VFS_O_RDONLY);
+    /* Open source; it is read one line at a time, twice */
+    vfs_file_t *src_file = NULL;
+    if (source_path) {
+        src_file = vfs_open(source_path, VFS_O_RDONLY);
         if (!src_file) {
             sh->io->printf("Error: Cannot open '%s'\n", source_path);
             sh->last_result = 1;
             return;
         }
+        sh->io->printf("Assembling '%s' (%u bytes)...\n", source_path, src_file->node.size);
+    }
 
-        int32_t bytes_read = vfs_read(src_file, g_rfasm_source, RFASM_SOURCE_BUFFER_SIZE - 1);
-        vfs_close(src_file);
-
-        if (bytes_read < 0) {
-            sh->io->printf("Error: Failed to read '%s'\n", source_path);
+    /* Output streams straight into the file if specified */
+    vfs_file_t *out_file = NULL;
+    if (output_path) {
+        out_file = vfs_open(output_path, VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC);
+        if (!out_file) {
+            sh->io->printf("Error: Cannot create '%s'\n", output_path);
+            if (src_file) vfs_close(src_file);
             sh->last_result = 1;
             return;
         }
-
-        g_rfasm_source[bytes_read] = '\0';
-        source_text = g_rfasm_source;
-
-        sh->io->printf("Assembling '%s' (%d bytes)...\n", source_path, bytes_read);
     }
 
     /* Initialize assembler */
     rfasm_init(&g_rfasm_state, g_rfasm_output, RFASM_OUTPUT_BUFFER_SIZE);
+    g_rfasm_state.peephole = optimize;
 
     /* Assemble */
-    rfasm_error_t err = rfasm_assemble(&g_rfasm_state, source_text);
+    rfasm_error_t err = rfasm_shell_assemble(&g_rfasm_state, src_file, source_text, out_file);
+    if (src_file) vfs_close(src_file);
+    if (out_file) vfs_close(out_file);
 
     if (err != RFASM_OK) {
         sh->io->printf("Error on line %d: %s\n", 
@@ -123,29 +250,8 @@ static void sh_cmd_asm(shell_state_t *sh, int argc, char **argv) {
     sh->io->printf("  Labels: %d\n", g_rfasm_state.num_labels);
     sh->io->printf("  Output: %u bytes\n", g_rfasm_state.output_size);
 
-    /* Write output file if specified */
     if (output_path) {
-        /* Create output file */
-        if (!vfs_create(output_path, VFS_FILE)) {
-            /* File might already exist, try opening anyway */
-        }
-
-        vfs_file_t *out_file = vfs_open(output_path, VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC);
-        if (!out_file) {
-            sh->io->printf("Error: Cannot create '%s'\n", output_path);
-            sh->last_result = 1;
-            return;
-        }
-
-        int32_t written = vfs_write(out_file, g_rfasm_output, g_rfasm_state.output_size);
-        vfs_close(out_file);
-
-        if (written != (int32_t)g_rfasm_state.output_size) {
-            sh->io->printf("Warning: Only wrote %d of %u bytes\n", 
-                          written, g_rfasm_state.output_size);
-        } else {
-            sh->io->printf("  Wrote: %s\n", output_path);
-        }
+        sh->io->printf("  Wrote: %s\n", output_path);
     } else if (inline_mode) {
         /* Show hex dump for inline mode */
         sh->io->printf("\nOutput (%u bytes):\n", g_rfasm_state.output_size);
@@ -178,8 +284,7 @@ static void sh_cmd_hexdump(shell_state_t *sh, int argc, char **argv) {
 
     if (rfa_strcmp(argv[1], "-l") == 0) {
         /* Last assembly output */
-        if (g_rfasm_state.output_size == 0) {
-            sh->io->printf("No assembly output available.\n");
+        if (!rfasm_shell_have_output(sh)) {
             sh->last_result = 1;
             return;
         }
@@ -313,8 +418,7 @@ static void sh_cmd_run(shell_state_t *sh, int argc, char **argv) {
 
     if (rfa_strcmp(argv[1], "-l") == 0) {
         /* Run last assembly output */
-        if (g_rfasm_state.output_size == 0) {
-            sh->io->printf("Error: No assembly output available.\n");
+        if (!rfasm_shell_have_output(sh)) {
             sh->io->printf("Use 'asm' to assemble code first.\n");
             sh->last_result = 1;
             return;
@@ -546,7 +650,7 @@ static void sh_cmd_monitor(shell_state_t *sh, int argc, char **argv) {
         }
 
         /* Try to assemble the line as an instruction */
-        rfasm_state_t asm_state;
+        static rfasm_state_t asm_state;     /* Too large for a thread stack */
         uint8_t temp_output[32];  /* Single instruction won't be more than 15 bytes */
         rfasm_init(&asm_state, temp_output, sizeof(temp_output));
         asm_state.org = g_monitor.current_addr;
@@ -592,12 +696,13 @@ static void sh_cmd_monitor(shell_state_t *sh, int argc, char **argv) {
 /* ============================================================================
  * ASM2MEM Command - Assemble directly to memory address
  *
- * Usage: asm2mem <address> <source_file>
+ * Usage: asm2mem [-O] <address> <source_file>
  * ============================================================================ */
 
 static void sh_cmd_asm2mem(shell_state_t *sh, int argc, char **argv) {
+    bool optimize = rfasm_shell_opt_flag(&argc, &argv);
     if (argc < 3) {
-        sh->io->printf("Usage: asm2mem <address> <source_file>\n");
+        sh->io->printf("Usage: asm2mem [-O] <address> <source_file>\n");
         sh->io->printf("Assembles file directly to memory address.\n");
         sh->last_result = 1;
         return;
@@ -612,7 +717,7 @@ static void sh_cmd_asm2mem(shell_state_t *sh, int argc, char **argv) {
         return;
     }
 
-    /* Read source file */
+    /* Open source (streamed, never loaded whole) */
     vfs_file_t *src_file = vfs_open(argv[2], VFS_O_RDONLY);
     if (!src_file) {
         sh->io->printf("Error: Cannot open '%s'\n", argv[2]);
@@ -620,23 +725,14 @@ static void sh_cmd_asm2mem(shell_state_t *sh, int argc, char **argv) {
         return;
     }
 
-    int32_t bytes_read = vfs_read(src_file, g_rfasm_source, RFASM_SOURCE_BUFFER_SIZE - 1);
-    vfs_close(src_file);
-
-    if (bytes_read < 0) {
-        sh->io->printf("Error: Failed to read '%s'\n", argv[2]);
-        sh->last_result = 1;
-        return;
-    }
-
-    g_rfasm_source[bytes_read] = '\0';
-
     /* Assemble directly to target memory */
     uint8_t *target = (uint8_t *)(uintptr_t)addr_val;
     rfasm_init(&g_rfasm_state, target, 65536);  /* Assume 64K max */
     g_rfasm_state.org = (uint32_t)addr_val;
+    g_rfasm_state.peephole = optimize;
 
-    rfasm_error_t err = rfasm_assemble(&g_rfasm_state, g_rfasm_source);
+    rfasm_error_t err = rfasm_shell_assemble(&g_rfasm_state, src_file, NULL, NULL);
+    vfs_close(src_file);
 
     if (err != RFASM_OK) {
         sh->io->printf("Error on line %d: %s\n",
@@ -0,0 +1,306 @@
+/**
+ * sched.h - Cooperative Kernel Threads
+ *
+ * Kernel threads run on their own kmalloc'd stacks and give up the CPU
+ * only at well-defined points: kthread_yield(), one step of a wait loop
+ * (sched_wait_yield(), called by timer sleeps, disk IRQ waits and the
+ * keyboard), or kthread_exit(). There is no preemption, so code between
+ * those points runs atomically with respect to other threads; IRQ
+ * handlers never switch and never touch the run queue.
+ *
+ * The boot thread (the shell) is thread 0 and keeps the boot stack. It
+ * never exits, so the run queue is never empty while another thread runs.
+ * A thread in a wait loop stays runnable: once every thread is waiting
+ * and each has had a turn, the wait step tells its caller to halt until
+ * the next interrupt instead of cycling through the queue.
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "intrusive_list_fast.h"
+#include "heap.h"
+
+/* ============================================================================
+ * Configuration
+ * ============================================================================ */
+
+#define KTHREAD_STACK_SIZE  16384       /* Same as the boot stack (entry.asm) */
+#define KTHREAD_NAME_LEN    16
+#define KTHREAD_MAX         16          /* Live threads, boot thread included */
+
+#define KTHREAD_EFLAGS      0x202       /* IF set, reserved bit 1 */
+
+/* ============================================================================
+ * Types
+ * ============================================================================ */
+
+typedef void (*kthread_fn)(void *arg);
+
+typedef enum {
+    KTHREAD_READY = 0,                  /* On the run queue */
+    KTHREAD_RUNNING,
+    KTHREAD_DEAD,                       /* Exited, stack not yet freed */
+} kthread_state_t;
+
+typedef struct kthread {
+    ilist_node_t    link;               /* Run queue or dead list */
+    ilist_node_t    all_link;           /* g_sched.all */
+    uint32_t        esp;                /* Saved stack pointer while switched out */
+    uint8_t        *stack;              /* NULL for the boot thread */
+    uint32_t        stack_size;
+    kthread_fn      fn;
+    void           *arg;
+    uint32_t        id;
+    kthread_state_t state;
+    bool            waiting;            /* Switched out from a wait loop */
+    uint32_t        switches;           /* Times switched in */
+    char            name[KTHREAD_NAME_LEN];
+} kthread_t;
+
+typedef struct {
+    kthread_t    *current;
+    kthread_t     boot;                 /* Thread 0 */
+    ilist_head_t  run;                  /* Ready threads, round robin */
+    ilist_head_t  all;                  /* Every live thread, by creation */
+    ilist_head_t  dead;                 /* Stacks freed after the next switch */
+    uint32_t      count;                /* Live threads */
+    uint32_t      waiting;              /* Live threads inside a wait loop */
+    uint32_t      idle_turns;           /* Wait steps while all threads wait */
+    uint32_t      next_id;
+
+    /* Statistics */
+    uint32_t      created;
+    uint32_t      switches;
+    uint32_t      halts;                /* Wait steps that let the CPU halt */
+
+    bool          initialized;
+} sched_state_t;
+
+static sched_state_t g_sched;
+
+/* kernel/switch.asm */
+extern void ctx_switch(uint32_t *save_esp, uint32_t next_esp);
+
+/* ============================================================================
+ * Scheduler
+ * ============================================================================ */
+
+static inline kthread_t *kthread_current(void) {
+    return g_sched.current;
+}
+
+static void kthread_set_name(kthread_t *t, const char *name) {
+    int i = 0;
+    for (; name && name[i] && i < KTHREAD_NAME_LEN - 1; i++) t->name[i] = name[i];
+    t->name[i] = '\0';
+}
+
+/* Adopt the running context (boot stack) as thread 0 */
+static void sched_init(void) {
+    kthread_t *t = &g_sched.boot;
+
+    ilist_init_head(&g_sched.run);
+    ilist_init_head(&g_sched.all);
+    ilist_init_head(&g_sched.dead);
+
+    ilist_init_node(&t->link);
+    ilist_init_node(&t->all_link);
+    t->state = KTHREAD_RUNNING;
+    t->id = 0;
+    kthread_set_name(t, "kernel");
+    ilist_push_back(&g_sched.all, &t->all_link);
+
+    g_sched.current = t;
+    g_sched.count = 1;
+    g_sched.next_id = 1;
+    g_sched.initialized = true;
+}
+
+/* Free the threads that have exited (never the running one) */
+static void sched_reap(void) {
+    while (!ilist_is_empty(&g_sched.dead)) {
+        kthread_t *t = ilist_entry(ilist_pop_front(&g_sched.dead), kthread_t, link);
+        ilist_remove(&t->all_link);
+        kfree(t->stack);
+        kfree(t);
+    }
+}
+
+/* Run @next; the caller has already queued, or retired, the current thread */
+static void sched_switch_to(kthread_t *next) {
+    kthread_t *prev = g_sched.current;
+
+    next->state = KTHREAD_RUNNING;
+    next->switches++;
+    g_sched.switches++;
+    g_sched.current = next;
+    ctx_switch(&prev->esp, next->esp);
+
+    /* Back on prev's stack */
+    sched_reap();
+}
+
+/**
+ * Let the next runnable thread run; returns when this one comes round
+ * again (immediately if nothing else is runnable)
+ * @return true if another thread ran
+ */
+static bool kthread_yield(void) {
+    if (!g_sched.initialized || ilist_is_empty(&g_sched.run)) return false;
+
+    kthread_t *self = g_sched.current;
+    kthread_t *next = ilist_entry(ilist_pop_front(&g_sched.run), kthread_t, link);
+    self->state = KTHREAD_READY;
+    ilist_push_back(&g_sched.run, &self->link);
+    sched_switch_to(next);
+    return true;
+}
+
+/**
+ * One step of a wait loop: run the other threads while this one waits
+ * @return false if the caller should halt until the next interrupt:
+ *         nothing else is runnable, or every thread is waiting and each
+ *         has checked its condition since the last halt
+ */
+static bool sched_wait_yield(void) {
+    if (!g_sched.initialized || ilist_is_empty(&g_sched.run)) return false;
+
+    if (g_sched.waiting + 1 == g_sched.count) {
+        if (++g_sched.idle_turns > g_sched.count) {
+            g_sched.idle_turns = 0;
+            g_sched.halts++;
+            return false;
+        }
+    } else {
+        g_sched.idle_turns = 0;
+    }
+
+    kthread_t *self = g_sched.current;
+    self->waiting = true;
+    g_sched.waiting++;
+    kthread_yield();
+    self->waiting = false;
+    g_sched.waiting--;
+    return true;
+}
+
+/* Halt until the next interrupt when one can arrive, else just pause */
+static inline void sched_halt(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushfl; popl %0" : "=r"(flags));
+    if (flags & 0x200) __asm__ volatile ("hlt");
+    else               __asm__ volatile ("pause");
+}
+
+/**
+ * End the calling thread (thread 0 cannot exit). Its stack is freed by
+ * whichever thread runs next.
+ */
+static void kthread_exit(void) {
+    kthread_t *self = g_sched.current;
+    if (self == &g_sched.boot) return;
+
+    self->state = KTHREAD_DEAD;
+    g_sched.count--;
+    ilist_push_back(&g_sched.dead, &self->link);
+
+    /* Thread 0 is always live, so someone is runnable */
+    sched_switch_to(ilist_entry(ilist_pop_front(&g_sched.run), kthread_t, link));
+}
+
+/* Where ctx_switch first returns to on a new thread's stack */
+static void kthread_start(void) {
+    sched_reap();
+
+    kthread_t *self = g_sched.current;
+    self->fn(self->arg);
+    kthread_exit();
+}
+
+/**
+ * Start a thread running @fn(@arg); it is queued behind the threads
+ * already runnable and first runs at the caller's next yield
+ * @param stack_size  Bytes of stack (0 = KTHREAD_STACK_SIZE)
+ * @return            NULL if the thread limit is reached or out of memory
+ */
+static kthread_t *kthread_create(const char *name, kthread_fn fn, void *arg,
+                                 uint32_t stack_size) {
+    if (!g_sched.initialized || g_sched.count >= KTHREAD_MAX) return NULL;
+    if (!stack_size) stack_size = KTHREAD_STACK_SIZE;
+
+    kthread_t *t = (kthread_t *)kmalloc(sizeof(kthread_t));
+    uint8_t *stack = t ? (uint8_t *)kmalloc(stack_size) : NULL;
+    if (!stack) {
+        kfree(t);
+        return NULL;
+    }
+
+    ilist_init_node(&t->link);
+    ilist_init_node(&t->all_link);
+    t->stack = stack;
+    t->stack_size = stack_size;
+    t->fn = fn;
+    t->arg = arg;
+    t->id = g_sched.next_id++;
+    t->state = KTHREAD_READY;
+    t->waiting = false;
+    t->switches = 0;
+    kthread_set_name(t, name);
+
+    /*
+     * Seed the frame ctx_switch unwinds. The slot above kthread_start's
+     * return address is its (unused) return address, placed so the stack
+     * is 16-byte aligned at entry as GCC assumes.
+     */
+    uint32_t *sp = (uint32_t *)(((uint32_t)stack + stack_size) & ~15u);
+    *--sp = 0;                              /* kthread_start never returns */
+    *--sp = (uint32_t)kthread_start;
+    *--sp = 0;                              /* ebp */
+    *--sp = 0;                              /* ebx */
+    *--sp = 0;                              /* esi */
+    *--sp = 0;                              /* edi */
+    *--sp = KTHREAD_EFLAGS;
+    t->esp = (uint32_t)sp;
+
+    ilist_push_back(&g_sched.all, &t->all_link);
+    ilist_push_back(&g_sched.run, &t->link);
+    g_sched.count++;
+    g_sched.created++;
+    return t;
+}
+
+/* ============================================================================
+ * Mutex
+ *
+ * Recursive sleep lock for state that stays in use across yield points
+ * (a filesystem operation waiting on its disk). Contenders wait with
+ * sched_wait_yield, so the CPU still halts when everyone is waiting.
+ * ============================================================================ */
+
+typedef struct {
+    kthread_t *owner;
+    uint32_t   depth;
+    uint32_t   contended;               /* Acquisitions that had to wait */
+} kmutex_t;
+
+static void kmutex_lock(kmutex_t *m) {
+    kthread_t *self = g_sched.current;
+
+    if (m->depth && m->owner != self) {
+        m->contended++;
+        while (m->depth) {
+            if (!sched_wait_yield()) sched_halt();
+        }
+    }
+    m->owner = self;
+    m->depth++;
+}
+
+static void kmutex_unlock(kmutex_t *m) {
+    if (m->depth && --m->depth == 0) m->owner = NULL;
+}
+
+#endif /* SCHED_H */
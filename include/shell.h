@@ -9,6 +9,9 @@
  *   2. Call shell_init() with the I/O interface
  *   3. Call shell_run() for interactive mode, or
  *      shell_execute() for single commands
+ *
+ * A trailing '&' hands the command line to the spawn hook, which runs it
+ * in the background (a kernel thread) if the backend provides one.
  */
 
 #ifndef SHELL_H
@@ -42,6 +45,7 @@ typedef struct shell_io {
     void (*putchar)(char c);
     void (*puts)(const char *s);
     void (*printf)(const char *fmt, ...);
+    void (*write)(const char *buf, size_t len);  /* Span of bytes (optional) */
 
     /* Input functions */
     char (*getchar)(void);               /* Blocking read */
@@ -104,6 +108,9 @@ typedef struct shell_state {
 
     /* Environment/context pointer for command handlers */
     void *context;
+
+    /* Run @cmdline ('&' stripped) in the background (optional) */
+    bool (*spawn)(struct shell_state *sh, const char *cmdline);
 } shell_state_t;
 
 /* ============================================================================
@@ -208,6 +215,7 @@ static void sh_cmd_echo(shell_state_t *sh, int argc, char **argv);
 static void shell_init(shell_state_t *sh, shell_io_t *io, void *context) {
     sh->io = io;
     sh->context = context;
+    sh->spawn = NULL;
     sh->num_commands = 0;
     sh->running = false;
     sh->last_result = 0;
@@ -303,6 +311,19 @@ static int shell_execute(shell_state_t *sh, const char *cmdline) {
     for (int i = 0; i < len; i++) cmd_buf[i] = cmdline[i];
     cmd_buf[len] = '\0';
 
+    /* Trailing '&': run in the background */
+    while (len > 0 && (cmd_buf[len - 1] == ' ' || cmd_buf[len - 1] == '\t')) len--;
+    if (len > 0 && cmd_buf[len - 1] == '&') {
+        cmd_buf[len - 1] = '\0';
+        if (!sh->spawn) {
+            if (sh->io->printf) sh->io->printf("Background jobs not supported\n");
+            sh->last_result = 1;
+        } else {
+            sh->last_result = sh->spawn(sh, cmd_buf) ? 0 : 1;
+        }
+        return sh->last_result;
+    }
+
     /* Parse into arguments */
     char *argv[SHELL_MAX_ARGS];
     int argc = shell_parse_args(cmd_buf, argv, SHELL_MAX_ARGS);
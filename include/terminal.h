@@ -8,6 +8,16 @@
  *   - Smooth character rendering
  *   - Blinking cursor
  * 
+ * Output goes to a shadow character+attribute grid whose rows form a ring
+ * (scrolling just moves top_row). Dirty cells are rendered into an optional
+ * offscreen back buffer and copied to VRAM in write-only bursts by
+ * terminal_flush(); terminal_update() paces full-screen redraws to the
+ * frame rate. Without a back buffer cells render straight to VRAM.
+ * 
+ * Glyph rows are expanded through a 256-entry table of ready-made pixel
+ * rows per colour and scanline parity. With SSE each row is two aligned
+ * XMM stores and VRAM copies use movntps; otherwise plain 32-bit stores.
+ * 
  * Designed for Pentium III - efficient pixel operations
  */
 
@@ -18,11 +28,28 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "boot_info.h"
+#include "tsc.h"
+#include "trace.h"
+#include "cpu.h"
 
 /* ============================================================================
  * Terminal Configuration
  * ============================================================================ */
 
+#define TERM_MAX_COLS        160     /* 1280 pixels of 8-wide cells */
+#define TERM_MAX_ROWS        64      /* 1024 pixels of 16-high cells */
+#define TERM_FRAME_MS        16      /* ~60Hz redraw pacing */
+
+/* Cell attributes (high byte of a grid cell) */
+#define TERM_ATTR_NORMAL     0x00
+#define TERM_ATTR_BRIGHT     0x01
+
+/* Glyph row tables: 8 expanded pixels for each bit pattern */
+#define TERM_LUT_NORMAL      0       /* medium on dark */
+#define TERM_LUT_BRIGHT      1       /* bright on dark */
+#define TERM_LUT_SCANLINE    2       /* dim on dark (odd lines) */
+#define TERM_LUT_COUNT       3
+
 /* Phosphor Color Schemes */
 typedef enum {
     PHOSPHOR_GREEN,         // Classic green CRT
@@ -68,7 +95,7 @@ typedef struct {
     uint8_t rows;
     uint8_t cursor_x;
     uint8_t cursor_y;
-    bool cursor_visible;
+    volatile bool cursor_visible;   // Blink phase (flipped from IRQ0)
     
     /* Configuration */
     terminal_config_t config;
@@ -77,10 +104,34 @@ typedef struct {
     const uint8_t *font;
     uint8_t font_width;
     uint8_t font_height;
+    uint32_t glyph_lut[TERM_LUT_COUNT][256][8] __attribute__((aligned(16)));
+    bool sse;               // XMM render/stream path usable
+    bool fb_aligned;        // VRAM rows are 16-byte aligned (movntps)
+    
+    /* Shadow grid: cells[ring row][col] = char | attr << 8 */
+    uint16_t cells[TERM_MAX_ROWS][TERM_MAX_COLS];
+    uint8_t attr;           // Attribute for new characters
+    uint8_t top_row;        // Ring row shown on screen row 0
+
+    /* Dirty column spans [lo, hi): render per ring row, present per screen row */
+    uint8_t render_lo[TERM_MAX_ROWS];
+    uint8_t render_hi[TERM_MAX_ROWS];
+    uint8_t present_lo[TERM_MAX_ROWS];
+    uint8_t present_hi[TERM_MAX_ROWS];
+    bool dirty;             // Any render span is set
+    bool present_all;       // Every screen row must be recopied (after scroll)
+    bool redraw_pending;    // Full-screen redraw queued (held to frame rate)
+
+    /* Cursor as last drawn to VRAM */
+    bool cursor_drawn;
+    uint8_t drawn_x;
+    uint8_t drawn_y;
     
     /* Internal state */
     uint32_t frame_count;
-    uint32_t *backbuffer;   // For double buffering (optional)
+    uint64_t next_frame;    // TSC deadline of the next frame tick
+    uint32_t *backbuffer;   // Ring-ordered cell pixels (optional)
+    uint32_t back_pitch;    // In pixels
     
 } terminal_t;
 
@@ -162,38 +213,182 @@ static inline void term_fill_rect(terminal_t *term, uint32_t x, uint32_t y,
     }
 }
 
+/* Order streaming (non-temporal) stores before anything that follows */
+static inline void term_sfence(void) {
+    __asm__ volatile ("sfence" : : : "memory");
+}
+
+/* Move one 8-pixel row (32 bytes, both sides 16-byte aligned) */
+static inline void term_sse_row(uint32_t *dst, const uint32_t *src, bool stream) {
+    if (stream) {
+        __asm__ volatile ("movaps (%0), %%xmm0\n\t"
+                          "movaps 16(%0), %%xmm1\n\t"
+                          "movntps %%xmm0, (%1)\n\t"
+                          "movntps %%xmm1, 16(%1)"
+                          : : "r"(src), "r"(dst) : "xmm0", "xmm1", "memory");
+    } else {
+        __asm__ volatile ("movaps (%0), %%xmm0\n\t"
+                          "movaps 16(%0), %%xmm1\n\t"
+                          "movaps %%xmm0, (%1)\n\t"
+                          "movaps %%xmm1, 16(%1)"
+                          : : "r"(src), "r"(dst) : "xmm0", "xmm1", "memory");
+    }
+}
+
+/**
+ * Copy a span of pixels to VRAM in one write burst
+ * Streams 32 bytes at a time with movntps when both sides are aligned,
+ * rep movsd otherwise.
+ */
+static inline void term_copy_span(terminal_t *term, uint32_t *dst, const uint32_t *src,
+                                  uint32_t n) {
+    if (term->sse && term->fb_aligned) {
+        for (; n >= 8; n -= 8, dst += 8, src += 8) {
+            term_sse_row(dst, src, true);
+        }
+    }
+    __asm__ volatile ("rep movsl" : "+D"(dst), "+S"(src), "+c"(n) : : "memory");
+}
+
 /**
- * Draw single character at pixel position
+ * Expand every 8-bit glyph row pattern into pixels for the current scheme
+ * (one table per foreground plus one for dimmed scanlines)
  */
-static void term_draw_char(terminal_t *term, uint32_t px, uint32_t py,
-                           char c, uint32_t fg, uint32_t bg) {
+static void term_build_lut(terminal_t *term) {
+    const phosphor_colors_t *c = &term->config.colors;
+    const uint32_t fg[TERM_LUT_COUNT] = { c->medium, c->bright, c->dim };
+
+    for (uint32_t t = 0; t < TERM_LUT_COUNT; t++) {
+        for (uint32_t bits = 0; bits < 256; bits++) {
+            uint32_t *row = term->glyph_lut[t][bits];
+            for (uint32_t col = 0; col < 8; col++) {
+                row[col] = (bits & (0x80 >> col)) ? fg[t] : c->dark;
+            }
+        }
+    }
+}
+
+/**
+ * Draw single character into a pixel buffer
+ * @param dst     Top-left pixel of the cell
+ * @param pitch   Buffer pitch in pixels
+ * @param py      Screen y of the cell (for scanline parity)
+ * @param stream  Destination is VRAM (use non-temporal stores)
+ */
+static void term_draw_char(terminal_t *term, uint32_t *dst, uint32_t pitch, uint32_t py,
+                           char c, uint8_t attr, bool stream) {
+    TRACE_BEGIN(t0);
     if ((uint8_t)c >= 128) c = '?';  // ASCII only
 
     const uint8_t *glyph = &term->font[(uint8_t)c * term->font_height];
+    uint32_t lut = (attr & TERM_ATTR_BRIGHT) ? TERM_LUT_BRIGHT : TERM_LUT_NORMAL;
+    bool sse = term->sse && (!stream || term->fb_aligned);
 
     for (uint8_t row = 0; row < term->font_height; row++) {
-        uint32_t y = py + row;
-        if (y >= term->height) break;
-
-        uint8_t bits = glyph[row];
-        uint32_t *pixel = &term->framebuffer[y * term->pitch + px];
-
         // Apply scanline effect on odd rows
-        uint32_t line_fg = fg;
-        uint32_t line_bg = bg;
-        if (term->config.scanlines && (y & 1)) {
-            line_fg = term->config.colors.dim;
-            line_bg = term->config.colors.dark;
-        }
+        uint32_t t = (term->config.scanlines && ((py + row) & 1)) ? TERM_LUT_SCANLINE : lut;
+        const uint32_t *pixels = term->glyph_lut[t][glyph[row]];
 
-        for (uint8_t col = 0; col < term->font_width && (px + col) < term->width; col++) {
-            *pixel++ = (bits & (0x80 >> col)) ? line_fg : line_bg;
+        if (sse) {
+            term_sse_row(dst, pixels, stream);
+        } else {
+            for (uint8_t col = 0; col < 8; col++) {
+                dst[col] = pixels[col];
+            }
         }
+        dst += pitch;
+    }
+    TRACE_END(TP_TERM_CHAR, t0, c);
+}
+
+/* ============================================================================
+ * Shadow Grid
+ * ============================================================================ */
+
+/* Ring row holding screen row @row */
+static inline uint8_t term_ring_row(terminal_t *term, uint8_t row) {
+    uint32_t r = (uint32_t)term->top_row + row;
+    return (uint8_t)(r >= term->rows ? r - term->rows : r);
+}
+
+/* Screen row showing ring row @ring */
+static inline uint8_t term_screen_row(terminal_t *term, uint8_t ring) {
+    return (uint8_t)(ring >= term->top_row ? ring - term->top_row
+                                           : ring + term->rows - term->top_row);
+}
+
+/* Widen a [lo, hi) span */
+static inline void term_span_add(uint8_t *lo, uint8_t *hi, uint8_t from, uint8_t to) {
+    if (*lo >= *hi) {
+        *lo = from;
+        *hi = to;
+    } else {
+        if (from < *lo) *lo = from;
+        if (to > *hi) *hi = to;
+    }
+}
+
+/* Queue cells [from, to) of a ring row for rendering */
+static inline void term_mark(terminal_t *term, uint8_t ring, uint8_t from, uint8_t to) {
+    term_span_add(&term->render_lo[ring], &term->render_hi[ring], from, to);
+    term->dirty = true;
+}
+
+/* Queue the whole grid for rendering */
+static void term_mark_all(terminal_t *term) {
+    for (uint8_t r = 0; r < term->rows; r++) {
+        term_mark(term, r, 0, term->cols);
+    }
+    term->redraw_pending = true;
+}
+
+static inline void term_set_cell(terminal_t *term, uint8_t x, uint8_t y, char c) {
+    uint8_t ring = term_ring_row(term, y);
+    term->cells[ring][x] = (uint8_t)c | ((uint16_t)term->attr << 8);
+    term_mark(term, ring, x, x + 1);
+}
+
+/* Render dirty cells of a ring row into the back buffer (or VRAM) */
+static void term_render_row(terminal_t *term, uint8_t ring, uint8_t lo, uint8_t hi) {
+    uint32_t *base;
+    uint32_t pitch;
+    uint32_t py;
+
+    if (term->backbuffer) {
+        py = (uint32_t)ring * term->font_height;
+        pitch = term->back_pitch;
+        base = &term->backbuffer[py * pitch];
+    } else {
+        py = (uint32_t)term_screen_row(term, ring) * term->font_height;
+        pitch = term->pitch;
+        base = &term->framebuffer[py * pitch];
+    }
+
+    bool stream = !term->backbuffer;   // VRAM is never read back
+    const uint16_t *cell = &term->cells[ring][lo];
+    for (uint8_t x = lo; x < hi; x++, cell++) {
+        term_draw_char(term, base + (uint32_t)x * term->font_width, pitch, py,
+                       (char)(*cell & 0xFF), (uint8_t)(*cell >> 8), stream);
+    }
+}
+
+/* Copy cells [lo, hi) of a screen row from the back buffer to VRAM */
+static void term_present_row(terminal_t *term, uint8_t row, uint8_t lo, uint8_t hi) {
+    uint32_t x = (uint32_t)lo * term->font_width;
+    uint32_t n = (uint32_t)(hi - lo) * term->font_width;
+    const uint32_t *src = &term->backbuffer[(uint32_t)term_ring_row(term, row) *
+                                            term->font_height * term->back_pitch + x];
+    uint32_t *dst = &term->framebuffer[(uint32_t)row * term->font_height * term->pitch + x];
+
+    for (uint8_t line = 0; line < term->font_height; line++) {
+        term_copy_span(term, dst, src, n);
+        src += term->back_pitch;
+        dst += term->pitch;
     }
 }
 
 /**
- * Draw cursor at current position
+ * Draw cursor at current position (straight to VRAM, over the grid)
  */
 static void term_draw_cursor(terminal_t *term) {
     if (!term->cursor_visible) return;
@@ -209,23 +404,24 @@ static void term_draw_cursor(terminal_t *term) {
         if (term->config.scanlines && (y & 1)) continue;  // Skip scanlines
         term_hline(term, px, y, term->font_width, term->config.colors.cursor);
     }
+
+    term->cursor_drawn = true;
+    term->drawn_x = term->cursor_x;
+    term->drawn_y = term->cursor_y;
 }
 
 /**
- * Erase cursor at current position (redraw background)
+ * Erase the drawn cursor by queueing its cell for redraw
  */
 static void term_erase_cursor(terminal_t *term) {
-    uint32_t px = term->cursor_x * term->font_width;
-    uint32_t py = term->cursor_y * term->font_height;
-
-    uint32_t cursor_start = py + term->font_height - 3;
-    uint32_t cursor_end = py + term->font_height;
-
-    for (uint32_t y = cursor_start; y < cursor_end && y < term->height; y++) {
-        uint32_t bg = (term->config.scanlines && (y & 1))
-                      ? term->config.colors.dark
-                      : term->config.colors.dark;
-        term_hline(term, px, y, term->font_width, bg);
+    if (!term->cursor_drawn) return;
+    term->cursor_drawn = false;
+
+    uint8_t x = term->drawn_x, y = term->drawn_y;
+    if (term->backbuffer && !term->present_all) {
+        term_span_add(&term->present_lo[y], &term->present_hi[y], x, x + 1);
+    } else if (!term->backbuffer) {
+        term_mark(term, term_ring_row(term, y), x, x + 1);
     }
 }
 
@@ -233,45 +429,115 @@ static void term_erase_cursor(terminal_t *term) {
  * Public Implementation
  * ============================================================================ */
 
+/**
+ * Bytes needed for a back buffer covering the character grid
+ */
+static inline uint32_t terminal_backbuffer_size(terminal_t *term) {
+    return (uint32_t)term->cols * term->font_width *
+           term->rows * term->font_height * sizeof(uint32_t);
+}
+
+/**
+ * Render everything dirty and copy it to VRAM now
+ */
+static void terminal_flush(terminal_t *term) {
+    bool cursor_moved = term->cursor_drawn != term->cursor_visible ||
+                        (term->cursor_drawn && (term->drawn_x != term->cursor_x ||
+                                                term->drawn_y != term->cursor_y));
+    if (!term->dirty && !term->present_all && !cursor_moved) return;
+
+    term_erase_cursor(term);
+
+    for (uint8_t ring = 0; ring < term->rows; ring++) {
+        uint8_t lo = term->render_lo[ring], hi = term->render_hi[ring];
+        if (lo >= hi) continue;
+        term->render_lo[ring] = term->render_hi[ring] = 0;
+
+        term_render_row(term, ring, lo, hi);
+        if (term->backbuffer) {
+            uint8_t row = term_screen_row(term, ring);
+            term_span_add(&term->present_lo[row], &term->present_hi[row], lo, hi);
+        }
+    }
+
+    if (term->backbuffer) {
+        for (uint8_t row = 0; row < term->rows; row++) {
+            uint8_t lo = term->present_lo[row], hi = term->present_hi[row];
+            if (term->present_all) {
+                lo = 0;
+                hi = term->cols;
+            }
+            if (lo >= hi) continue;
+            term->present_lo[row] = term->present_hi[row] = 0;
+            term_present_row(term, row, lo, hi);
+        }
+    }
+
+    if (term->sse) term_sfence();
+
+    term->dirty = false;
+    term->present_all = false;
+    term->redraw_pending = false;
+
+    term_draw_cursor(term);
+}
+
+/**
+ * Attach (or detach, with NULL) an offscreen back buffer of
+ * terminal_backbuffer_size() bytes; the grid is redrawn on the next flush
+ */
+static inline void terminal_set_backbuffer(terminal_t *term, uint32_t *buf) {
+    term->backbuffer = buf;
+    term->back_pitch = (uint32_t)term->cols * term->font_width;
+    for (uint8_t r = 0; r < term->rows; r++) {
+        term->present_lo[r] = term->present_hi[r] = 0;
+    }
+    term->present_all = false;
+    term_mark_all(term);
+}
+
 static inline void terminal_clear(terminal_t *term) {
     uint32_t bg = term->config.colors.dark;
 
-    for (uint32_t y = 0; y < term->height; y++) {
-        uint32_t *row = &term->framebuffer[y * term->pitch];
-        for (uint32_t x = 0; x < term->width; x++) {
-            row[x] = bg;
+    for (uint8_t r = 0; r < term->rows; r++) {
+        for (uint8_t x = 0; x < term->cols; x++) {
+            term->cells[r][x] = ' ';
         }
     }
+    term->top_row = 0;
+    term->cursor_drawn = false;
+    term_mark_all(term);
+
+    // Margins outside the grid are never rendered; paint them here
+    uint32_t grid_w = (uint32_t)term->cols * term->font_width;
+    uint32_t grid_h = (uint32_t)term->rows * term->font_height;
+    term_fill_rect(term, grid_w, 0, term->width - grid_w, grid_h, bg);
+    term_fill_rect(term, 0, grid_h, term->width, term->height - grid_h, bg);
 
     term->cursor_x = 0;
     term->cursor_y = 0;
 }
 
 static inline void terminal_scroll(terminal_t *term) {
-    uint32_t line_height = term->font_height;
-    uint32_t copy_lines = (term->rows - 1) * line_height;
-
-    // Move framebuffer up by one text line
-    uint32_t *dst = term->framebuffer;
-    uint32_t *src = &term->framebuffer[line_height * term->pitch];
+    TRACE_BEGIN(t0);
+    uint8_t last = term->top_row;   // Old top becomes the new bottom row
 
-    for (uint32_t y = 0; y < copy_lines; y++) {
-        for (uint32_t x = 0; x < term->width; x++) {
-            dst[x] = src[x];
-        }
-        dst += term->pitch;
-        src += term->pitch;
+    term->top_row = term_ring_row(term, 1);
+    for (uint8_t x = 0; x < term->cols; x++) {
+        term->cells[last][x] = ' ';
     }
-
-    // Clear last line
-    uint32_t clear_start = copy_lines;
-    for (uint32_t y = clear_start; y < term->height; y++) {
-        uint32_t *row = &term->framebuffer[y * term->pitch];
-        uint32_t bg = term->config.colors.dark;
-        for (uint32_t x = 0; x < term->width; x++) {
-            row[x] = bg;
-        }
+    term->render_lo[last] = 0;
+    term->render_hi[last] = term->cols;
+    term->dirty = true;
+
+    // Rendered rows stay valid in the ring; only the screen mapping moved
+    if (term->backbuffer) {
+        term->present_all = true;
+        term->redraw_pending = true;
+    } else {
+        term_mark_all(term);
     }
+    TRACE_END(TP_TERM_SCROLL, t0, term->top_row);
 }
 
 static inline void terminal_init(terminal_t *term, boot_info_t *bi, terminal_config_t *cfg) {
@@ -297,74 +563,105 @@ static inline void terminal_init(terminal_t *term, boot_info_t *bi, terminal_con
     term->font_width = 8;
     term->font_height = 16;
 
+    // Vector path needs SSE and 16-byte aligned VRAM rows
+    term->sse = g_cpu.sse_enabled;
+    term->fb_aligned = !(((uintptr_t)term->framebuffer | bi->pitch) & 15);
+    term_build_lut(term);
+
     // Calculate grid size
-    term->cols = term->width / term->font_width;
-    term->rows = term->height / term->font_height;
+    uint32_t cols = term->width / term->font_width;
+    uint32_t rows = term->height / term->font_height;
+    term->cols = (uint8_t)(cols < TERM_MAX_COLS ? cols : TERM_MAX_COLS);
+    term->rows = (uint8_t)(rows < TERM_MAX_ROWS ? rows : TERM_MAX_ROWS);
 
     // Initialize cursor
     term->cursor_x = 0;
     term->cursor_y = 0;
     term->cursor_visible = true;
+    term->cursor_drawn = false;
     term->frame_count = 0;
+    term->next_frame = 0;
+    term->attr = TERM_ATTR_NORMAL;
+    term->backbuffer = NULL;
+    term->back_pitch = 0;
 
     // Clear to background
     terminal_clear(term);
 }
 
+/* Wrap and scroll after the cursor moved */
+static inline void term_advance(terminal_t *term) {
+    // Handle line wrap
+    if (term->cursor_x >= term->cols) {
+        term->cursor_x = 0;
+        term->cursor_y++;
+    }
+
+    // Handle scroll
+    if (term->cursor_y >= term->rows) {
+        terminal_scroll(term);
+        term->cursor_y = term->rows - 1;
+    }
+}
+
 static inline void terminal_putchar(terminal_t *term, char c) {
     // Handle control characters
     switch (c) {
         case '\n':
-            term_erase_cursor(term);
             term->cursor_x = 0;
             term->cursor_y++;
             break;
         case '\r':
-            term_erase_cursor(term);
             term->cursor_x = 0;
             break;
         case '\t':
-            term_erase_cursor(term);
             term->cursor_x = (term->cursor_x + 8) & ~7;
             break;
         case '\b':
             if (term->cursor_x > 0) {
-                term_erase_cursor(term);
                 term->cursor_x--;
                 // Erase character
-                term_draw_char(term,
-                    term->cursor_x * term->font_width,
-                    term->cursor_y * term->font_height,
-                    ' ', term->config.colors.dark, term->config.colors.dark);
+                term_set_cell(term, term->cursor_x, term->cursor_y, ' ');
             }
             break;
         default:
             if (c >= 32 && c < 127) {
-                term_draw_char(term,
-                    term->cursor_x * term->font_width,
-                    term->cursor_y * term->font_height,
-                    c,
-                    term->config.colors.medium,
-                    term->config.colors.dark);
+                term_set_cell(term, term->cursor_x, term->cursor_y, c);
                 term->cursor_x++;
             }
             break;
     }
 
-    // Handle line wrap
-    if (term->cursor_x >= term->cols) {
-        term->cursor_x = 0;
-        term->cursor_y++;
-    }
+    term_advance(term);
+}
 
-    // Handle scroll
-    if (term->cursor_y >= term->rows) {
-        terminal_scroll(term);
-        term->cursor_y = term->rows - 1;
-    }
+/**
+ * Lay a span of text into the grid. Printable runs are stored and
+ * marked dirty per row rather than per character; the cursor is only
+ * redrawn by the next flush.
+ */
+static void terminal_write(terminal_t *term, const char *buf, size_t len) {
+    uint16_t attr = (uint16_t)term->attr << 8;
 
-    // Redraw cursor
-    term_draw_cursor(term);
+    while (len) {
+        uint8_t start = term->cursor_x;
+        uint8_t x = start;
+        uint16_t *row = term->cells[term_ring_row(term, term->cursor_y)];
+
+        while (len && x < term->cols && *buf >= 32 && *buf < 127) {
+            row[x++] = (uint8_t)*buf++ | attr;
+            len--;
+        }
+
+        if (x != start) {
+            term_mark(term, term_ring_row(term, term->cursor_y), start, x);
+            term->cursor_x = x;
+            term_advance(term);
+        } else {
+            terminal_putchar(term, *buf++);
+            len--;
+        }
+    }
 }
 
 static inline void terminal_puts(terminal_t *term, const char *s) {
@@ -374,27 +671,43 @@ static inline void terminal_puts(terminal_t *term, const char *s) {
 }
 
 static inline void terminal_set_cursor(terminal_t *term, uint8_t x, uint8_t y) {
-    term_erase_cursor(term);
     term->cursor_x = (x < term->cols) ? x : term->cols - 1;
     term->cursor_y = (y < term->rows) ? y : term->rows - 1;
-    term_draw_cursor(term);
 }
 
-static inline void terminal_update(terminal_t *term) {
-    term->frame_count++;
+/* Blink period in ms (cursor_rate counts frames) */
+static inline uint32_t terminal_blink_ms(terminal_t *term) {
+    return term->config.cursor_rate * TERM_FRAME_MS;
+}
 
+/**
+ * Toggle the cursor phase; called from a periodic timer (IRQ context),
+ * so it only flips state and the next flush draws it
+ */
+static inline void terminal_blink(terminal_t *term) {
     if (term->config.cursor_blink) {
-        if ((term->frame_count / term->config.cursor_rate) & 1) {
-            if (term->cursor_visible) {
-                term_erase_cursor(term);
-                term->cursor_visible = false;
-            }
-        } else {
-            if (!term->cursor_visible) {
-                term->cursor_visible = true;
-                term_draw_cursor(term);
-            }
-        }
+        term->cursor_visible = !term->cursor_visible;
+    }
+}
+
+static inline void terminal_set_attr(terminal_t *term, uint8_t attr) {
+    term->attr = attr;
+}
+
+/**
+ * Flush what is due. Cell updates go out at once; full-screen redraws
+ * (scroll, clear) wait for the next frame tick.
+ */
+static inline void terminal_update(terminal_t *term) {
+    bool frame = tsc_expired(term->next_frame);
+
+    if (frame) {
+        term->frame_count++;
+        term->next_frame = tsc_deadline(TERM_FRAME_MS);
+    }
+
+    if (frame || !term->redraw_pending) {
+        terminal_flush(term);
     }
 }
 
@@ -407,6 +720,8 @@ static inline void terminal_set_scheme(terminal_t *term, phosphor_scheme_t schem
         case PHOSPHOR_CYAN:  term->config.colors = COLORS_CYAN; break;
         default: break;
     }
+    term_build_lut(term);
+    term_mark_all(term);
 }
 
 /**
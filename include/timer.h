@@ -0,0 +1,361 @@
+/**
+ * timer.h - PIT System Timer and Timer Wheel
+ *
+ * PIT channel 0 on IRQ0 at a configurable rate drives a monotonic tick
+ * count, a millisecond clock and (interpolated with the TSC) a
+ * microsecond clock. Deferred work is queued on a hierarchical timer
+ * wheel: 256 one-tick slots plus three 64-slot levels that cascade down
+ * as time passes, so adding, cancelling and expiring are all O(1).
+ *
+ * Expired timers run in IRQ0 context with interrupts disabled: callbacks
+ * must be short and only touch state that is safe from an interrupt.
+ *
+ * The wait helpers are yield points: while one thread waits, the other
+ * kernel threads run, and the CPU halts only when all of them wait.
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "idt.h"
+#include "tsc.h"
+#include "cpu.h"
+#include "intrusive_list_fast.h"
+#include "sched.h"
+
+/* ============================================================================
+ * Configuration
+ * ============================================================================ */
+
+#define TIMER_DEFAULT_HZ    1000
+#define TIMER_MIN_HZ        19          /* Largest 16-bit PIT divisor */
+#define TIMER_MAX_HZ        10000
+
+#define PIT_CH0_DATA        0x40
+#define PIT_COMMAND         0x43
+#define PIT_CMD_CH0_RATE    0x34        /* Ch0, lo/hi, mode 2 (rate generator) */
+
+/* Wheel geometry */
+#define TW_ROOT_BITS        8
+#define TW_LEVEL_BITS       6
+#define TW_LEVELS           3
+#define TW_ROOT_SIZE        (1u << TW_ROOT_BITS)
+#define TW_LEVEL_SIZE       (1u << TW_LEVEL_BITS)
+#define TW_ROOT_MASK        (TW_ROOT_SIZE - 1)
+#define TW_LEVEL_MASK       (TW_LEVEL_SIZE - 1)
+#define TW_MAX_DELTA        ((1u << (TW_ROOT_BITS + TW_LEVELS * TW_LEVEL_BITS)) - 1)
+
+/* ============================================================================
+ * Types
+ * ============================================================================ */
+
+typedef void (*ktimer_fn)(void *arg);
+
+typedef struct ktimer {
+    ilist_node_t link;
+    uint32_t     expires;       /* Tick at which it fires */
+    uint32_t     period;        /* Re-arm interval in ticks (0 = one-shot) */
+    ktimer_fn    fn;
+    void        *arg;
+    bool         pending;
+} ktimer_t;
+
+typedef struct {
+    /* Clock */
+    volatile uint32_t ticks;
+    volatile uint32_t ms;
+    volatile uint64_t us;           /* Microseconds at the last tick */
+    volatile uint32_t tick_tsc;     /* Low TSC word at the last tick */
+    uint32_t    hz;
+    uint32_t    tick_us;            /* Microseconds per tick */
+    uint32_t    ms_frac;            /* Microseconds not yet counted in ms */
+    bool        running;
+
+    /* Wheel (base = next tick to process) */
+    uint32_t    base;
+    ilist_head_t root[TW_ROOT_SIZE];
+    ilist_head_t level[TW_LEVELS][TW_LEVEL_SIZE];
+    uint32_t    armed;
+    uint32_t    fired;
+
+    void        (*idle_work)(void); /* Run by every wait step (deferred event dispatch) */
+} timer_state_t;
+
+static timer_state_t g_timer;
+
+/* ============================================================================
+ * Clock
+ * ============================================================================ */
+
+static inline uint32_t timer_ticks(void) {
+    return g_timer.ticks;
+}
+
+/* Milliseconds since timer_init */
+static inline uint32_t timer_ms(void) {
+    return g_timer.ms;
+}
+
+/**
+ * Microseconds since timer_init: the last tick plus TSC cycles since it
+ * (falls back to tick resolution without a TSC)
+ */
+static uint64_t timer_us(void) {
+    uint32_t flags = irq_save();
+    uint64_t us = g_timer.us;
+    uint32_t since = g_timer.tick_tsc;
+    irq_restore(flags);
+
+    if (g_timer.running && cpu_has(CPUID_FEAT_TSC)) {
+        uint32_t delta = ((uint32_t)tsc_read() - since) / tsc_mhz();
+        if (delta >= g_timer.tick_us) delta = g_timer.tick_us - 1;
+        us += delta;
+    }
+    return us;
+}
+
+/* Ticks covering at least @ms (minimum one), without overflowing ms * hz */
+static inline uint32_t timer_ms_to_ticks(uint32_t ms) {
+    uint32_t t = (ms / 1000) * g_timer.hz + ((ms % 1000) * g_timer.hz + 999) / 1000;
+    return t ? t : 1;
+}
+
+/* ============================================================================
+ * Timer Wheel
+ * ============================================================================ */
+
+/* Bucket for a timer given the wheel's current base */
+static ilist_head_t *tw_bucket(uint32_t expires) {
+    uint32_t delta = expires - g_timer.base;
+
+    if ((int32_t)delta < 0) {
+        return &g_timer.root[g_timer.base & TW_ROOT_MASK];    /* Already due */
+    }
+    if (delta < TW_ROOT_SIZE) {
+        return &g_timer.root[expires & TW_ROOT_MASK];
+    }
+    for (uint32_t lvl = 0; lvl < TW_LEVELS; lvl++) {
+        uint32_t shift = TW_ROOT_BITS + (lvl + 1) * TW_LEVEL_BITS;
+        if (lvl == TW_LEVELS - 1 || delta < (1u << shift)) {
+            if (delta > TW_MAX_DELTA) expires = g_timer.base + TW_MAX_DELTA;
+            uint32_t idx = (expires >> (shift - TW_LEVEL_BITS)) & TW_LEVEL_MASK;
+            return &g_timer.level[lvl][idx];
+        }
+    }
+    return NULL;
+}
+
+/* Caller holds interrupts off */
+static void tw_insert(ktimer_t *t) {
+    ilist_push_back(tw_bucket(t->expires), &t->link);
+    t->pending = true;
+    g_timer.armed++;
+}
+
+/* Re-spread one upper-level bucket; returns the index that was cascaded */
+static uint32_t tw_cascade(uint32_t lvl) {
+    uint32_t shift = TW_ROOT_BITS + lvl * TW_LEVEL_BITS;
+    uint32_t idx = (g_timer.base >> shift) & TW_LEVEL_MASK;
+    ilist_head_t list;
+
+    ilist_init_head(&list);
+    ilist_splice_back(&g_timer.level[lvl][idx], &list);
+    while (!ilist_is_empty(&list)) {
+        ktimer_t *t = ilist_entry(ilist_pop_front(&list), ktimer_t, link);
+        ilist_push_back(tw_bucket(t->expires), &t->link);
+    }
+    return idx;
+}
+
+/* Expire everything up to the current tick (IRQ0 context) */
+static void tw_run(void) {
+    while ((int32_t)(g_timer.ticks - g_timer.base) >= 0) {
+        uint32_t idx = g_timer.base & TW_ROOT_MASK;
+
+        if (idx == 0) {
+            for (uint32_t lvl = 0; lvl < TW_LEVELS && tw_cascade(lvl) == 0; lvl++);
+        }
+        g_timer.base++;
+
+        /* Detach the slot first: a re-armed timer may hash back into it */
+        ilist_head_t due;
+        ilist_init_head(&due);
+        ilist_splice_back(&g_timer.root[idx], &due);
+        while (!ilist_is_empty(&due)) {
+            ktimer_t *t = ilist_entry(ilist_pop_front(&due), ktimer_t, link);
+            t->pending = false;
+            g_timer.armed--;
+            g_timer.fired++;
+
+            if (t->period) {
+                t->expires += t->period;
+                tw_insert(t);
+            }
+            t->fn(t->arg);
+        }
+    }
+}
+
+static inline void timer_setup(ktimer_t *t, ktimer_fn fn, void *arg) {
+    ilist_init_node(&t->link);
+    t->fn = fn;
+    t->arg = arg;
+    t->period = 0;
+    t->pending = false;
+}
+
+/* Cancel a pending timer (no-op if it is not armed) */
+static void timer_cancel(ktimer_t *t) {
+    uint32_t flags = irq_save();
+    if (t->pending) {
+        ilist_remove(&t->link);
+        t->pending = false;
+        g_timer.armed--;
+    }
+    irq_restore(flags);
+}
+
+/**
+ * (Re)arm a timer @ms from now; @period_ms > 0 makes it periodic.
+ * Re-arming a pending timer just moves it.
+ */
+static void timer_start(ktimer_t *t, uint32_t ms, uint32_t period_ms) {
+    uint32_t flags = irq_save();
+    if (t->pending) {
+        ilist_remove(&t->link);
+        g_timer.armed--;
+    }
+    t->expires = g_timer.ticks + timer_ms_to_ticks(ms);
+    t->period = period_ms ? timer_ms_to_ticks(period_ms) : 0;
+    tw_insert(t);
+    irq_restore(flags);
+}
+
+/* ============================================================================
+ * PIT and IRQ0
+ * ============================================================================ */
+
+static void timer_irq_handler(int_frame_t *frame) {
+    (void)frame;
+
+    g_timer.ticks++;
+    g_timer.us += g_timer.tick_us;
+    g_timer.tick_tsc = (uint32_t)tsc_read();
+    g_timer.ms_frac += g_timer.tick_us;
+    while (g_timer.ms_frac >= 1000) {
+        g_timer.ms_frac -= 1000;
+        g_timer.ms++;
+    }
+
+    tw_run();
+}
+
+/* Program PIT channel 0 to fire @hz times a second */
+static void timer_set_rate(uint32_t hz) {
+    if (hz < TIMER_MIN_HZ) hz = TIMER_MIN_HZ;
+    if (hz > TIMER_MAX_HZ) hz = TIMER_MAX_HZ;
+
+    uint32_t divisor = (TSC_PIT_HZ + hz / 2) / hz;
+    uint32_t flags = irq_save();
+    outb(PIT_COMMAND, PIT_CMD_CH0_RATE);
+    outb(PIT_CH0_DATA, divisor & 0xFF);
+    outb(PIT_CH0_DATA, (divisor >> 8) & 0xFF);
+    g_timer.hz = hz;
+    g_timer.tick_us = 1000000 / hz;
+    irq_restore(flags);
+}
+
+/**
+ * Start the system timer at @hz and unmask IRQ0
+ * The clock advances once interrupts are enabled.
+ */
+static void timer_init(uint32_t hz) {
+    for (uint32_t i = 0; i < TW_ROOT_SIZE; i++) ilist_init_head(&g_timer.root[i]);
+    for (uint32_t l = 0; l < TW_LEVELS; l++) {
+        for (uint32_t i = 0; i < TW_LEVEL_SIZE; i++) ilist_init_head(&g_timer.level[l][i]);
+    }
+
+    if (cpu_has(CPUID_FEAT_TSC)) {
+        tsc_mhz();                          /* Calibrate before ch0 is busy */
+        g_timer.tick_tsc = (uint32_t)tsc_read();
+    }
+
+    timer_set_rate(hz);
+    irq_register(IRQ_TIMER, timer_irq_handler);
+    pic_enable_irq(IRQ_TIMER);
+    g_timer.running = true;
+}
+
+/* ============================================================================
+ * Waiting
+ * ============================================================================ */
+
+/* Work for timer_idle to do before yielding (normal context, never IRQ) */
+static inline void timer_set_idle_work(void (*fn)(void)) {
+    g_timer.idle_work = fn;
+}
+
+static inline bool timer_irqs_enabled(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushfl; popl %0" : "=r"(flags));
+    return (flags & 0x200) != 0;
+}
+
+/**
+ * One step of a wait loop: run other threads if any can, else sleep
+ * until the next interrupt if the timer guarantees one will come,
+ * otherwise just pause (interrupts off, or before timer_init)
+ */
+static inline void timer_idle(void) {
+    if (g_timer.idle_work && timer_irqs_enabled()) g_timer.idle_work();
+    if (sched_wait_yield()) return;
+    if (g_timer.running && timer_irqs_enabled()) {
+        __asm__ volatile ("hlt");
+    } else {
+        __asm__ volatile ("pause");
+    }
+}
+
+/* Block for at least @ms milliseconds */
+static void timer_sleep_ms(uint32_t ms) {
+    if (!g_timer.running || !timer_irqs_enabled()) {
+        uint64_t deadline = tsc_deadline(ms);
+        while (!tsc_expired(deadline)) __asm__ volatile ("pause");
+        return;
+    }
+
+    uint32_t start = g_timer.ms;
+    while (g_timer.ms - start < ms) {
+        timer_idle();
+    }
+}
+
+/**
+ * Wait until *@flag is set (typically by an IRQ handler) or @ms pass
+ * @return the flag's final value
+ */
+static bool timer_wait_flag(volatile bool *flag, uint32_t ms) {
+    if (!g_timer.running || !timer_irqs_enabled()) {
+        uint64_t deadline = tsc_deadline(ms);
+        while (!*flag && !tsc_expired(deadline)) __asm__ volatile ("pause");
+        return *flag;
+    }
+
+    uint32_t start = g_timer.ms;
+    while (!*flag && g_timer.ms - start < ms) {
+        if (sched_wait_yield()) continue;
+
+        /* Interrupts stay on; check and halt with IF=0 so a wakeup is not lost */
+        __asm__ volatile ("cli");
+        if (*flag) {
+            __asm__ volatile ("sti");
+            break;
+        }
+        __asm__ volatile ("sti; hlt");
+    }
+    return *flag;
+}
+
+#endif /* TIMER_H */
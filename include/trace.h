@@ -0,0 +1,191 @@
+/**
+ * trace.h - TSC Trace Points and Latency Histograms
+ *
+ * Hot paths bracket their work with TRACE_BEGIN/TRACE_END. Each completed
+ * span goes into a ring of the most recent records (for dumping and
+ * offline analysis) and into its trace point's statistics: call count,
+ * total and worst cycles, and a log-linear histogram (four sub-buckets
+ * per power of two) from which percentiles are read.
+ *
+ * Spans are inclusive: an IRQ taken inside a block read counts towards
+ * both. Recording is off until trace_enable() (the kernel enables it
+ * once the TSC is known to exist); build with -DTRACE_ENABLED=0 to
+ * compile every trace point out.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tsc.h"
+
+/* ============================================================================
+ * Configuration
+ * ============================================================================ */
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED       1
+#endif
+
+#define TRACE_RING_SIZE     2048        /* Records kept (power of two) */
+#define TRACE_RING_MASK     (TRACE_RING_SIZE - 1)
+#define TRACE_HIST_BUCKETS  128         /* 32 powers of two x 4 */
+
+typedef enum {
+    TP_IRQ = 0,                         /* arg: IRQ line */
+    TP_BLK_READ,                        /* arg: sectors */
+    TP_BLK_WRITE,                       /* arg: sectors */
+    TP_FAT_READ,                        /* arg: cluster */
+    TP_VFS_OPEN,
+    TP_VFS_READ,                        /* arg: bytes requested */
+    TP_TERM_CHAR,
+    TP_TERM_SCROLL,
+    TP_PROGRAM_RUN,
+    TP_COUNT
+} trace_point_t;
+
+static const char *const g_trace_names[TP_COUNT] = {
+    "irq", "blk_read", "blk_write", "fat_read", "vfs_open",
+    "vfs_read", "term_char", "term_scroll", "program_run",
+};
+
+/* ============================================================================
+ * Types
+ * ============================================================================ */
+
+typedef struct {
+    uint32_t start;                     /* Low TSC word at TRACE_BEGIN */
+    uint32_t cycles;
+    uint32_t arg;
+    uint32_t point;
+} trace_rec_t;
+
+typedef struct {
+    uint32_t count;
+    uint64_t total;                     /* Cycles */
+    uint32_t max;
+    uint32_t hist[TRACE_HIST_BUCKETS];
+} trace_stat_t;
+
+typedef struct {
+    volatile bool enabled;
+    uint32_t      head;                 /* Records ever written */
+    trace_stat_t  stats[TP_COUNT];
+    trace_rec_t   ring[TRACE_RING_SIZE];
+} trace_state_t;
+
+static trace_state_t g_trace;
+
+/* ============================================================================
+ * Recording
+ * ============================================================================ */
+
+/* Histogram bucket: values below 8 map directly, then 4 per power of two */
+static inline uint32_t trace_bucket(uint32_t cycles) {
+    if (cycles < 8) return cycles;
+    uint32_t lg = 31 - (uint32_t)__builtin_clz(cycles);
+    return (lg << 2) | ((cycles >> (lg - 2)) & 3);
+}
+
+/* Largest value that falls in bucket @b */
+static inline uint32_t trace_bucket_max(uint32_t b) {
+    if (b < 8) return b;
+    uint32_t lg = b >> 2;
+    uint64_t next = (uint64_t)(5 + (b & 3)) << (lg - 2);
+    return next > 0xFFFFFFFFull ? 0xFFFFFFFFu : (uint32_t)(next - 1);
+}
+
+/* Start stamp (0 while recording is off, which TRACE_END then skips) */
+static inline uint32_t trace_begin(void) {
+    return g_trace.enabled ? ((uint32_t)tsc_read() | 1) : 0;
+}
+
+static void trace_end(trace_point_t point, uint32_t start, uint32_t arg) {
+    if (!start || !g_trace.enabled) return;
+
+    uint32_t cycles = (uint32_t)tsc_read() - start;
+    uint32_t flags = irq_save();
+
+    trace_stat_t *st = &g_trace.stats[point];
+    st->count++;
+    st->total += cycles;
+    if (cycles > st->max) st->max = cycles;
+    st->hist[trace_bucket(cycles)]++;
+
+    trace_rec_t *r = &g_trace.ring[g_trace.head++ & TRACE_RING_MASK];
+    r->start = start;
+    r->cycles = cycles;
+    r->arg = arg;
+    r->point = point;
+
+    irq_restore(flags);
+}
+
+#if TRACE_ENABLED
+#define TRACE_BEGIN(var)            uint32_t var = trace_begin()
+#define TRACE_END(point, var, arg)  trace_end((point), (var), (uint32_t)(arg))
+#else
+#define TRACE_BEGIN(var)            do { } while (0)
+#define TRACE_END(point, var, arg)  do { } while (0)
+#endif
+
+/* ============================================================================
+ * Control and Queries
+ * ============================================================================ */
+
+static inline void trace_enable(bool on) {
+    g_trace.enabled = on;
+}
+
+/* Drop every record and statistic */
+static void trace_reset(void) {
+    uint32_t flags = irq_save();
+    uint8_t *p = (uint8_t *)g_trace.stats;
+    for (uint32_t i = 0; i < sizeof(g_trace.stats); i++) p[i] = 0;
+    g_trace.head = 0;
+    irq_restore(flags);
+}
+
+/* Records currently held in the ring */
+static inline uint32_t trace_ring_count(void) {
+    return g_trace.head < TRACE_RING_SIZE ? g_trace.head : TRACE_RING_SIZE;
+}
+
+/* @i-th oldest record still in the ring */
+static inline const trace_rec_t *trace_ring_at(uint32_t i) {
+    return &g_trace.ring[(g_trace.head - trace_ring_count() + i) & TRACE_RING_MASK];
+}
+
+/**
+ * Upper bound of the @pct-th percentile of @point's latencies
+ * @return cycles (0 if nothing was recorded)
+ */
+static uint32_t trace_percentile(trace_point_t point, uint32_t pct) {
+    const trace_stat_t *st = &g_trace.stats[point];
+    if (!st->count) return 0;
+
+    /* Rank of the sample, rounded up so p99 of few samples is the worst */
+    uint32_t rank = st->count / 100 * pct + (st->count % 100 * pct + 99) / 100;
+    if (rank == 0) rank = 1;
+
+    uint32_t seen = 0;
+    for (uint32_t b = 0; b < TRACE_HIST_BUCKETS; b++) {
+        seen += st->hist[b];
+        if (seen >= rank) {
+            uint32_t bound = trace_bucket_max(b);
+            return bound < st->max ? bound : st->max;
+        }
+    }
+    return st->max;
+}
+
+/* @cycles / @d without a 64-bit divide helper (edx:eax / d in two steps) */
+static inline uint64_t trace_div64(uint64_t cycles, uint32_t d) {
+    uint32_t hi = (uint32_t)(cycles >> 32), lo = (uint32_t)cycles;
+    uint32_t q_hi = hi / d, q_lo, rem = hi % d;
+    __asm__ ("divl %3" : "=a"(q_lo), "=d"(rem) : "0"(lo), "rm"(d), "1"(rem));
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+#endif /* TRACE_H */
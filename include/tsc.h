@@ -0,0 +1,81 @@
+/**
+ * tsc.h - Time Stamp Counter Helpers
+ *
+ * RDTSC plus a one-shot calibration against PIT channel 2 (the speaker
+ * timer, gated through port 0x61), so drivers can measure short delays
+ * without a running system timer. Pentium and later only.
+ */
+
+#ifndef TSC_H
+#define TSC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "idt.h"
+
+#define TSC_PIT_HZ          1193182
+#define TSC_CALIBRATE_MS    10
+
+static uint32_t g_tsc_mhz = 0;
+
+static inline uint64_t tsc_read(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * Measure the TSC rate against a 10ms one-shot on PIT channel 2
+ * @return TSC rate in MHz (cached after the first call)
+ */
+static uint32_t tsc_calibrate(void) {
+    uint16_t latch = TSC_PIT_HZ / (1000 / TSC_CALIBRATE_MS);
+
+    uint8_t port61 = inb(0x61);
+    outb(0x61, (port61 & ~0x02) | 0x01);   /* Gate on, speaker off */
+
+    outb(0x43, 0xB0);                       /* Ch2, lo/hi, mode 0 */
+    outb(0x42, latch & 0xFF);
+    outb(0x42, latch >> 8);
+
+    uint32_t start = (uint32_t)tsc_read();
+    while (!(inb(0x61) & 0x20));            /* OUT2 goes high at terminal count */
+    uint32_t cycles = (uint32_t)tsc_read() - start;
+
+    outb(0x61, port61);
+
+    g_tsc_mhz = cycles / (TSC_CALIBRATE_MS * 1000);
+    if (g_tsc_mhz == 0) g_tsc_mhz = 1;
+    return g_tsc_mhz;
+}
+
+static inline uint32_t tsc_mhz(void) {
+    return g_tsc_mhz ? g_tsc_mhz : tsc_calibrate();
+}
+
+/* Cycles in @ms milliseconds */
+static inline uint64_t tsc_ms_to_cycles(uint32_t ms) {
+    return (uint64_t)ms * 1000 * tsc_mhz();
+}
+
+/* TSC value @ms milliseconds from now */
+static inline uint64_t tsc_deadline(uint32_t ms) {
+    return tsc_read() + tsc_ms_to_cycles(ms);
+}
+
+static inline bool tsc_expired(uint64_t deadline) {
+    return tsc_read() >= deadline;
+}
+
+/* TSC value @us microseconds from now */
+static inline uint64_t tsc_deadline_us(uint32_t us) {
+    return tsc_read() + (uint64_t)us * tsc_mhz();
+}
+
+/* Busy-wait @us microseconds (for short hardware settle times) */
+static inline void tsc_delay_us(uint32_t us) {
+    uint64_t deadline = tsc_deadline_us(us);
+    while (!tsc_expired(deadline)) __asm__ volatile ("pause");
+}
+
+#endif /* TSC_H */
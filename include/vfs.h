@@ -10,6 +10,10 @@
  *   Filesystem Ops   - FAT12, ext2, etc. (read/write/create/delete)
  *     |
  *   Block Device     - ATA, Floppy, Ramdisk (sector read/write)
+ *
+ * Disk waits are yield points for kernel threads, so every public entry
+ * point runs under g_vfs.lock: one filesystem or block-cache operation at
+ * a time, interleaved with other threads' work between operations.
  */
 
 #ifndef VFS_H
@@ -18,6 +22,10 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "intrusive_list_pool.h"
+#include "idt.h"
+#include "sched.h"
+#include "trace.h"
 
 /* ============================================================================
  * Configuration
@@ -27,6 +35,23 @@
 #define VFS_MAX_PATH        256     /* Maximum path length */
 #define VFS_MAX_NAME        64      /* Maximum filename length */
 #define VFS_MAX_OPEN_FILES  32      /* Maximum open file handles */
+#define BLKDEV_MAX_SECTORS  65536   /* Largest count one blkdev request carries */
+
+#define BCACHE_BLOCK_SIZE   512     /* Cached block size (one sector) */
+#define BCACHE_NUM_BUFS     64      /* Buffer heads in the block cache */
+#define BCACHE_HASH_SIZE    32      /* Hash buckets (power of 2) */
+#define BCACHE_FLUSH_BATCH  16      /* Max sectors per write-back request */
+#define BCACHE_STREAM_MAX   16      /* Longer reads/writes bypass the cache */
+#define BCACHE_READAHEAD_MAX 16     /* Sectors per readahead request */
+
+#define BLKQ_MAX_DEVICES    4       /* Devices with a request queue */
+#define BLKQ_MAX_MERGE      32      /* Sectors per merged dispatch (stage size) */
+
+#define DCACHE_NUM_ENTRIES  64      /* Cached path components */
+#define DCACHE_HASH_SIZE    32      /* Hash buckets (power of 2) */
+
+#define VFS_READAHEAD_STREAK 2      /* Sequential reads before readahead starts */
+#define VFS_READAHEAD_SECTORS 16    /* Window kept in flight ahead of the reader */
 
 /* ============================================================================
  * Block Device Interface
@@ -43,6 +68,8 @@ typedef enum {
     BLKDEV_USB,         /* USB mass storage (future) */
 } blkdev_type_t;
 
+struct blkq;
+
 typedef struct blkdev {
     /* Device identification */
     blkdev_type_t type;
@@ -60,13 +87,22 @@ typedef struct blkdev {
     bool     present;       /* Device is present */
     bool     removable;     /* Device is removable */
     bool     readonly;      /* Write-protected */
+    bool     cached;        /* blkdev_read/blkdev_write use the buffer cache */
 
-    /* Block operations */
-    uint32_t (*read)(struct blkdev *dev, uint32_t lba, uint8_t count, void *buf);
-    uint32_t (*write)(struct blkdev *dev, uint32_t lba, uint8_t count, const void *buf);
-    bool     (*sync)(struct blkdev *dev);       /* Flush cache */
+    /* Block operations (raw driver I/O, use blkdev_read/blkdev_write).
+     * count may be up to BLKDEV_MAX_SECTORS; drivers split as needed. */
+    uint32_t (*read)(struct blkdev *dev, uint32_t lba, uint32_t count, void *buf);
+    uint32_t (*write)(struct blkdev *dev, uint32_t lba, uint32_t count, const void *buf);
+    bool     (*sync)(struct blkdev *dev);       /* Flush cache (bcache_flush) */
     bool     (*eject)(struct blkdev *dev);      /* Eject media (removable) */
 
+    /* Asynchronous I/O (optional): start issues a transfer and returns
+     * true if it will be reported via blkq_complete (or handed back with
+     * blkq_retry); poll completes it when interrupts are unavailable */
+    bool     (*start)(struct blkdev *dev, uint32_t lba, uint32_t count, void *buf, bool write);
+    void     (*poll)(struct blkdev *dev);
+    struct blkq *queue;                         /* Request queue (blkq_get) */
+
     /* Private driver data */
     void    *driver_data;
 } blkdev_t;
@@ -110,6 +146,9 @@ typedef struct vfs_dirent {
     uint32_t inode;         /* Inode number (fs-specific) */
     uint8_t  type;          /* VFS_FILE, VFS_DIRECTORY, etc. */
     uint32_t size;          /* File size in bytes */
+    uint8_t  attributes;    /* Filesystem attribute bits (FAT: FAT12_ATTR_*) */
+    uint16_t cluster;       /* First cluster (FAT), 0 otherwise */
+    uint32_t mtime;         /* Modify time, as vfs_stat_t.mtime */
 } vfs_dirent_t;
 
 /* File stat information */
@@ -124,6 +163,7 @@ typedef struct vfs_stat {
     uint32_t ctime;         /* Create time */
     uint32_t blocks;        /* Blocks allocated */
     uint32_t block_size;    /* Block size */
+    uint32_t inode;         /* Filesystem-specific identifier */
 } vfs_stat_t;
 
 /* Filesystem operations */
@@ -153,10 +193,22 @@ typedef struct vfs_ops {
     int32_t  (*seek)(struct vfs_file *file, int32_t offset, int whence);
     bool     (*truncate)(struct vfs_file *file, uint32_t size);
 
+    /* Read-only pointer to the whole file if it is contiguous in memory
+     * (optional); valid until the file is closed */
+    const void *(*map)(struct vfs_file *file, uint32_t *size);
+
+    /* Start fetching up to @sectors past the file position into the
+     * block cache without waiting (optional; blkdev_readahead only
+     * prefetches on devices with an asynchronous start op) */
+    void (*readahead)(struct vfs_file *file, uint32_t sectors);
+
     /* Directory operations */
     bool (*opendir)(struct vfs_dir *dir);
     void (*closedir)(struct vfs_dir *dir);
     bool (*readdir)(struct vfs_dir *dir, vfs_dirent_t *entry);
+    /* Fill up to @max entries in one call; count, 0 at end, -1 on error
+     * (optional: vfs_getdents falls back to readdir) */
+    int  (*getdents)(struct vfs_dir *dir, vfs_dirent_t *entries, int max);
     void (*rewinddir)(struct vfs_dir *dir);
 
     /* Filesystem info */
@@ -175,6 +227,7 @@ typedef struct vfs_node {
     uint32_t      size;
     uint32_t      inode;          /* Filesystem-specific identifier */
     uint16_t      cluster;        /* For FAT filesystems */
+    uint32_t      mtime;          /* Modify time (fs-specific encoding) */
     struct vfs_mount *mount;      /* Mount point this node belongs to */
     void         *fs_data;        /* Filesystem-specific data */
 } vfs_node_t;
@@ -204,6 +257,12 @@ typedef struct vfs_file {
     /* For FAT: track directory entry location for updates */
     uint32_t      dir_sector;
     uint32_t      dir_offset;
+
+    uint32_t      dentry;         /* Dentry id of the opened path (0 = none) */
+
+    /* Sequential-read detection */
+    uint32_t      ra_next;        /* Where the next read continues the stream */
+    uint32_t      ra_streak;      /* Consecutive reads that did */
 } vfs_file_t;
 
 /* Open directory handle */
@@ -227,11 +286,20 @@ typedef struct vfs_state {
     /* Open file table */
     vfs_file_t    files[VFS_MAX_OPEN_FILES];
     vfs_dir_t     dirs[VFS_MAX_OPEN_FILES];
+
+    /* Called before a file's contents or name change (optional); inode 0 = the whole mount */
+    void        (*on_change)(vfs_mount_t *mnt, uint32_t inode);
+
+    /* Serialises operations across thread switches (recursive) */
+    kmutex_t      lock;
 } vfs_state_t;
 
 /* Global VFS state */
 static vfs_state_t g_vfs = {0};
 
+static inline void vfs_lock(void)   { kmutex_lock(&g_vfs.lock); }
+static inline void vfs_unlock(void) { kmutex_unlock(&g_vfs.lock); }
+
 /* ============================================================================
  * VFS String Utilities
  * ============================================================================ */
@@ -261,6 +329,1055 @@ static inline int vfs_strncmp(const char *a, const char *b, int n) {
     return n ? ((unsigned char)*a - (unsigned char)*b) : 0;
 }
 
+/* ============================================================================
+ * Block Request Queue
+ *
+ * Each device (attached lazily) gets a queue of submitted requests kept
+ * sorted by LBA. Dispatch picks requests in C-SCAN order: ascending from
+ * the last head position, wrapping to the lowest LBA. Requests that
+ * continue the chosen one (same direction, adjacent LBA) are merged into
+ * a single driver call through the queue's staging buffer.
+ *
+ * Drivers with a start op run the dispatch asynchronously and report it
+ * with blkq_complete() from their IRQ handler (or their poll op). Other
+ * drivers are called synchronously at dispatch. blkq_plug()/blkq_unplug()
+ * hold back dispatch while a batch is submitted, so the whole batch is
+ * sorted and merged. blkq_rw() is the blocking wrapper.
+ *
+ * Completion may run in an IRQ handler, where synchronous driver calls
+ * (which wait, and may yield) are not allowed. There the next dispatch
+ * is only started if dev->start accepts it; otherwise, or when a driver
+ * hands a failed transfer back with blkq_retry(), the dispatch is left
+ * deferred and run synchronously by the next thread-context caller
+ * (blkq_wait, blkq_submit, blkq_unplug, blkq_idle).
+ * ============================================================================ */
+
+typedef enum {
+    BLKREQ_QUEUED = 0,
+    BLKREQ_ACTIVE,
+    BLKREQ_DONE,
+    BLKREQ_ERROR,
+} blkreq_status_t;
+
+typedef struct blkreq {
+    ilist_node_t     link;          /* Pending (sorted) or active list */
+    uint32_t         lba;
+    uint32_t         count;         /* Sectors */
+    void            *buf;
+    bool             write;
+    volatile blkreq_status_t status;
+    uint32_t         done;          /* Sectors transferred */
+    void           (*complete)(struct blkreq *req);    /* Optional, may run in IRQ context */
+    void            *priv;
+} blkreq_t;
+
+typedef struct blkq {
+    blkdev_t     *dev;              /* NULL = free slot */
+    ilist_head_t  pending;          /* Sorted by LBA */
+    ilist_head_t  active;           /* Requests in the dispatch in flight */
+    uint32_t      head_lba;         /* C-SCAN position (end of last dispatch) */
+    bool          busy;             /* Dispatch in flight */
+    bool          staged;           /* In-flight dispatch uses the stage buffer */
+    bool          deferred;         /* Dispatch waits for a synchronous run */
+    bool          dispatching;
+
+    /* Transfer of the dispatch in flight */
+    uint32_t      cur_lba;
+    uint32_t      cur_count;
+    void         *cur_buf;
+    bool          cur_write;
+    uint32_t      plugged;
+
+    /* Statistics */
+    uint32_t      submitted;
+    uint32_t      dispatches;
+    uint32_t      merged;
+
+    uint8_t       stage[BLKQ_MAX_MERGE * BCACHE_BLOCK_SIZE] __attribute__((aligned(16)));
+} blkq_t;
+
+static blkq_t g_blkq[BLKQ_MAX_DEVICES];
+
+static inline void blkq_copy(void *dst, const void *src, uint32_t bytes) {
+    uint32_t *d = (uint32_t *)dst;
+    const uint32_t *s = (const uint32_t *)src;
+    for (uint32_t i = 0; i < bytes / 4; i++) d[i] = s[i];
+}
+
+static inline void blkreq_init(blkreq_t *req, uint32_t lba, uint32_t count,
+                               void *buf, bool write) {
+    ilist_init_node(&req->link);
+    req->lba = lba;
+    req->count = count;
+    req->buf = buf;
+    req->write = write;
+    req->status = BLKREQ_QUEUED;
+    req->done = 0;
+    req->complete = NULL;
+    req->priv = NULL;
+}
+
+static inline bool blkreq_busy(const blkreq_t *req) {
+    return req->status == BLKREQ_QUEUED || req->status == BLKREQ_ACTIVE;
+}
+
+/**
+ * Get the queue of @dev, attaching a free one on first use
+ * @return NULL if every queue is taken (callers fall back to direct I/O)
+ */
+static blkq_t *blkq_get(blkdev_t *dev) {
+    if (dev->queue) return dev->queue;
+
+    for (int i = 0; i < BLKQ_MAX_DEVICES; i++) {
+        blkq_t *q = &g_blkq[i];
+        if (q->dev) continue;
+        q->dev = dev;
+        ilist_init_head(&q->pending);
+        ilist_init_head(&q->active);
+        q->head_lba = 0;
+        q->busy = false;
+        q->staged = false;
+        q->deferred = false;
+        q->dispatching = false;
+        q->plugged = 0;
+        q->submitted = 0;
+        q->dispatches = 0;
+        q->merged = 0;
+        dev->queue = q;
+        return q;
+    }
+    return NULL;
+}
+
+/* Hand back the requests of the finished dispatch, @sectors of which succeeded */
+static void blkq_finish(blkq_t *q, uint32_t sectors) {
+    uint32_t offset = 0;
+
+    while (!ilist_is_empty(&q->active)) {
+        blkreq_t *req = ilist_first_entry(&q->active, blkreq_t, link);
+        ilist_remove(&req->link);
+
+        uint32_t got = sectors > req->count ? req->count : sectors;
+        sectors -= got;
+
+        if (q->staged && !req->write && got) {
+            blkq_copy(req->buf, q->stage + offset * BCACHE_BLOCK_SIZE, got * BCACHE_BLOCK_SIZE);
+        }
+        offset += req->count;
+
+        req->done = got;
+        req->status = (got == req->count) ? BLKREQ_DONE : BLKREQ_ERROR;
+        if (req->complete) req->complete(req);
+    }
+
+    q->busy = false;
+    q->staged = false;
+    q->deferred = false;
+}
+
+/* Carry out the dispatch in flight with the driver's synchronous ops */
+static void blkq_run_sync(blkq_t *q, uint32_t flags) {
+    blkdev_t *dev = q->dev;
+
+    q->deferred = false;
+    irq_restore(flags);
+    uint32_t n = q->cur_write
+        ? (dev->write ? dev->write(dev, q->cur_lba, q->cur_count, q->cur_buf) : 0)
+        : (dev->read ? dev->read(dev, q->cur_lba, q->cur_count, q->cur_buf) : 0);
+    irq_save();
+    blkq_finish(q, n);
+}
+
+/**
+ * Issue queued requests until one is in flight or the queue is empty
+ * (called with interrupts disabled; @flags are the caller's saved flags,
+ * restored around synchronous driver calls that may need interrupts).
+ * With @sync false (IRQ context) nothing is run synchronously: a
+ * dispatch dev->start turns down is left deferred.
+ */
+static void blkq_dispatch(blkq_t *q, uint32_t flags, bool sync) {
+    if (q->dispatching) return;
+    q->dispatching = true;
+
+    if (q->deferred && sync) blkq_run_sync(q, flags);
+
+    while (!q->busy && !q->plugged && !ilist_is_empty(&q->pending)) {
+        /* C-SCAN: next request at or above the head, else wrap around */
+        blkreq_t *first = NULL, *r;
+        ilist_foreach_entry(r, &q->pending, link) {
+            if (r->lba >= q->head_lba) { first = r; break; }
+        }
+        if (!first) first = ilist_first_entry(&q->pending, blkreq_t, link);
+
+        ilist_node_t *next = first->link.next;
+        ilist_remove(&first->link);
+        ilist_push_back(&q->active, &first->link);
+        first->status = BLKREQ_ACTIVE;
+
+        /* Merge requests that continue this one */
+        uint32_t lba = first->lba;
+        uint32_t count = first->count;
+        bool write = first->write;
+        while (next != &q->pending.node) {
+            r = ilist_entry(next, blkreq_t, link);
+            if (r->lba != lba + count || r->write != write) break;
+            if (count + r->count > BLKQ_MAX_MERGE) break;
+            next = next->next;
+            ilist_remove(&r->link);
+            ilist_push_back(&q->active, &r->link);
+            r->status = BLKREQ_ACTIVE;
+            count += r->count;
+            q->merged++;
+        }
+
+        /* Several buffers go through the stage as one transfer */
+        void *buf = first->buf;
+        q->staged = (count != first->count);
+        if (q->staged) {
+            buf = q->stage;
+            if (write) {
+                uint32_t offset = 0;
+                ilist_foreach_entry(r, &q->active, link) {
+                    blkq_copy(q->stage + offset * BCACHE_BLOCK_SIZE, r->buf,
+                              r->count * BCACHE_BLOCK_SIZE);
+                    offset += r->count;
+                }
+            }
+        }
+
+        q->busy = true;
+        q->head_lba = lba + count;
+        q->dispatches++;
+        q->cur_lba = lba;
+        q->cur_count = count;
+        q->cur_buf = buf;
+        q->cur_write = write;
+
+        blkdev_t *dev = q->dev;
+        if (dev->start && dev->start(dev, lba, count, buf, write)) break;
+        if (!sync) {
+            q->deferred = true;
+            break;
+        }
+        blkq_run_sync(q, flags);
+    }
+
+    q->dispatching = false;
+}
+
+/**
+ * Called by a driver when an asynchronous dispatch (dev->start) finishes
+ * @param sectors  Sectors transferred (0 on error)
+ */
+static void blkq_complete(blkdev_t *dev, uint32_t sectors) {
+    blkq_t *q = dev->queue;
+    if (!q || !q->busy) return;
+
+    uint32_t flags = irq_save();
+    blkq_finish(q, sectors);
+    blkq_dispatch(q, flags, false);
+    irq_restore(flags);
+}
+
+/**
+ * Called by a driver instead of blkq_complete when an asynchronous
+ * dispatch failed: it is run again with the synchronous ops from thread
+ * context (see blkq_kick)
+ */
+static void blkq_retry(blkdev_t *dev) {
+    blkq_t *q = dev->queue;
+    if (!q || !q->busy) return;
+    q->deferred = true;
+}
+
+/* Run a deferred dispatch and whatever follows it (thread context) */
+static void blkq_kick(blkq_t *q) {
+    uint32_t flags = irq_save();
+    blkq_dispatch(q, flags, true);
+    irq_restore(flags);
+}
+
+/**
+ * Queue a request (dispatched immediately unless the queue is plugged).
+ * Without a free queue the request is carried out synchronously.
+ */
+static void blkq_submit(blkdev_t *dev, blkreq_t *req) {
+    blkq_t *q = blkq_get(dev);
+    if (!q) {
+        uint32_t n;
+        if (req->write) n = dev->write ? dev->write(dev, req->lba, req->count, req->buf) : 0;
+        else            n = dev->read ? dev->read(dev, req->lba, req->count, req->buf) : 0;
+        req->done = n;
+        req->status = (n == req->count) ? BLKREQ_DONE : BLKREQ_ERROR;
+        if (req->complete) req->complete(req);
+        return;
+    }
+
+    uint32_t flags = irq_save();
+
+    /* Sorted insert; equal LBAs keep submission order */
+    ilist_node_t *pos;
+    for (pos = q->pending.node.next; pos != &q->pending.node; pos = pos->next) {
+        if (ilist_entry(pos, blkreq_t, link)->lba > req->lba) break;
+    }
+    req->status = BLKREQ_QUEUED;
+    req->done = 0;
+    ilist_insert_before(pos, &req->link);
+    q->submitted++;
+
+    blkq_dispatch(q, flags, true);
+    irq_restore(flags);
+}
+
+/* Hold back dispatch so a batch of requests is sorted and merged */
+static inline void blkq_plug(blkdev_t *dev) {
+    blkq_t *q = blkq_get(dev);
+    if (q) q->plugged++;
+}
+
+/* Release a plug and dispatch what was queued */
+static void blkq_unplug(blkdev_t *dev) {
+    blkq_t *q = dev->queue;
+    if (!q || !q->plugged) return;
+
+    uint32_t flags = irq_save();
+    if (--q->plugged == 0) blkq_dispatch(q, flags, true);
+    irq_restore(flags);
+}
+
+/**
+ * Wait for a submitted request (the queue must not be plugged)
+ * @return true if every sector was transferred
+ */
+static bool blkq_wait(blkdev_t *dev, blkreq_t *req) {
+    while (blkreq_busy(req)) {
+        if (dev->queue && dev->queue->deferred) blkq_kick(dev->queue);
+        if (!blkreq_busy(req)) break;
+        if (dev->poll) dev->poll(dev);
+        if (!sched_wait_yield() && !dev->poll) __asm__ volatile ("pause");
+    }
+    return req->status == BLKREQ_DONE;
+}
+
+/**
+ * Wait until @dev's queue has nothing pending or in flight (thread
+ * context). Callers hold vfs_lock so nothing new is queued meanwhile.
+ */
+static void blkq_idle(blkdev_t *dev) {
+    blkq_t *q = dev->queue;
+    if (!q) return;
+
+    while (q->busy || (!q->plugged && !ilist_is_empty(&q->pending))) {
+        if (q->deferred) blkq_kick(q);
+        if (!q->busy && ilist_is_empty(&q->pending)) break;
+        if (dev->poll) dev->poll(dev);
+        if (!sched_wait_yield() && !dev->poll) __asm__ volatile ("pause");
+    }
+}
+
+/**
+ * Detach @dev's queue once it drains, so another device can take the
+ * slot (thread context, vfs_lock held). A plugged queue is left alone.
+ */
+static void blkq_release(blkdev_t *dev) {
+    blkq_t *q = dev->queue;
+    if (!q) return;
+
+    blkq_idle(dev);
+    if (q->busy || q->plugged || !ilist_is_empty(&q->pending)) return;
+    q->dev = NULL;
+    dev->queue = NULL;
+}
+
+/**
+ * Blocking transfer through the request queue
+ * @return Sectors transferred
+ */
+static uint32_t blkq_rw(blkdev_t *dev, uint32_t lba, uint32_t count, void *buf, bool write) {
+    blkreq_t req;
+    blkreq_init(&req, lba, count, buf, write);
+    blkq_submit(dev, &req);
+    blkq_wait(dev, &req);
+    return req.done;
+}
+
+/* ============================================================================
+ * Block Buffer Cache
+ *
+ * Sector cache shared by every block device with dev->cached set. Buffer
+ * heads come from a pool seeded with static storage, are hashed by
+ * (device, lba) and kept on an LRU list with the most recent use at the
+ * front. Writes are write-back: sectors are marked dirty and only go to
+ * the device on eviction or bcache_flush() (called from the drivers'
+ * sync op and vfs_sync_all).
+ *
+ * Readahead inserts buffers marked pending whose read is still queued or
+ * in flight. Lookups wait for (and on failure drop) a pending buffer;
+ * eviction skips one until its request is done.
+ * ============================================================================ */
+
+#define BCACHE_DIRTY        0x01
+#define BCACHE_PENDING      0x02    /* Readahead not yet checked */
+
+typedef struct bcache_buf {
+    ilist_node_t  lru_link;     /* LRU position (first: reused by pool free list) */
+    ilist_node_t  hash_link;    /* Hash bucket chain */
+    blkdev_t     *dev;
+    uint32_t      lba;
+    uint32_t      flags;
+    blkreq_t      req;          /* Write-back request */
+    uint8_t       data[BCACHE_BLOCK_SIZE];
+} bcache_buf_t;
+
+typedef struct bcache {
+    ilist_pool_t  pool;
+    ilist_head_t  lru;
+    ilist_head_t  hash[BCACHE_HASH_SIZE];
+    uint32_t      count;        /* Buffers in use */
+    uint32_t      dirty;        /* Dirty buffers */
+
+    /* Statistics */
+    uint32_t      hits;
+    uint32_t      misses;
+    uint32_t      evictions;
+    uint32_t      writebacks;
+    uint32_t      readaheads;   /* Sectors prefetched */
+
+    bool          initialized;
+} bcache_t;
+
+static bcache_t g_bcache;
+static uint8_t  g_bcache_storage[ILIST_POOL_STORAGE_SIZE(sizeof(bcache_buf_t), BCACHE_NUM_BUFS)]
+    __attribute__((aligned(ILIST_POOL_ALIGNMENT)));
+
+static inline void bcache_copy(void *dst, const void *src) {
+    uint32_t *d = (uint32_t *)dst;
+    const uint32_t *s = (const uint32_t *)src;
+    for (int i = 0; i < BCACHE_BLOCK_SIZE / 4; i++) d[i] = s[i];
+}
+
+static inline uint32_t bcache_hash(blkdev_t *dev, uint32_t lba) {
+    return (lba ^ ((uint32_t)(uintptr_t)dev >> 4)) & (BCACHE_HASH_SIZE - 1);
+}
+
+/**
+ * Initialize the buffer cache (called lazily on first cached I/O)
+ */
+static void bcache_init(void) {
+    ilist_pool_init(&g_bcache.pool, sizeof(bcache_buf_t), BCACHE_NUM_BUFS);
+    ilist_pool_add_storage(&g_bcache.pool, g_bcache_storage, sizeof(g_bcache_storage));
+    ilist_init_head(&g_bcache.lru);
+    for (int i = 0; i < BCACHE_HASH_SIZE; i++) {
+        ilist_init_head(&g_bcache.hash[i]);
+    }
+    g_bcache.count = 0;
+    g_bcache.dirty = 0;
+    g_bcache.hits = 0;
+    g_bcache.misses = 0;
+    g_bcache.evictions = 0;
+    g_bcache.writebacks = 0;
+    g_bcache.readaheads = 0;
+    g_bcache.initialized = true;
+}
+
+/* Cached buffer of (dev, lba), pending or not, or NULL */
+static bcache_buf_t *bcache_find(blkdev_t *dev, uint32_t lba) {
+    bcache_buf_t *b;
+    ilist_foreach_entry(b, &g_bcache.hash[bcache_hash(dev, lba)], hash_link) {
+        if (b->dev == dev && b->lba == lba) return b;
+    }
+    return NULL;
+}
+
+/* Unlink a buffer and return it to the pool */
+static void bcache_drop(bcache_buf_t *b) {
+    if (b->flags & BCACHE_DIRTY) g_bcache.dirty--;
+    ilist_remove(&b->lru_link);
+    ilist_remove(&b->hash_link);
+    ilist_pool_free(&g_bcache.pool, b);
+    g_bcache.count--;
+}
+
+/**
+ * Find a cached sector, or NULL; waits for a pending readahead and
+ * drops the buffer if it failed (the queue must not be plugged)
+ */
+static bcache_buf_t *bcache_lookup(blkdev_t *dev, uint32_t lba) {
+    bcache_buf_t *b = bcache_find(dev, lba);
+    if (!b || !(b->flags & BCACHE_PENDING)) return b;
+
+    b->flags &= ~BCACHE_PENDING;
+    if (blkq_wait(dev, &b->req)) return b;
+    bcache_drop(b);
+    return NULL;
+}
+
+/* Queue the write-back of a dirty buffer (merged by the request queue) */
+static inline void bcache_submit_writeback(bcache_buf_t *b) {
+    blkreq_init(&b->req, b->lba, 1, b->data, true);
+    blkq_submit(b->dev, &b->req);
+}
+
+/* Wait for a queued write-back and mark the buffer clean if it succeeded */
+static bool bcache_finish_writeback(bcache_buf_t *b) {
+    if (!blkq_wait(b->dev, &b->req)) return false;
+    if (b->flags & BCACHE_DIRTY) {
+        b->flags &= ~BCACHE_DIRTY;
+        g_bcache.dirty--;
+    }
+    return true;
+}
+
+/**
+ * Write a run of dirty sectors starting at @first, submitted together
+ * so the request queue merges up to BCACHE_FLUSH_BATCH of them.
+ */
+static bool bcache_writeback(bcache_buf_t *first) {
+    blkdev_t *dev = first->dev;
+    uint32_t lba = first->lba;
+    bcache_buf_t *run[BCACHE_FLUSH_BATCH];
+    uint32_t n = 0;
+
+    blkq_plug(dev);
+    for (bcache_buf_t *b = first; b && (b->flags & BCACHE_DIRTY) && n < BCACHE_FLUSH_BATCH;
+         b = bcache_find(dev, lba + n)) {
+        bcache_submit_writeback(b);
+        run[n++] = b;
+    }
+    blkq_unplug(dev);
+
+    bool ok = true;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!bcache_finish_writeback(run[i])) ok = false;
+    }
+    g_bcache.writebacks++;
+    return ok;
+}
+
+/**
+ * Get an unused buffer head, evicting the least recently used one
+ */
+static bcache_buf_t *bcache_get_free(void) {
+    bcache_buf_t *b = NULL;
+    if (g_bcache.count < BCACHE_NUM_BUFS) b = ILIST_POOL_ALLOC(&g_bcache.pool, bcache_buf_t);
+    if (b) {
+        g_bcache.count++;
+        return b;
+    }
+
+    ilist_foreach_entry_reverse(b, &g_bcache.lru, lru_link) {
+        if (b->flags & BCACHE_PENDING) {
+            if (blkreq_busy(&b->req)) continue;
+            b->flags &= ~BCACHE_PENDING;
+        }
+        if ((b->flags & BCACHE_DIRTY) && !bcache_writeback(b)) continue;
+        ilist_remove(&b->lru_link);
+        ilist_remove(&b->hash_link);
+        g_bcache.evictions++;
+        return b;
+    }
+    return NULL;
+}
+
+/**
+ * Insert a copy of @data as the cached contents of (dev, lba)
+ */
+static bcache_buf_t *bcache_insert(blkdev_t *dev, uint32_t lba, const void *data) {
+    bcache_buf_t *b = bcache_get_free();
+    if (!b) return NULL;
+
+    b->dev = dev;
+    b->lba = lba;
+    b->flags = 0;
+    bcache_copy(b->data, data);
+    ilist_push_front(&g_bcache.hash[bcache_hash(dev, lba)], &b->hash_link);
+    ilist_push_front(&g_bcache.lru, &b->lru_link);
+    return b;
+}
+
+/**
+ * Write back every dirty sector belonging to @dev
+ *
+ * All dirty sectors are queued as one batch, so they go out in C-SCAN
+ * order with adjacent sectors merged into multi-sector requests.
+ */
+static bool bcache_flush(blkdev_t *dev) {
+    if (!g_bcache.initialized || g_bcache.dirty == 0) return true;
+
+    bcache_buf_t *b;
+    uint32_t queued = 0;
+
+    blkq_plug(dev);
+    ilist_foreach_entry(b, &g_bcache.lru, lru_link) {
+        if (b->dev != dev || !(b->flags & BCACHE_DIRTY)) continue;
+        bcache_submit_writeback(b);
+        queued++;
+    }
+    blkq_unplug(dev);
+
+    bool ok = true;
+    ilist_foreach_entry(b, &g_bcache.lru, lru_link) {
+        if (queued == 0) break;
+        if (b->dev != dev || !(b->flags & BCACHE_DIRTY)) continue;
+        if (!bcache_finish_writeback(b)) ok = false;
+        queued--;
+    }
+    if (ok) g_bcache.writebacks++;
+    return ok;
+}
+
+/**
+ * Drop every cached sector of @dev (dirty data is discarded, flush first)
+ */
+static void bcache_invalidate(blkdev_t *dev) {
+    if (!g_bcache.initialized) return;
+
+    bcache_buf_t *b, *tmp;
+    ilist_foreach_entry_safe(b, tmp, &g_bcache.lru, lru_link) {
+        if (b->dev != dev) continue;
+        if (b->flags & BCACHE_PENDING) blkq_wait(dev, &b->req);
+        bcache_drop(b);
+    }
+}
+
+/**
+ * Read sectors through the buffer cache
+ *
+ * Hits are copied out of the cache; each run of consecutive misses is
+ * fetched from the device in one request straight into @buf and then
+ * copied into the cache unless it is longer than BCACHE_STREAM_MAX.
+ */
+static uint32_t blkdev_read_locked(blkdev_t *dev, uint32_t lba, uint32_t count, void *buf) {
+    if (!dev || !dev->read) return 0;
+    if (!dev->cached) return blkq_rw(dev, lba, count, buf, false);
+    if (!g_bcache.initialized) bcache_init();
+
+    uint8_t *dst = (uint8_t *)buf;
+    uint32_t i = 0;
+
+    while (i < count) {
+        bcache_buf_t *b = bcache_lookup(dev, lba + i);
+        if (b) {
+            bcache_copy(dst + i * BCACHE_BLOCK_SIZE, b->data);
+            ilist_move_to_front(&g_bcache.lru, &b->lru_link);
+            g_bcache.hits++;
+            i++;
+            continue;
+        }
+
+        uint32_t run = 1;
+        while (i + run < count && !bcache_lookup(dev, lba + i + run)) run++;
+
+        if (blkq_rw(dev, lba + i, run, dst + i * BCACHE_BLOCK_SIZE, false) != run) {
+            return i;
+        }
+        g_bcache.misses += run;
+
+        /* Streaming reads would only flush the cache; leave them out */
+        if (run <= BCACHE_STREAM_MAX) {
+            for (uint32_t j = 0; j < run; j++) {
+                bcache_insert(dev, lba + i + j, dst + (i + j) * BCACHE_BLOCK_SIZE);
+            }
+        }
+        i += run;
+    }
+
+    return count;
+}
+
+static uint32_t blkdev_read(blkdev_t *dev, uint32_t lba, uint32_t count, void *buf) {
+    vfs_lock();
+    TRACE_BEGIN(t0);
+    uint32_t n = blkdev_read_locked(dev, lba, count, buf);
+    TRACE_END(TP_BLK_READ, t0, count);
+    vfs_unlock();
+    return n;
+}
+
+/**
+ * Start reading up to BCACHE_READAHEAD_MAX sectors into the cache without
+ * waiting for them. Sectors already cached are skipped; the rest are
+ * queued as one batch, so the request queue merges them.
+ *
+ * Only devices with a start op take readahead: on the others dispatch
+ * is synchronous, so the caller would wait for the sectors it meant to
+ * prefetch. (A start op can still turn a transfer down, e.g. ATA once
+ * DMA is disabled; that batch then runs before this returns.)
+ */
+static void blkdev_readahead(blkdev_t *dev, uint32_t lba, uint32_t count) {
+    if (!dev || !dev->read || !dev->cached || !dev->start) return;
+
+    vfs_lock();
+    if (!g_bcache.initialized) bcache_init();
+    if (count > BCACHE_READAHEAD_MAX) count = BCACHE_READAHEAD_MAX;
+
+    /* Take every buffer first: eviction may write back, which needs an unplugged queue */
+    bcache_buf_t *bufs[BCACHE_READAHEAD_MAX];
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (bcache_find(dev, lba + i)) continue;
+        bcache_buf_t *b = bcache_get_free();
+        if (!b) break;
+        b->dev = dev;
+        b->lba = lba + i;
+        b->flags = BCACHE_PENDING;
+        bufs[n++] = b;
+    }
+
+    blkq_plug(dev);
+    for (uint32_t i = 0; i < n; i++) {
+        bcache_buf_t *b = bufs[i];
+        blkreq_init(&b->req, b->lba, 1, b->data, false);
+        ilist_push_front(&g_bcache.hash[bcache_hash(dev, b->lba)], &b->hash_link);
+        ilist_push_front(&g_bcache.lru, &b->lru_link);
+        blkq_submit(dev, &b->req);
+    }
+    blkq_unplug(dev);
+
+    g_bcache.readaheads += n;
+    vfs_unlock();
+}
+
+/**
+ * Write sectors through the buffer cache (write-back)
+ *
+ * Requests longer than BCACHE_STREAM_MAX go straight to the device in
+ * one call, refreshing any cached copies. Falls back to writing through
+ * if no buffer can be freed.
+ */
+static uint32_t blkdev_write_locked(blkdev_t *dev, uint32_t lba, uint32_t count, const void *buf) {
+    if (!dev || !dev->write) return 0;
+    if (!dev->cached) return blkq_rw(dev, lba, count, (void *)buf, true);
+    if (!g_bcache.initialized) bcache_init();
+
+    const uint8_t *src = (const uint8_t *)buf;
+
+    if (count > BCACHE_STREAM_MAX) {
+        uint32_t done = blkq_rw(dev, lba, count, (void *)buf, true);
+        for (uint32_t i = 0; i < done; i++) {
+            bcache_buf_t *b = bcache_lookup(dev, lba + i);
+            if (!b) continue;
+            bcache_copy(b->data, src + i * BCACHE_BLOCK_SIZE);
+            if (b->flags & BCACHE_DIRTY) {
+                b->flags &= ~BCACHE_DIRTY;
+                g_bcache.dirty--;
+            }
+        }
+        return done;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *data = src + i * BCACHE_BLOCK_SIZE;
+        bcache_buf_t *b = bcache_lookup(dev, lba + i);
+
+        if (b) {
+            bcache_copy(b->data, data);
+            ilist_move_to_front(&g_bcache.lru, &b->lru_link);
+        } else {
+            b = bcache_insert(dev, lba + i, data);
+        }
+
+        if (!b) {
+            if (blkq_rw(dev, lba + i, 1, (void *)data, true) != 1) return i;
+            continue;
+        }
+
+        if (!(b->flags & BCACHE_DIRTY)) {
+            b->flags |= BCACHE_DIRTY;
+            g_bcache.dirty++;
+        }
+    }
+
+    return count;
+}
+
+static uint32_t blkdev_write(blkdev_t *dev, uint32_t lba, uint32_t count, const void *buf) {
+    vfs_lock();
+    TRACE_BEGIN(t0);
+    uint32_t n = blkdev_write_locked(dev, lba, count, buf);
+    TRACE_END(TP_BLK_WRITE, t0, count);
+    vfs_unlock();
+    return n;
+}
+
+/**
+ * Flush a device: write back its dirty sectors via the driver's sync op
+ */
+static bool blkdev_sync(blkdev_t *dev) {
+    if (!dev) return false;
+
+    vfs_lock();
+    bool ok = dev->sync ? dev->sync(dev) : bcache_flush(dev);
+    vfs_unlock();
+    return ok;
+}
+
+/* ============================================================================
+ * Dentry Cache
+ *
+ * Path lookups are cached one component at a time, keyed by (mount,
+ * parent dentry, name hash). Every dentry gets a fresh id that is never
+ * reused, so children of an evicted or invalidated directory simply stop
+ * matching and age out. Misses that the filesystem could not resolve are
+ * cached as negative entries. Entries come from a pool seeded with static
+ * storage and are evicted LRU; the namespace-changing VFS calls invalidate
+ * the components they touch.
+ * ============================================================================ */
+
+#define DCACHE_NEGATIVE     0x01
+
+typedef struct dentry {
+    ilist_node_t  lru_link;     /* LRU position (first: reused by pool free list) */
+    ilist_node_t  hash_link;    /* Hash bucket chain */
+    vfs_mount_t  *mount;
+    uint32_t      parent;       /* Parent dentry id (0 = mount root) */
+    uint32_t      id;
+    uint32_t      hash;
+    uint32_t      flags;
+    char          name[VFS_MAX_NAME];
+    vfs_node_t    node;         /* Valid unless DCACHE_NEGATIVE */
+} dentry_t;
+
+typedef struct dcache {
+    ilist_pool_t  pool;
+    ilist_head_t  lru;
+    ilist_head_t  hash[DCACHE_HASH_SIZE];
+    uint32_t      count;        /* Entries in use */
+    uint32_t      next_id;
+
+    /* Statistics */
+    uint32_t      hits;
+    uint32_t      negative_hits;
+    uint32_t      misses;
+    uint32_t      evictions;
+
+    bool          initialized;
+} dcache_t;
+
+static dcache_t g_dcache;
+static uint8_t  g_dcache_storage[ILIST_POOL_STORAGE_SIZE(sizeof(dentry_t), DCACHE_NUM_ENTRIES)]
+    __attribute__((aligned(ILIST_POOL_ALIGNMENT)));
+
+/* FNV-1a over one path component */
+static inline uint32_t dcache_name_hash(const char *name, int len) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return h;
+}
+
+static inline uint32_t dcache_bucket(vfs_mount_t *mnt, uint32_t parent, uint32_t hash) {
+    return (hash ^ (parent * 0x9E3779B1u) ^ ((uint32_t)(uintptr_t)mnt >> 4)) &
+           (DCACHE_HASH_SIZE - 1);
+}
+
+/**
+ * Initialize the dentry cache (called lazily on first lookup)
+ */
+static void dcache_init(void) {
+    ilist_pool_init(&g_dcache.pool, sizeof(dentry_t), DCACHE_NUM_ENTRIES);
+    ilist_pool_add_storage(&g_dcache.pool, g_dcache_storage, sizeof(g_dcache_storage));
+    ilist_init_head(&g_dcache.lru);
+    for (int i = 0; i < DCACHE_HASH_SIZE; i++) {
+        ilist_init_head(&g_dcache.hash[i]);
+    }
+    g_dcache.count = 0;
+    g_dcache.next_id = 1;
+    g_dcache.hits = 0;
+    g_dcache.negative_hits = 0;
+    g_dcache.misses = 0;
+    g_dcache.evictions = 0;
+    g_dcache.initialized = true;
+}
+
+/**
+ * Find the dentry for component @name (@len bytes) under @parent, or NULL
+ */
+static dentry_t *dcache_find(vfs_mount_t *mnt, uint32_t parent, const char *name,
+                             int len, uint32_t hash) {
+    dentry_t *d;
+    ilist_foreach_entry(d, &g_dcache.hash[dcache_bucket(mnt, parent, hash)], hash_link) {
+        if (d->hash != hash || d->mount != mnt || d->parent != parent) continue;
+        if (vfs_strncmp(d->name, name, len) == 0 && d->name[len] == '\0') return d;
+    }
+    return NULL;
+}
+
+static void dcache_drop(dentry_t *d) {
+    ilist_remove(&d->lru_link);
+    ilist_remove(&d->hash_link);
+    ilist_pool_free(&g_dcache.pool, d);
+    g_dcache.count--;
+}
+
+/**
+ * Add a dentry for @name under @parent; @node NULL makes it negative
+ */
+static dentry_t *dcache_insert(vfs_mount_t *mnt, uint32_t parent, const char *name,
+                               int len, uint32_t hash, const vfs_node_t *node) {
+    dentry_t *d = NULL;
+    if (g_dcache.count < DCACHE_NUM_ENTRIES) d = ILIST_POOL_ALLOC(&g_dcache.pool, dentry_t);
+    if (d) {
+        g_dcache.count++;
+    } else {
+        if (ilist_is_empty(&g_dcache.lru)) return NULL;
+        d = ilist_last_entry(&g_dcache.lru, dentry_t, lru_link);
+        ilist_remove(&d->lru_link);
+        ilist_remove(&d->hash_link);
+        g_dcache.evictions++;
+    }
+
+    d->mount = mnt;
+    d->parent = parent;
+    d->id = g_dcache.next_id++;
+    if (g_dcache.next_id == 0) g_dcache.next_id = 1;
+    d->hash = hash;
+    d->flags = node ? 0 : DCACHE_NEGATIVE;
+    for (int i = 0; i < len; i++) d->name[i] = name[i];
+    d->name[len] = '\0';
+    if (node) d->node = *node;
+    ilist_push_front(&g_dcache.hash[dcache_bucket(mnt, parent, hash)], &d->hash_link);
+    ilist_push_front(&g_dcache.lru, &d->lru_link);
+    return d;
+}
+
+/**
+ * Look up @rel (relative to @mnt) through the dentry cache
+ *
+ * Each component is probed under its parent's dentry; only components
+ * not yet cached go to the filesystem's lookup op (with the path prefix
+ * ending at that component).
+ *
+ * @param id    If non-NULL, receives the final dentry id (0 if uncached)
+ * @return      true if found (node filled in)
+ */
+static bool vfs_lookup(vfs_mount_t *mnt, const char *rel, vfs_node_t *node, uint32_t *id) {
+    if (id) *id = 0;
+    if (!mnt->ops->lookup) return false;
+
+    while (*rel == '/') rel++;
+    if (*rel == '\0') return mnt->ops->lookup(mnt, rel, node);
+
+    if (!g_dcache.initialized) dcache_init();
+
+    char prefix[VFS_MAX_PATH];
+    uint32_t parent = 0;
+    const char *p = rel;
+
+    while (*p) {
+        const char *name = p;
+        int len = 0;
+        while (name[len] && name[len] != '/') len++;
+        p = name + len;
+        while (*p == '/') p++;
+
+        if (len >= VFS_MAX_NAME) {
+            return mnt->ops->lookup(mnt, rel, node);  /* Not cacheable */
+        }
+
+        uint32_t hash = dcache_name_hash(name, len);
+        dentry_t *d = dcache_find(mnt, parent, name, len, hash);
+        if (d) {
+            ilist_move_to_front(&g_dcache.lru, &d->lru_link);
+            if (d->flags & DCACHE_NEGATIVE) {
+                g_dcache.negative_hits++;
+                return false;
+            }
+            g_dcache.hits++;
+        } else {
+            vfs_node_t found;
+            int plen = (int)(name - rel) + len;
+            g_dcache.misses++;
+            for (int i = 0; i < plen; i++) prefix[i] = rel[i];
+            prefix[plen] = '\0';
+
+            bool ok = mnt->ops->lookup(mnt, prefix, &found);
+            d = dcache_insert(mnt, parent, name, len, hash, ok ? &found : NULL);
+            if (!ok) return false;
+            if (!d) {
+                /* Cache full of nothing evictable: resolve the rest directly */
+                return mnt->ops->lookup(mnt, rel, node);
+            }
+        }
+
+        parent = d->id;
+        if (*p == '\0') {
+            *node = d->node;
+            if (id) *id = d->id;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Forget the cached names in the directory holding the final component
+ * of @rel. The whole directory goes because the filesystem may match
+ * names loosely (FAT is case-insensitive, so "a.txt" aliases "A.TXT").
+ * Dentries below the dropped ones become unreachable with their parents.
+ */
+static void dcache_invalidate(vfs_mount_t *mnt, const char *rel) {
+    if (!g_dcache.initialized) return;
+
+    uint32_t parent = 0;
+    const char *p = rel;
+    while (*p == '/') p++;
+
+    while (*p) {
+        const char *name = p;
+        int len = 0;
+        while (name[len] && name[len] != '/') len++;
+        p = name + len;
+        while (*p == '/') p++;
+        if (*p == '\0') break;
+
+        if (len >= VFS_MAX_NAME) return;
+        dentry_t *d = dcache_find(mnt, parent, name, len, dcache_name_hash(name, len));
+        if (!d || (d->flags & DCACHE_NEGATIVE)) return;  /* Nothing cached below */
+        parent = d->id;
+    }
+
+    dentry_t *d, *tmp;
+    ilist_foreach_entry_safe(d, tmp, &g_dcache.lru, lru_link) {
+        if (d->mount == mnt && d->parent == parent) dcache_drop(d);
+    }
+}
+
+/**
+ * Forget dentry @id and its siblings (e.g. after its file was written)
+ */
+static void dcache_invalidate_id(vfs_mount_t *mnt, uint32_t id) {
+    if (!g_dcache.initialized || id == 0) return;
+
+    dentry_t *d, *tmp;
+    dentry_t *found = NULL;
+    ilist_foreach_entry(d, &g_dcache.lru, lru_link) {
+        if (d->id == id && d->mount == mnt) {
+            found = d;
+            break;
+        }
+    }
+    if (!found) return;
+
+    uint32_t parent = found->parent;
+    ilist_foreach_entry_safe(d, tmp, &g_dcache.lru, lru_link) {
+        if (d->mount == mnt && d->parent == parent) dcache_drop(d);
+    }
+}
+
+/**
+ * Drop every dentry of @mnt
+ */
+static void dcache_invalidate_mount(vfs_mount_t *mnt) {
+    if (!g_dcache.initialized) return;
+
+    dentry_t *d, *tmp;
+    ilist_foreach_entry_safe(d, tmp, &g_dcache.lru, lru_link) {
+        if (d->mount == mnt) dcache_drop(d);
+    }
+}
+
 /* ============================================================================
  * Path Utilities
  * ============================================================================ */
@@ -382,8 +1499,8 @@ static void vfs_init(void) {
 /**
  * Register and mount a filesystem
  */
-static vfs_mount_t *vfs_mount(const char *path, blkdev_t *dev, vfs_ops_t *ops,
-                               uint8_t *sector_buf, uint8_t *cache) {
+static vfs_mount_t *vfs_mount_locked(const char *path, blkdev_t *dev, vfs_ops_t *ops,
+                                      uint8_t *sector_buf, uint8_t *cache) {
     /* Find free mount point */
     vfs_mount_t *mnt = NULL;
     for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
@@ -419,10 +1536,18 @@ static vfs_mount_t *vfs_mount(const char *path, blkdev_t *dev, vfs_ops_t *ops,
     return mnt;
 }
 
+static vfs_mount_t *vfs_mount(const char *path, blkdev_t *dev, vfs_ops_t *ops,
+                               uint8_t *sector_buf, uint8_t *cache) {
+    vfs_lock();
+    vfs_mount_t *mnt = vfs_mount_locked(path, dev, ops, sector_buf, cache);
+    vfs_unlock();
+    return mnt;
+}
+
 /**
  * Unmount a filesystem
  */
-static bool vfs_unmount(const char *path) {
+static bool vfs_unmount_locked(const char *path) {
     vfs_mount_t *mnt = vfs_find_mount(path);
     if (!mnt || !mnt->mounted) return false;
 
@@ -441,7 +1566,23 @@ static bool vfs_unmount(const char *path) {
         mnt->ops->unmount(mnt);
     }
 
+    dcache_invalidate_mount(mnt);
+    if (g_vfs.on_change) g_vfs.on_change(mnt, 0);
+
+    /* Write back and drop cached sectors */
+    if (mnt->device) {
+        blkdev_sync(mnt->device);
+        bcache_invalidate(mnt->device);
+    }
+
     mnt->mounted = false;
+
+    /* Give the request queue back unless another mount uses the device */
+    bool shared = false;
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (g_vfs.mounts[i].mounted && g_vfs.mounts[i].device == mnt->device) shared = true;
+    }
+    if (mnt->device && !shared) blkq_release(mnt->device);
     g_vfs.mount_count--;
 
     if (g_vfs.root_mount == mnt) {
@@ -451,10 +1592,17 @@ static bool vfs_unmount(const char *path) {
     return true;
 }
 
+static bool vfs_unmount(const char *path) {
+    vfs_lock();
+    bool ok = vfs_unmount_locked(path);
+    vfs_unlock();
+    return ok;
+}
+
 /**
  * Open a file
  */
-static vfs_file_t *vfs_open(const char *path, uint32_t flags) {
+static vfs_file_t *vfs_open_locked(const char *path, uint32_t flags) {
     char normalized[VFS_MAX_PATH];
     vfs_normalize_path(path, normalized, "/");
 
@@ -475,14 +1623,15 @@ static vfs_file_t *vfs_open(const char *path, uint32_t flags) {
     const char *rel = vfs_relative_path(mnt, normalized);
 
     /* Lookup node */
-    if (!mnt->ops->lookup || !mnt->ops->lookup(mnt, rel, &file->node)) {
+    if (!vfs_lookup(mnt, rel, &file->node, &file->dentry)) {
         /* File doesn't exist - create if requested */
         if (flags & VFS_O_CREAT) {
             if (!mnt->ops->create || !mnt->ops->create(mnt, rel, VFS_FILE)) {
                 return NULL;
             }
             /* Try lookup again */
-            if (!mnt->ops->lookup(mnt, rel, &file->node)) {
+            dcache_invalidate(mnt, rel);
+            if (!vfs_lookup(mnt, rel, &file->node, &file->dentry)) {
                 return NULL;
             }
         } else {
@@ -494,6 +1643,8 @@ static vfs_file_t *vfs_open(const char *path, uint32_t flags) {
     file->flags = flags;
     file->position = 0;
     file->dirty = false;
+    file->ra_next = 0;
+    file->ra_streak = 0;
 
     /* Call filesystem open */
     if (mnt->ops->open && !mnt->ops->open(file, flags)) {
@@ -504,17 +1655,52 @@ static vfs_file_t *vfs_open(const char *path, uint32_t flags) {
     return file;
 }
 
+static vfs_file_t *vfs_open(const char *path, uint32_t flags) {
+    vfs_lock();
+    TRACE_BEGIN(t0);
+    vfs_file_t *file = vfs_open_locked(path, flags);
+    TRACE_END(TP_VFS_OPEN, t0, flags);
+    vfs_unlock();
+    return file;
+}
+
 /**
  * Close a file
  */
 static void vfs_close(vfs_file_t *file) {
     if (!file || !file->open) return;
 
+    vfs_lock();
     if (file->mount && file->mount->ops->close) {
         file->mount->ops->close(file);
     }
 
+    /* Size and first cluster may have changed */
+    if (file->mount && (file->flags & VFS_O_WRONLY)) {
+        if (g_vfs.on_change) g_vfs.on_change(file->mount, file->node.inode);
+        dcache_invalidate_id(file->mount, file->dentry);
+    }
+
     file->open = false;
+    vfs_unlock();
+}
+
+/**
+ * Sequential-read detection, after a read that started at @start: once
+ * VFS_READAHEAD_STREAK reads in a row have each continued where the last
+ * one stopped, ask the filesystem to keep VFS_READAHEAD_SECTORS beyond
+ * the position in flight. Small reads trigger it once per sector crossed.
+ */
+static void vfs_readahead_check(vfs_file_t *file, uint32_t start) {
+    file->ra_streak = (start == file->ra_next) ? file->ra_streak + 1 : 0;
+    file->ra_next = file->position;
+
+    if (file->ra_streak < VFS_READAHEAD_STREAK || !file->mount->ops->readahead) return;
+    if (file->position >= file->node.size) return;
+    if (start / BCACHE_BLOCK_SIZE == file->position / BCACHE_BLOCK_SIZE &&
+        file->ra_streak > VFS_READAHEAD_STREAK) return;
+
+    file->mount->ops->readahead(file, VFS_READAHEAD_SECTORS);
 }
 
 /**
@@ -524,7 +1710,14 @@ static int32_t vfs_read(vfs_file_t *file, void *buf, uint32_t size) {
     if (!file || !file->open) return -1;
     if (!file->mount || !file->mount->ops->read) return -1;
 
-    return file->mount->ops->read(file, buf, size);
+    vfs_lock();
+    TRACE_BEGIN(t0);
+    uint32_t start = file->position;
+    int32_t n = file->mount->ops->read(file, buf, size);
+    if (n > 0) vfs_readahead_check(file, start);
+    TRACE_END(TP_VFS_READ, t0, size);
+    vfs_unlock();
+    return n;
 }
 
 /**
@@ -535,7 +1728,24 @@ static int32_t vfs_write(vfs_file_t *file, const void *buf, uint32_t size) {
     if (!file->mount || !file->mount->ops->write) return -1;
     if (file->mount->readonly) return -1;
 
-    return file->mount->ops->write(file, buf, size);
+    vfs_lock();
+    int32_t n = file->mount->ops->write(file, buf, size);
+    vfs_unlock();
+    return n;
+}
+
+/**
+ * Map a file's contents for direct reading
+ *
+ * @param size  Receives the file size
+ * @return      Read-only pointer valid until vfs_close, or NULL if the
+ *              filesystem cannot map (use vfs_read instead)
+ */
+static const void *vfs_map(vfs_file_t *file, uint32_t *size) {
+    if (!file || !file->open) return NULL;
+    if (!file->mount || !file->mount->ops->map) return NULL;
+
+    return file->mount->ops->map(file, size);
 }
 
 /**
@@ -545,7 +1755,10 @@ static int32_t vfs_seek(vfs_file_t *file, int32_t offset, int whence) {
     if (!file || !file->open) return -1;
 
     if (file->mount && file->mount->ops->seek) {
-        return file->mount->ops->seek(file, offset, whence);
+        vfs_lock();
+        int32_t pos = file->mount->ops->seek(file, offset, whence);
+        vfs_unlock();
+        return pos;
     }
 
     /* Default seek implementation */
@@ -565,7 +1778,7 @@ static int32_t vfs_seek(vfs_file_t *file, int32_t offset, int whence) {
 /**
  * Open directory
  */
-static vfs_dir_t *vfs_opendir(const char *path) {
+static vfs_dir_t *vfs_opendir_locked(const char *path) {
     char normalized[VFS_MAX_PATH];
     vfs_normalize_path(path, normalized, "/");
 
@@ -586,7 +1799,7 @@ static vfs_dir_t *vfs_opendir(const char *path) {
 
     /* Lookup directory node */
     if (mnt->ops->lookup) {
-        if (!mnt->ops->lookup(mnt, rel, &dir->node)) {
+        if (!vfs_lookup(mnt, rel, &dir->node, NULL)) {
             return NULL;
         }
     }
@@ -602,17 +1815,26 @@ static vfs_dir_t *vfs_opendir(const char *path) {
     return dir;
 }
 
+static vfs_dir_t *vfs_opendir(const char *path) {
+    vfs_lock();
+    vfs_dir_t *dir = vfs_opendir_locked(path);
+    vfs_unlock();
+    return dir;
+}
+
 /**
  * Close directory
  */
 static void vfs_closedir(vfs_dir_t *dir) {
     if (!dir || !dir->open) return;
 
+    vfs_lock();
     if (dir->mount && dir->mount->ops->closedir) {
         dir->mount->ops->closedir(dir);
     }
 
     dir->open = false;
+    vfs_unlock();
 }
 
 /**
@@ -622,13 +1844,44 @@ static bool vfs_readdir(vfs_dir_t *dir, vfs_dirent_t *entry) {
     if (!dir || !dir->open) return false;
     if (!dir->mount || !dir->mount->ops->readdir) return false;
 
-    return dir->mount->ops->readdir(dir, entry);
+    vfs_lock();
+    bool ok = dir->mount->ops->readdir(dir, entry);
+    vfs_unlock();
+    return ok;
+}
+
+/**
+ * Read up to @max directory entries at once
+ * @return entries filled, 0 at the end of the directory, -1 on error
+ */
+static int vfs_getdents(vfs_dir_t *dir, vfs_dirent_t *entries, int max) {
+    if (!dir || !dir->open || !entries || max <= 0) return -1;
+    vfs_ops_t *ops = dir->mount ? dir->mount->ops : NULL;
+    if (!ops || (!ops->getdents && !ops->readdir)) return -1;
+
+    vfs_lock();
+    int n = 0;
+    if (ops->getdents) {
+        n = ops->getdents(dir, entries, max);
+    } else {
+        while (n < max && ops->readdir(dir, &entries[n])) n++;
+    }
+    vfs_unlock();
+    return n;
+}
+
+/* Tell the change hook that the file at @rel is about to change */
+static void vfs_notify_change(vfs_mount_t *mnt, const char *rel) {
+    vfs_node_t node;
+    if (g_vfs.on_change && vfs_lookup(mnt, rel, &node, NULL)) {
+        g_vfs.on_change(mnt, node.inode);
+    }
 }
 
 /**
  * Create a file
  */
-static bool vfs_create(const char *path) {
+static bool vfs_create_locked(const char *path) {
     char normalized[VFS_MAX_PATH];
     vfs_normalize_path(path, normalized, "/");
 
@@ -637,13 +1890,22 @@ static bool vfs_create(const char *path) {
     if (!mnt->ops->create) return false;
 
     const char *rel = vfs_relative_path(mnt, normalized);
-    return mnt->ops->create(mnt, rel, VFS_FILE);
+    bool ok = mnt->ops->create(mnt, rel, VFS_FILE);
+    dcache_invalidate(mnt, rel);
+    return ok;
+}
+
+static bool vfs_create(const char *path) {
+    vfs_lock();
+    bool ok = vfs_create_locked(path);
+    vfs_unlock();
+    return ok;
 }
 
 /**
  * Create a directory
  */
-static bool vfs_mkdir(const char *path) {
+static bool vfs_mkdir_locked(const char *path) {
     char normalized[VFS_MAX_PATH];
     vfs_normalize_path(path, normalized, "/");
 
@@ -652,13 +1914,22 @@ static bool vfs_mkdir(const char *path) {
     if (!mnt->ops->mkdir) return false;
 
     const char *rel = vfs_relative_path(mnt, normalized);
-    return mnt->ops->mkdir(mnt, rel);
+    bool ok = mnt->ops->mkdir(mnt, rel);
+    dcache_invalidate(mnt, rel);
+    return ok;
+}
+
+static bool vfs_mkdir(const char *path) {
+    vfs_lock();
+    bool ok = vfs_mkdir_locked(path);
+    vfs_unlock();
+    return ok;
 }
 
 /**
  * Delete a file
  */
-static bool vfs_unlink(const char *path) {
+static bool vfs_unlink_locked(const char *path) {
     char normalized[VFS_MAX_PATH];
     vfs_normalize_path(path, normalized, "/");
 
@@ -667,13 +1938,23 @@ static bool vfs_unlink(const char *path) {
     if (!mnt->ops->unlink) return false;
 
     const char *rel = vfs_relative_path(mnt, normalized);
-    return mnt->ops->unlink(mnt, rel);
+    vfs_notify_change(mnt, rel);
+    bool ok = mnt->ops->unlink(mnt, rel);
+    dcache_invalidate(mnt, rel);
+    return ok;
+}
+
+static bool vfs_unlink(const char *path) {
+    vfs_lock();
+    bool ok = vfs_unlink_locked(path);
+    vfs_unlock();
+    return ok;
 }
 
 /**
  * Delete a directory
  */
-static bool vfs_rmdir(const char *path) {
+static bool vfs_rmdir_locked(const char *path) {
     char normalized[VFS_MAX_PATH];
     vfs_normalize_path(path, normalized, "/");
 
@@ -682,13 +1963,22 @@ static bool vfs_rmdir(const char *path) {
     if (!mnt->ops->rmdir) return false;
 
     const char *rel = vfs_relative_path(mnt, normalized);
-    return mnt->ops->rmdir(mnt, rel);
+    bool ok = mnt->ops->rmdir(mnt, rel);
+    dcache_invalidate(mnt, rel);
+    return ok;
+}
+
+static bool vfs_rmdir(const char *path) {
+    vfs_lock();
+    bool ok = vfs_rmdir_locked(path);
+    vfs_unlock();
+    return ok;
 }
 
 /**
  * Rename/move a file
  */
-static bool vfs_rename(const char *old_path, const char *new_path) {
+static bool vfs_rename_locked(const char *old_path, const char *new_path) {
     char old_norm[VFS_MAX_PATH], new_norm[VFS_MAX_PATH];
     vfs_normalize_path(old_path, old_norm, "/");
     vfs_normalize_path(new_path, new_norm, "/");
@@ -704,13 +1994,25 @@ static bool vfs_rename(const char *old_path, const char *new_path) {
     const char *old_rel = vfs_relative_path(mnt, old_norm);
     const char *new_rel = vfs_relative_path(mnt, new_norm);
 
-    return mnt->ops->rename(mnt, old_rel, new_rel);
+    vfs_notify_change(mnt, old_rel);
+    vfs_notify_change(mnt, new_rel);
+    bool ok = mnt->ops->rename(mnt, old_rel, new_rel);
+    dcache_invalidate(mnt, old_rel);
+    dcache_invalidate(mnt, new_rel);
+    return ok;
+}
+
+static bool vfs_rename(const char *old_path, const char *new_path) {
+    vfs_lock();
+    bool ok = vfs_rename_locked(old_path, new_path);
+    vfs_unlock();
+    return ok;
 }
 
 /**
  * Get file information
  */
-static bool vfs_stat(const char *path, vfs_stat_t *stat) {
+static bool vfs_stat_locked(const char *path, vfs_stat_t *stat) {
     char normalized[VFS_MAX_PATH];
     vfs_normalize_path(path, normalized, "/");
 
@@ -720,7 +2022,7 @@ static bool vfs_stat(const char *path, vfs_stat_t *stat) {
     vfs_node_t node;
     const char *rel = vfs_relative_path(mnt, normalized);
 
-    if (!mnt->ops->lookup || !mnt->ops->lookup(mnt, rel, &node)) {
+    if (!vfs_lookup(mnt, rel, &node, NULL)) {
         return false;
     }
 
@@ -735,24 +2037,37 @@ static bool vfs_stat(const char *path, vfs_stat_t *stat) {
     stat->uid = 0;
     stat->gid = 0;
     stat->atime = 0;
-    stat->mtime = 0;
+    stat->mtime = node.mtime;
     stat->ctime = 0;
     stat->blocks = (node.size + 511) / 512;
     stat->block_size = 512;
+    stat->inode = node.inode;
 
     return true;
 }
 
+static bool vfs_stat(const char *path, vfs_stat_t *stat) {
+    vfs_lock();
+    bool ok = vfs_stat_locked(path, stat);
+    vfs_unlock();
+    return ok;
+}
+
 /**
  * Sync all filesystems
  */
 static void vfs_sync_all(void) {
+    vfs_lock();
     for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
         vfs_mount_t *mnt = &g_vfs.mounts[i];
         if (mnt->mounted && mnt->ops->sync) {
             mnt->ops->sync(mnt);
         }
+        if (mnt->mounted && mnt->device) {
+            blkdev_sync(mnt->device);
+        }
     }
+    vfs_unlock();
 }
 
 #endif /* VFS_H */
\ No newline at end of file
@@ -14,8 +14,14 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "boot_info.h"
+#include "intrusive_list_fast.h"
+#include "cpu.h"
+#include "heap.h"
 #include "terminal.h"
 #include "idt.h"
+#include "tsc.h"
+#include "sched.h"
+#include "timer.h"
 #include "keyboard.h"
 #include "mount_cmd.h"
 #include "ata.h"
@@ -26,57 +32,6 @@
 #include "shell.h"
 #include "program_shell.h"
 
-/* ============================================================================
- * Forward Declarations for Intrusive List
- * ============================================================================ */
-
-typedef struct ilist_node {
-    struct ilist_node *next;
-    struct ilist_node *prev;
-} ilist_node_t;
-
-typedef struct ilist_head {
-    ilist_node_t node;
-} ilist_head_t;
-
-#define container_of(ptr, type, member) \
-    ((type *)((char *)(ptr) - __builtin_offsetof(type, member)))
-
-#define ilist_entry(ptr, type, member) container_of(ptr, type, member)
-
-static inline void ilist_init_head(ilist_head_t *head) {
-    head->node.next = &head->node;
-    head->node.prev = &head->node;
-}
-
-static inline void ilist_init_node(ilist_node_t *node) {
-    node->next = NULL;
-    node->prev = NULL;
-}
-
-static inline bool ilist_is_empty(const ilist_head_t *head) {
-    return head->node.next == &head->node;
-}
-
-static inline void __ilist_insert(ilist_node_t *node, ilist_node_t *prev, ilist_node_t *next) {
-    next->prev = node;
-    node->next = next;
-    node->prev = prev;
-    prev->next = node;
-}
-
-static inline void ilist_push_back(ilist_head_t *head, ilist_node_t *node) {
-    __ilist_insert(node, head->node.prev, &head->node);
-}
-
-static inline ilist_node_t *ilist_pop_front(ilist_head_t *head) {
-    if (ilist_is_empty(head)) return NULL;
-    ilist_node_t *node = head->node.next;
-    node->next->prev = &head->node;
-    head->node.next = node->next;
-    return node;
-}
-
 /* ============================================================================
  * Memory Manager
  * ============================================================================ */
@@ -157,37 +112,29 @@ static void mm_parse_e820(mem_manager_t *mm, e820_map_t *map) {
     }
 }
 
-/* ============================================================================
- * Slab Allocator
- * ============================================================================ */
-
-#define SLAB_SIZES 8
-
-typedef struct slab_allocator {
-    uint32_t heap_start;
-    uint32_t heap_size;
-    uint32_t heap_used;
-
-    struct {
-        uint32_t size;
-        uint32_t free_count;
-        void *free_list;
-    } caches[SLAB_SIZES];
-} slab_allocator_t;
-
-static slab_allocator_t g_slab;
+/**
+ * Seed the page allocator from the usable E820 regions above HEAP_BASE
+ * (the page_info array goes at HEAP_BASE, so that must be usable)
+ */
+static bool mm_heap_init(mem_manager_t *mm) {
+    uint64_t top = 0;
+    bool base_usable = false;
+    mem_region_t *r;
 
-static void slab_init(slab_allocator_t *slab, uint32_t heap_start, uint32_t heap_size) {
-    slab->heap_start = heap_start;
-    slab->heap_size = heap_size;
-    slab->heap_used = 0;
+    ilist_foreach_entry(r, &mm->free_regions, free_link) {
+        uint64_t end = r->base + r->length;
+        if (end > top) top = end;
+        if (r->base <= HEAP_BASE && end > HEAP_BASE) base_usable = true;
+    }
+    if (!base_usable) return false;
+    if (top > 0xFFFFF000u) top = 0xFFFFF000u;
 
-    uint32_t sizes[] = {16, 32, 64, 128, 256, 512, 1024, 2048};
-    for (int i = 0; i < SLAB_SIZES; i++) {
-        slab->caches[i].size = sizes[i];
-        slab->caches[i].free_count = 0;
-        slab->caches[i].free_list = NULL;
+    if (!page_init(HEAP_BASE, (uint32_t)top)) return false;
+    ilist_foreach_entry(r, &mm->free_regions, free_link) {
+        page_add_range(r->base, r->length);
     }
+    slab_init(&g_slab);
+    return g_pages.free_pages > 0;
 }
 
 /* ============================================================================
@@ -222,6 +169,12 @@ typedef void (*event_handler_t)(event_t *event);
 typedef struct event_chain {
     event_handler_t handlers[EVENT_MAX_HANDLERS];
     int count;
+
+    /* Deferred dispatch (each counter has a single writer) */
+    volatile uint32_t queued;       /* Producer: events put on the ring */
+    volatile uint32_t fired;        /* Bottom half: events dispatched */
+    uint32_t dropped;               /* Producer: lost to a full ring */
+    uint32_t high_water;            /* Producer: most pending at once */
 } event_chain_t;
 
 static inline void event_chain_init(event_chain_t *chain) {
@@ -229,6 +182,8 @@ static inline void event_chain_init(event_chain_t *chain) {
     for (int i = 0; i < EVENT_MAX_HANDLERS; i++) {
         chain->handlers[i] = NULL;
     }
+    chain->queued = chain->fired = 0;
+    chain->dropped = chain->high_water = 0;
 }
 
 static inline bool event_chain_subscribe(event_chain_t *chain, event_handler_t handler) {
@@ -264,6 +219,118 @@ static event_chain_t g_keyboard_events;
 static event_chain_t g_system_events;
 static event_chain_t g_file_events;
 
+/* ============================================================================
+ * Deferred Events - IRQ top halves enqueue, wait steps fire
+ * ============================================================================
+ *
+ * Single-producer/single-consumer ring: producers run in IRQ context
+ * (handlers do not nest, so they are one producer) and only advance
+ * head; the bottom half only advances tail. Subscribed handlers never
+ * run with interrupts off. x86 keeps stores in order, so a compiler
+ * barrier is enough between filling a slot and publishing it.
+ */
+
+#define EVENT_RING_SIZE         64      /* Power of two */
+#define EVENT_RING_MASK         (EVENT_RING_SIZE - 1)
+#define EVENT_DISPATCH_BATCH    16
+#define EVENT_PAYLOAD_MAX       8
+
+typedef struct {
+    event_chain_t *chain;
+    event_type_t type;
+    void *source;
+    union {
+        key_event_data_t key;
+        uint8_t bytes[EVENT_PAYLOAD_MAX];   /* event_t.data points here */
+    } payload;
+} event_record_t;
+
+typedef struct {
+    event_record_t slots[EVENT_RING_SIZE];
+    volatile uint32_t head;     /* Next slot to fill (producer) */
+    volatile uint32_t tail;     /* Next slot to fire (consumer) */
+    uint32_t high_water;
+    uint32_t dropped;
+    uint32_t batches;
+    bool dispatching;
+} event_ring_t;
+
+static event_ring_t g_event_ring;
+
+#define event_barrier() __asm__ volatile ("" ::: "memory")
+
+/**
+ * Queue an event for @chain (IRQ context, or interrupts off)
+ * @data/@size is copied into the record; the handler sees it as event->data.
+ */
+static bool event_queue(event_chain_t *chain, event_type_t type, void *source,
+                        const void *data, uint32_t size) {
+    uint32_t head = g_event_ring.head;
+    uint32_t used = head - g_event_ring.tail;
+
+    if (used >= EVENT_RING_SIZE || size > EVENT_PAYLOAD_MAX) {
+        chain->dropped++;
+        g_event_ring.dropped++;
+        return false;
+    }
+
+    event_record_t *r = &g_event_ring.slots[head & EVENT_RING_MASK];
+    r->chain = chain;
+    r->type = type;
+    r->source = source;
+    for (uint32_t i = 0; i < size; i++) {
+        r->payload.bytes[i] = ((const uint8_t *)data)[i];
+    }
+
+    event_barrier();
+    g_event_ring.head = head + 1;
+
+    chain->queued++;
+    uint32_t pending = chain->queued - chain->fired;
+    if (pending > chain->high_water) chain->high_water = pending;
+    if (used + 1 > g_event_ring.high_water) g_event_ring.high_water = used + 1;
+    return true;
+}
+
+/**
+ * Bottom half: fire up to EVENT_DISPATCH_BATCH queued events in order
+ * @return number fired (0 = ring empty, or already dispatching)
+ */
+static uint32_t event_dispatch(void) {
+    if (g_event_ring.dispatching) return 0;
+
+    uint32_t tail = g_event_ring.tail;
+    uint32_t count = g_event_ring.head - tail;
+    if (count == 0) return 0;
+    if (count > EVENT_DISPATCH_BATCH) count = EVENT_DISPATCH_BATCH;
+
+    event_barrier();
+    g_event_ring.dispatching = true;
+    for (uint32_t i = 0; i < count; i++) {
+        event_record_t *r = &g_event_ring.slots[(tail + i) & EVENT_RING_MASK];
+        event_t evt = {
+            .type = r->type,
+            .source = r->source,
+            .data = &r->payload,
+            .handled = false
+        };
+        event_chain_fire(r->chain, &evt);
+        r->chain->fired++;
+    }
+    g_event_ring.dispatching = false;
+
+    /* Slots are reused only after their handlers are done with the payload */
+    event_barrier();
+    g_event_ring.tail = tail + count;
+    g_event_ring.batches++;
+    return count;
+}
+
+/* Drain everything queued so far */
+static inline void event_dispatch_all(void) {
+    while (event_dispatch());
+}
+
 /* ============================================================================
  * Terminal and Output (both VGA text and VESA graphics)
  * ============================================================================ */
@@ -337,94 +404,179 @@ static void kputchar(char c) {
     }
 }
 
+/* End of an output span: present what the terminal has due */
+static void kupdate(void) {
+    if (!g_use_vga_text) terminal_update(&g_term);
+}
+
+/* Cursor blink, from IRQ0; the idle loop's flush draws it */
+static ktimer_t g_blink_timer;
+
+static void kcursor_blink(void *arg) {
+    (void)arg;
+    terminal_blink(&g_term);
+}
+
+/* Present everything pending now (idle, panic) */
+static void kflush(void) {
+    if (!g_use_vga_text) terminal_flush(&g_term);
+}
+
+/* Emit a span of text, then present it once */
+static void kwrite(const char *buf, size_t len) {
+    if (g_use_vga_text) {
+        while (len--) vga_putchar(*buf++);
+    } else {
+        terminal_write(&g_term, buf, len);
+    }
+    kupdate();
+}
+
 static void kputs(const char *s) {
-    while (*s) kputchar(*s++);
+    size_t len = 0;
+    while (s[len]) len++;
+    kwrite(s, len);
 }
 
-/* Simple printf implementation */
-static void kprintf(const char *fmt, ...) {
-    __builtin_va_list args;
-    __builtin_va_start(args, fmt);
+/* ============================================================================
+ * Formatted Output
+ *
+ * kprintf and the shell printf format into a stack span buffer that goes
+ * out through kwrite() when full and at the end of the call.
+ * ============================================================================ */
+
+#define KPRINTF_SPAN    256
+
+typedef struct {
+    char   buf[KPRINTF_SPAN];
+    size_t len;
+} kspan_t;
+
+static void kspan_flush(kspan_t *sp) {
+    if (sp->len) kwrite(sp->buf, sp->len);
+    sp->len = 0;
+}
+
+static inline void kspan_putc(kspan_t *sp, char c) {
+    if (sp->len == KPRINTF_SPAN) kspan_flush(sp);
+    sp->buf[sp->len++] = c;
+}
 
+static void kspan_pad(kspan_t *sp, char c, int n) {
+    while (n-- > 0) kspan_putc(sp, c);
+}
+
+/**
+ * Format into @sp: %s %c %d %i %u %x %X %%, with optional '-', '0' and
+ * width. Numbers pad with spaces unless '0' is given; hex always with zeros.
+ */
+static void kvprintf(kspan_t *sp, const char *fmt, __builtin_va_list args) {
     while (*fmt) {
-        if (*fmt == '%') {
+        if (*fmt != '%') {
+            kspan_putc(sp, *fmt++);
+            continue;
+        }
+        fmt++;
+
+        /* Parse flags */
+        bool left_align = false;
+        if (*fmt == '-') {
+            left_align = true;
+            fmt++;
+        }
+
+        /* Parse width (a leading 0 pads with zeros) */
+        char pad = (*fmt == '0') ? '0' : ' ';
+        int width = 0;
+        while (*fmt >= '0' && *fmt <= '9') {
+            width = width * 10 + (*fmt - '0');
             fmt++;
+        }
+
+        char buf[12];
+        int i = 0;
+
+        switch (*fmt) {
+            case 's': {
+                const char *s = __builtin_va_arg(args, const char *);
+                if (!s) s = "(null)";
+
+                int len = 0;
+                while (s[len]) len++;
 
-            /* Width handling */
-            int width = 0;
-            while (*fmt >= '0' && *fmt <= '9') {
-                width = width * 10 + (*fmt - '0');
+                if (!left_align) kspan_pad(sp, ' ', width - len);
+                while (*s) kspan_putc(sp, *s++);
+                if (left_align) kspan_pad(sp, ' ', width - len);
                 fmt++;
+                continue;
             }
-
-            switch (*fmt) {
-                case 's': {
-                    const char *s = __builtin_va_arg(args, const char *);
-                    if (s) kputs(s);
-                    else kputs("(null)");
-                    break;
-                }
-                case 'd':
-                case 'i': {
-                    int val = __builtin_va_arg(args, int);
-                    if (val < 0) {
-                        kputchar('-');
-                        val = -val;
-                    }
-                    char buf[12];
-                    int i = 0;
-                    do {
-                        buf[i++] = '0' + (val % 10);
-                        val /= 10;
-                    } while (val);
-                    while (i < width) { kputchar(' '); width--; }
-                    while (i--) kputchar(buf[i]);
-                    break;
-                }
-                case 'u': {
-                    uint32_t val = __builtin_va_arg(args, uint32_t);
-                    char buf[12];
-                    int i = 0;
-                    do {
-                        buf[i++] = '0' + (val % 10);
-                        val /= 10;
-                    } while (val);
-                    while (i < width) { kputchar(' '); width--; }
-                    while (i--) kputchar(buf[i]);
-                    break;
-                }
-                case 'x':
-                case 'X': {
-                    uint32_t val = __builtin_va_arg(args, uint32_t);
-                    char buf[9];
-                    int i = 0;
-                    const char *hex = (*fmt == 'X') ? "0123456789ABCDEF" : "0123456789abcdef";
-                    do {
-                        buf[i++] = hex[val & 0xF];
-                        val >>= 4;
-                    } while (val);
-                    while (i < width) { kputchar('0'); width--; }
-                    while (i--) kputchar(buf[i]);
-                    break;
+            case 'd':
+            case 'i': {
+                int val = __builtin_va_arg(args, int);
+                uint32_t u = (uint32_t)val;
+                if (val < 0) {
+                    kspan_putc(sp, '-');
+                    u = 0u - u;
                 }
-                case 'c':
-                    kputchar((char)__builtin_va_arg(args, int));
-                    break;
-                case '%':
-                    kputchar('%');
-                    break;
-                default:
-                    kputchar('%');
-                    kputchar(*fmt);
-                    break;
+                do {
+                    buf[i++] = '0' + (u % 10);
+                    u /= 10;
+                } while (u);
+                break;
             }
-        } else {
-            kputchar(*fmt);
+            case 'u': {
+                uint32_t val = __builtin_va_arg(args, uint32_t);
+                do {
+                    buf[i++] = '0' + (val % 10);
+                    val /= 10;
+                } while (val);
+                break;
+            }
+            case 'x':
+            case 'X': {
+                uint32_t val = __builtin_va_arg(args, uint32_t);
+                const char *hex = (*fmt == 'X') ? "0123456789ABCDEF" : "0123456789abcdef";
+                do {
+                    buf[i++] = hex[val & 0xF];
+                    val >>= 4;
+                } while (val);
+                pad = '0';
+                break;
+            }
+            case 'c':
+                kspan_putc(sp, (char)__builtin_va_arg(args, int));
+                fmt++;
+                continue;
+            case '%':
+                kspan_putc(sp, '%');
+                fmt++;
+                continue;
+            default:
+                kspan_putc(sp, '%');
+                if (left_align) kspan_putc(sp, '-');
+                if (*fmt) kspan_putc(sp, *fmt++);
+                continue;
         }
+
+        if (!left_align) kspan_pad(sp, pad, width - i);
+        int digits = i;
+        while (i--) kspan_putc(sp, buf[i]);
+        if (left_align) kspan_pad(sp, ' ', width - digits);
         fmt++;
     }
+}
 
+/* Simple printf implementation */
+static void kprintf(const char *fmt, ...) {
+    kspan_t sp;
+    sp.len = 0;
+
+    __builtin_va_list args;
+    __builtin_va_start(args, fmt);
+    kvprintf(&sp, fmt, args);
     __builtin_va_end(args);
+
+    kspan_flush(&sp);
 }
 
 /* String utilities */
@@ -456,6 +608,7 @@ void exception_handler(int_frame_t *frame) {
             frame->eip, frame->cs, frame->eflags);
     kprintf("EAX: 0x%x  EBX: 0x%x  ECX: 0x%x  EDX: 0x%x\n",
             frame->eax, frame->ebx, frame->ecx, frame->edx);
+    kflush();
 
     while (1) {
         __asm__ volatile ("cli; hlt");
@@ -464,27 +617,25 @@ void exception_handler(int_frame_t *frame) {
 
 void irq_handler(int_frame_t *frame) {
     uint8_t irq = frame->int_no - INT_IRQ_BASE;
+    TRACE_BEGIN(t0);
 
     if (g_irq_handlers[irq]) {
         g_irq_handlers[irq](frame);
     }
 
     pic_eoi(irq);
+    TRACE_END(TP_IRQ, t0, irq);
 }
 
 /* ============================================================================
  * Keyboard Event Integration
  * ============================================================================ */
 
+/* Called from IRQ1: handlers run later from event_dispatch */
 static void fire_key_event(char ascii, uint8_t scancode, uint8_t modifiers, bool pressed) {
     key_event_data_t data = { ascii, scancode, modifiers };
-    event_t evt = {
-        .source = &g_keyboard_events,
-        .data = &data,
-        .type = pressed ? EVENT_KEY_PRESS : EVENT_KEY_RELEASE,
-        .handled = false
-    };
-    event_chain_fire(&g_keyboard_events, &evt);
+    event_queue(&g_keyboard_events, pressed ? EVENT_KEY_PRESS : EVENT_KEY_RELEASE,
+                &g_keyboard_events, &data, sizeof(data));
 }
 
 /* ============================================================================
@@ -493,14 +644,30 @@ static void fire_key_event(char ascii, uint8_t scancode, uint8_t modifiers, bool
 
 static ata_drive_t *g_format_drive = NULL;
 
-static uint32_t ata_block_read(uint32_t lba, uint8_t count, void *buf) {
+/* Raw transfers share the drive with the VFS (see ata_blkdev_raw_begin) */
+static uint32_t ata_block_read(uint32_t lba, uint32_t count, void *buf) {
     if (!g_format_drive) return 0;
-    return ata_read_sectors(g_format_drive, lba, count, buf);
+    ata_blkdev_raw_begin(g_format_drive);
+    uint32_t n = ata_read_sectors_multi(g_format_drive, lba, count, buf);
+    ata_blkdev_raw_end(g_format_drive, false);
+    return n;
 }
 
-static uint32_t ata_block_write(uint32_t lba, uint8_t count, const void *buf) {
+static uint32_t ata_block_write(uint32_t lba, uint32_t count, const void *buf) {
     if (!g_format_drive) return 0;
-    return ata_write_sectors(g_format_drive, lba, count, buf);
+    ata_blkdev_raw_begin(g_format_drive);
+    uint32_t n = ata_write_sectors_multi(g_format_drive, lba, count, buf);
+    ata_blkdev_raw_end(g_format_drive, true);
+    return n;
+}
+
+/* One sector for format, then let other threads run (it may be a background job) */
+static bool format_write_sector(ata_drive_t *drive, uint32_t lba, const uint8_t *sector) {
+    ata_blkdev_raw_begin(drive);
+    bool ok = ata_write_sectors(drive, lba, 1, sector) == 1;
+    ata_blkdev_raw_end(drive, true);
+    kthread_yield();
+    return ok;
 }
 
 /* ============================================================================
@@ -510,92 +677,48 @@ static uint32_t ata_block_write(uint32_t lba, uint8_t count, const void *buf) {
 /* Shell I/O callbacks */
 static void shell_io_putchar(char c) {
     kputchar(c);
+    kupdate();
 }
 
 static void shell_io_puts(const char *s) {
     kputs(s);
 }
 
+static void shell_io_write(const char *buf, size_t len) {
+    kwrite(buf, len);
+}
+
 static void shell_io_printf(const char *fmt, ...) {
+    kspan_t sp;
+    sp.len = 0;
+
     __builtin_va_list args;
     __builtin_va_start(args, fmt);
+    kvprintf(&sp, fmt, args);
+    __builtin_va_end(args);
 
-    while (*fmt) {
-        if (*fmt == '%') {
-            fmt++;
-
-            /* Parse flags */
-            bool left_align = false;
-            if (*fmt == '-') {
-                left_align = true;
-                fmt++;
-            }
-
-            /* Parse width */
-            int width = 0;
-            while (*fmt >= '0' && *fmt <= '9') {
-                width = width * 10 + (*fmt - '0');
-                fmt++;
-            }
-
-            /* Handle format specifier */
-            switch (*fmt) {
-                case 's': {
-                    const char *s = __builtin_va_arg(args, const char *);
-                    if (!s) s = "(null)";
-
-                    /* Calculate string length */
-                    int len = 0;
-                    const char *p = s;
-                    while (*p++) len++;
+    kspan_flush(&sp);
+}
 
-                    /* Padding */
-                    int pad = (width > len) ? width - len : 0;
+static char shell_io_getchar(void) {
+    key_event_t event;
 
-                    if (!left_align) {
-                        while (pad-- > 0) kputchar(' ');
-                    }
-                    kputs(s);
-                    if (left_align) {
-                        while (pad-- > 0) kputchar(' ');
-                    }
-                    break;
-                }
-                case 'd': case 'i': {
-                    kprintf("%d", __builtin_va_arg(args, int));
-                    break;
-                }
-                case 'u': {
-                    kprintf("%u", __builtin_va_arg(args, uint32_t));
-                    break;
-                }
-                case 'x': {
-                    kprintf("%x", __builtin_va_arg(args, uint32_t));
-                    break;
-                }
-                case 'c':
-                    kputchar((char)__builtin_va_arg(args, int));
-                    break;
-                case '%':
-                    kputchar('%');
-                    break;
-                default:
-                    kputchar('%');
-                    if (left_align) kputchar('-');
-                    kputchar(*fmt);
-                    break;
+    while (1) {
+        while (keyboard_get_event(&event)) {
+            if (event.pressed && event.ascii != 0) {
+                return event.ascii;
             }
-        } else {
-            kputchar(*fmt);
         }
-        fmt++;
-    }
 
-    __builtin_va_end(args);
-}
+        /* Idle work runs on every wakeup (at least once per timer tick) */
+        event_dispatch_all();
+        kupdate();
+        kflush();
 
-static char shell_io_getchar(void) {
-    return keyboard_getchar();
+        /* Background threads run here; halts once they are all waiting too */
+        __asm__ volatile ("sti");
+        timer_idle();
+    }
 }
 
 static void shell_io_clear(void) {
@@ -612,6 +735,7 @@ static shell_io_t g_shell_io = {
     .putchar = shell_io_putchar,
     .puts = shell_io_puts,
     .printf = shell_io_printf,
+    .write = shell_io_write,
     .getchar = shell_io_getchar,
     .getchar_nonblock = NULL,
     .clear = shell_io_clear,
@@ -665,12 +789,30 @@ static void kcmd_info(shell_state_t *sh, int argc, char **argv) {
 
     sh->io->printf("\nSystem Information:\n");
     sh->io->printf("-------------------\n");
-    sh->io->printf("  CPU: Pentium III compatible\n");
+    if (g_cpu.has_cpuid) {
+        sh->io->printf("  CPU: %s family %u model %u stepping %u\n", g_cpu.vendor,
+                      g_cpu.family, g_cpu.model, g_cpu.stepping);
+        sh->io->printf("  Features:%s%s%s%s%s\n",
+                      cpu_has(CPUID_FEAT_TSC) ? " TSC" : "",
+                      cpu_has(CPUID_FEAT_MMX) ? " MMX" : "",
+                      cpu_has(CPUID_FEAT_SSE) ? " SSE" : "",
+                      cpu_has(CPUID_FEAT_SSE2) ? " SSE2" : "",
+                      g_cpu.sse_enabled ? " (SSE on)" : "");
+    } else {
+        sh->io->printf("  CPU: pre-CPUID 486 or older\n");
+    }
     sh->io->printf("  RAM: %u KB total\n", ctx->mm->total_bytes / 1024);
+    uint32_t up = timer_ms();
+    sh->io->printf("  Uptime: %u.%03u s (%u Hz timer, %u timers armed)\n",
+                  up / 1000, up % 1000, g_timer.hz, g_timer.armed);
 
     if (!ctx->use_vga_text) {
         sh->io->printf("  Display: %ux%u VESA\n",
                       ctx->term->width, ctx->term->height);
+        sh->io->printf("  Framebuffer: 0x%x, %u KB, %s", g_fb_wc.base,
+                      g_fb_wc.size / 1024, g_fb_wc.status);
+        if (g_fb_wc.wc) sh->io->printf(" (%u MTRR)", g_fb_wc.regs);
+        sh->io->printf("\n");
     } else {
         sh->io->printf("  Display: 80x25 VGA text mode\n");
     }
@@ -706,8 +848,220 @@ static void kcmd_mem(shell_state_t *sh, int argc, char **argv) {
                       type_str);
     }
 
-    sh->io->printf("\n  Total usable: %u KB\n\n", ctx->mm->total_bytes / 1024);
+    sh->io->printf("\n  Total usable: %u KB\n", ctx->mm->total_bytes / 1024);
+
+    sh->io->printf("\nKernel Heap:\n");
+    sh->io->printf("  Pages: %u free / %u (%u KB free)\n",
+                  g_pages.free_pages, g_pages.total_pages,
+                  g_pages.free_pages * (PAGE_SIZE / 1024));
+    sh->io->printf("  Large allocations: %u pages\n", ctx->slab->large_pages);
+    for (int i = 0; i < SLAB_SIZES; i++) {
+        slab_cache_t *c = &ctx->slab->caches[i];
+        if (c->slabs == 0) continue;
+        sh->io->printf("  Slab %4u: %u in use, %u free, %u slabs\n",
+                      c->size, c->inuse, c->free_count, c->slabs);
+    }
+    sh->io->printf("\n");
+    sh->last_result = 0;
+}
+
+static void kcmd_events(shell_state_t *sh, int argc, char **argv) {
+    (void)argc; (void)argv;
+    kernel_context_t *ctx = (kernel_context_t *)sh->context;
+    static const char *names[] = { "keyboard", "system", "file" };
+    event_chain_t *chains[] = { ctx->keyboard_events, ctx->system_events, ctx->file_events };
+
+    event_dispatch_all();
+
+    sh->io->printf("\nEvent Ring:\n");
+    sh->io->printf("  Slots:      %u (%u pending)\n", EVENT_RING_SIZE,
+                  g_event_ring.head - g_event_ring.tail);
+    sh->io->printf("  High water: %u\n", g_event_ring.high_water);
+    sh->io->printf("  Dropped:    %u\n", g_event_ring.dropped);
+    sh->io->printf("  Batches:    %u (up to %u events)\n", g_event_ring.batches,
+                  EVENT_DISPATCH_BATCH);
+
+    sh->io->printf("\n  %-10s %8s %10s %10s %6s %8s\n",
+                  "Chain", "Handlers", "Queued", "Fired", "Peak", "Dropped");
+    for (int i = 0; i < 3; i++) {
+        event_chain_t *c = chains[i];
+        sh->io->printf("  %-10s %8d %10u %10u %6u %8u\n", names[i], c->count,
+                      c->queued, c->fired, c->high_water, c->dropped);
+    }
+    sh->io->printf("\n");
+    sh->last_result = 0;
+}
+
+static void kcmd_threads(shell_state_t *sh, int argc, char **argv) {
+    (void)argc; (void)argv;
+    static const char *states[] = { "ready", "running", "dead" };
+    kthread_t *t;
+
+    sh->io->printf("\nKernel Threads:\n");
+    sh->io->printf("  ID  State    Stack  Switches  Name\n");
+    ilist_foreach_entry(t, &g_sched.all, all_link) {
+        const char *state = (t->state == KTHREAD_READY && t->waiting) ? "waiting"
+                                                                       : states[t->state];
+        sh->io->printf("  %2u  %-7s %5uK  %8u  %s\n", t->id, state,
+                      (t->stack ? t->stack_size : KTHREAD_STACK_SIZE) / 1024, t->switches, t->name);
+    }
+    sh->io->printf("\n  Live: %u, created: %u, switches: %u, idle halts: %u\n",
+                  g_sched.count, g_sched.created, g_sched.switches, g_sched.halts);
+    sh->io->printf("  VFS lock: %s, contended %u\n\n",
+                  g_vfs.lock.owner ? g_vfs.lock.owner->name : "free",
+                  g_vfs.lock.contended);
+    sh->last_result = 0;
+}
+
+/* ============================================================================
+ * Profiler (trace points from trace.h)
+ * ============================================================================ */
+
+#define PERF_DUMP_CHUNK     512
+
+static uint64_t g_perf_since_us;        /* timer_us() at the last reset (0 = boot) */
+
+/* Print @cycles as microseconds with one decimal */
+static void perf_print_us(shell_state_t *sh, uint32_t cycles) {
+    uint32_t mhz = tsc_mhz();
+    sh->io->printf(" %7u.%u", cycles / mhz, (cycles % mhz) * 10 / mhz);
+}
+
+static void perf_show(shell_state_t *sh, uint32_t top) {
+    uint8_t order[TP_COUNT];
+    uint32_t n = 0;
+
+    /* Busiest first (by total cycles) */
+    for (uint32_t p = 0; p < TP_COUNT; p++) {
+        if (!g_trace.stats[p].count) continue;
+        uint32_t i = n++;
+        while (i > 0 && g_trace.stats[order[i - 1]].total < g_trace.stats[p].total) {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = (uint8_t)p;
+    }
+    if (top < n) n = top;
+
+    uint32_t window_ms = (uint32_t)(timer_us() - g_perf_since_us) / 1000;
+    sh->io->printf("\nTrace points (%s, TSC %u MHz, %u records in %u.%03u s):\n",
+                  g_trace.enabled ? "on" : "off", tsc_mhz(), g_trace.head,
+                  window_ms / 1000, window_ms % 1000);
+    if (n == 0) {
+        sh->io->printf("  Nothing recorded\n\n");
+        return;
+    }
+    sh->io->printf("  %-12s %8s %9s %9s %9s %9s %9s\n",
+                  "Point", "Calls", "Total ms", "Avg us", "p50 us", "p99 us", "Max us");
+    for (uint32_t i = 0; i < n; i++) {
+        trace_point_t p = (trace_point_t)order[i];
+        trace_stat_t *st = &g_trace.stats[p];
+        uint32_t ms = (uint32_t)trace_div64(st->total, tsc_mhz() * 1000);
+
+        sh->io->printf("  %-12s %8u %9u", g_trace_names[p], st->count, ms);
+        perf_print_us(sh, (uint32_t)trace_div64(st->total, st->count));
+        perf_print_us(sh, trace_percentile(p, 50));
+        perf_print_us(sh, trace_percentile(p, 99));
+        perf_print_us(sh, st->max);
+        sh->io->printf("\n");
+    }
+    sh->io->printf("\n");
+}
+
+static void perf_append(char *buf, uint32_t *len, const char *s) {
+    while (*s) buf[(*len)++] = *s++;
+}
+
+static void perf_append_u32(char *buf, uint32_t *len, uint32_t v) {
+    char digits[10];
+    int i = 0;
+    do {
+        digits[i++] = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    while (i--) buf[(*len)++] = digits[i];
+}
+
+/**
+ * Write the trace ring, oldest first, as CSV: start,cycles,point,arg
+ * Recording pauses meanwhile so the dump's own I/O stays out of it.
+ * @return records written, or -1 if the file could not be written
+ */
+static int32_t perf_dump(const char *path) {
+    vfs_file_t *file = vfs_open(path, VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC);
+    if (!file) return -1;
+
+    bool was_enabled = g_trace.enabled;
+    trace_enable(false);
+
+    char buf[PERF_DUMP_CHUNK];
+    uint32_t len = 0;
+    perf_append(buf, &len, "# tsc_mhz=");
+    perf_append_u32(buf, &len, tsc_mhz());
+    perf_append(buf, &len, "\nstart,cycles,point,arg\n");
+
+    uint32_t count = trace_ring_count();
+    bool ok = true;
+    for (uint32_t i = 0; i < count && ok; i++) {
+        const trace_rec_t *r = trace_ring_at(i);
+        perf_append_u32(buf, &len, r->start);
+        perf_append(buf, &len, ",");
+        perf_append_u32(buf, &len, r->cycles);
+        perf_append(buf, &len, ",");
+        perf_append(buf, &len, g_trace_names[r->point]);
+        perf_append(buf, &len, ",");
+        perf_append_u32(buf, &len, r->arg);
+        perf_append(buf, &len, "\n");
+
+        /* A record is at most ~50 bytes */
+        if (len > PERF_DUMP_CHUNK - 64 || i + 1 == count) {
+            ok = vfs_write(file, buf, len) == (int32_t)len;
+            len = 0;
+        }
+    }
+    if (count == 0) ok = vfs_write(file, buf, len) == (int32_t)len;
+    vfs_close(file);
+
+    trace_enable(was_enabled);
+    return ok ? (int32_t)count : -1;
+}
+
+/* perf [top N | reset | on | off | dump <file>] */
+static void kcmd_perf(shell_state_t *sh, int argc, char **argv) {
     sh->last_result = 0;
+
+    if (argc < 2) {
+        perf_show(sh, TP_COUNT);
+    } else if (kstrcmp(argv[1], "top") == 0 && argc > 2) {
+        uint32_t top = 0;
+        for (const char *p = argv[2]; *p >= '0' && *p <= '9'; p++) top = top * 10 + (*p - '0');
+        perf_show(sh, top ? top : TP_COUNT);
+    } else if (kstrcmp(argv[1], "reset") == 0) {
+        trace_reset();
+        g_perf_since_us = timer_us();
+        sh->io->printf("Trace cleared\n");
+    } else if (kstrcmp(argv[1], "on") == 0 || kstrcmp(argv[1], "off") == 0) {
+        if (!cpu_has(CPUID_FEAT_TSC)) {
+            sh->io->printf("No TSC: tracing unavailable\n");
+            sh->last_result = 1;
+            return;
+        }
+        trace_enable(argv[1][1] == 'n');
+        sh->io->printf("Tracing %s\n", argv[1]);
+    } else if (kstrcmp(argv[1], "dump") == 0 && argc > 2) {
+        char path[VFS_MAX_PATH];
+        vfs_normalize_path(argv[2], path, sh->cwd);
+        int32_t n = perf_dump(path);
+        if (n < 0) {
+            sh->io->printf("Failed to write %s\n", path);
+            sh->last_result = 1;
+        } else {
+            sh->io->printf("Wrote %d records to %s\n", n, path);
+        }
+    } else {
+        sh->io->printf("Usage: perf [top N | reset | on | off | dump <file>]\n");
+        sh->last_result = 1;
+    }
 }
 
 static void kcmd_disk(shell_state_t *sh, int argc, char **argv) {
@@ -723,10 +1077,45 @@ static void kcmd_disk(shell_state_t *sh, int argc, char **argv) {
         sh->io->printf("  Model: %s\n", ctx->boot_device.model);
         sh->io->printf("  Size: %u MB\n", ctx->boot_device.total_sectors / 2048);
         sh->io->printf("  Sectors: %u\n", ctx->boot_device.total_sectors);
+        if (ctx->boot_device.type == BLKDEV_ATA && ctx->boot_device.driver_data) {
+            ata_drive_t *drive = (ata_drive_t *)ctx->boot_device.driver_data;
+            sh->io->printf("  Addressing: %s\n", drive->lba48 ? "LBA48" : "LBA28");
+            sh->io->printf("  Transfer: %s", drive->dma ? "Bus-master DMA" : "PIO");
+            if (drive->dma_errors) {
+                sh->io->printf(" (%u DMA errors)", drive->dma_errors);
+            }
+            sh->io->printf("\n");
+        }
     } else {
         sh->io->printf("  No disk detected\n");
     }
 
+    sh->io->printf("\nBuffer Cache:\n");
+    sh->io->printf("  Buffers: %u/%u (%u dirty)\n",
+                  g_bcache.count, BCACHE_NUM_BUFS, g_bcache.dirty);
+    sh->io->printf("  Hits: %u  Misses: %u\n", g_bcache.hits, g_bcache.misses);
+    sh->io->printf("  Evictions: %u  Write-backs: %u  Readahead: %u\n",
+                  g_bcache.evictions, g_bcache.writebacks, g_bcache.readaheads);
+
+    sh->io->printf("\nDentry Cache:\n");
+    sh->io->printf("  Entries: %u/%u  Evictions: %u\n",
+                  g_dcache.count, DCACHE_NUM_ENTRIES, g_dcache.evictions);
+    sh->io->printf("  Hits: %u  Negative: %u  Misses: %u\n",
+                  g_dcache.hits, g_dcache.negative_hits, g_dcache.misses);
+
+    sh->io->printf("\nProgram Cache:\n");
+    sh->io->printf("  Images: %u KB/%u KB  Evictions: %u  Invalidated: %u\n",
+                  g_program_cache.bytes / 1024, PROGRAM_CACHE_BYTES / 1024,
+                  g_program_cache.evictions, g_program_cache.invalidations);
+    sh->io->printf("  Hits: %u  Misses: %u\n", g_program_cache.hits, g_program_cache.misses);
+
+    if (ctx->boot_device.queue) {
+        blkq_t *q = ctx->boot_device.queue;
+        sh->io->printf("\nRequest Queue:\n");
+        sh->io->printf("  Submitted: %u  Dispatched: %u  Merged: %u\n",
+                      q->submitted, q->dispatches, q->merged);
+    }
+
     sh->io->printf("\n");
     sh->last_result = 0;
 }
@@ -744,12 +1133,15 @@ static void kcmd_ls(shell_state_t *sh, int argc, char **argv) {
     sh->io->printf("\nDirectory: %s\n", path);
     sh->io->printf("----------------\n");
 
-    vfs_dirent_t entry;
-    while (vfs_readdir(dir, &entry)) {
-        if (entry.type == VFS_DIRECTORY) {
-            sh->io->printf("  [DIR]  %s\n", entry.name);
-        } else {
-            sh->io->printf("  %6u  %s\n", entry.size, entry.name);
+    vfs_dirent_t entries[16];
+    int n;
+    while ((n = vfs_getdents(dir, entries, 16)) > 0) {
+        for (int i = 0; i < n; i++) {
+            if (entries[i].type == VFS_DIRECTORY) {
+                sh->io->printf("  [DIR]  %s\n", entries[i].name);
+            } else {
+                sh->io->printf("  %6u  %s\n", entries[i].size, entries[i].name);
+            }
         }
     }
 
@@ -932,6 +1324,54 @@ static void kcmd_write(shell_state_t *sh, int argc, char **argv) {
     }
 }
 
+/* ramdisk [compact] - RAM disk usage, optionally defragmenting it */
+static void kcmd_ramdisk(shell_state_t *sh, int argc, char **argv) {
+    ramdisk_stats_t st;
+
+    if (!g_ramdisk.initialized) {
+        sh->io->printf("RAM disk not initialized\n");
+        sh->last_result = 1;
+        return;
+    }
+
+    if (argc > 1) {
+        if (kstrcmp(argv[1], "compact") != 0) {
+            sh->io->printf("Usage: ramdisk [compact]\n");
+            sh->last_result = 1;
+            return;
+        }
+        if (g_ramdisk.mapped) {
+            sh->io->printf("Cannot compact: %u open file(s) are mapped\n", g_ramdisk.mapped);
+            sh->last_result = 1;
+            return;
+        }
+        uint32_t extents = g_ramdisk.extent_count;
+        uint32_t gained = ramdisk_compact(&g_ramdisk);
+        sh->io->printf("Compacted %u free extents into %u, largest free +%u KB\n",
+                      extents, g_ramdisk.extent_count, gained / 1024);
+    }
+
+    ramdisk_get_stats(&g_ramdisk, &st);
+    sh->io->printf("\nRAM Disk:\n");
+    sh->io->printf("  Files: %u/%u\n", st.file_count, st.max_files);
+    sh->io->printf("  Data: %u KB used, %u KB free of %u KB (%u KB slack)\n",
+                  st.used_size / 1024, st.free_size / 1024, st.total_size / 1024,
+                  st.fragmented_bytes / 1024);
+    sh->io->printf("  Free extents: %u (largest %u KB)\n",
+                  st.free_extents, st.largest_free / 1024);
+    sh->io->printf("  Reads: %u (%u KB)  Writes: %u (%u KB)\n\n",
+                  st.total_reads, st.bytes_read / 1024, st.total_writes, st.bytes_written / 1024);
+    sh->last_result = 0;
+}
+
+static void kcmd_sync(shell_state_t *sh, int argc, char **argv) {
+    (void)argc; (void)argv;
+
+    vfs_sync_all();
+    sh->io->printf("Filesystems synced.\n");
+    sh->last_result = 0;
+}
+
 static void kcmd_reboot(shell_state_t *sh, int argc, char **argv) {
     (void)argc; (void)argv;
 
@@ -939,6 +1379,7 @@ static void kcmd_reboot(shell_state_t *sh, int argc, char **argv) {
     vfs_sync_all();
 
     sh->io->printf("Rebooting...\n");
+    timer_cancel(&g_blink_timer);
 
     /* Triple fault to reboot */
     uint8_t good = 0x02;
@@ -1022,7 +1463,10 @@ static void kcmd_atatest(shell_state_t *sh, int argc, char **argv) {
 
     /* Write test sector */
     sh->io->printf("  Writing test pattern...\n");
+    ata_blkdev_raw_begin(drive);
     uint32_t written = ata_write_sectors(drive, test_lba, 1, write_buf);
+    uint32_t read = written == 1 ? ata_read_sectors(drive, test_lba, 1, read_buf) : 0;
+    ata_blkdev_raw_end(drive, true);
     if (written != 1) {
         sh->io->printf("  FAILED: Write returned %u (expected 1)\n", written);
         sh->last_result = 1;
@@ -1032,7 +1476,6 @@ static void kcmd_atatest(shell_state_t *sh, int argc, char **argv) {
 
     /* Read it back */
     sh->io->printf("  Reading back...\n");
-    uint32_t read = ata_read_sectors(drive, test_lba, 1, read_buf);
     if (read != 1) {
         sh->io->printf("  FAILED: Read returned %u (expected 1)\n", read);
         sh->last_result = 1;
@@ -1063,47 +1506,169 @@ static void kcmd_atatest(shell_state_t *sh, int argc, char **argv) {
     }
 }
 
+/* ============================================================================
+ * ATA Benchmark
+ * ============================================================================ */
+
+#define ATABENCH_CHUNK      64          /* Sectors per command */
+#define ATABENCH_MAX        32768       /* Sectors per run (16 MB) */
+
+static uint8_t g_atabench_buf[ATABENCH_CHUNK * 512] __attribute__((aligned(16)));
+
+/**
+ * Read @total sectors from LBA 0 with the drive's current settings
+ * @return elapsed time in microseconds (0 on error)
+ */
+static uint32_t bench_ata_run(ata_drive_t *drive, uint32_t total, uint32_t mhz, bool dma) {
+    uint32_t us = 0;
+    uint32_t lba = 0;
+    bool ok = true;
+
+    /* Keep the drive to ourselves for the whole run */
+    ata_blkdev_raw_begin(drive);
+    while (total > 0) {
+        uint8_t n = total > ATABENCH_CHUNK ? ATABENCH_CHUNK : (uint8_t)total;
+
+        uint32_t start = (uint32_t)tsc_read();
+        uint32_t got = dma ? ata_dma_read_sectors(drive, lba, n, g_atabench_buf)
+                           : ata_read_sectors(drive, lba, n, g_atabench_buf);
+        us += ((uint32_t)tsc_read() - start) / mhz;
+
+        if (got != n) {
+            ok = false;
+            break;
+        }
+        lba += n;
+        total -= n;
+    }
+    ata_blkdev_raw_end(drive, false);
+
+    if (!ok) return 0;
+    return us ? us : 1;
+}
+
+static void bench_ata_report(shell_state_t *sh, uint32_t sectors, uint32_t us) {
+    if (us == 0) {
+        sh->io->printf("FAILED\n");
+        return;
+    }
+    uint32_t units = us / 10 ? us / 10 : 1;            /* 10us units keep this in 32 bits */
+    uint32_t sps = sectors * 100000 / units;
+    sh->io->printf("%6u ms %7u sectors/s %6u KB/s\n", us / 1000, sps, sps / 2);
+}
+
+/* Measure raw ATA read throughput in each transfer mode */
+static void kcmd_atabench(shell_state_t *sh, int argc, char **argv) {
+    kernel_context_t *ctx = (kernel_context_t *)sh->context;
+
+    if (!ctx->boot_device.present || ctx->boot_device.type != BLKDEV_ATA ||
+        !ctx->boot_device.driver_data) {
+        sh->io->printf("No ATA drive present\n");
+        sh->last_result = 1;
+        return;
+    }
+    ata_drive_t *drive = (ata_drive_t *)ctx->boot_device.driver_data;
+
+    uint32_t sectors = 2048;
+    if (argc > 1) {
+        sectors = 0;
+        for (const char *p = argv[1]; *p >= '0' && *p <= '9'; p++) {
+            sectors = sectors * 10 + (*p - '0');
+        }
+    }
+    if (sectors == 0) sectors = 1;
+    if (sectors > ATABENCH_MAX) sectors = ATABENCH_MAX;
+    if (sectors > drive->size) sectors = drive->size;
+
+    uint32_t mhz = tsc_mhz();
+    sh->io->printf("\nATA read benchmark: %u sectors from LBA 0 (TSC %u MHz)\n",
+                  sectors, mhz);
+    sh->io->printf("-------------------\n");
+
+    /* Bypass the buffer cache and force each mode in turn */
+    uint8_t multiple = drive->multiple;
+    bool dma = drive->dma;
+    drive->dma = false;
+
+    drive->multiple = 0;
+    sh->io->printf("  PIO, 1 sector/DRQ:    ");
+    bench_ata_report(sh, sectors, bench_ata_run(drive, sectors, mhz, false));
+
+    sh->io->printf("  PIO MULTIPLE (%3u):   ", multiple);
+    if (multiple) {
+        drive->multiple = multiple;
+        bench_ata_report(sh, sectors, bench_ata_run(drive, sectors, mhz, false));
+    } else {
+        sh->io->printf("not supported\n");
+    }
+
+    sh->io->printf("  Bus-master DMA:       ");
+    if (dma) {
+        drive->dma = true;
+        bench_ata_report(sh, sectors, bench_ata_run(drive, sectors, mhz, true));
+    } else {
+        sh->io->printf("not available\n");
+    }
+
+    drive->multiple = multiple;
+    drive->dma = dma;
+
+    sh->io->printf("\n");
+    sh->last_result = 0;
+}
+
 /* Format drive with FAT12 - with progress output */
 static void kcmd_format(shell_state_t *sh, int argc, char **argv) {
     kernel_context_t *ctx = (kernel_context_t *)sh->context;
-    const char *label = (argc > 1) ? argv[1] : NULL;
+
+    /* -y skips the prompt, so 'format -y &' can run in the background */
+    bool confirmed = (argc > 1 && kstrcmp(argv[1], "-y") == 0);
+    int argi = confirmed ? 2 : 1;
+    const char *label = (argc > argi) ? argv[argi] : NULL;
 
     if (!ctx->boot_device.present) {
         sh->io->printf("No drive to format\n");
         sh->last_result = 1;
         return;
     }
+    if (g_format_drive) {
+        sh->io->printf("Format already in progress\n");
+        sh->last_result = 1;
+        return;
+    }
 
     sh->io->printf("\n!!! WARNING: This will ERASE ALL DATA !!!\n");
     sh->io->printf("Drive: %s\n", ctx->boot_device.model);
     sh->io->printf("Size: %u MB\n", ctx->boot_device.total_sectors / 2048);
-    sh->io->printf("\nType 'YES' to confirm: ");
-
-    /* Read confirmation */
-    char confirm[16];
-    int i = 0;
-    while (i < 15) {
-        char c = sh->io->getchar();
-        if (c == '\n' || c == '\r') {
-            sh->io->putchar('\n');
-            break;
-        }
-        if (c == '\b' && i > 0) {
-            i--;
-            sh->io->putchar('\b');
-            sh->io->putchar(' ');
-            sh->io->putchar('\b');
-        } else if (c >= 32 && c < 127) {
-            confirm[i++] = c;
-            sh->io->putchar(c);
+    if (!confirmed) {
+        sh->io->printf("\nType 'YES' to confirm: ");
+
+        /* Read confirmation */
+        char confirm[16];
+        int i = 0;
+        while (i < 15) {
+            char c = sh->io->getchar();
+            if (c == '\n' || c == '\r') {
+                sh->io->putchar('\n');
+                break;
+            }
+            if (c == '\b' && i > 0) {
+                i--;
+                sh->io->putchar('\b');
+                sh->io->putchar(' ');
+                sh->io->putchar('\b');
+            } else if (c >= 32 && c < 127) {
+                confirm[i++] = c;
+                sh->io->putchar(c);
+            }
         }
-    }
-    confirm[i] = '\0';
+        confirm[i] = '\0';
 
-    if (sh_strcmp(confirm, "YES") != 0) {
-        sh->io->printf("Format cancelled.\n");
-        sh->last_result = 1;
-        return;
+        if (sh_strcmp(confirm, "YES") != 0) {
+            sh->io->printf("Format cancelled.\n");
+            sh->last_result = 1;
+            return;
+        }
     }
 
     /* Unmount current filesystem */
@@ -1223,7 +1788,7 @@ static void kcmd_format(shell_state_t *sh, int argc, char **argv) {
     sector[510] = 0x55;
     sector[511] = 0xAA;
 
-    if (ata_write_sectors(drive, 0, 1, sector) != 1) {
+    if (!format_write_sector(drive, 0, sector)) {
         sh->io->printf(" FAILED!\n");
         success = false;
         goto format_done;
@@ -1249,7 +1814,7 @@ static void kcmd_format(shell_state_t *sh, int argc, char **argv) {
                 sector[2] = 0xFF;
             }
 
-            if (ata_write_sectors(drive, fat_sector + s, 1, sector) != 1) {
+            if (!format_write_sector(drive, fat_sector + s, sector)) {
                 sh->io->printf(" FAILED at sector %u!\n", s);
                 success = false;
                 break;
@@ -1287,7 +1852,7 @@ static void kcmd_format(shell_state_t *sh, int argc, char **argv) {
                 sector[11] = 0x08;  /* Volume label attribute */
             }
 
-            if (ata_write_sectors(drive, root_start + s, 1, sector) != 1) {
+            if (!format_write_sector(drive, root_start + s, sector)) {
                 sh->io->printf(" FAILED at sector %u!\n", s);
                 success = false;
                 break;
@@ -1325,10 +1890,79 @@ format_done:
  * Initialize Shell with Kernel Commands
  * ============================================================================ */
 
+/* ============================================================================
+ * Background Jobs
+ *
+ * 'cmd &' runs the command on its own kernel thread with a copy of the
+ * shell state taken at spawn time, so a job's 'cd' and exit code stay its
+ * own. It shares the console with the foreground and switches with it at
+ * yield points (disk waits, sleeps, the keyboard).
+ *
+ * There is one program area, so program commands only go to the
+ * background while it is empty: the job then owns it until it finishes
+ * (load, run and unload refuse while a program is loading or running).
+ * ============================================================================ */
+
+typedef struct {
+    shell_state_t  sh;                  /* Private copy: cwd, last_result */
+    char           line[SHELL_CMD_BUF_SIZE];
+} shell_job_t;
+
+static void shell_job_main(void *arg) {
+    shell_job_t *job = (shell_job_t *)arg;
+    int result = shell_execute(&job->sh, job->line);
+
+    kprintf("\n[%u] Done (%d)  %s\n", kthread_current()->id, result, job->line);
+    kfree(job);
+}
+
+static bool shell_job_spawn(shell_state_t *sh, const char *cmdline) {
+    while (*cmdline == ' ' || *cmdline == '\t') cmdline++;
+    if (!*cmdline) return false;
+
+    shell_job_t *job = (shell_job_t *)kmalloc(sizeof(shell_job_t));
+    if (!job) {
+        sh->io->printf("Out of memory\n");
+        return false;
+    }
+    job->sh = *sh;
+    sh_strcpy(job->line, cmdline);
+
+    /* Thread name: the command word */
+    char name[KTHREAD_NAME_LEN];
+    int n = 0;
+    while (cmdline[n] && cmdline[n] != ' ' && n < KTHREAD_NAME_LEN - 1) {
+        name[n] = cmdline[n];
+        n++;
+    }
+    name[n] = '\0';
+
+    static const char *const program_cmds[] = { "load", "run", "exec", "unload" };
+    const program_state_t *prog = program_get_state();
+    for (uint32_t i = 0; i < sizeof(program_cmds) / sizeof(program_cmds[0]); i++) {
+        if (sh_strcmp(name, program_cmds[i]) == 0 && (prog->loaded || prog->busy)) {
+            sh->io->printf("'%s' cannot run in the background while a program is loaded\n",
+                           name);
+            kfree(job);
+            return false;
+        }
+    }
+
+    kthread_t *t = kthread_create(name, shell_job_main, job, 0);
+    if (!t) {
+        sh->io->printf("Cannot start job (%u threads)\n", g_sched.count);
+        kfree(job);
+        return false;
+    }
+    sh->io->printf("[%u] %s\n", t->id, name);
+    return true;
+}
+
 static shell_state_t g_shell;
 
 static void setup_kernel_shell(kernel_context_t *ctx) {
     shell_init(&g_shell, &g_shell_io, ctx);
+    g_shell.spawn = shell_job_spawn;
 
     /* Initialize program loader */
     program_shell_init();
@@ -1339,10 +1973,16 @@ static void setup_kernel_shell(kernel_context_t *ctx) {
     shell_register(&g_shell, "info",    "System information",        kcmd_info,    0);
     shell_register(&g_shell, "mem",     "Memory information",        kcmd_mem,     0);
     shell_register(&g_shell, "disk",    "Disk information",          kcmd_disk,    0);
+    shell_register(&g_shell, "events",  "Event queue statistics",    kcmd_events,  0);
+    shell_register(&g_shell, "threads", "Kernel threads",            kcmd_threads, 0);
+    shell_register(&g_shell, "perf",    "Profiler [top N|reset|dump]", kcmd_perf,  0);
     shell_register(&g_shell, "color",   "Cycle terminal colors",     kcmd_color,   0);
+    shell_register(&g_shell, "sync",    "Flush cached disk writes",  kcmd_sync,    0);
+    shell_register(&g_shell, "ramdisk", "RAM disk usage [compact]",  kcmd_ramdisk, 0);
     shell_register(&g_shell, "reboot",  "Reboot system",             kcmd_reboot,  0);
     shell_register(&g_shell, "atatest", "Test ATA write [lba]",       kcmd_atatest, 0);
-    shell_register(&g_shell, "format",  "Format drive (FAT12)",      kcmd_format,  0);
+    shell_register(&g_shell, "atabench", "ATA read speed [sectors]",  kcmd_atabench, 0);
+    shell_register(&g_shell, "format",  "Format drive (FAT12) [-y]", kcmd_format,  0);
 
     /* File commands */
     shell_register(&g_shell, "ls",     "List directory",            kcmd_ls,     0);
@@ -1361,6 +2001,9 @@ static void setup_kernel_shell(kernel_context_t *ctx) {
 extern const uint8_t terminal_font_8x16[];
 
 void kernel_main(boot_info_t *bi) {
+    /* CPU features first: compiled code may already use SSE moves */
+    cpu_init();
+
     /* DEBUG: Immediate VGA output to prove we got here */
     volatile uint16_t *vga = (volatile uint16_t *)0xB8000;
     vga[0] = 0x4F4B;  /* 'K' in white on red - proves kernel entry */
@@ -1371,7 +2014,7 @@ void kernel_main(boot_info_t *bi) {
     vga[5] = 0x4F4C;  /* 'L' */
 
     /* DEBUG: Pause so we can see it */
-    for (volatile int i = 0; i < 50000000; i++);
+    tsc_delay_us(250000);
 
     /* Verify boot info */
     if (bi->magic != BOOT_MAGIC) {
@@ -1416,6 +2059,18 @@ void kernel_main(boot_info_t *bi) {
     kprintf("========================================\n\n");
     kprintf("  Initializing system...\n\n");
 
+    /* Write-combining framebuffer: streamed stores leave as bursts */
+    if (!g_use_vga_text) {
+        kprintf("  [....] Framebuffer write-combining");
+        if (mtrr_set_write_combining(bi->framebuffer, bi->pitch * bi->height)) {
+            kprintf("\r  [ OK ] Framebuffer write-combining\n");
+            kprintf("         %u KB at 0x%x, %u MTRR\n", g_fb_wc.size / 1024,
+                    g_fb_wc.base, g_fb_wc.regs);
+        } else {
+            kprintf("\r  [WARN] Framebuffer write-combining (%s)\n", g_fb_wc.status);
+        }
+    }
+
     /* Initialize EventChains */
     kprintf("  [....] EventChains");
     event_chain_init(&g_keyboard_events);
@@ -1428,6 +2083,25 @@ void kernel_main(boot_info_t *bi) {
     idt_init();
     kprintf("\r  [ OK ] Interrupt system\n");
 
+    /* System timer (ticks start once interrupts are enabled) */
+    kprintf("  [....] Scheduler");
+    sched_init();
+    kprintf("\r  [ OK ] Scheduler\n");
+
+    kprintf("  [....] System timer");
+    timer_init(TIMER_DEFAULT_HZ);
+    timer_set_idle_work(event_dispatch_all);   /* Drain events during long commands too */
+    if (!g_use_vga_text) {
+        timer_setup(&g_blink_timer, kcursor_blink, NULL);
+        uint32_t blink = terminal_blink_ms(&g_term);
+        timer_start(&g_blink_timer, blink, blink);
+    }
+    kprintf("\r  [ OK ] System timer\n");
+    kprintf("         PIT %u Hz, TSC %u MHz\n", g_timer.hz, tsc_mhz());
+
+    /* Trace points stamp with rdtsc */
+    if (cpu_has(CPUID_FEAT_TSC)) trace_enable(true);
+
     /* Initialize memory manager */
     kprintf("  [....] Memory manager");
     mm_init(&g_mm);
@@ -1436,10 +2110,20 @@ void kernel_main(boot_info_t *bi) {
     kprintf("\r  [ OK ] Memory manager\n");
     kprintf("         Total: %u KB\n", g_mm.total_bytes / 1024);
 
-    /* Initialize slab allocator */
-    kprintf("  [....] Slab allocator");
-    slab_init(&g_slab, 0x200000, 0x200000);
-    kprintf("\r  [ OK ] Slab allocator\n");
+    /* Initialize kernel heap */
+    kprintf("  [....] Kernel heap");
+    if (mm_heap_init(&g_mm)) {
+        kprintf("\r  [ OK ] Kernel heap\n");
+        kprintf("         Free: %u KB at 0x%x\n", g_pages.free_pages * (PAGE_SIZE / 1024),
+                g_pages.base);
+
+        /* Offscreen terminal buffer; without one cells render straight to VRAM */
+        if (!g_use_vga_text) {
+            terminal_set_backbuffer(&g_term, kmalloc(terminal_backbuffer_size(&g_term)));
+        }
+    } else {
+        kprintf("\r  [FAIL] Kernel heap\n");
+    }
 
     /* Initialize RAM disk */
     kprintf("  [....] RAM disk");
@@ -1496,6 +2180,15 @@ void kernel_main(boot_info_t *bi) {
         kprintf("         No drives found\n");
     }
 
+    if (g_ramdisk.initialized) {
+        kprintf("  [....] Mounting RAM disk");
+        if (mount_ramdisk(RAMDISK_MOUNT_PATH)) {
+            kprintf("\r  [ OK ] Mounting RAM disk at %s\n", RAMDISK_MOUNT_PATH);
+        } else {
+            kprintf("\r  [FAIL] Mounting RAM disk\n");
+        }
+    }
+
     /* Setup kernel context */
     g_kernel_ctx.mm = &g_mm;
     g_kernel_ctx.slab = &g_slab;
@@ -0,0 +1,43 @@
+; ============================================================================
+; switch.asm - Kernel Thread Context Switch
+; ============================================================================
+;
+; void ctx_switch(uint32_t *save_esp, uint32_t next_esp)
+;
+; Saves the callee-saved registers and EFLAGS of the running thread on its
+; own stack, stores the stack pointer in *save_esp, then loads next_esp
+; and unwinds the same frame for the next thread. Switches only happen at
+; C call boundaries, so every other register (including the x87/SSE
+; state, caller-saved under the cdecl ABI) needs no saving.
+;
+; Frame at a saved esp (lowest address first):
+;   eflags, edi, esi, ebx, ebp, return address
+;
+; A new thread's stack is seeded with this frame by kthread_create, with
+; the return address pointing at its entry function.
+;
+; ============================================================================
+
+[BITS 32]
+
+global ctx_switch
+
+ctx_switch:
+    mov     eax, [esp + 4]      ; save_esp
+    mov     edx, [esp + 8]      ; next_esp
+
+    push    ebp
+    push    ebx
+    push    esi
+    push    edi
+    pushfd
+
+    mov     [eax], esp
+    mov     esp, edx
+
+    popfd
+    pop     edi
+    pop     esi
+    pop     ebx
+    pop     ebp
+    ret
@@ -0,0 +1,316 @@
+/**
+ * bench.c - Host benchmark suite for the filesystem, lists and assembler
+ *
+ * Build: make bench (or see the bench target in the Makefile)
+ * Run:   build/bench [filter]
+ *
+ * Runs the kernel's header-only code on the build machine: FAT12 against
+ * an in-memory 1.44MB floppy image that charges a fixed cost per device
+ * call and per sector, both intrusive list implementations
+ * and the list pool, and RF-ASM on a generated source. Only benchmarks
+ * whose name contains @filter are run. Output is one JSON object per
+ * line (see bench.h); progress and errors go to stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+/*
+ * Port I/O and interrupt stand-ins for idt.h: the FAT12 formatter reads
+ * the PIT for a volume ID, and the trace hooks (compiled out here with
+ * TRACE_ENABLED=0) mask interrupts.
+ */
+#define IDT_H
+static inline uint8_t inb(uint16_t port) { (void)port; return 0; }
+static inline void outb(uint16_t port, uint8_t val) { (void)port; (void)val; }
+static inline uint32_t irq_save(void) { return 0; }
+static inline void irq_restore(uint32_t flags) { (void)flags; }
+
+#include "../include/fat12.h"
+#include "../include/fat12_write.h"
+
+#define RFASM_SHELL_INTEGRATION
+#include "../include/rfasm.h"
+
+/* ============================================================================
+ * Harness
+ * ============================================================================ */
+
+static const char *g_filter;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+void bench_run(const char *name, const char *unit, bench_fn fn, void *ctx) {
+    uint64_t ns[BENCH_RUNS];
+    uint64_t ops = 0;
+
+    if (g_filter && !strstr(name, g_filter)) return;
+    fprintf(stderr, "  %s\n", name);
+
+    fn(ctx);                            /* Warm-up: caches, page faults */
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        uint64_t t0 = now_ns();
+        ops = fn(ctx);
+        ns[i] = now_ns() - t0;
+    }
+
+    qsort(ns, BENCH_RUNS, sizeof(ns[0]), cmp_u64);
+    uint64_t median = ns[BENCH_RUNS / 2];
+    if (!ops) ops = 1;
+    if (!median) median = 1;
+
+    printf("{\"bench\":\"%s\",\"ops\":%llu,\"unit\":\"%s\",\"runs\":%d,"
+           "\"min_ns\":%llu,\"median_ns\":%llu,\"ns_per_op\":%.3f,\"ops_per_s\":%.0f}\n",
+           name, (unsigned long long)ops, unit, BENCH_RUNS,
+           (unsigned long long)ns[0], (unsigned long long)median,
+           (double)median / (double)ops, (double)ops * 1e9 / (double)median);
+    fflush(stdout);
+}
+
+/* ============================================================================
+ * FAT12 on an In-Memory Floppy
+ * ============================================================================ */
+
+#define FLOPPY_SECTORS  2880
+#define BIG_FILE_SIZE   (256 * 1024)
+#define BIG_CHUNK       4096
+#define RANDOM_READS    1024
+#define RANDOM_SIZE     512
+#define SMALL_FILES     64
+
+/*
+ * Device model: a command costs IMAGE_CALL_NS however many sectors it
+ * moves, plus IMAGE_SECTOR_NS per sector, so the numbers reflect how
+ * well FAT12 batches its I/O rather than the speed of memcpy
+ */
+#define IMAGE_CALL_NS   20000
+#define IMAGE_SECTOR_NS 1000
+
+static uint8_t    g_image[FLOPPY_SECTORS * FAT12_SECTOR_SIZE];
+static uint8_t    g_fat_cache[4608];    /* 9 FAT sectors, as fat12_vfs.h */
+static fat12_fs_t g_fs;
+static uint8_t    g_buf[BIG_FILE_SIZE];
+static uint64_t   g_dev_calls;
+static uint64_t   g_dev_sectors;
+
+static void image_charge(uint32_t count) {
+    uint64_t until = now_ns() + IMAGE_CALL_NS + (uint64_t)count * IMAGE_SECTOR_NS;
+    g_dev_calls++;
+    g_dev_sectors += count;
+    while (now_ns() < until);
+}
+
+static uint32_t image_read(uint32_t lba, uint32_t count, void *buf) {
+    if (lba >= FLOPPY_SECTORS) return 0;
+    if (count > FLOPPY_SECTORS - lba) count = FLOPPY_SECTORS - lba;
+    image_charge(count);
+    memcpy(buf, &g_image[lba * FAT12_SECTOR_SIZE], count * FAT12_SECTOR_SIZE);
+    return count;
+}
+
+static uint32_t image_write(uint32_t lba, uint32_t count, const void *buf) {
+    if (lba >= FLOPPY_SECTORS) return 0;
+    if (count > FLOPPY_SECTORS - lba) count = FLOPPY_SECTORS - lba;
+    image_charge(count);
+    memcpy(&g_image[lba * FAT12_SECTOR_SIZE], buf, count * FAT12_SECTOR_SIZE);
+    return count;
+}
+
+static void fs_fail(const char *what) {
+    fprintf(stderr, "fat12: %s failed\n", what);
+    exit(1);
+}
+
+static void fs_prepare(void) {
+    uint32_t seed = 0xF12u;
+
+    memset(g_image, 0, sizeof(g_image));
+    if (!fat12_format(image_write, image_read, NULL, FLOPPY_SECTORS, "BENCH"))
+        fs_fail("format");
+    if (!fat12_mount(&g_fs, image_read, image_write, g_fat_cache))
+        fs_fail("mount");
+
+    for (uint32_t i = 0; i < BIG_FILE_SIZE; i++) g_buf[i] = (uint8_t)bench_rand(&seed);
+    if (fat12_write_file(&g_fs, "BIG.BIN", g_buf, BIG_FILE_SIZE) != BIG_FILE_SIZE)
+        fs_fail("write BIG.BIN");
+}
+
+/* Whole file front to back in 4KB reads */
+static uint64_t run_seq_read(void *ctx) {
+    (void)ctx;
+    fat12_file_t f;
+    uint64_t total = 0;
+    uint32_t n;
+
+    if (!fat12_open(&g_fs, "BIG.BIN", &f)) fs_fail("open BIG.BIN");
+    while ((n = fat12_read(&f, g_buf, BIG_CHUNK)) > 0) total += n;
+    fat12_close(&f);
+    if (total != BIG_FILE_SIZE) fs_fail("sequential read");
+    return total;
+}
+
+/* Rewrite the whole file (delete, create, 256KB write, flush) */
+static uint64_t run_seq_write(void *ctx) {
+    (void)ctx;
+    if (fat12_write_file(&g_fs, "BIG.BIN", g_buf, BIG_FILE_SIZE) != BIG_FILE_SIZE)
+        fs_fail("sequential write");
+    fat12_sync(&g_fs);
+    return BIG_FILE_SIZE;
+}
+
+/* Sector-sized reads at random offsets */
+static uint64_t run_rand_read(void *ctx) {
+    (void)ctx;
+    fat12_file_t f;
+    uint32_t seed = 0x5EEDu;
+
+    if (!fat12_open(&g_fs, "BIG.BIN", &f)) fs_fail("open BIG.BIN");
+    for (uint32_t i = 0; i < RANDOM_READS; i++) {
+        uint32_t pos = bench_rand(&seed) % (BIG_FILE_SIZE - RANDOM_SIZE);
+        if (!fat12_seek(&f, pos) || fat12_read(&f, g_buf, RANDOM_SIZE) != RANDOM_SIZE)
+            fs_fail("random read");
+    }
+    fat12_close(&f);
+    return RANDOM_READS;
+}
+
+/* Create, read back and delete a batch of 100-2100 byte files */
+static uint64_t run_small_files(void *ctx) {
+    (void)ctx;
+    uint32_t seed = 0x5A11u;
+    uint32_t sizes[SMALL_FILES];
+    char name[16];
+
+    for (uint32_t i = 0; i < SMALL_FILES; i++) {
+        sizes[i] = 100 + bench_rand(&seed) % 2000;
+        snprintf(name, sizeof(name), "F%03u.DAT", (unsigned)i);
+        if (fat12_write_file(&g_fs, name, g_buf, sizes[i]) != sizes[i])
+            fs_fail("small write");
+    }
+    for (uint32_t i = 0; i < SMALL_FILES; i++) {
+        fat12_file_t f;
+        snprintf(name, sizeof(name), "F%03u.DAT", (unsigned)i);
+        if (!fat12_open(&g_fs, name, &f) || fat12_read(&f, g_buf, BIG_CHUNK) != sizes[i])
+            fs_fail("small read");
+        fat12_close(&f);
+    }
+    for (uint32_t i = 0; i < SMALL_FILES; i++) {
+        snprintf(name, sizeof(name), "F%03u.DAT", (unsigned)i);
+        if (!fat12_delete(&g_fs, name)) fs_fail("small delete");
+    }
+    fat12_sync(&g_fs);
+    return SMALL_FILES;
+}
+
+/* bench_run plus a line with the device calls one run makes */
+static void fs_bench(const char *name, const char *unit, bench_fn fn) {
+    if (g_filter && !strstr(name, g_filter)) return;
+
+    g_dev_calls = g_dev_sectors = 0;
+    bench_run(name, unit, fn, NULL);
+
+    uint64_t calls = g_dev_calls / (BENCH_RUNS + 1);
+    uint64_t sectors = g_dev_sectors / (BENCH_RUNS + 1);
+    printf("{\"device\":\"%s\",\"calls\":%llu,\"sectors\":%llu,\"sectors_per_call\":%.2f}\n",
+           name, (unsigned long long)calls, (unsigned long long)sectors,
+           calls ? (double)sectors / (double)calls : 0.0);
+    fflush(stdout);
+}
+
+static void bench_fat12(void) {
+    fs_prepare();
+    fs_bench("fat12.seq_read", "byte", run_seq_read);
+    fs_bench("fat12.rand_read", "read", run_rand_read);
+    fs_bench("fat12.small_files", "file", run_small_files);
+    fs_bench("fat12.seq_write", "byte", run_seq_write);
+}
+
+/* ============================================================================
+ * RF-ASM
+ * ============================================================================ */
+
+#define ASM_BLOCKS      400             /* Labels (RFASM_MAX_LABELS is 512) */
+
+static char     g_asm_src[65536];
+static uint32_t g_asm_lines;
+static uint8_t  g_asm_out[65536];
+
+/*
+ * Labelled blocks of mixed instructions, each ending in a forward branch
+ * to the next block and a backward loop, so every run resolves fixups
+ * and relaxes branches
+ */
+static void asm_generate(void) {
+    static const char *const body[] = {
+        "MOV EAX, 0x12345678", "MOV EBX, [ESI+8]", "ADD EAX, EBX",
+        "SUB ECX, 10", "XOR EDX, EDX", "SHL EAX, 4", "PUSH EAX",
+        "POP EDI", "CMP EAX, 0", "INC ESI", "AND EAX, 0xFF", "MOV [EDI], AL",
+    };
+    uint32_t seed = 0xA5Au;
+    size_t len = 0;
+
+    g_asm_lines = 0;
+    for (uint32_t b = 0; b < ASM_BLOCKS; b++) {
+        len += snprintf(g_asm_src + len, sizeof(g_asm_src) - len, "blk%u:\n", (unsigned)b);
+        for (int i = 0; i < 6; i++) {
+            const char *ins = body[bench_rand(&seed) % (sizeof(body) / sizeof(body[0]))];
+            len += snprintf(g_asm_src + len, sizeof(g_asm_src) - len, "    %s\n", ins);
+        }
+        if (b + 1 < ASM_BLOCKS)
+            len += snprintf(g_asm_src + len, sizeof(g_asm_src) - len,
+                            "    JZ blk%u\n    DEC ECX\n    JNZ blk%u\n",
+                            (unsigned)b + 1, (unsigned)b);
+        else
+            len += snprintf(g_asm_src + len, sizeof(g_asm_src) - len, "    RET\n");
+        g_asm_lines += b + 1 < ASM_BLOCKS ? 10 : 8;
+    }
+}
+
+static uint64_t run_rfasm(void *ctx) {
+    bool peephole = ctx != NULL;
+    rfasm_state_t st;
+
+    rfasm_init(&st, g_asm_out, sizeof(g_asm_out));
+    st.peephole = peephole;
+    if (rfasm_assemble(&st, g_asm_src) != RFASM_OK) {
+        fprintf(stderr, "rfasm: line %d: %s\n", st.error_line, st.error_msg);
+        exit(1);
+    }
+    return g_asm_lines;
+}
+
+static void bench_rfasm(void) {
+    static int peephole_on = 1;
+
+    asm_generate();
+    bench_run("rfasm.assemble", "line", run_rfasm, NULL);
+    bench_run("rfasm.assemble_peephole", "line", run_rfasm, &peephole_on);
+}
+
+/* ============================================================================
+ * Main
+ * ============================================================================ */
+
+int main(int argc, char **argv) {
+    if (argc > 1) g_filter = argv[1];
+
+    fprintf(stderr, "Running benchmarks (%d runs each, median reported)\n", BENCH_RUNS);
+    bench_fat12();
+    bench_ilist_classic();
+    bench_ilist_fast();
+    bench_rfasm();
+    return 0;
+}
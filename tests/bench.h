@@ -0,0 +1,43 @@
+/**
+ * bench.h - Shared helpers for the host benchmark suite
+ *
+ * Every workload is timed BENCH_RUNS times after one untimed warm-up run,
+ * with fixed PRNG seeds, and reported as one JSON object per line:
+ *
+ *   {"bench":"fat12.seq_read","ops":262144,"unit":"byte","runs":7,
+ *    "min_ns":...,"median_ns":...,"ns_per_op":...,"ops_per_s":...}
+ *
+ * ns_per_op and ops_per_s come from the median run. FAT12 benchmarks are
+ * followed by the device calls a single run makes:
+ *
+ *   {"device":"fat12.seq_read","calls":...,"sectors":...,"sectors_per_call":...}
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BENCH_RUNS      7
+
+/* One timed workload; returns the operations it performed */
+typedef uint64_t (*bench_fn)(void *ctx);
+
+/* Run @fn (warm-up + BENCH_RUNS) and print its result line */
+void bench_run(const char *name, const char *unit, bench_fn fn, void *ctx);
+
+/* Fixed-seed xorshift PRNG, so every run sees the same workload */
+static inline uint32_t bench_rand(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/* Intrusive list workloads (bench_ilist.c, built once per header) */
+void bench_ilist_classic(void);
+void bench_ilist_fast(void);
+
+#endif /* BENCH_H */
@@ -0,0 +1,145 @@
+/**
+ * bench_ilist.c - Intrusive list and pool workloads
+ *
+ * Built twice: as is against intrusive_list.h, and with -DBENCH_ILIST_FAST
+ * against intrusive_list_fast.h (plus the pool, which is built on it).
+ * The two headers define the same names, so they cannot share a
+ * translation unit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#ifdef BENCH_ILIST_FAST
+#include "../include/intrusive_list_pool.h"
+#define BENCH_PREFIX    "ilist_fast"
+#define BENCH_ENTRY     bench_ilist_fast
+#else
+#include "../include/intrusive_list.h"
+#define BENCH_PREFIX    "ilist"
+#define BENCH_ENTRY     bench_ilist_classic
+#endif
+
+#define LIST_NODES      4096
+#define LIST_PASSES     64              /* Iteration passes per run */
+#define LIST_SPLICES    65536
+#define POOL_LIVE       1024
+#define POOL_CHURN      262144
+
+typedef struct {
+    ilist_node_t link;
+    uint32_t     value;
+} item_t;
+
+static item_t   g_items[LIST_NODES];
+static uint32_t g_order[LIST_NODES];    /* Link order: a fixed shuffle */
+
+static void shuffle_order(void) {
+    uint32_t seed = 0x1157u;
+    for (uint32_t i = 0; i < LIST_NODES; i++) g_order[i] = i;
+    for (uint32_t i = LIST_NODES - 1; i > 0; i--) {
+        uint32_t j = bench_rand(&seed) % (i + 1);
+        uint32_t t = g_order[i];
+        g_order[i] = g_order[j];
+        g_order[j] = t;
+    }
+}
+
+static void build_list(ilist_head_t *head) {
+    ilist_init_head(head);
+    for (uint32_t i = 0; i < LIST_NODES; i++) {
+        item_t *it = &g_items[g_order[i]];
+        it->value = i;
+        ilist_push_back(head, &it->link);
+    }
+}
+
+/* ============================================================================
+ * Workloads
+ * ============================================================================ */
+
+/* Alternate front/back inserts, then unlink everything */
+static uint64_t run_insert(void *ctx) {
+    (void)ctx;
+    ilist_head_t head;
+    ilist_init_head(&head);
+
+    for (uint32_t i = 0; i < LIST_NODES; i++) {
+        item_t *it = &g_items[g_order[i]];
+        if (i & 1) ilist_push_back(&head, &it->link);
+        else       ilist_push_front(&head, &it->link);
+    }
+    while (!ilist_is_empty(&head)) ilist_pop_front(&head);
+    return LIST_NODES;
+}
+
+static volatile uint32_t g_sink;
+
+/* Walk a shuffled list summing entries */
+static uint64_t run_iterate(void *ctx) {
+    ilist_head_t *head = (ilist_head_t *)ctx;
+    uint32_t sum = 0;
+
+    for (uint32_t pass = 0; pass < LIST_PASSES; pass++) {
+        item_t *it;
+        ilist_foreach_entry(it, head, link) sum += it->value;
+    }
+    g_sink = sum;
+    return (uint64_t)LIST_PASSES * LIST_NODES;
+}
+
+/* Move the whole list back and forth between two heads */
+static uint64_t run_splice(void *ctx) {
+    ilist_head_t *a = (ilist_head_t *)ctx;
+    ilist_head_t b;
+    ilist_init_head(&b);
+
+    for (uint32_t i = 0; i < LIST_SPLICES / 2; i++) {
+        ilist_splice_back(a, &b);
+        ilist_splice_front(&b, a);
+    }
+    return LIST_SPLICES;
+}
+
+#ifdef BENCH_ILIST_FAST
+/* Random free/alloc against a pool holding POOL_LIVE objects */
+static uint64_t run_pool_churn(void *ctx) {
+    (void)ctx;
+    static item_t *live[POOL_LIVE];
+    ilist_pool_t pool;
+    uint32_t seed = 0xC0FFEEu;
+
+    ilist_pool_init(&pool, sizeof(item_t), 256);
+    for (uint32_t i = 0; i < POOL_LIVE; i++) live[i] = ILIST_POOL_ALLOC(&pool, item_t);
+
+    for (uint32_t i = 0; i < POOL_CHURN; i++) {
+        uint32_t slot = bench_rand(&seed) % POOL_LIVE;
+        ilist_pool_free(&pool, live[slot]);
+        live[slot] = ILIST_POOL_ALLOC(&pool, item_t);
+        if (!live[slot]) {
+            fprintf(stderr, "pool: allocation failed\n");
+            exit(1);
+        }
+    }
+
+    ilist_pool_destroy(&pool);
+    return POOL_CHURN;
+}
+#endif
+
+void BENCH_ENTRY(void) {
+    ilist_head_t head;
+
+    shuffle_order();
+    bench_run(BENCH_PREFIX ".insert", "node", run_insert, NULL);
+
+    build_list(&head);
+    bench_run(BENCH_PREFIX ".iterate", "node", run_iterate, &head);
+    bench_run(BENCH_PREFIX ".splice", "splice", run_splice, &head);
+
+#ifdef BENCH_ILIST_FAST
+    bench_run("ilist_pool.churn", "alloc", run_pool_churn, NULL);
+#endif
+}
@@ -44,11 +44,15 @@ static void hexdump(const uint8_t *data, size_t len, uint32_t base_addr) {
     }
 }
 
+/* Peephole rewrites for the cases that follow */
+static bool test_peephole = false;
+
 /* Run a single test case */
 static int test_case(const char *name, const char *source,
                      const uint8_t *expected, size_t expected_len) {
     rfasm_state_t state;
     rfasm_init(&state, output_buffer, sizeof(output_buffer));
+    state.peephole = test_peephole;
 
     rfasm_error_t err = rfasm_assemble(&state, source);
 
@@ -374,6 +378,143 @@ static int run_tests(void) {
         failures += test_case("MOV reg, label", src, expected, sizeof(expected));
     }
 
+    /* Test: Branch relaxation */
+    {
+        const char *src =
+            "    JZ done\n"
+            "    NOP\n"
+            "done:\n";
+        const uint8_t expected[] = { 0x74, 0x01, 0x90 };  /* Forward Jcc relaxed to rel8 */
+        failures += test_case("JZ short forward", src, expected, sizeof(expected));
+    }
+
+    {
+        const char *src =
+            "    JNZ done\n"
+            "    TIMES 127 NOP\n"
+            "done:\n";
+        uint8_t expected[2 + 127];
+        expected[0] = 0x75;
+        expected[1] = 0x7F;                               /* Largest rel8 */
+        memset(expected + 2, 0x90, 127);
+        failures += test_case("JNZ rel8 limit", src, expected, sizeof(expected));
+    }
+
+    {
+        const char *src =
+            "    JNZ done\n"
+            "    TIMES 128 NOP\n"
+            "done:\n";
+        uint8_t expected[6 + 128];
+        const uint8_t head[] = { 0x0F, 0x85, 0x80, 0x00, 0x00, 0x00 };
+        memcpy(expected, head, sizeof(head));
+        memset(expected + 6, 0x90, 128);
+        failures += test_case("JNZ rel32 past limit", src, expected, sizeof(expected));
+    }
+
+    {
+        const char *src =
+            "    JMP done\n"
+            "    TIMES 200 NOP\n"
+            "done:\n"
+            "    RET\n";
+        uint8_t expected[5 + 200 + 1];
+        const uint8_t head[] = { 0xE9, 0xC8, 0x00, 0x00, 0x00 };
+        memcpy(expected, head, sizeof(head));
+        memset(expected + 5, 0x90, 200);
+        expected[205] = 0xC3;
+        failures += test_case("JMP near forward", src, expected, sizeof(expected));
+    }
+
+    {
+        /* JZ only fits once JNZ has shrunk (needs another layout pass) */
+        const char *src =
+            "    JZ done\n"
+            "    JNZ done\n"
+            "    TIMES 122 NOP\n"
+            "done:\n";
+        uint8_t expected[4 + 122];
+        const uint8_t head[] = { 0x74, 0x7C, 0x75, 0x7A };
+        memcpy(expected, head, sizeof(head));
+        memset(expected + 4, 0x90, 122);
+        failures += test_case("Relaxation cascade", src, expected, sizeof(expected));
+    }
+
+    {
+        const char *src =
+            "    JMP skip\n"
+            "    MOV EAX, skip\n"
+            "skip:\n"
+            "    RET\n";
+        /* Labels after a relaxed jump get their final address */
+        const uint8_t expected[] = { 0xEB, 0x05, 0xB8, 0x07, 0x00, 0x00, 0x00, 0xC3 };
+        failures += test_case("Label after relaxed JMP", src, expected, sizeof(expected));
+    }
+
+    /* Test: Accumulator short forms */
+    {
+        const char *src = "ADD AL, 5\nSUB AX, 0x1234\nCMP AL, 10\n";
+        const uint8_t expected[] = { 0x04, 0x05, 0x66, 0x2D, 0x34, 0x12, 0x3C, 0x0A };
+        failures += test_case("ALU AL/AX, imm", src, expected, sizeof(expected));
+    }
+
+    /* Test: Peephole (off by default) */
+    {
+        const char *src = "MOV EAX, 0\nADD ECX, 1\n";
+        const uint8_t expected[] = { 0xB8, 0x00, 0x00, 0x00, 0x00, 0x83, 0xC1, 0x01 };
+        failures += test_case("Peephole off", src, expected, sizeof(expected));
+    }
+
+    test_peephole = true;
+
+    {
+        const char *src = "MOV EAX, 0\nMOV BX, 0\n";
+        const uint8_t expected[] = { 0x31, 0xC0, 0x66, 0x31, 0xDB };
+        failures += test_case("MOV reg, 0 -> XOR", src, expected, sizeof(expected));
+    }
+
+    {
+        const char *src = "ADD ECX, 1\nSUB EDX, 1\nADD EBX, -1\nSUB ESI, -1\n";
+        const uint8_t expected[] = { 0x41, 0x4A, 0x4B, 0x46 };
+        failures += test_case("ADD/SUB 1 -> INC/DEC", src, expected, sizeof(expected));
+    }
+
+    {
+        const char *src = "CMP ESI, 0\nCMP EAX, 5\n";
+        const uint8_t expected[] = { 0x85, 0xF6, 0x83, 0xF8, 0x05 };
+        failures += test_case("CMP reg, 0 -> TEST", src, expected, sizeof(expected));
+    }
+
+    {
+        const char *src = "MOV AL, 0\nADD EAX, 2\n";
+        const uint8_t expected[] = { 0xB0, 0x00, 0x83, 0xC0, 0x02 };
+        failures += test_case("Peephole leaves others", src, expected, sizeof(expected));
+    }
+
+    test_peephole = false;
+
+    /* Test: Large symbol tables (hashed lookup, hundreds of forward refs) */
+    {
+        enum { LABELS = 400 };
+        static char src[LABELS * 32];
+        static uint8_t expected[LABELS * 5 - 4];
+        size_t len = 0, o = 0;
+
+        /* L<i>: MOV EAX, L<i+1> -- every reference is forward */
+        for (int i = 0; i < LABELS; i++) {
+            if (i + 1 < LABELS) {
+                len += snprintf(src + len, sizeof(src) - len, "L%d:\n    MOV EAX, L%d\n", i, i + 1);
+                uint32_t target = (uint32_t)(i + 1) * 5;
+                expected[o++] = 0xB8;
+                for (int b = 0; b < 4; b++) expected[o++] = (uint8_t)(target >> (b * 8));
+            } else {
+                len += snprintf(src + len, sizeof(src) - len, "L%d:\n    RET\n", i);
+                expected[o++] = 0xC3;
+            }
+        }
+        failures += test_case("400 labels, forward refs", src, expected, o);
+    }
+
     printf("\n=== Results: %d failures ===\n\n", failures);
     return failures;
 }
@@ -0,0 +1,201 @@
+/**
+ * lzpack.c - Pack the kernel image for the boot loader
+ *
+ * Build: cc -O2 -o lzpack lzpack.c
+ * Run:   ./lzpack kernel.bin kernel.lz
+ *
+ * Output is a 12-byte header followed by an LZSS stream, decoded by
+ * stage2 (boot/stage2.asm, lz_decode) while it moves the kernel to 1MB:
+ *
+ *   +0  "RFLZ"
+ *   +4  uncompressed size (little endian)
+ *   +8  stream size
+ *   +12 stream
+ *
+ * The stream is a sequence of groups: a flag byte, then eight items, one
+ * per flag bit from the least significant; the last group may stop short.
+ * A clear bit is a literal byte. A set bit is a two-byte little-endian
+ * match word: the low 12 bits are distance - 1 (1..4096 bytes back), the
+ * high 4 bits length - 3 (3..18 bytes). Matches may overlap the output
+ * they produce.
+ *
+ * The packed stream is decoded again and compared before it is written.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define LZ_MAGIC        "RFLZ"
+#define LZ_HEADER       12
+#define LZ_WINDOW       4096
+#define LZ_MIN_MATCH    3
+#define LZ_MAX_MATCH    18
+#define LZ_HASH_BITS    13
+#define LZ_HASH_SIZE    (1u << LZ_HASH_BITS)
+#define LZ_CHAIN_LIMIT  512             /* Candidates tried per position */
+
+static uint32_t hash3(const uint8_t *p) {
+    uint32_t v = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/* Greedy LZSS with hash chains; @out needs len + len / 8 + 1 bytes */
+static size_t lz_pack(const uint8_t *in, size_t len, uint8_t *out) {
+    int32_t *head = malloc(LZ_HASH_SIZE * sizeof(int32_t));
+    int32_t *prev = malloc((len ? len : 1) * sizeof(int32_t));
+    size_t o = 0, flag_at = 0, pos = 0;
+    int items = 8;
+
+    if (!head || !prev) {
+        fprintf(stderr, "lzpack: out of memory\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < LZ_HASH_SIZE; i++) head[i] = -1;
+
+    while (pos < len) {
+        size_t best_len = 0, best_dist = 0;
+
+        if (pos + LZ_MIN_MATCH <= len) {
+            size_t max = len - pos < LZ_MAX_MATCH ? len - pos : LZ_MAX_MATCH;
+            int32_t cand = head[hash3(&in[pos])];
+            for (int tries = 0; cand >= 0 && pos - (size_t)cand <= LZ_WINDOW &&
+                                tries < LZ_CHAIN_LIMIT; tries++) {
+                size_t n = 0;
+                while (n < max && in[cand + n] == in[pos + n]) n++;
+                if (n > best_len) {
+                    best_len = n;
+                    best_dist = pos - (size_t)cand;
+                    if (n == max) break;
+                }
+                cand = prev[cand];
+            }
+        }
+
+        if (items == 8) {
+            flag_at = o;
+            out[o++] = 0;
+            items = 0;
+        }
+
+        size_t step;
+        if (best_len >= LZ_MIN_MATCH) {
+            uint16_t w = (uint16_t)((best_dist - 1) | (best_len - LZ_MIN_MATCH) << 12);
+            out[flag_at] |= (uint8_t)(1u << items);
+            out[o++] = (uint8_t)w;
+            out[o++] = (uint8_t)(w >> 8);
+            step = best_len;
+        } else {
+            out[o++] = in[pos];
+            step = 1;
+        }
+        items++;
+
+        /* Index every position the item covered */
+        for (; step; step--, pos++) {
+            if (pos + LZ_MIN_MATCH <= len) {
+                uint32_t h = hash3(&in[pos]);
+                prev[pos] = head[h];
+                head[h] = (int32_t)pos;
+            }
+        }
+    }
+
+    free(head);
+    free(prev);
+    return o;
+}
+
+/* Reference decoder, mirroring lz_decode in stage2.asm */
+static size_t lz_unpack(const uint8_t *in, size_t len, uint8_t *out, size_t cap) {
+    size_t i = 0, o = 0;
+
+    while (i < len) {
+        uint8_t flags = in[i++];
+        for (int b = 0; b < 8 && i < len; b++, flags >>= 1) {
+            if (!(flags & 1)) {
+                if (o >= cap) return (size_t)-1;
+                out[o++] = in[i++];
+                continue;
+            }
+            if (i + 2 > len) return (size_t)-1;
+            uint16_t w = (uint16_t)(in[i] | in[i + 1] << 8);
+            size_t dist = (w & 0x0FFFu) + 1, n = (w >> 12) + LZ_MIN_MATCH;
+            i += 2;
+            if (dist > o || o + n > cap) return (size_t)-1;
+            for (; n; n--, o++) out[o] = out[o - dist];
+        }
+    }
+    return o;
+}
+
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *buf = malloc(size > 0 ? (size_t)size : 1);
+    if (buf && size > 0 && fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = size > 0 ? (size_t)size : 0;
+    return buf;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <input> <output>\n", argv[0]);
+        return 2;
+    }
+
+    size_t len;
+    uint8_t *in = read_file(argv[1], &len);
+    if (!in) {
+        fprintf(stderr, "lzpack: cannot read '%s'\n", argv[1]);
+        return 1;
+    }
+
+    uint8_t *out = malloc(LZ_HEADER + len + len / 8 + 1);
+    uint8_t *check = malloc(len ? len : 1);
+    if (!out || !check) {
+        fprintf(stderr, "lzpack: out of memory\n");
+        return 1;
+    }
+
+    size_t packed = lz_pack(in, len, out + LZ_HEADER);
+    if (lz_unpack(out + LZ_HEADER, packed, check, len) != len || memcmp(check, in, len)) {
+        fprintf(stderr, "lzpack: round trip failed\n");
+        return 1;
+    }
+
+    memcpy(out, LZ_MAGIC, 4);
+    put_le32(out + 4, (uint32_t)len);
+    put_le32(out + 8, (uint32_t)packed);
+
+    FILE *f = fopen(argv[2], "wb");
+    if (!f || fwrite(out, 1, LZ_HEADER + packed, f) != LZ_HEADER + packed) {
+        fprintf(stderr, "lzpack: cannot write '%s'\n", argv[2]);
+        return 1;
+    }
+    fclose(f);
+
+    printf("lzpack: %zu -> %zu bytes (%zu sectors -> %zu)\n", len, LZ_HEADER + packed,
+           (len + 511) / 512, (LZ_HEADER + packed + 511) / 512);
+    free(in);
+    free(out);
+    free(check);
+    return 0;
+}